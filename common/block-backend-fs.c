@@ -13,6 +13,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "block-backend.h"
 #include "obj-store.h"
@@ -133,6 +134,23 @@ block_backend_fs_close_block (BlockBackend *bend,
     return ret;
 }
 
+static int
+block_backend_fs_dup_block_fd (BlockBackend *bend,
+                               BHandle *handle)
+{
+    int fd;
+
+    if (handle->rw_type != BLOCK_READ)
+        return -1;
+
+    fd = dup (handle->fd);
+    if (fd < 0)
+        seaf_warning ("Failed to dup fd for block %s:%s: %s.\n",
+                      handle->store_id, handle->block_id, strerror (errno));
+
+    return fd;
+}
+
 static void
 block_backend_fs_block_handle_free (BlockBackend *bend,
                                     BHandle *handle)
@@ -208,6 +226,29 @@ block_backend_fs_block_exists (BlockBackend *bend,
         return FALSE;
 }
 
+static void
+block_backend_fs_blocks_exist (BlockBackend *bend,
+                               const char *store_id,
+                               int version,
+                               char **block_ids,
+                               int n_ids,
+                               gboolean *exists)
+{
+    char **paths = g_new (char *, n_ids);
+    int i;
+
+    for (i = 0; i < n_ids; ++i) {
+        paths[i] = g_new (char, SEAF_PATH_MAX);
+        get_block_path (bend, block_ids[i], paths[i], store_id, version);
+    }
+
+    seaf_util_exists_many (paths, n_ids, exists);
+
+    for (i = 0; i < n_ids; ++i)
+        g_free (paths[i]);
+    g_free (paths);
+}
+
 static int
 block_backend_fs_remove_block (BlockBackend *bend,
                                const char *store_id,
@@ -363,6 +404,205 @@ block_backend_fs_copy (BlockBackend *bend,
 #endif
 }
 
+/* The number of stores scanned at the same time is bounded, so that the
+ * queue of directory tasks stays small however many stores there are.
+ */
+#define SCAN_STORES_PER_THREAD 4
+
+typedef struct ScanState {
+    SeafBlockFunc process;
+    SeafBlockStoreFunc store_done;
+    void *user_data;
+    GThreadPool *tpool;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int active_stores;
+    int max_active_stores;
+    gint stop;
+} ScanState;
+
+typedef struct ScanStore {
+    char *store_id;
+    char *path;
+    /* The store listing and the block dirs not scanned yet. */
+    gint pending;
+} ScanStore;
+
+typedef struct ScanTask {
+    ScanStore *store;
+    /* NULL for listing the block dirs of the store. */
+    char *prefix;
+} ScanTask;
+
+static void
+scan_store_finish (ScanState *state, ScanStore *store)
+{
+    if (!g_atomic_int_dec_and_test (&store->pending))
+        return;
+
+    if (!g_atomic_int_get (&state->stop))
+        state->store_done (store->store_id, 1, state->user_data);
+
+    g_free (store->store_id);
+    g_free (store->path);
+    g_free (store);
+
+    pthread_mutex_lock (&state->lock);
+    state->active_stores--;
+    pthread_cond_signal (&state->cond);
+    pthread_mutex_unlock (&state->lock);
+}
+
+static void
+scan_store_dir (ScanState *state, ScanStore *store)
+{
+    GDir *dir;
+    const char *dname;
+    ScanTask *task;
+
+    dir = g_dir_open (store->path, 0, NULL);
+    if (!dir) {
+        seaf_warning ("Failed to open block dir %s.\n", store->path);
+        return;
+    }
+
+    while ((dname = g_dir_read_name(dir)) != NULL) {
+        task = g_new0 (ScanTask, 1);
+        task->store = store;
+        task->prefix = g_strdup (dname);
+        g_atomic_int_inc (&store->pending);
+        g_thread_pool_push (state->tpool, task, NULL);
+    }
+
+    g_dir_close (dir);
+}
+
+static void
+scan_block_dir (ScanState *state, ScanStore *store, const char *prefix)
+{
+    char *path;
+    GDir *dir;
+    const char *dname;
+    char block_id[128];
+
+    path = g_build_filename (store->path, prefix, NULL);
+    dir = g_dir_open (path, 0, NULL);
+    if (!dir) {
+        seaf_warning ("Failed to open block dir %s.\n", path);
+        g_free (path);
+        return;
+    }
+
+    while ((dname = g_dir_read_name(dir)) != NULL) {
+        snprintf (block_id, sizeof(block_id), "%s%s", prefix, dname);
+        if (!state->process (store->store_id, 1, block_id, state->user_data)) {
+            g_atomic_int_set (&state->stop, 1);
+            break;
+        }
+    }
+
+    g_dir_close (dir);
+    g_free (path);
+}
+
+static void
+scan_task_cb (gpointer data, gpointer user_data)
+{
+    ScanTask *task = data;
+    ScanState *state = user_data;
+
+    if (!g_atomic_int_get (&state->stop)) {
+        if (task->prefix)
+            scan_block_dir (state, task->store, task->prefix);
+        else
+            scan_store_dir (state, task->store);
+    }
+
+    scan_store_finish (state, task->store);
+    g_free (task->prefix);
+    g_free (task);
+}
+
+/* Every store dir and every block dir inside it is a separate task, so
+ * large stores are spread over all scanners instead of keeping one
+ * thread busy while the others are idle.
+ */
+static int
+block_backend_fs_scan_all_stores (BlockBackend *bend,
+                                  int n_threads,
+                                  SeafBlockFunc process,
+                                  SeafBlockStoreFunc store_done,
+                                  void *user_data)
+{
+    FsPriv *priv = bend->be_priv;
+    ScanState state;
+    ScanStore *store;
+    ScanTask *task;
+    GDir *dir;
+    const char *dname;
+
+    dir = g_dir_open (priv->block_dir, 0, NULL);
+    if (!dir) {
+        seaf_warning ("Failed to open block dir %s.\n", priv->block_dir);
+        return -1;
+    }
+
+    memset (&state, 0, sizeof(state));
+    state.process = process;
+    state.store_done = store_done;
+    state.user_data = user_data;
+    state.max_active_stores = n_threads * SCAN_STORES_PER_THREAD;
+    pthread_mutex_init (&state.lock, NULL);
+    pthread_cond_init (&state.cond, NULL);
+
+    state.tpool = g_thread_pool_new (scan_task_cb, &state, n_threads, FALSE, NULL);
+    if (!state.tpool) {
+        seaf_warning ("Failed to create thread pool to scan blocks.\n");
+        g_dir_close (dir);
+        pthread_mutex_destroy (&state.lock);
+        pthread_cond_destroy (&state.cond);
+        return -1;
+    }
+
+    while ((dname = g_dir_read_name(dir)) != NULL) {
+        if (g_atomic_int_get (&state.stop))
+            break;
+        if (!is_uuid_valid (dname))
+            continue;
+
+        pthread_mutex_lock (&state.lock);
+        while (state.active_stores >= state.max_active_stores)
+            pthread_cond_wait (&state.cond, &state.lock);
+        state.active_stores++;
+        pthread_mutex_unlock (&state.lock);
+
+        store = g_new0 (ScanStore, 1);
+        store->store_id = g_strdup (dname);
+        store->path = g_build_filename (priv->block_dir, dname, NULL);
+        store->pending = 1;
+
+        task = g_new0 (ScanTask, 1);
+        task->store = store;
+        g_thread_pool_push (state.tpool, task, NULL);
+    }
+    g_dir_close (dir);
+
+    /* Workers push block dir tasks while listing a store, so the pool
+     * can only be freed after every store is finished.
+     */
+    pthread_mutex_lock (&state.lock);
+    while (state.active_stores > 0)
+        pthread_cond_wait (&state.cond, &state.lock);
+    pthread_mutex_unlock (&state.lock);
+
+    g_thread_pool_free (state.tpool, FALSE, TRUE);
+    pthread_mutex_destroy (&state.lock);
+    pthread_cond_destroy (&state.cond);
+
+    return state.stop ? -1 : 0;
+}
+
 static int
 block_backend_fs_remove_store (BlockBackend *bend, const char *store_id)
 {
@@ -490,11 +730,14 @@ block_backend_fs_new (const char *seaf_dir, const char *tmp_dir)
     bend->commit_block = block_backend_fs_commit_block;
     bend->close_block = block_backend_fs_close_block;
     bend->exists = block_backend_fs_block_exists;
+    bend->exists_many = block_backend_fs_blocks_exist;
     bend->remove_block = block_backend_fs_remove_block;
     bend->stat_block = block_backend_fs_stat_block;
     bend->stat_block_by_handle = block_backend_fs_stat_block_by_handle;
     bend->block_handle_free = block_backend_fs_block_handle_free;
+    bend->dup_block_fd = block_backend_fs_dup_block_fd;
     bend->foreach_block = block_backend_fs_foreach_block;
+    bend->scan_all_stores = block_backend_fs_scan_all_stores;
     bend->remove_store = block_backend_fs_remove_store;
     bend->copy = block_backend_fs_copy;
 
@@ -25,6 +25,12 @@ struct BlockBackend {
                         const char *store_id, int version,
                         const char *block_id);
 
+    /* Optional. Sets @exists[i] for each of @block_ids[i]. */
+    void     (*exists_many) (BlockBackend *bend,
+                             const char *store_id, int version,
+                             char **block_ids, int n_ids,
+                             gboolean *exists);
+
     int      (*remove_block) (BlockBackend *bend,
                               const char *store_id, int version,
                               const char *block_id);
@@ -37,12 +43,28 @@ struct BlockBackend {
 
     void     (*block_handle_free) (BlockBackend *bend, BHandle *handle);
 
+    /* Optional. Returns a new file descriptor for a block opened for read,
+     * or -1 if the backend can't expose the block as a file.
+     */
+    int      (*dup_block_fd) (BlockBackend *bend, BHandle *handle);
+
     int      (*foreach_block) (BlockBackend *bend,
                                const char *store_id,
                                int version,
                                SeafBlockFunc process,
                                void *user_data);
 
+    /* Optional. Walks the blocks of all stores once with @n_threads
+     * scanners. @process may be called concurrently, also for the same
+     * store. @store_done is called once all blocks of a store have been
+     * passed to @process.
+     */
+    int      (*scan_all_stores) (BlockBackend *bend,
+                                 int n_threads,
+                                 SeafBlockFunc process,
+                                 SeafBlockStoreFunc store_done,
+                                 void *user_data);
+
     int         (*copy) (BlockBackend *bend,
                          const char *src_store_id,
                          int src_version,
@@ -102,6 +102,16 @@ seaf_block_manager_block_handle_free (SeafBlockManager *mgr,
     return mgr->backend->block_handle_free (mgr->backend, handle);
 }
 
+int
+seaf_block_manager_dup_block_fd (SeafBlockManager *mgr,
+                                 BlockHandle *handle)
+{
+    if (!mgr->backend->dup_block_fd)
+        return -1;
+
+    return mgr->backend->dup_block_fd (mgr->backend, handle);
+}
+
 int
 seaf_block_manager_commit_block (SeafBlockManager *mgr,
                                  BlockHandle *handle)
@@ -121,6 +131,55 @@ gboolean seaf_block_manager_block_exists (SeafBlockManager *mgr,
     return mgr->backend->exists (mgr->backend, store_id, version, block_id);
 }
 
+void
+seaf_block_manager_blocks_exist (SeafBlockManager *mgr,
+                                 const char *store_id,
+                                 int version,
+                                 char **block_ids,
+                                 int n_ids,
+                                 gboolean *exists)
+{
+    BlockBackend *bend = mgr->backend;
+    char **valid_ids;
+    gboolean *valid_exists;
+    int *index;
+    int i, n_valid = 0;
+
+    memset (exists, 0, sizeof(gboolean) * n_ids);
+
+    if (!store_id || !is_uuid_valid(store_id) || n_ids <= 0)
+        return;
+
+    if (!bend->exists_many) {
+        for (i = 0; i < n_ids; ++i) {
+            if (block_ids[i] && is_object_id_valid(block_ids[i]))
+                exists[i] = bend->exists (bend, store_id, version, block_ids[i]);
+        }
+        return;
+    }
+
+    valid_ids = g_new (char *, n_ids);
+    valid_exists = g_new0 (gboolean, n_ids);
+    index = g_new (int, n_ids);
+    for (i = 0; i < n_ids; ++i) {
+        if (!block_ids[i] || !is_object_id_valid(block_ids[i]))
+            continue;
+        valid_ids[n_valid] = block_ids[i];
+        index[n_valid] = i;
+        ++n_valid;
+    }
+
+    if (n_valid > 0)
+        bend->exists_many (bend, store_id, version,
+                           valid_ids, n_valid, valid_exists);
+    for (i = 0; i < n_valid; ++i)
+        exists[index[i]] = valid_exists[i];
+
+    g_free (valid_ids);
+    g_free (valid_exists);
+    g_free (index);
+}
+
 int
 seaf_block_manager_remove_block (SeafBlockManager *mgr,
                                  const char *store_id,
@@ -166,6 +225,20 @@ seaf_block_manager_foreach_block (SeafBlockManager *mgr,
                                         process, user_data);
 }
 
+int
+seaf_block_manager_scan_all_stores (SeafBlockManager *mgr,
+                                    int n_threads,
+                                    SeafBlockFunc process,
+                                    SeafBlockStoreFunc store_done,
+                                    void *user_data)
+{
+    if (!mgr->backend->scan_all_stores)
+        return -1;
+
+    return mgr->backend->scan_all_stores (mgr->backend, n_threads,
+                                          process, store_done, user_data);
+}
+
 int
 seaf_block_manager_copy_block (SeafBlockManager *mgr,
                                const char *src_store_id,
@@ -97,12 +97,31 @@ void
 seaf_block_manager_block_handle_free (SeafBlockManager *mgr,
                                       BlockHandle *handle);
 
+/*
+ * Get a new file descriptor for a block opened for read.
+ * The caller owns the returned fd and must close it.
+ *
+ * Returns: the fd, or -1 if the backend doesn't store blocks as files.
+ */
+int
+seaf_block_manager_dup_block_fd (SeafBlockManager *mgr,
+                                 BlockHandle *handle);
+
 gboolean 
 seaf_block_manager_block_exists (SeafBlockManager *mgr,
                                  const char *store_id,
                                  int version,
                                  const char *block_id);
 
+/* Sets @exists[i] for each of @block_ids[i]. Invalid ids don't exist. */
+void
+seaf_block_manager_blocks_exist (SeafBlockManager *mgr,
+                                 const char *store_id,
+                                 int version,
+                                 char **block_ids,
+                                 int n_ids,
+                                 gboolean *exists);
+
 int
 seaf_block_manager_remove_block (SeafBlockManager *mgr,
                                  const char *store_id,
@@ -126,6 +145,17 @@ seaf_block_manager_foreach_block (SeafBlockManager *mgr,
                                   SeafBlockFunc process,
                                   void *user_data);
 
+/* Walks the whole block store once instead of one store at a time.
+ * See scan_all_stores in block-backend.h. Returns -1 if the backend
+ * doesn't support it.
+ */
+int
+seaf_block_manager_scan_all_stores (SeafBlockManager *mgr,
+                                    int n_threads,
+                                    SeafBlockFunc process,
+                                    SeafBlockStoreFunc store_done,
+                                    void *user_data);
+
 int
 seaf_block_manager_copy_block (SeafBlockManager *mgr,
                                const char *src_store_id,
@@ -26,4 +26,8 @@ typedef gboolean (*SeafBlockFunc) (const char *store_id,
                                    const char *block_id,
                                    void *user_data);
 
+typedef void (*SeafBlockStoreFunc) (const char *store_id,
+                                    int version,
+                                    void *user_data);
+
 #endif
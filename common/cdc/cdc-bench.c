@@ -0,0 +1,128 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Measure the throughput of the chunking engines.
+ *
+ * Usage: cdc-bench [file ...]
+ * Without arguments a file of random data is generated and used.
+ */
+
+#include "common.h"
+
+#include <fcntl.h>
+#include <glib/gstdio.h>
+
+#include "utils.h"
+
+#include "cdc.h"
+
+#define SYNTHETIC_FILE_SIZE (256 * 1024 * 1024)
+
+#define CDC_AVERAGE_BLOCK_SIZE (1 << 23) /* 8MB */
+#define CDC_MIN_BLOCK_SIZE (6 * (1 << 20)) /* 6MB */
+#define CDC_MAX_BLOCK_SIZE (10 * (1 << 20)) /* 10MB */
+
+static int
+checksum_chunk (const char *repo_id,
+                int version,
+                CDCDescriptor *chunk_descr,
+                struct SeafileCrypt *crypt,
+                uint8_t *checksum,
+                gboolean write_data)
+{
+    SHA_CTX ctx;
+
+    SHA1_Init (&ctx);
+    SHA1_Update (&ctx, chunk_descr->block_buf, chunk_descr->len);
+    SHA1_Final (checksum, &ctx);
+
+    return 0;
+}
+
+static char *
+create_synthetic_file ()
+{
+    char *path = g_build_filename (g_get_tmp_dir (), "cdc-bench.XXXXXX", NULL);
+    char buf[64 * 1024];
+    int fd, i;
+    gint64 written = 0;
+
+    fd = g_mkstemp (path);
+    if (fd < 0) {
+        fprintf (stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        g_free (path);
+        return NULL;
+    }
+
+    while (written < SYNTHETIC_FILE_SIZE) {
+        for (i = 0; i < sizeof(buf); i++)
+            buf[i] = g_random_int () & 0xff;
+        if (writen (fd, buf, sizeof(buf)) < 0) {
+            fprintf (stderr, "Failed to write %s: %s\n", path, strerror(errno));
+            close (fd);
+            g_unlink (path);
+            g_free (path);
+            return NULL;
+        }
+        written += sizeof(buf);
+    }
+
+    close (fd);
+    return path;
+}
+
+static void
+run_bench (const char *path, int engine, const char *engine_name)
+{
+    CDCFileDescriptor cdc;
+    gint64 start, usec;
+    double mb;
+
+    memset (&cdc, 0, sizeof(cdc));
+    cdc.block_sz = CDC_AVERAGE_BLOCK_SIZE;
+    cdc.block_min_sz = CDC_MIN_BLOCK_SIZE;
+    cdc.block_max_sz = CDC_MAX_BLOCK_SIZE;
+    cdc.write_block = checksum_chunk;
+    cdc.engine = engine;
+
+    start = g_get_monotonic_time ();
+    if (filename_chunk_cdc (path, &cdc, NULL, FALSE, NULL) < 0) {
+        fprintf (stderr, "Failed to chunk %s.\n", path);
+        return;
+    }
+    usec = g_get_monotonic_time () - start;
+
+    mb = (double)cdc.file_size / (1024 * 1024);
+    printf ("%-6s %s: %.1f MB, %u chunks, %.1f MB/s\n",
+            engine_name, path, mb, cdc.block_nr,
+            usec > 0 ? mb * 1000000 / usec : 0);
+
+    free (cdc.blk_sha1s);
+}
+
+int
+main (int argc, char **argv)
+{
+    char *synthetic = NULL;
+    int i;
+
+    cdc_init ();
+
+    if (argc < 2) {
+        synthetic = create_synthetic_file ();
+        if (!synthetic)
+            return 1;
+        run_bench (synthetic, CDC_ENGINE_RABIN, "rabin");
+        run_bench (synthetic, CDC_ENGINE_GEAR, "gear");
+        g_unlink (synthetic);
+        g_free (synthetic);
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++) {
+        run_bench (argv[i], CDC_ENGINE_RABIN, "rabin");
+        run_bench (argv[i], CDC_ENGINE_GEAR, "gear");
+    }
+
+    return 0;
+}
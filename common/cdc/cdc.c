@@ -19,6 +19,7 @@
 #include "../seafile-crypt.h"
 
 #include "rabin-checksum.h"
+#include "gear-checksum.h"
 #define finger rabin_checksum
 #define rolling_finger rabin_rolling_checksum
 
@@ -33,6 +34,9 @@
 
 #define READ_SIZE 1024 * 4
 
+/* The gear engine reads the file in large pieces. */
+#define GEAR_READ_SIZE (1024 * 1024 * 4)
+
 #define BYTE_TO_HEX(b)  (((b)>=10)?('a'+b-10):('0'+b))
 
 static int default_write_chunk (CDCDescriptor *chunk_descr)
@@ -108,6 +112,127 @@ do {                                                         \
     cur = 0;                                                 \
 }while(0);
 
+static int
+write_gear_chunk (CDCFileDescriptor *file_descr,
+                  SeafileCrypt *crypt,
+                  gboolean write_data,
+                  SHA_CTX *file_ctx,
+                  char *data, uint32_t len, uint64_t offset)
+{
+    CDCDescriptor chunk_descr;
+    int ret;
+
+    if (file_descr->block_nr == file_descr->max_block_nr) {
+        seaf_warning ("Block id array is not large enough, bail out.\n");
+        return -1;
+    }
+
+    memset (&chunk_descr, 0, sizeof(chunk_descr));
+    chunk_descr.block_buf = data;
+    chunk_descr.len = len;
+    chunk_descr.offset = offset;
+    ret = file_descr->write_block (file_descr->repo_id,
+                                   file_descr->version,
+                                   &chunk_descr,
+                                   crypt, chunk_descr.checksum,
+                                   write_data);
+    if (ret < 0) {
+        g_warning ("CDC: failed to write chunk.\n");
+        return -1;
+    }
+    memcpy (file_descr->blk_sha1s +
+            file_descr->block_nr * CHECKSUM_LENGTH,
+            chunk_descr.checksum, CHECKSUM_LENGTH);
+    SHA1_Update (file_ctx, chunk_descr.checksum, 20);
+    file_descr->block_nr++;
+
+    return 0;
+}
+
+/*
+ * Content-defined chunking with the gear engine.
+ *
+ * Unlike the rabin engine, data is read in large pieces and chunks are
+ * cut in place. Unprocessed data is only moved to the front of the
+ * buffer when less than block_max_sz bytes are left in it.
+ */
+static int
+file_chunk_gear (int fd_src,
+                 uint64_t expected_size,
+                 CDCFileDescriptor *file_descr,
+                 SeafileCrypt *crypt,
+                 gboolean write_data,
+                 gint64 *indexed)
+{
+    unsigned char *buf;
+    uint32_t buf_sz;
+    uint32_t start, tail, len;
+    uint64_t offset = 0;
+    gboolean eof = FALSE;
+    SHA_CTX file_ctx;
+    int n;
+
+    SHA1_Init (&file_ctx);
+
+    buf_sz = file_descr->block_max_sz + GEAR_READ_SIZE;
+    buf = malloc (buf_sz);
+    if (!buf)
+        return -1;
+
+    /* buf[start, tail) holds the data that hasn't been chunked. */
+    start = tail = 0;
+    while (1) {
+        if (!eof && tail - start < file_descr->block_max_sz) {
+            memmove (buf, buf + start, tail - start);
+            tail -= start;
+            start = 0;
+
+            n = readn (fd_src, buf + tail, buf_sz - tail);
+            if (n < 0) {
+                seaf_warning ("CDC: failed to read: %s.\n", strerror(errno));
+                free (buf);
+                return -1;
+            }
+            if (n == 0)
+                eof = TRUE;
+            tail += n;
+            file_descr->file_size += n;
+
+            if (file_descr->file_size > expected_size) {
+                seaf_warning ("File size changed while chunking.\n");
+                free (buf);
+                return -1;
+            }
+            continue;
+        }
+
+        if (start == tail)
+            break;
+
+        len = gear_find_boundary (buf + start, tail - start,
+                                  file_descr->block_min_sz,
+                                  file_descr->block_sz,
+                                  file_descr->block_max_sz);
+
+        if (write_gear_chunk (file_descr, crypt, write_data, &file_ctx,
+                              (char *)buf + start, len, offset) < 0) {
+            free (buf);
+            return -1;
+        }
+        if (indexed)
+            *indexed += len;
+
+        start += len;
+        offset += len;
+    }
+
+    SHA1_Final (file_descr->file_sum, &file_ctx);
+
+    free (buf);
+
+    return 0;
+}
+
 /* content-defined chunking */
 int file_chunk_cdc(int fd_src,
                    CDCFileDescriptor *file_descr,
@@ -129,6 +254,11 @@ int file_chunk_cdc(int fd_src,
     uint64_t expected_size = sb.st_size;
 
     init_cdc_file_descriptor (fd_src, expected_size, file_descr);
+
+    if (file_descr->engine == CDC_ENGINE_GEAR)
+        return file_chunk_gear (fd_src, expected_size, file_descr,
+                                crypt, write_data, indexed);
+
     uint32_t block_min_sz = file_descr->block_min_sz;
     uint32_t block_mask = file_descr->block_sz - 1;
 
@@ -248,4 +378,5 @@ int filename_chunk_cdc(const char *filename,
 void cdc_init ()
 {
     rabin_init (BLOCK_WIN_SZ);
+    gear_init ();
 }
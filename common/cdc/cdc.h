@@ -31,6 +31,17 @@ typedef int (*WriteblockFunc)(const char *repo_id,
                               uint8_t *checksum,
                               gboolean write_data);
 
+/* Chunking engines.
+ * CDC_ENGINE_RABIN is the original engine. It must be used where chunk
+ * boundaries have to match the ones produced by existing clients.
+ * CDC_ENGINE_GEAR is a much faster FastCDC style engine, but it cuts
+ * files at different offsets.
+ */
+enum {
+    CDC_ENGINE_RABIN = 0,
+    CDC_ENGINE_GEAR,
+};
+
 /* define chunk file header and block entry */
 typedef struct _CDCFileDescriptor {
     uint32_t block_min_sz;
@@ -47,6 +58,8 @@ typedef struct _CDCFileDescriptor {
 
     char repo_id[37];
     int version;
+
+    int engine;
 } CDCFileDescriptor;
 
 typedef struct _CDCDescriptor {
@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include "gear-checksum.h"
+
+/* fileserver/cdc.go uses the same seed, keep them in sync. */
+#define GEAR_SEED 0x2f5e3c1a9d7b4861ULL
+
+static uint64_t gear[256];
+
+/* Use splitmix64 to fill the table, it's simple and reproducible. */
+static uint64_t
+splitmix64 (uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void gear_init ()
+{
+    uint64_t state = GEAR_SEED;
+    int i;
+
+    for (i = 0; i < 256; i++)
+        gear[i] = splitmix64 (&state);
+}
+
+static int
+log2_floor (uint32_t v)
+{
+    int n = 0;
+
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+/* Bit i of the gear hash only depends on the last i + 1 bytes, so the
+ * mask is taken from the most significant bits to cover a full window.
+ */
+static uint64_t
+high_bits_mask (int bits)
+{
+    if (bits <= 0)
+        return 0;
+    if (bits >= 64)
+        return ~0ULL;
+    return ((1ULL << bits) - 1) << (64 - bits);
+}
+
+/*
+ * Normalized chunking as described in the FastCDC paper: a harder mask
+ * is used before the average size and an easier one after it, which
+ * pulls chunk sizes towards the average.
+ */
+uint32_t gear_find_boundary (const unsigned char *buf, uint32_t len,
+                             uint32_t min_sz, uint32_t avg_sz, uint32_t max_sz)
+{
+    int bits = log2_floor (avg_sz);
+    uint64_t mask_s = high_bits_mask (bits + 2);
+    uint64_t mask_l = high_bits_mask (bits - 2);
+    uint64_t hash = 0;
+    uint32_t normal_sz;
+    uint32_t i;
+
+    if (len <= min_sz)
+        return len;
+    if (len > max_sz)
+        len = max_sz;
+
+    normal_sz = avg_sz < len ? avg_sz : len;
+
+    for (i = min_sz; i < normal_sz; i++) {
+        hash = (hash << 1) + gear[buf[i]];
+        if (!(hash & mask_s))
+            return i + 1;
+    }
+
+    for (; i < len; i++) {
+        hash = (hash << 1) + gear[buf[i]];
+        if (!(hash & mask_l))
+            return i + 1;
+    }
+
+    return len;
+}
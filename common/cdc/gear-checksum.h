@@ -0,0 +1,26 @@
+#ifndef _GEAR_CHECKSUM_H
+#define _GEAR_CHECKSUM_H
+
+#include <stdint.h>
+
+/*
+ * Gear rolling hash used by the FastCDC style chunking engine.
+ *
+ * The gear table is generated from a fixed seed, so that the same data
+ * is always cut at the same offsets. Never change the seed or the
+ * generator, or existing blocks won't be deduplicated any more.
+ */
+
+void gear_init ();
+
+/*
+ * Find the next chunk boundary in @buf.
+ *
+ * @len is the number of bytes available. Unless the end of file has
+ * been reached, the caller must provide at least @max_sz bytes.
+ * Returns the length of the chunk starting at @buf.
+ */
+uint32_t gear_find_boundary (const unsigned char *buf, uint32_t len,
+                             uint32_t min_sz, uint32_t avg_sz, uint32_t max_sz);
+
+#endif
@@ -0,0 +1,700 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+#include "utils.h"
+#include "commit-graph.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define DEBUG_FLAG SEAFILE_DEBUG_OTHER
+#include "log.h"
+
+/*
+ * The graph of a repo is stored under <seaf_dir>/commit-graph/<repo_id>/,
+ * in the same way as git's commit-graph plus an append-only log:
+ *
+ * graph: Header with a 256-entry fanout table, followed by records sorted
+ *        by commit id. It is accessed through mmap.
+ * log:   Records of commits added after the graph was written. It's
+ *        flock()ed shared for reading and exclusive for writing, so that
+ *        seaf-server and GC can share the files.
+ *
+ * Once the log holds enough records, they're merged into a new graph and
+ * the log is truncated.
+ */
+
+#define GRAPH_MAGIC "SEAFCGRF"
+#define GRAPH_VERSION 1
+#define MIN_LOG_RECORDS 1024
+#define MAX_OPEN_REPOS 256
+
+#define RECORD_HAS_PARENT 0x1
+#define RECORD_HAS_SECOND_PARENT 0x2
+
+typedef struct GraphRecord {
+    unsigned char id[20];
+    unsigned char root_id[20];
+    unsigned char parent_id[20];
+    unsigned char second_parent_id[20];
+    guint64       ctime;
+    guint32       flags;
+    guint32       version;
+} __attribute__((__packed__)) GraphRecord;
+
+typedef struct GraphHeader {
+    char          magic[8];
+    guint32       version;
+    guint32       n_records;
+    /* fanout[i] is the number of records with the first id byte <= i. */
+    guint32       fanout[256];
+} __attribute__((__packed__)) GraphHeader;
+
+typedef struct GraphRepo {
+    char             *dir;
+    int               ref_count;
+    pthread_rwlock_t  lock;
+    int               log_fd;
+
+    /* mmapped graph */
+    void             *graph_map;
+    gsize             graph_size;
+    GraphRecord      *records;
+    guint32           n_records;
+    guint32           fanout[256];
+    struct stat       graph_st;
+
+    /* Records read from the log, and the length of the log read so far. */
+    GHashTable       *recent;
+    guint64           log_offset;
+} GraphRepo;
+
+struct CommitGraph {
+    char             *graph_dir;
+    pthread_mutex_t   lock;
+    GHashTable       *repos;
+    GQueue           *lru;
+};
+
+static guint
+raw_id_hash (gconstpointer key)
+{
+    return *(const guint *)key;
+}
+
+static gboolean
+raw_id_equal (gconstpointer a, gconstpointer b)
+{
+    return memcmp (a, b, 20) == 0;
+}
+
+static int
+compare_records (const void *a, const void *b)
+{
+    return memcmp (((const GraphRecord *)a)->id, ((const GraphRecord *)b)->id, 20);
+}
+
+static void
+unmap_graph (GraphRepo *repo)
+{
+    if (repo->graph_map)
+        munmap (repo->graph_map, repo->graph_size);
+    repo->graph_map = NULL;
+    repo->graph_size = 0;
+    repo->records = NULL;
+    repo->n_records = 0;
+    memset (repo->fanout, 0, sizeof(repo->fanout));
+    memset (&repo->graph_st, 0, sizeof(repo->graph_st));
+}
+
+/* Map the graph and drop records read from the log. */
+static int
+load_graph (GraphRepo *repo)
+{
+    char *path = g_build_filename (repo->dir, "graph", NULL);
+    GraphHeader *hdr;
+    struct stat st;
+    guint32 prev = 0;
+    int fd = -1;
+    int i;
+    int ret = 0;
+
+    unmap_graph (repo);
+    g_hash_table_remove_all (repo->recent);
+    repo->log_offset = 0;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            seaf_warning ("[commit graph] Failed to open %s: %s.\n",
+                          path, strerror(errno));
+            ret = -1;
+        }
+        goto out;
+    }
+
+    if (fstat (fd, &st) < 0 || st.st_size < sizeof(GraphHeader)) {
+        seaf_warning ("[commit graph] Invalid graph %s.\n", path);
+        ret = -1;
+        goto out;
+    }
+
+    repo->graph_map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (repo->graph_map == MAP_FAILED) {
+        seaf_warning ("[commit graph] Failed to mmap %s: %s.\n",
+                      path, strerror(errno));
+        repo->graph_map = NULL;
+        ret = -1;
+        goto out;
+    }
+    repo->graph_size = st.st_size;
+
+    hdr = repo->graph_map;
+    if (memcmp (hdr->magic, GRAPH_MAGIC, 8) != 0 ||
+        ntohl (hdr->version) != GRAPH_VERSION ||
+        sizeof(GraphHeader) + (guint64)ntohl (hdr->n_records) * sizeof(GraphRecord) != st.st_size)
+        goto invalid;
+
+    for (i = 0; i < 256; ++i) {
+        repo->fanout[i] = ntohl (hdr->fanout[i]);
+        if (repo->fanout[i] < prev)
+            goto invalid;
+        prev = repo->fanout[i];
+    }
+    if (prev != ntohl (hdr->n_records))
+        goto invalid;
+
+    repo->records = (GraphRecord *)(hdr + 1);
+    repo->n_records = ntohl (hdr->n_records);
+    repo->graph_st = st;
+    goto out;
+
+invalid:
+    seaf_warning ("[commit graph] Invalid graph %s.\n", path);
+    unmap_graph (repo);
+    ret = -1;
+
+out:
+    if (fd >= 0)
+        close (fd);
+    g_free (path);
+    return ret;
+}
+
+static gboolean
+graph_changed (GraphRepo *repo)
+{
+    char *path = g_build_filename (repo->dir, "graph", NULL);
+    struct stat st;
+    int rc;
+
+    rc = stat (path, &st);
+    g_free (path);
+
+    if (rc < 0)
+        return repo->graph_map != NULL;
+
+    return (st.st_ino != repo->graph_st.st_ino ||
+            st.st_size != repo->graph_st.st_size ||
+            st.st_mtime != repo->graph_st.st_mtime);
+}
+
+static void
+add_recent (GraphRepo *repo, const GraphRecord *rec)
+{
+    GraphRecord *copy = g_memdup (rec, sizeof(GraphRecord));
+
+    g_hash_table_replace (repo->recent, copy->id, copy);
+}
+
+/* Read records appended to the log since the last scan, possibly by other
+ * processes. A partial record at the end is left for the next scan.
+ */
+static void
+scan_log (GraphRepo *repo)
+{
+    GraphRecord recs[256];
+    struct stat st;
+    guint64 n;
+    ssize_t len;
+    int i;
+
+    if (fstat (repo->log_fd, &st) < 0)
+        return;
+
+    if (st.st_size < repo->log_offset) {
+        /* Truncated without a new graph, which means the graph was lost. */
+        g_hash_table_remove_all (repo->recent);
+        repo->log_offset = 0;
+    }
+
+    while (repo->log_offset + sizeof(GraphRecord) <= st.st_size) {
+        n = (st.st_size - repo->log_offset) / sizeof(GraphRecord);
+        if (n > G_N_ELEMENTS(recs))
+            n = G_N_ELEMENTS(recs);
+        len = pread (repo->log_fd, recs, n * sizeof(GraphRecord), repo->log_offset);
+        if (len < (ssize_t)sizeof(GraphRecord))
+            return;
+        n = len / sizeof(GraphRecord);
+        for (i = 0; i < n; ++i)
+            add_recent (repo, &recs[i]);
+        repo->log_offset += n * sizeof(GraphRecord);
+    }
+}
+
+static void
+refresh_repo (GraphRepo *repo)
+{
+    if (graph_changed (repo))
+        load_graph (repo);
+    scan_log (repo);
+}
+
+static const GraphRecord *
+lookup_record (GraphRepo *repo, const unsigned char *id)
+{
+    const GraphRecord *rec;
+    guint32 lo, hi, mid;
+    int cmp;
+
+    rec = g_hash_table_lookup (repo->recent, id);
+    if (rec)
+        return rec;
+
+    lo = id[0] > 0 ? repo->fanout[id[0] - 1] : 0;
+    hi = repo->fanout[id[0]];
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        rec = &repo->records[mid];
+        cmp = memcmp (id, rec->id, 20);
+        if (cmp == 0)
+            return rec;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+/* Merge the log into a new graph. Called with the exclusive lock. */
+static int
+write_graph (GraphRepo *repo)
+{
+    char *path = g_build_filename (repo->dir, "graph", NULL);
+    char *tmp_path = g_strconcat (path, ".tmp", NULL);
+    GraphRecord *recent = NULL, *merged = NULL, *rec;
+    guint32 n_recent, n_merged = 0, i = 0, j = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+    GraphHeader hdr;
+    guint32 fanout[256] = {0};
+    int fd = -1;
+    int ret = 0;
+
+    n_recent = g_hash_table_size (repo->recent);
+    recent = g_new (GraphRecord, MAX (n_recent, 1));
+    g_hash_table_iter_init (&iter, repo->recent);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        recent[i++] = *(GraphRecord *)value;
+    qsort (recent, n_recent, sizeof(GraphRecord), compare_records);
+
+    merged = g_new (GraphRecord, MAX (repo->n_records + n_recent, 1));
+    i = 0;
+    while (i < repo->n_records || j < n_recent) {
+        if (j == n_recent ||
+            (i < repo->n_records &&
+             memcmp (repo->records[i].id, recent[j].id, 20) < 0)) {
+            rec = &repo->records[i++];
+        } else {
+            if (i < repo->n_records &&
+                memcmp (repo->records[i].id, recent[j].id, 20) == 0)
+                ++i;
+            rec = &recent[j++];
+        }
+        merged[n_merged++] = *rec;
+        ++fanout[rec->id[0]];
+    }
+
+    memcpy (hdr.magic, GRAPH_MAGIC, 8);
+    hdr.version = htonl (GRAPH_VERSION);
+    hdr.n_records = htonl (n_merged);
+    for (i = 0; i < 256; ++i) {
+        if (i > 0)
+            fanout[i] += fanout[i - 1];
+        hdr.fanout[i] = htonl (fanout[i]);
+    }
+
+    fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        seaf_warning ("[commit graph] Failed to create %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (writen (fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        writen (fd, merged, n_merged * sizeof(GraphRecord)) !=
+        n_merged * sizeof(GraphRecord) ||
+        fsync (fd) < 0) {
+        seaf_warning ("[commit graph] Failed to write %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+    close (fd);
+    fd = -1;
+
+    if (rename (tmp_path, path) < 0) {
+        seaf_warning ("[commit graph] Failed to rename %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (ftruncate (repo->log_fd, 0) < 0) {
+        seaf_warning ("[commit graph] Failed to truncate log in %s: %s.\n",
+                      repo->dir, strerror(errno));
+    }
+
+    ret = load_graph (repo);
+    scan_log (repo);
+
+out:
+    if (fd >= 0) {
+        close (fd);
+        g_unlink (tmp_path);
+    }
+    g_free (recent);
+    g_free (merged);
+    g_free (path);
+    g_free (tmp_path);
+    return ret;
+}
+
+/* Append a record to the log. Called with the exclusive lock, after
+ * scanning the log.
+ */
+static int
+append_record (GraphRepo *repo, const GraphRecord *rec)
+{
+    struct stat st;
+
+    /* Drop a partial record left by a crashed writer. */
+    if (fstat (repo->log_fd, &st) == 0 && st.st_size > repo->log_offset)
+        ftruncate (repo->log_fd, repo->log_offset);
+
+    if (pwrite (repo->log_fd, rec, sizeof(GraphRecord), repo->log_offset) !=
+        sizeof(GraphRecord)) {
+        seaf_warning ("[commit graph] Failed to write log in %s: %s.\n",
+                      repo->dir, strerror(errno));
+        return -1;
+    }
+
+    add_recent (repo, rec);
+    repo->log_offset += sizeof(GraphRecord);
+
+    return 0;
+}
+
+static void
+graph_repo_unref (GraphRepo *repo)
+{
+    if (!g_atomic_int_dec_and_test (&repo->ref_count))
+        return;
+
+    unmap_graph (repo);
+    g_hash_table_destroy (repo->recent);
+    close (repo->log_fd);
+    pthread_rwlock_destroy (&repo->lock);
+    g_free (repo->dir);
+    g_free (repo);
+}
+
+static GraphRepo *
+graph_repo_open (CommitGraph *graph, const char *repo_id)
+{
+    GraphRepo *repo;
+    char *dir, *log_path;
+    int log_fd;
+
+    dir = g_build_filename (graph->graph_dir, repo_id, NULL);
+    if (g_mkdir_with_parents (dir, 0777) < 0) {
+        seaf_warning ("[commit graph] Failed to create %s: %s.\n",
+                      dir, strerror(errno));
+        g_free (dir);
+        return NULL;
+    }
+
+    log_path = g_build_filename (dir, "log", NULL);
+    log_fd = open (log_path, O_RDWR | O_CREAT, 0644);
+    g_free (log_path);
+    if (log_fd < 0) {
+        seaf_warning ("[commit graph] Failed to open log in %s: %s.\n",
+                      dir, strerror(errno));
+        g_free (dir);
+        return NULL;
+    }
+
+    repo = g_new0 (GraphRepo, 1);
+    repo->dir = dir;
+    repo->ref_count = 1;
+    repo->log_fd = log_fd;
+    pthread_rwlock_init (&repo->lock, NULL);
+    repo->recent = g_hash_table_new_full (raw_id_hash, raw_id_equal,
+                                          NULL, g_free);
+
+    flock (log_fd, LOCK_SH);
+    load_graph (repo);
+    scan_log (repo);
+    flock (log_fd, LOCK_UN);
+
+    return repo;
+}
+
+/* Look up an open repo and take a reference. Called with graph->lock. */
+static GraphRepo *
+lookup_open_repo (CommitGraph *graph, const char *repo_id)
+{
+    GraphRepo *repo;
+    GList *link;
+
+    repo = g_hash_table_lookup (graph->repos, repo_id);
+    if (!repo)
+        return NULL;
+
+    link = g_queue_find_custom (graph->lru, repo_id, (GCompareFunc)strcmp);
+    g_queue_unlink (graph->lru, link);
+    g_queue_push_head_link (graph->lru, link);
+    g_atomic_int_inc (&repo->ref_count);
+    return repo;
+}
+
+/* Returns a new reference. Recently used repos are kept open. */
+static GraphRepo *
+get_graph_repo (CommitGraph *graph, const char *repo_id)
+{
+    GraphRepo *repo, *opened, *evicted;
+    char *key;
+
+    pthread_mutex_lock (&graph->lock);
+    repo = lookup_open_repo (graph, repo_id);
+    pthread_mutex_unlock (&graph->lock);
+    if (repo)
+        return repo;
+
+    /* Opening creates the repo dir, waits for the file lock and loads the
+     * graph. Don't hold graph->lock meanwhile, or other repos would wait too.
+     */
+    opened = graph_repo_open (graph, repo_id);
+    if (!opened)
+        return NULL;
+
+    pthread_mutex_lock (&graph->lock);
+
+    /* Another thread may have opened it in the meantime. */
+    repo = lookup_open_repo (graph, repo_id);
+    if (repo) {
+        pthread_mutex_unlock (&graph->lock);
+        graph_repo_unref (opened);
+        return repo;
+    }
+    repo = opened;
+
+    if (g_queue_get_length (graph->lru) >= MAX_OPEN_REPOS) {
+        key = g_queue_pop_tail (graph->lru);
+        evicted = g_hash_table_lookup (graph->repos, key);
+        g_hash_table_remove (graph->repos, key);
+        graph_repo_unref (evicted);
+        g_free (key);
+    }
+
+    key = g_strdup (repo_id);
+    g_hash_table_insert (graph->repos, key, repo);
+    g_queue_push_head (graph->lru, g_strdup (repo_id));
+    g_atomic_int_inc (&repo->ref_count);
+
+    pthread_mutex_unlock (&graph->lock);
+
+    return repo;
+}
+
+static SeafCommit *
+record_to_commit (const GraphRecord *rec, const char *repo_id)
+{
+    SeafCommit *commit = g_new0 (SeafCommit, 1);
+    guint32 flags = ntohl (rec->flags);
+
+    commit->ref = 1;
+    rawdata_to_hex (rec->id, commit->commit_id, 20);
+    memcpy (commit->repo_id, repo_id, 36);
+    rawdata_to_hex (rec->root_id, commit->root_id, 20);
+    commit->ctime = ntoh64 (rec->ctime);
+    commit->version = ntohl (rec->version);
+
+    if (flags & RECORD_HAS_PARENT) {
+        commit->parent_id = g_new0 (char, 41);
+        rawdata_to_hex (rec->parent_id, commit->parent_id, 20);
+    }
+    if (flags & RECORD_HAS_SECOND_PARENT) {
+        commit->second_parent_id = g_new0 (char, 41);
+        rawdata_to_hex (rec->second_parent_id, commit->second_parent_id, 20);
+    }
+
+    return commit;
+}
+
+CommitGraph *
+commit_graph_new (const char *graph_dir)
+{
+    CommitGraph *graph = g_new0 (CommitGraph, 1);
+
+    graph->graph_dir = g_strdup (graph_dir);
+    pthread_mutex_init (&graph->lock, NULL);
+    graph->repos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    graph->lru = g_queue_new ();
+
+    return graph;
+}
+
+SeafCommit *
+commit_graph_lookup (CommitGraph *graph, const char *repo_id,
+                     const char *commit_id)
+{
+    GraphRepo *repo;
+    unsigned char id[20];
+    const GraphRecord *rec;
+    SeafCommit *commit = NULL;
+
+    if (!commit_id || strlen(commit_id) != 40)
+        return NULL;
+
+    repo = get_graph_repo (graph, repo_id);
+    if (!repo)
+        return NULL;
+
+    hex_to_rawdata (commit_id, id, 20);
+
+    pthread_rwlock_rdlock (&repo->lock);
+    rec = lookup_record (repo, id);
+    if (rec)
+        commit = record_to_commit (rec, repo_id);
+    pthread_rwlock_unlock (&repo->lock);
+
+    /* The commit may have been added by another process. */
+    if (!commit) {
+        pthread_rwlock_wrlock (&repo->lock);
+        flock (repo->log_fd, LOCK_SH);
+        refresh_repo (repo);
+        rec = lookup_record (repo, id);
+        if (rec)
+            commit = record_to_commit (rec, repo_id);
+        flock (repo->log_fd, LOCK_UN);
+        pthread_rwlock_unlock (&repo->lock);
+    }
+
+    graph_repo_unref (repo);
+    return commit;
+}
+
+int
+commit_graph_add (CommitGraph *graph, SeafCommit *commit)
+{
+    GraphRepo *repo;
+    GraphRecord rec;
+    guint32 flags = 0;
+    int ret = 0;
+
+    memset (&rec, 0, sizeof(rec));
+    hex_to_rawdata (commit->commit_id, rec.id, 20);
+    hex_to_rawdata (commit->root_id, rec.root_id, 20);
+    if (commit->parent_id) {
+        hex_to_rawdata (commit->parent_id, rec.parent_id, 20);
+        flags |= RECORD_HAS_PARENT;
+    }
+    if (commit->second_parent_id) {
+        hex_to_rawdata (commit->second_parent_id, rec.second_parent_id, 20);
+        flags |= RECORD_HAS_SECOND_PARENT;
+    }
+    rec.ctime = hton64 (commit->ctime);
+    rec.flags = htonl (flags);
+    rec.version = htonl (commit->version);
+
+    repo = get_graph_repo (graph, commit->repo_id);
+    if (!repo)
+        return -1;
+
+    pthread_rwlock_wrlock (&repo->lock);
+    flock (repo->log_fd, LOCK_EX);
+
+    refresh_repo (repo);
+    if (lookup_record (repo, rec.id))
+        goto out;
+
+    ret = append_record (repo, &rec);
+    if (ret == 0 &&
+        g_hash_table_size (repo->recent) > MAX (MIN_LOG_RECORDS, repo->n_records / 8))
+        write_graph (repo);
+
+out:
+    flock (repo->log_fd, LOCK_UN);
+    pthread_rwlock_unlock (&repo->lock);
+    graph_repo_unref (repo);
+    return ret;
+}
+
+int
+commit_graph_remove_repo (CommitGraph *graph, const char *repo_id)
+{
+    GraphRepo *repo;
+    GList *link;
+    char *dir;
+    GDir *d;
+    const char *dname;
+    char *path;
+    int ret = 0;
+
+    pthread_mutex_lock (&graph->lock);
+    repo = g_hash_table_lookup (graph->repos, repo_id);
+    if (repo) {
+        link = g_queue_find_custom (graph->lru, repo_id, (GCompareFunc)strcmp);
+        g_free (link->data);
+        g_queue_delete_link (graph->lru, link);
+        g_hash_table_remove (graph->repos, repo_id);
+        graph_repo_unref (repo);
+    }
+    pthread_mutex_unlock (&graph->lock);
+
+    dir = g_build_filename (graph->graph_dir, repo_id, NULL);
+    d = g_dir_open (dir, 0, NULL);
+    if (!d) {
+        g_free (dir);
+        return 0;
+    }
+
+    while ((dname = g_dir_read_name (d)) != NULL) {
+        path = g_build_filename (dir, dname, NULL);
+        if (g_unlink (path) < 0) {
+            seaf_warning ("[commit graph] Failed to remove %s: %s.\n",
+                          path, strerror(errno));
+            ret = -1;
+        }
+        g_free (path);
+    }
+    g_dir_close (d);
+
+    if (ret == 0 && g_rmdir (dir) < 0) {
+        seaf_warning ("[commit graph] Failed to remove %s: %s.\n",
+                      dir, strerror(errno));
+        ret = -1;
+    }
+    g_free (dir);
+
+    return ret;
+}
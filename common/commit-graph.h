@@ -0,0 +1,36 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "commit-mgr.h"
+
+/*
+ * Per-repo commit graph. It keeps the id, root id, parents, ctime and
+ * version of commits in fixed-width records, so that history can be walked
+ * without loading and parsing every commit object.
+ *
+ * Commits are immutable, so the graph is only a cache of commit objects.
+ * Commits missing from it are added when they're first loaded.
+ */
+
+typedef struct CommitGraph CommitGraph;
+
+CommitGraph *
+commit_graph_new (const char *graph_dir);
+
+/*
+ * Returns a commit with only commit_id, repo_id, root_id, ctime, parent_id,
+ * second_parent_id and version set, or NULL if the commit is not in the graph.
+ */
+SeafCommit *
+commit_graph_lookup (CommitGraph *graph, const char *repo_id,
+                     const char *commit_id);
+
+int
+commit_graph_add (CommitGraph *graph, SeafCommit *commit);
+
+int
+commit_graph_remove_repo (CommitGraph *graph, const char *repo_id);
+
+#endif
@@ -13,12 +13,13 @@
 
 #include "seafile-session.h"
 #include "commit-mgr.h"
+#include "commit-graph.h"
 #include "seaf-utils.h"
 
 #define MAX_TIME_SKEW 259200    /* 3 days */
 
 struct _SeafCommitManagerPriv {
-    int dummy;
+    CommitGraph *graph;
 };
 
 static SeafCommit *
@@ -201,6 +202,10 @@ seaf_commit_manager_new (SeafileSession *seaf)
     mgr->seaf = seaf;
     mgr->obj_store = seaf_obj_store_new (mgr->seaf, "commits");
 
+    char *graph_dir = g_build_filename (seaf->seaf_dir, "commit-graph", NULL);
+    mgr->priv->graph = commit_graph_new (graph_dir);
+    g_free (graph_dir);
+
     return mgr;
 }
 
@@ -241,7 +246,9 @@ seaf_commit_manager_add_commit (SeafCommitManager *mgr,
     /* add_commit_to_cache (mgr, commit); */
     if ((ret = save_commit (mgr, commit->repo_id, commit->version, commit)) < 0)
         return -1;
-    
+
+    commit_graph_add (mgr->priv->graph, commit);
+
     return 0;
 }
 
@@ -315,6 +322,36 @@ seaf_commit_manager_get_commit_compatible (SeafCommitManager *mgr,
     return commit;
 }
 
+SeafCommit *
+seaf_commit_manager_get_graph_commit (SeafCommitManager *mgr,
+                                      const char *repo_id,
+                                      int version,
+                                      const char *id)
+{
+    SeafCommit *commit;
+
+    commit = commit_graph_lookup (mgr->priv->graph, repo_id, id);
+    if (commit)
+        return commit;
+
+    commit = load_commit (mgr, repo_id, version, id);
+    if (!commit)
+        return NULL;
+
+    commit_graph_add (mgr->priv->graph, commit);
+
+    return commit;
+}
+
+static SeafCommit *
+get_traverse_commit (SeafCommitManager *mgr, const char *repo_id, int version,
+                     const char *id, gboolean use_graph)
+{
+    if (use_graph)
+        return seaf_commit_manager_get_graph_commit (mgr, repo_id, version, id);
+    return seaf_commit_manager_get_commit (mgr, repo_id, version, id);
+}
+
 static gint
 compare_commit_by_time (gconstpointer a, gconstpointer b, gpointer unused)
 {
@@ -328,7 +365,8 @@ compare_commit_by_time (gconstpointer a, gconstpointer b, gpointer unused)
 inline static int
 insert_parent_commit (GList **list, GHashTable *hash,
                       const char *repo_id, int version,
-                      const char *parent_id, gboolean allow_truncate)
+                      const char *parent_id, gboolean allow_truncate,
+                      gboolean use_graph)
 {
     SeafCommit *p;
     char *key;
@@ -336,9 +374,8 @@ insert_parent_commit (GList **list, GHashTable *hash,
     if (g_hash_table_lookup (hash, parent_id) != NULL)
         return 0;
 
-    p = seaf_commit_manager_get_commit (seaf->commit_mgr,
-                                        repo_id, version,
-                                        parent_id);
+    p = get_traverse_commit (seaf->commit_mgr, repo_id, version,
+                             parent_id, use_graph);
     if (!p) {
         if (allow_truncate)
             return 0;
@@ -356,16 +393,17 @@ insert_parent_commit (GList **list, GHashTable *hash,
     return 0;
 }
 
-gboolean
-seaf_commit_manager_traverse_commit_tree_with_limit (SeafCommitManager *mgr,
-                                                     const char *repo_id,
-                                                     int version,
-                                                     const char *head,
-                                                     CommitTraverseFunc func,
-                                                     int limit,
-                                                     void *data,
-                                                     char **next_start_commit,
-                                                     gboolean skip_errors)
+static gboolean
+traverse_commit_tree_with_limit_common (SeafCommitManager *mgr,
+                                        const char *repo_id,
+                                        int version,
+                                        const char *head,
+                                        CommitTraverseFunc func,
+                                        int limit,
+                                        void *data,
+                                        char **next_start_commit,
+                                        gboolean skip_errors,
+                                        gboolean use_graph)
 {
     SeafCommit *commit;
     GList *list = NULL;
@@ -375,7 +413,7 @@ seaf_commit_manager_traverse_commit_tree_with_limit (SeafCommitManager *mgr,
     /* A hash table for recording id of traversed commits. */
     commit_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-    commit = seaf_commit_manager_get_commit (mgr, repo_id, version, head);
+    commit = get_traverse_commit (mgr, repo_id, version, head, use_graph);
     if (!commit) {
         seaf_warning ("Failed to find commit %s.\n", head);
         g_hash_table_destroy (commit_hash);
@@ -413,7 +451,8 @@ seaf_commit_manager_traverse_commit_tree_with_limit (SeafCommitManager *mgr,
 
         if (commit->parent_id) {
             if (insert_parent_commit (&list, commit_hash, repo_id, version,
-                                      commit->parent_id, FALSE) < 0) {
+                                      commit->parent_id, FALSE,
+                                      use_graph) < 0) {
                 if (!skip_errors) {
                     seaf_commit_unref (commit);
                     ret = FALSE;
@@ -423,7 +462,8 @@ seaf_commit_manager_traverse_commit_tree_with_limit (SeafCommitManager *mgr,
         }
         if (commit->second_parent_id) {
             if (insert_parent_commit (&list, commit_hash, repo_id, version,
-                                      commit->second_parent_id, FALSE) < 0) {
+                                      commit->second_parent_id, FALSE,
+                                      use_graph) < 0) {
                 if (!skip_errors) {
                     seaf_commit_unref (commit);
                     ret = FALSE;
@@ -464,6 +504,40 @@ out:
     return ret;
 }
 
+gboolean
+seaf_commit_manager_traverse_commit_tree_with_limit (SeafCommitManager *mgr,
+                                                     const char *repo_id,
+                                                     int version,
+                                                     const char *head,
+                                                     CommitTraverseFunc func,
+                                                     int limit,
+                                                     void *data,
+                                                     char **next_start_commit,
+                                                     gboolean skip_errors)
+{
+    return traverse_commit_tree_with_limit_common (mgr, repo_id, version, head,
+                                                   func, limit, data,
+                                                   next_start_commit,
+                                                   skip_errors, FALSE);
+}
+
+gboolean
+seaf_commit_manager_traverse_commit_graph_with_limit (SeafCommitManager *mgr,
+                                                      const char *repo_id,
+                                                      int version,
+                                                      const char *head,
+                                                      CommitTraverseFunc func,
+                                                      int limit,
+                                                      void *data,
+                                                      char **next_start_commit,
+                                                      gboolean skip_errors)
+{
+    return traverse_commit_tree_with_limit_common (mgr, repo_id, version, head,
+                                                   func, limit, data,
+                                                   next_start_commit,
+                                                   skip_errors, TRUE);
+}
+
 static gboolean
 traverse_commit_tree_common (SeafCommitManager *mgr,
                              const char *repo_id,
@@ -472,14 +546,15 @@ traverse_commit_tree_common (SeafCommitManager *mgr,
                              CommitTraverseFunc func,
                              void *data,
                              gboolean skip_errors,
-                             gboolean allow_truncate)
+                             gboolean allow_truncate,
+                             gboolean use_graph)
 {
     SeafCommit *commit;
     GList *list = NULL;
     GHashTable *commit_hash;
     gboolean ret = TRUE;
 
-    commit = seaf_commit_manager_get_commit (mgr, repo_id, version, head);
+    commit = get_traverse_commit (mgr, repo_id, version, head, use_graph);
     if (!commit) {
         seaf_warning ("Failed to find commit %s.\n", head);
         // For head commit damaged, directly return FALSE
@@ -522,7 +597,8 @@ traverse_commit_tree_common (SeafCommitManager *mgr,
 
         if (commit->parent_id) {
             if (insert_parent_commit (&list, commit_hash, repo_id, version,
-                                      commit->parent_id, allow_truncate) < 0) {
+                                      commit->parent_id, allow_truncate,
+                                      use_graph) < 0) {
                 seaf_warning("[comit-mgr] insert parent commit failed\n");
 
                 /* If skip errors, try insert second parent. */
@@ -535,7 +611,8 @@ traverse_commit_tree_common (SeafCommitManager *mgr,
         }
         if (commit->second_parent_id) {
             if (insert_parent_commit (&list, commit_hash, repo_id, version,
-                                      commit->second_parent_id, allow_truncate) < 0) {
+                                      commit->second_parent_id, allow_truncate,
+                                      use_graph) < 0) {
                 seaf_warning("[comit-mgr]insert second parent commit failed\n");
 
                 if (!skip_errors) {
@@ -568,7 +645,20 @@ seaf_commit_manager_traverse_commit_tree (SeafCommitManager *mgr,
                                           gboolean skip_errors)
 {
     return traverse_commit_tree_common (mgr, repo_id, version, head,
-                                        func, data, skip_errors, FALSE);
+                                        func, data, skip_errors, FALSE, FALSE);
+}
+
+gboolean
+seaf_commit_manager_traverse_commit_graph (SeafCommitManager *mgr,
+                                           const char *repo_id,
+                                           int version,
+                                           const char *head,
+                                           CommitTraverseFunc func,
+                                           void *data,
+                                           gboolean skip_errors)
+{
+    return traverse_commit_tree_common (mgr, repo_id, version, head,
+                                        func, data, skip_errors, FALSE, TRUE);
 }
 
 gboolean
@@ -581,7 +671,7 @@ seaf_commit_manager_traverse_commit_tree_truncated (SeafCommitManager *mgr,
                                                     gboolean skip_errors)
 {
     return traverse_commit_tree_common (mgr, repo_id, version, head,
-                                        func, data, skip_errors, TRUE);
+                                        func, data, skip_errors, TRUE, FALSE);
 }
 
 gboolean
@@ -943,5 +1033,7 @@ int
 seaf_commit_manager_remove_store (SeafCommitManager *mgr,
                                   const char *store_id)
 {
+    commit_graph_remove_repo (mgr->priv->graph, store_id);
+
     return seaf_obj_store_remove_store (mgr->obj_store, store_id);
 }
@@ -132,6 +132,18 @@ seaf_commit_manager_get_commit (SeafCommitManager *mgr,
                                 int version,
                                 const char *id);
 
+/**
+ * Find a commit in the commit graph of the repo, and load the commit object
+ * only if it's not in the graph yet. The returned commit only has
+ * commit_id, repo_id, root_id, ctime, parent_id, second_parent_id and
+ * version set if it comes from the graph.
+ */
+SeafCommit *
+seaf_commit_manager_get_graph_commit (SeafCommitManager *mgr,
+                                      const char *repo_id,
+                                      int version,
+                                      const char *id);
+
 /**
  * Get a commit object, with compatibility between version 0 and version 1.
  * It will first try to get commit with version 1 layout; if fails, will
@@ -187,6 +199,32 @@ seaf_commit_manager_traverse_commit_tree_with_limit (SeafCommitManager *mgr,
                                                      char **next_start_commit,
                                                      gboolean skip_errors);
 
+/*
+ * The same as seaf_commit_manager_traverse_commit_tree() and
+ * seaf_commit_manager_traverse_commit_tree_with_limit(), but the commits are
+ * looked up in the commit graph. @func only gets the fields returned by
+ * seaf_commit_manager_get_graph_commit().
+ */
+gboolean
+seaf_commit_manager_traverse_commit_graph (SeafCommitManager *mgr,
+                                           const char *repo_id,
+                                           int version,
+                                           const char *head,
+                                           CommitTraverseFunc func,
+                                           void *data,
+                                           gboolean skip_errors);
+
+gboolean
+seaf_commit_manager_traverse_commit_graph_with_limit (SeafCommitManager *mgr,
+                                                      const char *repo_id,
+                                                      int version,
+                                                      const char *head,
+                                                      CommitTraverseFunc func,
+                                                      int limit,
+                                                      void *data,
+                                                      char **next_start_commit,
+                                                      gboolean skip_errors);
+
 gboolean
 seaf_commit_manager_commit_exists (SeafCommitManager *mgr,
                                    const char *repo_id,
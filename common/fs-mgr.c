@@ -10,6 +10,7 @@ char *strcasestr (const char *haystack, const char *needle);
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #ifndef WIN32
     #include <arpa/inet.h>
@@ -37,9 +38,43 @@ char *strcasestr (const char *haystack, const char *needle);
 
 #define SEAF_TMP_EXT "~"
 
+#define FS_CACHE_N_SHARDS 16
+#define DEFAULT_FS_CACHE_LIMIT 1024 /* MB */
+
+/*
+ * Decoded fs object cache.
+ *
+ * Objects are keyed by store id plus object id and spread over several
+ * shards, each protected by its own lock and evicted in LRU order once
+ * the shard exceeds its share of the memory limit. The cache owns one
+ * reference of every stored object.
+ */
+typedef struct FSCacheEntry {
+    char *key;
+    void *obj;
+    gint64 size;
+    GDestroyNotify free_func;
+    GList *lru_link;
+} FSCacheEntry;
+
+typedef struct FSCacheShard {
+    pthread_mutex_t lock;
+    GHashTable *entries;
+    GQueue lru;
+    gint64 mem_used;
+} FSCacheShard;
+
+typedef struct FSCache {
+    FSCacheShard shards[FS_CACHE_N_SHARDS];
+    gint64 shard_limit;
+    gint64 hits;
+    gint64 misses;
+} FSCache;
+
 struct _SeafFSManagerPriv {
     /* GHashTable      *seafile_cache; */
     GHashTable      *bl_cache;
+    FSCache         *obj_cache;
 };
 
 typedef struct SeafileOndisk {
@@ -70,6 +105,14 @@ write_seafile (SeafFSManager *fs_mgr,
                unsigned char *obj_sha1);
 #endif  /* SEAFILE_SERVER */
 
+static char *
+get_dir_id_by_path (SeafFSManager *mgr,
+                    const char *repo_id,
+                    int version,
+                    const char *root_id,
+                    const char *path,
+                    GError **error);
+
 SeafFSManager *
 seaf_fs_manager_new (SeafileSession *seaf,
                      const char *seaf_dir)
@@ -89,6 +132,118 @@ seaf_fs_manager_new (SeafileSession *seaf,
     return mgr;
 }
 
+static void
+fs_cache_entry_free (FSCacheEntry *entry)
+{
+    entry->free_func (entry->obj);
+    g_free (entry->key);
+    g_free (entry);
+}
+
+static FSCache *
+fs_cache_new (gint64 limit)
+{
+    FSCache *cache = g_new0 (FSCache, 1);
+    FSCacheShard *shard;
+    int i;
+
+    cache->shard_limit = limit / FS_CACHE_N_SHARDS;
+    for (i = 0; i < FS_CACHE_N_SHARDS; ++i) {
+        shard = &cache->shards[i];
+        pthread_mutex_init (&shard->lock, NULL);
+        shard->entries = g_hash_table_new (g_str_hash, g_str_equal);
+        g_queue_init (&shard->lru);
+    }
+
+    return cache;
+}
+
+static FSCacheShard *
+fs_cache_get_shard (FSCache *cache, const char *key)
+{
+    return &cache->shards[g_str_hash (key) % FS_CACHE_N_SHARDS];
+}
+
+/*
+ * Look up an object. On a hit, @copy_func is called with the shard lock held
+ * to hand the caller its own reference or copy of the cached object.
+ */
+static void *
+fs_cache_lookup (FSCache *cache, const char *store_id, const char *obj_id,
+                 void *(*copy_func)(void *))
+{
+    char *key = g_strconcat (store_id, obj_id, NULL);
+    FSCacheShard *shard = fs_cache_get_shard (cache, key);
+    FSCacheEntry *entry;
+    void *ret = NULL;
+
+    pthread_mutex_lock (&shard->lock);
+    entry = g_hash_table_lookup (shard->entries, key);
+    if (entry) {
+        g_queue_unlink (&shard->lru, entry->lru_link);
+        g_queue_push_head_link (&shard->lru, entry->lru_link);
+        ret = copy_func (entry->obj);
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    g_free (key);
+
+    if (ret)
+        __sync_fetch_and_add (&cache->hits, 1);
+    else
+        __sync_fetch_and_add (&cache->misses, 1);
+
+    return ret;
+}
+
+/* Takes ownership of @obj, which is freed if it cannot be kept. */
+static void
+fs_cache_insert (FSCache *cache, const char *store_id, const char *obj_id,
+                 void *obj, gint64 size, GDestroyNotify free_func)
+{
+    FSCacheEntry *entry, *victim;
+    FSCacheShard *shard;
+    GList *link;
+
+    if (size > cache->shard_limit) {
+        free_func (obj);
+        return;
+    }
+
+    entry = g_new0 (FSCacheEntry, 1);
+    entry->key = g_strconcat (store_id, obj_id, NULL);
+    entry->obj = obj;
+    entry->size = size;
+    entry->free_func = free_func;
+
+    shard = fs_cache_get_shard (cache, entry->key);
+
+    pthread_mutex_lock (&shard->lock);
+
+    /* Another thread has loaded the same object in the meantime. */
+    if (g_hash_table_lookup (shard->entries, entry->key)) {
+        pthread_mutex_unlock (&shard->lock);
+        fs_cache_entry_free (entry);
+        return;
+    }
+
+    while (shard->mem_used + size > cache->shard_limit) {
+        link = g_queue_pop_tail_link (&shard->lru);
+        victim = link->data;
+        g_list_free_1 (link);
+        g_hash_table_remove (shard->entries, victim->key);
+        shard->mem_used -= victim->size;
+        fs_cache_entry_free (victim);
+    }
+
+    g_queue_push_head (&shard->lru, entry);
+    entry->lru_link = shard->lru.head;
+    g_hash_table_insert (shard->entries, entry->key, entry);
+    shard->mem_used += size;
+
+    pthread_mutex_unlock (&shard->lock);
+}
+
 int
 seaf_fs_manager_init (SeafFSManager *mgr)
 {
@@ -97,9 +252,51 @@ seaf_fs_manager_init (SeafFSManager *mgr)
         return -1;
     }
 
+#ifdef SEAFILE_SERVER
+    GError *error = NULL;
+    gint64 cache_limit;
+
+    cache_limit = g_key_file_get_int64 (mgr->seaf->config,
+                                        "fileserver", "fs_cache_limit",
+                                        &error);
+    if (error) {
+        cache_limit = DEFAULT_FS_CACHE_LIMIT;
+        g_clear_error (&error);
+    }
+    if (cache_limit > 0) {
+        mgr->priv->obj_cache = fs_cache_new (cache_limit * 1024 * 1024);
+        seaf_message ("fs object cache limit is set to %"G_GINT64_FORMAT" MB.\n",
+                      cache_limit);
+    }
+#endif
+
     return 0;
 }
 
+void
+seaf_fs_manager_get_cache_stats (SeafFSManager *mgr,
+                                 gint64 *hits,
+                                 gint64 *misses,
+                                 gint64 *mem_used)
+{
+    FSCache *cache = mgr->priv->obj_cache;
+    FSCacheShard *shard;
+    int i;
+
+    *hits = *misses = *mem_used = 0;
+    if (!cache)
+        return;
+
+    *hits = __sync_fetch_and_add (&cache->hits, 0);
+    *misses = __sync_fetch_and_add (&cache->misses, 0);
+    for (i = 0; i < FS_CACHE_N_SHARDS; ++i) {
+        shard = &cache->shards[i];
+        pthread_mutex_lock (&shard->lock);
+        *mem_used += shard->mem_used;
+        pthread_mutex_unlock (&shard->lock);
+    }
+}
+
 #ifndef SEAFILE_SERVER
 static int
 checkout_block (const char *repo_id,
@@ -1087,7 +1284,7 @@ out:
 void
 seafile_ref (Seafile *seafile)
 {
-    ++seafile->ref_count;
+    g_atomic_int_inc (&seafile->ref_count);
 }
 
 static void
@@ -1110,10 +1307,42 @@ seafile_unref (Seafile *seafile)
     if (!seafile)
         return;
 
-    if (--seafile->ref_count <= 0)
+    if (g_atomic_int_dec_and_test (&seafile->ref_count))
         seafile_free (seafile);
 }
 
+Seafile *
+seafile_dup (Seafile *seafile)
+{
+    Seafile *new_file;
+    int i;
+
+    new_file = g_memdup (seafile, sizeof(Seafile));
+    new_file->ref_count = 1;
+    if (seafile->n_blocks > 0) {
+        new_file->blk_sha1s = g_new0 (char *, seafile->n_blocks);
+        for (i = 0; i < seafile->n_blocks; ++i)
+            new_file->blk_sha1s[i] = g_strdup (seafile->blk_sha1s[i]);
+    } else {
+        new_file->blk_sha1s = NULL;
+    }
+
+    return new_file;
+}
+
+static gint64
+seafile_mem_size (Seafile *seafile)
+{
+    return sizeof(Seafile) + (gint64)seafile->n_blocks * (sizeof(char *) + 41);
+}
+
+static void *
+seafile_cache_ref (void *obj)
+{
+    seafile_ref ((Seafile *)obj);
+    return obj;
+}
+
 static Seafile *
 seafile_from_v0_data (const char *id, const void *data, int len)
 {
@@ -1267,14 +1496,7 @@ seaf_fs_manager_get_seafile (SeafFSManager *mgr,
     void *data;
     int len;
     Seafile *seafile;
-
-#if 0
-    seafile = g_hash_table_lookup (mgr->priv->seafile_cache, file_id);
-    if (seafile) {
-        seafile_ref (seafile);
-        return seafile;
-    }
-#endif
+    FSCache *cache = mgr->priv->obj_cache;
 
     if (memcmp (file_id, EMPTY_SHA1, 40) == 0) {
         seafile = g_new0 (Seafile, 1);
@@ -1283,6 +1505,12 @@ seaf_fs_manager_get_seafile (SeafFSManager *mgr,
         return seafile;
     }
 
+    if (cache) {
+        seafile = fs_cache_lookup (cache, repo_id, file_id, seafile_cache_ref);
+        if (seafile)
+            return seafile;
+    }
+
     if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
                                  file_id, &data, &len) < 0) {
         seaf_warning ("[fs mgr] Failed to read file %s.\n", file_id);
@@ -1292,13 +1520,13 @@ seaf_fs_manager_get_seafile (SeafFSManager *mgr,
     seafile = seafile_from_data (file_id, data, len, (version > 0));
     g_free (data);
 
-#if 0
-    /*
-     * Add to cache. Also increase ref count.
-     */
-    seafile_ref (seafile);
-    g_hash_table_insert (mgr->priv->seafile_cache, g_strdup(file_id), seafile);
-#endif
+    /* Add to cache. The cache holds its own reference. */
+    if (seafile && cache) {
+        seafile_ref (seafile);
+        fs_cache_insert (cache, repo_id, file_id, seafile,
+                         seafile_mem_size (seafile),
+                         (GDestroyNotify)seafile_unref);
+    }
 
     return seafile;
 }
@@ -1527,6 +1755,207 @@ seaf_dirent_dup (SeafDirent *dent)
     return new_dent;
 }
 
+/*
+ * Compact dir representation.
+ */
+
+static gint
+compare_compact_dirents (const SeafCompactDirent *a, const SeafCompactDirent *b)
+{
+    /* Same (descending) order as compare_dirents(). */
+    return strcmp (b->name, a->name);
+}
+
+static gint
+compare_sorted_index (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    SeafCompactDirent *entries = user_data;
+
+    return compare_compact_dirents (&entries[*(const guint32 *)a],
+                                    &entries[*(const guint32 *)b]);
+}
+
+SeafCompactDir *
+seaf_compact_dir_from_dir (SeafDir *dir)
+{
+    SeafCompactDir *cdir;
+    SeafCompactDirent *cdent;
+    SeafDirent *dent;
+    GList *ptr;
+    gsize names_size = 0;
+    gboolean is_sorted = TRUE;
+    guint32 i;
+
+    cdir = g_new0 (SeafCompactDir, 1);
+    cdir->version = dir->version;
+    memcpy (cdir->dir_id, dir->dir_id, 41);
+    cdir->ref_count = 1;
+
+    cdir->n_entries = g_list_length (dir->entries);
+    for (ptr = dir->entries; ptr; ptr = ptr->next) {
+        dent = ptr->data;
+        names_size += dent->name_len + 1;
+    }
+
+    /* Names and modifiers share one arena, modifiers are interned since
+     * most files in a dir are usually modified by a few users.
+     */
+    cdir->strings = g_string_chunk_new (MAX (names_size, 64));
+    if (cdir->n_entries > 0)
+        cdir->entries = g_new (SeafCompactDirent, cdir->n_entries);
+
+    for (ptr = dir->entries, i = 0; ptr; ptr = ptr->next, ++i) {
+        dent = ptr->data;
+        cdent = &cdir->entries[i];
+
+        memcpy (cdent->id, dent->id, 41);
+        cdent->mode = dent->mode;
+        cdent->name_len = dent->name_len;
+        cdent->name = g_string_chunk_insert_len (cdir->strings,
+                                                 dent->name, dent->name_len);
+        cdent->mtime = dent->mtime;
+        cdent->size = dent->size;
+        if (dent->modifier)
+            cdent->modifier = g_string_chunk_insert_const (cdir->strings,
+                                                           dent->modifier);
+        else
+            cdent->modifier = NULL;
+
+        if (i > 0 && compare_compact_dirents (cdent - 1, cdent) > 0)
+            is_sorted = FALSE;
+    }
+
+    /* Only some very old dir objects are not sorted. For them keep an index
+     * in sorted order, so that the on-disk order is still preserved.
+     */
+    if (!is_sorted) {
+        cdir->sorted = g_new (guint32, cdir->n_entries);
+        for (i = 0; i < cdir->n_entries; ++i)
+            cdir->sorted[i] = i;
+        g_qsort_with_data (cdir->sorted, cdir->n_entries, sizeof(guint32),
+                           compare_sorted_index, cdir->entries);
+    }
+
+    return cdir;
+}
+
+void
+seaf_compact_dir_ref (SeafCompactDir *cdir)
+{
+    g_atomic_int_inc (&cdir->ref_count);
+}
+
+void
+seaf_compact_dir_unref (SeafCompactDir *cdir)
+{
+    if (!cdir)
+        return;
+
+    if (!g_atomic_int_dec_and_test (&cdir->ref_count))
+        return;
+
+    g_free (cdir->entries);
+    g_free (cdir->sorted);
+    g_string_chunk_free (cdir->strings);
+    g_free (cdir);
+}
+
+static SeafCompactDirent *
+compact_dir_nth_sorted (SeafCompactDir *cdir, guint32 n)
+{
+    return &cdir->entries[cdir->sorted ? cdir->sorted[n] : n];
+}
+
+SeafCompactDirent *
+seaf_compact_dir_lookup (SeafCompactDir *cdir, const char *name)
+{
+    SeafCompactDirent *cdent;
+    guint32 lo = 0, hi = cdir->n_entries, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cdent = compact_dir_nth_sorted (cdir, mid);
+        cmp = strcmp (name, cdent->name);
+        if (cmp == 0)
+            return cdent;
+        /* Entries are in descending order. */
+        if (cmp > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+SeafDirent *
+seaf_compact_dirent_to_dirent (SeafCompactDir *cdir, SeafCompactDirent *cdent)
+{
+    SeafDirent *dent = g_new0 (SeafDirent, 1);
+
+    dent->version = cdir->version;
+    memcpy (dent->id, cdent->id, 41);
+    dent->mode = cdent->mode;
+    dent->name_len = cdent->name_len;
+    dent->name = g_strndup (cdent->name, cdent->name_len);
+    dent->mtime = cdent->mtime;
+    dent->modifier = g_strdup (cdent->modifier);
+    dent->size = cdent->size;
+
+    return dent;
+}
+
+SeafDir *
+seaf_compact_dir_to_dir (SeafCompactDir *cdir, gboolean sorted)
+{
+    SeafDir *dir;
+    SeafCompactDirent *cdent;
+    guint32 i;
+
+    dir = g_new0 (SeafDir, 1);
+    dir->object.type = SEAF_METADATA_TYPE_DIR;
+    dir->version = cdir->version;
+    memcpy (dir->dir_id, cdir->dir_id, 41);
+
+    for (i = cdir->n_entries; i > 0; --i) {
+        if (sorted)
+            cdent = compact_dir_nth_sorted (cdir, i - 1);
+        else
+            cdent = &cdir->entries[i - 1];
+        dir->entries = g_list_prepend (dir->entries,
+                                       seaf_compact_dirent_to_dirent (cdir, cdent));
+    }
+
+    return dir;
+}
+
+static gint64
+compact_dir_mem_size (SeafCompactDir *cdir)
+{
+    gint64 size = sizeof(SeafCompactDir);
+    guint32 i;
+
+    size += (gint64)cdir->n_entries * sizeof(SeafCompactDirent);
+    if (cdir->sorted)
+        size += (gint64)cdir->n_entries * sizeof(guint32);
+    /* Upper bound: interned modifiers are usually shared. */
+    for (i = 0; i < cdir->n_entries; ++i) {
+        size += cdir->entries[i].name_len + 1;
+        if (cdir->entries[i].modifier)
+            size += strlen(cdir->entries[i].modifier) + 1;
+    }
+
+    return size;
+}
+
+static void *
+compact_dir_cache_ref (void *obj)
+{
+    seaf_compact_dir_ref ((SeafCompactDir *)obj);
+    return obj;
+}
+
 static SeafDir *
 seaf_dir_from_v0_data (const char *dir_id, const uint8_t *data, int len)
 {
@@ -1880,8 +2309,7 @@ seaf_fs_manager_get_seafdir (SeafFSManager *mgr,
     void *data;
     int len;
     SeafDir *dir;
-
-    /* TODO: add hash cache */
+    FSCache *cache = mgr->priv->obj_cache;
 
     if (memcmp (dir_id, EMPTY_SHA1, 40) == 0) {
         dir = g_new0 (SeafDir, 1);
@@ -1890,6 +2318,19 @@ seaf_fs_manager_get_seafdir (SeafFSManager *mgr,
         return dir;
     }
 
+    /* Dirs are cached in compact form. Callers are free to modify the
+     * returned dir, so always hand out a new one.
+     */
+    if (cache) {
+        SeafCompactDir *cdir = seaf_fs_manager_get_compact_dir (mgr, repo_id,
+                                                                version, dir_id);
+        if (!cdir)
+            return NULL;
+        dir = seaf_compact_dir_to_dir (cdir, FALSE);
+        seaf_compact_dir_unref (cdir);
+        return dir;
+    }
+
     if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
                                  dir_id, &data, &len) < 0) {
         seaf_warning ("[fs mgr] Failed to read dir %s.\n", dir_id);
@@ -1902,6 +2343,58 @@ seaf_fs_manager_get_seafdir (SeafFSManager *mgr,
     return dir;
 }
 
+SeafCompactDir *
+seaf_fs_manager_get_compact_dir (SeafFSManager *mgr,
+                                 const char *repo_id,
+                                 int version,
+                                 const char *dir_id)
+{
+    void *data;
+    int len;
+    SeafDir *dir;
+    SeafCompactDir *cdir;
+    FSCache *cache = mgr->priv->obj_cache;
+
+    if (memcmp (dir_id, EMPTY_SHA1, 40) == 0) {
+        cdir = g_new0 (SeafCompactDir, 1);
+        cdir->version = version;
+        memset (cdir->dir_id, '0', 40);
+        cdir->strings = g_string_chunk_new (64);
+        cdir->ref_count = 1;
+        return cdir;
+    }
+
+    if (cache) {
+        cdir = fs_cache_lookup (cache, repo_id, dir_id, compact_dir_cache_ref);
+        if (cdir)
+            return cdir;
+    }
+
+    if (seaf_obj_store_read_obj (mgr->obj_store, repo_id, version,
+                                 dir_id, &data, &len) < 0) {
+        seaf_warning ("[fs mgr] Failed to read dir %s.\n", dir_id);
+        return NULL;
+    }
+
+    dir = seaf_dir_from_data (dir_id, data, len, (version > 0));
+    g_free (data);
+    if (!dir)
+        return NULL;
+
+    cdir = seaf_compact_dir_from_dir (dir);
+    seaf_dir_free (dir);
+
+    /* Add to cache. The cache holds its own reference. */
+    if (cache) {
+        seaf_compact_dir_ref (cdir);
+        fs_cache_insert (cache, repo_id, dir_id, cdir,
+                         compact_dir_mem_size (cdir),
+                         (GDestroyNotify)seaf_compact_dir_unref);
+    }
+
+    return cdir;
+}
+
 static gint
 compare_dirents (gconstpointer a, gconstpointer b)
 {
@@ -1939,8 +2432,20 @@ seaf_fs_manager_get_seafdir_sorted (SeafFSManager *mgr,
                                     int version,
                                     const char *dir_id)
 {
-    SeafDir *dir = seaf_fs_manager_get_seafdir(mgr, repo_id, version, dir_id);
+    SeafDir *dir;
+
+    /* Compact dirs keep their sorted order, no need to sort again. */
+    if (mgr->priv->obj_cache) {
+        SeafCompactDir *cdir = seaf_fs_manager_get_compact_dir (mgr, repo_id,
+                                                                version, dir_id);
+        if (!cdir)
+            return NULL;
+        dir = seaf_compact_dir_to_dir (cdir, TRUE);
+        seaf_compact_dir_unref (cdir);
+        return dir;
+    }
 
+    dir = seaf_fs_manager_get_seafdir(mgr, repo_id, version, dir_id);
     if (!dir)
         return NULL;
 
@@ -1961,20 +2466,16 @@ seaf_fs_manager_get_seafdir_sorted_by_path (SeafFSManager *mgr,
                                             const char *root_id,
                                             const char *path)
 {
-    SeafDir *dir = seaf_fs_manager_get_seafdir_by_path (mgr, repo_id,
-                                                        version, root_id,
-                                                        path, NULL);
+    SeafDir *dir;
+    char *dir_id;
 
-    if (!dir)
+    dir_id = get_dir_id_by_path (mgr, repo_id, version, root_id, path, NULL);
+    if (!dir_id)
         return NULL;
 
-    /* Only some very old dir objects are not sorted. */
-    if (version > 0)
-        return dir;
-
-    if (!is_dirents_sorted (dir->entries))
-        dir->entries = g_list_sort (dir->entries, compare_dirents);
+    dir = seaf_fs_manager_get_seafdir_sorted (mgr, repo_id, version, dir_id);
 
+    g_free (dir_id);
     return dir;
 }
 
@@ -2385,6 +2886,26 @@ seaf_fs_manager_object_exists (SeafFSManager *mgr,
     return seaf_obj_store_obj_exists (mgr->obj_store, repo_id, version, id);
 }
 
+void
+seaf_fs_manager_objects_exist (SeafFSManager *mgr,
+                               const char *repo_id,
+                               int version,
+                               char **ids,
+                               int n_ids,
+                               gboolean *exists)
+{
+    int i;
+
+    seaf_obj_store_objs_exist (mgr->obj_store, repo_id, version,
+                               ids, n_ids, exists);
+
+    /* Empty file and dir always exists. */
+    for (i = 0; i < n_ids; ++i) {
+        if (ids[i] && memcmp (ids[i], EMPTY_SHA1, 40) == 0)
+            exists[i] = TRUE;
+    }
+}
+
 void
 seaf_fs_manager_delete_object (SeafFSManager *mgr,
                                const char *repo_id,
@@ -2549,61 +3070,77 @@ seaf_fs_manager_count_fs_files (SeafFSManager *mgr,
      return count_dir_files (mgr, repo_id, version, root_id);
 }
 
-SeafDir *
-seaf_fs_manager_get_seafdir_by_path (SeafFSManager *mgr,
-                                     const char *repo_id,
-                                     int version,
-                                     const char *root_id,
-                                     const char *path,
-                                     GError **error)
-{
-    SeafDir *dir;
-    SeafDirent *dent;
-    const char *dir_id = root_id;
+/*
+ * Walk @path from @root_id with compact dirs, looking up each component
+ * by binary search. Returns the id of the dir at @path.
+ */
+static char *
+get_dir_id_by_path (SeafFSManager *mgr,
+                    const char *repo_id,
+                    int version,
+                    const char *root_id,
+                    const char *path,
+                    GError **error)
+{
+    SeafCompactDir *cdir;
+    SeafCompactDirent *cdent;
+    char dir_id[41];
     char *name, *saveptr;
     char *tmp_path = g_strdup(path);
+    char *ret = NULL;
 
-    dir = seaf_fs_manager_get_seafdir (mgr, repo_id, version, dir_id);
-    if (!dir) {
-        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING, "directory is missing");
-        g_free (tmp_path);
-        return NULL;
-    }
+    g_strlcpy (dir_id, root_id, sizeof(dir_id));
 
     name = strtok_r (tmp_path, "/", &saveptr);
     while (name != NULL) {
-        GList *l;
-        for (l = dir->entries; l != NULL; l = l->next) {
-            dent = l->data;
-
-            if (strcmp(dent->name, name) == 0 && S_ISDIR(dent->mode)) {
-                dir_id = dent->id;
-                break;
-            }
+        cdir = seaf_fs_manager_get_compact_dir (mgr, repo_id, version, dir_id);
+        if (!cdir) {
+            g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING,
+                         "directory is missing");
+            goto out;
         }
 
-        if (!l) {
+        cdent = seaf_compact_dir_lookup (cdir, name);
+        if (!cdent || !S_ISDIR(cdent->mode)) {
             g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_PATH_NO_EXIST,
                          "Path does not exists %s", path);
-            seaf_dir_free (dir);
-            dir = NULL;
-            break;
+            seaf_compact_dir_unref (cdir);
+            goto out;
         }
 
-        SeafDir *prev = dir;
-        dir = seaf_fs_manager_get_seafdir (mgr, repo_id, version, dir_id);
-        seaf_dir_free (prev);
-
-        if (!dir) {
-            g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING,
-                         "directory is missing");
-            break;
-        }
+        memcpy (dir_id, cdent->id, 41);
+        seaf_compact_dir_unref (cdir);
 
         name = strtok_r (NULL, "/", &saveptr);
     }
 
+    ret = g_strdup (dir_id);
+
+out:
     g_free (tmp_path);
+    return ret;
+}
+
+SeafDir *
+seaf_fs_manager_get_seafdir_by_path (SeafFSManager *mgr,
+                                     const char *repo_id,
+                                     int version,
+                                     const char *root_id,
+                                     const char *path,
+                                     GError **error)
+{
+    SeafDir *dir;
+    char *dir_id;
+
+    dir_id = get_dir_id_by_path (mgr, repo_id, version, root_id, path, error);
+    if (!dir_id)
+        return NULL;
+
+    dir = seaf_fs_manager_get_seafdir (mgr, repo_id, version, dir_id);
+    if (!dir)
+        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING, "directory is missing");
+
+    g_free (dir_id);
     return dir;
 }
 
@@ -2619,9 +3156,9 @@ seaf_fs_manager_path_to_obj_id (SeafFSManager *mgr,
     char *copy = g_strdup (path);
     int off = strlen(copy) - 1;
     char *slash, *name;
-    SeafDir *base_dir = NULL;
-    SeafDirent *dent;
-    GList *p;
+    char *base_dir_id = NULL;
+    SeafCompactDir *base_dir = NULL;
+    SeafCompactDirent *cdent;
     char *obj_id = NULL;
 
     while (off >= 0 && copy[off] == '/')
@@ -2638,7 +3175,7 @@ seaf_fs_manager_path_to_obj_id (SeafFSManager *mgr,
 
     slash = strrchr (copy, '/');
     if (!slash) {
-        base_dir = seaf_fs_manager_get_seafdir (mgr, repo_id, version, root_id);
+        base_dir = seaf_fs_manager_get_compact_dir (mgr, repo_id, version, root_id);
         if (!base_dir) {
             seaf_warning ("Failed to find root dir %s.\n", root_id);
             g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_GENERAL, " ");
@@ -2649,12 +3186,15 @@ seaf_fs_manager_path_to_obj_id (SeafFSManager *mgr,
         *slash = 0;
         name = slash + 1;
         GError *tmp_error = NULL;
-        base_dir = seaf_fs_manager_get_seafdir_by_path (mgr,
-                                                        repo_id,
-                                                        version,
-                                                        root_id,
-                                                        copy,
-                                                        &tmp_error);
+        base_dir_id = get_dir_id_by_path (mgr, repo_id, version,
+                                          root_id, copy, &tmp_error);
+        if (base_dir_id) {
+            base_dir = seaf_fs_manager_get_compact_dir (mgr, repo_id, version,
+                                                        base_dir_id);
+            if (!base_dir)
+                g_set_error (&tmp_error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING,
+                             "directory is missing");
+        }
         if (tmp_error &&
             !g_error_matches(tmp_error,
                              SEAFILE_DOMAIN,
@@ -2671,24 +3211,18 @@ seaf_fs_manager_path_to_obj_id (SeafFSManager *mgr,
         }
     }
 
-    for (p = base_dir->entries; p != NULL; p = p->next) {
-        dent = p->data;
-
-        if (!is_object_id_valid (dent->id))
-            continue;
-
-        if (strcmp (dent->name, name) == 0) {
-            obj_id = g_strdup (dent->id);
-            if (mode) {
-                *mode = dent->mode;
-            }
-            break;
+    cdent = seaf_compact_dir_lookup (base_dir, name);
+    if (cdent && is_object_id_valid (cdent->id)) {
+        obj_id = g_strdup (cdent->id);
+        if (mode) {
+            *mode = cdent->mode;
         }
     }
 
 out:
     if (base_dir)
-        seaf_dir_free (base_dir);
+        seaf_compact_dir_unref (base_dir);
+    g_free (base_dir_id);
     g_free (copy);
     return obj_id;
 }
@@ -2752,38 +3286,37 @@ seaf_fs_manager_get_dirent_by_path (SeafFSManager *mgr,
                                     GError **error)
 {
     SeafDirent *dent = NULL;
-    SeafDir *dir = NULL;
+    SeafCompactDir *dir = NULL;
+    SeafCompactDirent *cdent;
+    char *dir_id = NULL;
     char *parent_dir = NULL;
     char *file_name = NULL;
 
     parent_dir  = g_path_get_dirname(path);
     file_name = g_path_get_basename(path);
 
-    if (strcmp (parent_dir, ".") == 0) {
-        dir = seaf_fs_manager_get_seafdir (mgr, repo_id, version, root_id);
-        if (!dir) {
-            g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING, "directory is missing");
-        }
-    } else
-        dir = seaf_fs_manager_get_seafdir_by_path (mgr, repo_id, version,
-                                                   root_id, parent_dir, error);
+    if (strcmp (parent_dir, ".") == 0)
+        dir_id = g_strdup (root_id);
+    else
+        dir_id = get_dir_id_by_path (mgr, repo_id, version,
+                                     root_id, parent_dir, error);
+    if (!dir_id)
+        goto out;
 
+    dir = seaf_fs_manager_get_compact_dir (mgr, repo_id, version, dir_id);
     if (!dir) {
+        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_DIR_MISSING, "directory is missing");
         goto out;
     }
 
-    GList *p;
-    for (p = dir->entries; p; p = p->next) {
-        SeafDirent *d = p->data;
-        if (strcmp (d->name, file_name) == 0) {
-            dent = seaf_dirent_dup(d);
-            break;
-        }
-    }
+    cdent = seaf_compact_dir_lookup (dir, file_name);
+    if (cdent)
+        dent = seaf_compact_dirent_to_dirent (dir, cdent);
 
 out:
     if (dir)
-        seaf_dir_free (dir);
+        seaf_compact_dir_unref (dir);
+    g_free (dir_id);
     g_free (parent_dir);
     g_free (file_name);
 
@@ -3081,6 +3614,13 @@ seaf_fs_manager_remove_store (SeafFSManager *mgr,
     return seaf_obj_store_remove_store (mgr->obj_store, store_id);
 }
 
+int
+seaf_fs_manager_compact_store (SeafFSManager *mgr,
+                               const char *store_id)
+{
+    return seaf_obj_store_compact (mgr->obj_store, store_id);
+}
+
 GObject *
 seaf_fs_manager_get_file_count_info_by_path (SeafFSManager *mgr,
                                              const char *repo_id,
@@ -56,6 +56,12 @@ seafile_ref (Seafile *seafile);
 void
 seafile_unref (Seafile *seafile);
 
+/* Returned Seafile objects may be shared with the fs object cache.
+ * Callers that need to modify a file object must work on a copy.
+ */
+Seafile *
+seafile_dup (Seafile *seafile);
+
 int
 seafile_save (SeafFSManager *fs_mgr,
               const char *repo_id,
@@ -111,6 +117,52 @@ SeafDirent *
 seaf_dirent_new (int version, const char *sha1, int mode, const char *name,
                  gint64 mtime, const char *modifier, gint64 size);
 
+/*
+ * Read-only compact form of a dir object, used for lookups and caching.
+ * All dirents are kept in one array, names and (interned) modifiers in one
+ * string chunk. @entries keep the on-disk order; if that is not sorted,
+ * @sorted holds the entry indexes in descending name order.
+ */
+typedef struct _SeafCompactDirent {
+    char        id[41];
+    guint32     mode;
+    guint32     name_len;
+    const char *name;
+    gint64      mtime;
+    const char *modifier;
+    gint64      size;
+} SeafCompactDirent;
+
+typedef struct _SeafCompactDir {
+    int                 version;
+    char                dir_id[41];
+    guint32             n_entries;
+    SeafCompactDirent  *entries;
+    guint32            *sorted;
+    GStringChunk       *strings;
+    int                 ref_count;
+} SeafCompactDir;
+
+SeafCompactDir *
+seaf_compact_dir_from_dir (SeafDir *dir);
+
+void
+seaf_compact_dir_ref (SeafCompactDir *cdir);
+
+void
+seaf_compact_dir_unref (SeafCompactDir *cdir);
+
+/* Binary search for @name. Returns NULL if not found. */
+SeafCompactDirent *
+seaf_compact_dir_lookup (SeafCompactDir *cdir, const char *name);
+
+SeafDirent *
+seaf_compact_dirent_to_dirent (SeafCompactDir *cdir, SeafCompactDirent *cdent);
+
+/* If @sorted is TRUE, entries are returned in descending name order. */
+SeafDir *
+seaf_compact_dir_to_dir (SeafCompactDir *cdir, gboolean sorted);
+
 void
 seaf_dirent_free (SeafDirent *dent);
 
@@ -172,6 +224,13 @@ seaf_fs_manager_new (struct _SeafileSession *seaf,
 int
 seaf_fs_manager_init (SeafFSManager *mgr);
 
+/* Hit/miss counters and memory use of the decoded fs object cache. */
+void
+seaf_fs_manager_get_cache_stats (SeafFSManager *mgr,
+                                 gint64 *hits,
+                                 gint64 *misses,
+                                 gint64 *mem_used);
+
 #ifndef SEAFILE_SERVER
 
 int 
@@ -242,6 +301,13 @@ seaf_fs_manager_get_seafdir (SeafFSManager *mgr,
                              int version,
                              const char *dir_id);
 
+/* Returns a new reference, which may be shared with the fs object cache. */
+SeafCompactDir *
+seaf_fs_manager_get_compact_dir (SeafFSManager *mgr,
+                                 const char *repo_id,
+                                 int version,
+                                 const char *dir_id);
+
 /* Make sure entries in the returned dir is sorted in descending order.
  */
 SeafDir *
@@ -305,6 +371,15 @@ seaf_fs_manager_object_exists (SeafFSManager *mgr,
                                int version,
                                const char *id);
 
+/* Sets @exists[i] for each of @ids[i]. */
+void
+seaf_fs_manager_objects_exist (SeafFSManager *mgr,
+                               const char *repo_id,
+                               int version,
+                               char **ids,
+                               int n_ids,
+                               gboolean *exists);
+
 void
 seaf_fs_manager_delete_object (SeafFSManager *mgr,
                                const char *repo_id,
@@ -428,6 +503,11 @@ int
 seaf_fs_manager_remove_store (SeafFSManager *mgr,
                               const char *store_id);
 
+/* Reclaim space of deleted objects, if the backend supports it. */
+int
+seaf_fs_manager_compact_store (SeafFSManager *mgr,
+                               const char *store_id);
+
 GObject *
 seaf_fs_manager_get_file_count_info_by_path (SeafFSManager *mgr,
                                              const char *repo_id,
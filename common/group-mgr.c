@@ -2,6 +2,8 @@
 
 #include "common.h"
 
+#include <pthread.h>
+
 #include "seafile-session.h"
 #include "seaf-db.h"
 #include "group-mgr.h"
@@ -13,14 +15,38 @@
 
 #define DEFAULT_MAX_CONNECTIONS 100
 
+/* Group membership changes made through the group manager invalidate the
+ * cache at once, the ttl only covers changes made by other processes.
+ */
+#define MEMBERSHIP_CACHE_TTL 300 /* 5 minutes */
+#define MEMBERSHIP_CACHE_MAX_ENTRIES 100000
+
+typedef struct UserGroupsEntry {
+    GList *groups;              /* groups of the user and their ancestors */
+    gint64 expire_time;
+} UserGroupsEntry;
+
 struct _CcnetGroupManagerPriv {
     CcnetDB	*db;
     const char *table_name;
+
+    pthread_mutex_t membership_lock;
+    GHashTable *membership_cache; /* user -> UserGroupsEntry */
+    gint64 membership_version;
 };
 
 static int open_db (CcnetGroupManager *manager);
 static int check_db_table (CcnetGroupManager *manager, CcnetDB *db);
 
+static void
+user_groups_entry_free (gpointer data)
+{
+    UserGroupsEntry *entry = data;
+
+    g_list_free_full (entry->groups, g_object_unref);
+    g_free (entry);
+}
+
 CcnetGroupManager* ccnet_group_manager_new (SeafileSession *session)
 {
     CcnetGroupManager *manager = g_new0 (CcnetGroupManager, 1);
@@ -28,6 +54,11 @@ CcnetGroupManager* ccnet_group_manager_new (SeafileSession *session)
     manager->session = session;
     manager->priv = g_new0 (CcnetGroupManagerPriv, 1);
 
+    pthread_mutex_init (&manager->priv->membership_lock, NULL);
+    manager->priv->membership_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                             g_free,
+                                                             user_groups_entry_free);
+
     return manager;
 }
 
@@ -349,7 +380,13 @@ int ccnet_group_manager_create_group (CcnetGroupManager *mgr,
                                       int parent_group_id,
                                       GError **error)
 {
-    return create_group_common (mgr, group_name, user_name, parent_group_id, error);
+    int group_id;
+
+    group_id = create_group_common (mgr, group_name, user_name, parent_group_id, error);
+    if (group_id > 0)
+        ccnet_group_manager_invalidate_membership (mgr);
+
+    return group_id;
 }
 
 /* static gboolean */
@@ -404,6 +441,7 @@ int ccnet_group_manager_create_org_group (CcnetGroupManager *mgr,
         g_set_error (error, CCNET_DOMAIN, 0, "Failed to create org group.");
         return -1;
     }
+    ccnet_group_manager_invalidate_membership (mgr);
 
     if (ccnet_org_manager_add_org_group (org_mgr, org_id, group_id,
                                          error) < 0) {
@@ -503,6 +541,8 @@ int ccnet_group_manager_remove_group (CcnetGroupManager *mgr,
     seaf_db_statement_query (db, sql->str, 1, "int", group_id);
 
     g_string_free (sql, TRUE);
+
+    ccnet_group_manager_invalidate_membership (mgr);
     
     return 0;
 }
@@ -554,6 +594,8 @@ int ccnet_group_manager_add_member (CcnetGroupManager *mgr,
         return -1;
     }
 
+    ccnet_group_manager_invalidate_membership (mgr);
+
     return 0;
 }
 
@@ -581,6 +623,8 @@ int ccnet_group_manager_remove_member (CcnetGroupManager *mgr,
     sql = "DELETE FROM GroupUser WHERE group_id=? AND user_name=?";
     seaf_db_statement_query (db, sql, 2, "int", group_id, "string", member_name);
 
+    ccnet_group_manager_invalidate_membership (mgr);
+
     return 0;
 }
 
@@ -634,6 +678,9 @@ int ccnet_group_manager_set_group_name (CcnetGroupManager *mgr,
     }
     g_string_free (sql, TRUE);
 
+    /* The names of the cached groups are out of date. */
+    ccnet_group_manager_invalidate_membership (mgr);
+
     return 0;
 }
 
@@ -655,6 +702,8 @@ int ccnet_group_manager_quit_group (CcnetGroupManager *mgr,
                               "AND user_name=?",
                               2, "int", group_id, "string", user_name);
 
+    ccnet_group_manager_invalidate_membership (mgr);
+
     return 0;
 }
 
@@ -755,11 +804,11 @@ get_group_paths_cb (CcnetDBRow *row, void *data)
     return TRUE;
 }
 
-GList *
-ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
-                                        const char *user_name,
-                                        gboolean return_ancestors,
-                                        GError **error)
+static GList *
+get_groups_by_user (CcnetGroupManager *mgr,
+                    const char *user_name,
+                    gboolean return_ancestors,
+                    gboolean *db_err)
 {
     CcnetDB *db = mgr->priv->db;
     GList *groups = NULL, *ret = NULL;
@@ -786,6 +835,7 @@ ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
                                         &groups,
                                         1, "string", user_name) < 0) {
         g_string_free (sql, TRUE);
+        *db_err = TRUE;
         return NULL;
     }
 
@@ -819,12 +869,14 @@ ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
                                             paths, 0) < 0) {
             g_list_free_full (ret, g_object_unref);
             ret = NULL;
+            *db_err = TRUE;
             goto out;
         }
         if (g_strcmp0(paths->str, "") == 0) {
             ccnet_warning ("Failed to get groups path for user %s\n", user_name);
             g_list_free_full (ret, g_object_unref);
             ret = NULL;
+            *db_err = TRUE;
             goto out;
         }
 
@@ -837,6 +889,7 @@ ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
                                         &ret, 0) < 0) {
             g_list_free_full (ret, g_object_unref);
             ret = NULL;
+            *db_err = TRUE;
             goto out;
         }
     }
@@ -850,6 +903,110 @@ out:
     return ret;
 }
 
+GList *
+ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
+                                        const char *user_name,
+                                        gboolean return_ancestors,
+                                        GError **error)
+{
+    gboolean db_err = FALSE;
+
+    return get_groups_by_user (mgr, user_name, return_ancestors, &db_err);
+}
+
+static GList *
+copy_group_list (GList *groups)
+{
+    GList *ret = NULL, *ptr;
+
+    for (ptr = groups; ptr; ptr = ptr->next)
+        ret = g_list_prepend (ret, g_object_ref (ptr->data));
+
+    return g_list_reverse (ret);
+}
+
+static gboolean
+is_user_groups_entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    UserGroupsEntry *entry = value;
+    gint64 *now = user_data;
+
+    return entry->expire_time <= *now;
+}
+
+GList *
+ccnet_group_manager_get_groups_by_user_cached (CcnetGroupManager *mgr,
+                                               const char *user_name,
+                                               GError **error)
+{
+    CcnetGroupManagerPriv *priv = mgr->priv;
+    UserGroupsEntry *entry;
+    GList *groups;
+    gint64 version, now = (gint64)time(NULL);
+    gboolean db_err = FALSE;
+
+    pthread_mutex_lock (&priv->membership_lock);
+    entry = g_hash_table_lookup (priv->membership_cache, user_name);
+    if (entry && entry->expire_time > now) {
+        groups = copy_group_list (entry->groups);
+        pthread_mutex_unlock (&priv->membership_lock);
+        return groups;
+    }
+    if (entry)
+        g_hash_table_remove (priv->membership_cache, user_name);
+    version = priv->membership_version;
+    pthread_mutex_unlock (&priv->membership_lock);
+
+    groups = get_groups_by_user (mgr, user_name, TRUE, &db_err);
+    if (db_err) {
+        g_set_error (error, CCNET_DOMAIN, 0, "Failed to get groups of user");
+        return NULL;
+    }
+
+    pthread_mutex_lock (&priv->membership_lock);
+    /* Don't cache the groups if the membership changed while loading them. */
+    if (version == priv->membership_version) {
+        if (g_hash_table_size (priv->membership_cache) >= MEMBERSHIP_CACHE_MAX_ENTRIES) {
+            g_hash_table_foreach_remove (priv->membership_cache,
+                                         is_user_groups_entry_expired, &now);
+            if (g_hash_table_size (priv->membership_cache) >= MEMBERSHIP_CACHE_MAX_ENTRIES)
+                g_hash_table_remove_all (priv->membership_cache);
+        }
+
+        entry = g_new0 (UserGroupsEntry, 1);
+        entry->groups = copy_group_list (groups);
+        entry->expire_time = now + MEMBERSHIP_CACHE_TTL;
+        g_hash_table_replace (priv->membership_cache, g_strdup (user_name), entry);
+    }
+    pthread_mutex_unlock (&priv->membership_lock);
+
+    return groups;
+}
+
+gint64
+ccnet_group_manager_get_membership_version (CcnetGroupManager *mgr)
+{
+    CcnetGroupManagerPriv *priv = mgr->priv;
+    gint64 version;
+
+    pthread_mutex_lock (&priv->membership_lock);
+    version = priv->membership_version;
+    pthread_mutex_unlock (&priv->membership_lock);
+
+    return version;
+}
+
+void
+ccnet_group_manager_invalidate_membership (CcnetGroupManager *mgr)
+{
+    CcnetGroupManagerPriv *priv = mgr->priv;
+
+    pthread_mutex_lock (&priv->membership_lock);
+    g_hash_table_remove_all (priv->membership_cache);
+    ++(priv->membership_version);
+    pthread_mutex_unlock (&priv->membership_lock);
+}
+
 static gboolean
 get_ccnetgroup_cb (CcnetDBRow *row, void *data)
 {
@@ -1090,6 +1247,8 @@ ccnet_group_manager_remove_group_user (CcnetGroupManager *mgr,
                               "WHERE user_name = ?",
                               1, "string", user);
 
+    ccnet_group_manager_invalidate_membership (mgr);
+
     return 0;
 }
 
@@ -1489,5 +1648,7 @@ ccnet_group_manager_update_group_user (CcnetGroupManager *mgr,
         return -1;
     }
 
+    ccnet_group_manager_invalidate_membership (mgr);
+
     return 0;
 }
@@ -79,6 +79,21 @@ ccnet_group_manager_get_groups_by_user (CcnetGroupManager *mgr,
                                         gboolean return_ancestors,
                                         GError **error);
 
+/* Same as ccnet_group_manager_get_groups_by_user() with ancestors returned,
+ * but served from a per-user cache. Sets @error on database errors.
+ */
+GList *
+ccnet_group_manager_get_groups_by_user_cached (CcnetGroupManager *mgr,
+                                               const char *user_name,
+                                               GError **error);
+
+/* Bumped every time group membership changes. */
+gint64
+ccnet_group_manager_get_membership_version (CcnetGroupManager *mgr);
+
+void
+ccnet_group_manager_invalidate_membership (CcnetGroupManager *mgr);
+
 CcnetGroup *
 ccnet_group_manager_get_group (CcnetGroupManager *mgr, int group_id,
                                GError **error);
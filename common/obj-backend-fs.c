@@ -335,6 +335,29 @@ obj_backend_fs_exists (ObjBackend *bend,
     return FALSE;
 }
 
+static void
+obj_backend_fs_exists_many (ObjBackend *bend,
+                            const char *repo_id,
+                            int version,
+                            char **obj_ids,
+                            int n_ids,
+                            gboolean *exists)
+{
+    char **paths = g_new (char *, n_ids);
+    int i;
+
+    for (i = 0; i < n_ids; ++i) {
+        paths[i] = g_new (char, SEAF_PATH_MAX);
+        id_to_path (bend->priv, obj_ids[i], paths[i], repo_id, version);
+    }
+
+    seaf_util_exists_many (paths, n_ids, exists);
+
+    for (i = 0; i < n_ids; ++i)
+        g_free (paths[i]);
+    g_free (paths);
+}
+
 static void
 obj_backend_fs_delete (ObjBackend *bend,
                        const char *repo_id,
@@ -516,6 +539,7 @@ obj_backend_fs_new (const char *seaf_dir, const char *obj_type)
     bend->read = obj_backend_fs_read;
     bend->write = obj_backend_fs_write;
     bend->exists = obj_backend_fs_exists;
+    bend->exists_many = obj_backend_fs_exists_many;
     bend->delete = obj_backend_fs_delete;
     bend->foreach_obj = obj_backend_fs_foreach_obj;
     bend->copy = obj_backend_fs_copy;
@@ -0,0 +1,1256 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+#include "utils.h"
+#include "obj-backend.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define DEBUG_FLAG SEAFILE_DEBUG_OTHER
+#include "log.h"
+
+/*
+ * Pack object backend.
+ *
+ * Instead of one file per object, objects of a repo are appended to a few
+ * large pack files under <seaf_dir>/storage/<obj_type>-packs/<repo_id>/:
+ *
+ * NNNNNNNN.pack: "SEAFPACK" followed by records. A record is the 20-byte
+ *                raw object id, a 32-bit big-endian data length and the
+ *                object data. A length of PACK_TOMBSTONE marks a deleted
+ *                object.
+ * index:         Header followed by entries (id, pack, offset, len) sorted
+ *                by id, covering all records before (covered_pack,
+ *                covered_offset). It is accessed through mmap.
+ * lock:          flock()ed shared for reading and exclusive for writing,
+ *                so that seaf-server, the Go fileserver and GC can share
+ *                the packs.
+ *
+ * Records after the index coverage are scanned into memory and folded into
+ * the index once there are enough of them. Compaction copies live objects
+ * out of packs that are mostly garbage and removes those packs.
+ *
+ * The same format is implemented in fileserver/objstore/backend_pack.go.
+ */
+
+#define PACK_MAGIC "SEAFPACK"
+#define PACK_MAGIC_LEN 8
+#define INDEX_MAGIC "SEAFPIDX"
+#define INDEX_VERSION 1
+
+#define PACK_TOMBSTONE 0xFFFFFFFF
+#define MAX_PACK_SIZE (256 << 20)
+#define MAX_UNINDEXED_OBJS 4096
+#define MAX_OPEN_REPOS 256
+/* Compact packs with less live data than this ratio. */
+#define COMPACT_LIVE_RATIO 0.5
+
+typedef struct RecordHeader {
+    unsigned char id[20];
+    guint32       len;
+} __attribute__((__packed__)) RecordHeader;
+
+typedef struct IndexHeader {
+    char          magic[8];
+    guint32       version;
+    guint32       covered_pack;
+    guint64       covered_offset;
+    guint64       n_entries;
+} __attribute__((__packed__)) IndexHeader;
+
+typedef struct IndexEntry {
+    unsigned char id[20];
+    guint32       pack;
+    guint64       offset;
+    guint32       len;
+} __attribute__((__packed__)) IndexEntry;
+
+typedef struct ObjLocation {
+    guint32 pack;
+    guint64 offset;
+    guint32 len;
+} ObjLocation;
+
+typedef struct PackRepo {
+    char             *dir;
+    int               ref_count;
+    pthread_rwlock_t  lock;
+    int               lock_fd;
+
+    /* mmapped index */
+    void             *index_map;
+    gsize             index_size;
+    IndexEntry       *entries;
+    guint64           n_entries;
+    struct stat       index_st;
+
+    /* Position up to which the pack files have been scanned. */
+    guint32           tail_pack;
+    guint64           tail_offset;
+
+    /* Objects written or deleted after the index coverage. */
+    GHashTable       *recent;
+    GHashTable       *deleted;
+
+    /* Pack number -> fd. */
+    GHashTable       *pack_fds;
+} PackRepo;
+
+typedef struct PackPriv {
+    char             *pack_dir;
+    pthread_mutex_t   lock;
+    GHashTable       *repos;
+    GQueue           *lru;
+} PackPriv;
+
+static guint
+raw_id_hash (gconstpointer key)
+{
+    return *(const guint *)key;
+}
+
+static gboolean
+raw_id_equal (gconstpointer a, gconstpointer b)
+{
+    return memcmp (a, b, 20) == 0;
+}
+
+static int
+compare_index_entries (const void *a, const void *b)
+{
+    return memcmp (((const IndexEntry *)a)->id, ((const IndexEntry *)b)->id, 20);
+}
+
+static char *
+pack_path (PackRepo *repo, guint32 pack)
+{
+    return g_strdup_printf ("%s/%08u.pack", repo->dir, pack);
+}
+
+static int
+get_pack_fd (PackRepo *repo, guint32 pack)
+{
+    gpointer value;
+    char *path;
+    int fd;
+
+    value = g_hash_table_lookup (repo->pack_fds, GUINT_TO_POINTER(pack));
+    if (value)
+        return GPOINTER_TO_INT(value) - 1;
+
+    path = pack_path (repo, pack);
+    fd = open (path, O_RDWR);
+    g_free (path);
+    if (fd < 0)
+        return -1;
+
+    g_hash_table_insert (repo->pack_fds, GUINT_TO_POINTER(pack),
+                         GINT_TO_POINTER(fd + 1));
+    return fd;
+}
+
+static void
+close_pack_fd (gpointer key, gpointer value, gpointer user_data)
+{
+    close (GPOINTER_TO_INT(value) - 1);
+}
+
+static gboolean
+is_pack_removed (gpointer key, gpointer value, gpointer user_data)
+{
+    int fd = GPOINTER_TO_INT(value) - 1;
+    struct stat st;
+
+    if (fstat (fd, &st) == 0 && st.st_nlink > 0)
+        return FALSE;
+
+    close (fd);
+    return TRUE;
+}
+
+/* Packs dropped by compaction in another process keep their disk space
+ * until every fd is closed.
+ */
+static void
+close_removed_packs (PackRepo *repo)
+{
+    g_hash_table_foreach_remove (repo->pack_fds, is_pack_removed, NULL);
+}
+
+static void
+unmap_index (PackRepo *repo)
+{
+    if (repo->index_map)
+        munmap (repo->index_map, repo->index_size);
+    repo->index_map = NULL;
+    repo->index_size = 0;
+    repo->entries = NULL;
+    repo->n_entries = 0;
+    memset (&repo->index_st, 0, sizeof(repo->index_st));
+}
+
+/* Map the index and reset in-memory state to the index coverage. */
+static int
+load_index (PackRepo *repo)
+{
+    char *path = g_build_filename (repo->dir, "index", NULL);
+    IndexHeader *hdr;
+    struct stat st;
+    int fd = -1;
+    int ret = 0;
+
+    unmap_index (repo);
+    close_removed_packs (repo);
+    g_hash_table_remove_all (repo->recent);
+    g_hash_table_remove_all (repo->deleted);
+    repo->tail_pack = 1;
+    repo->tail_offset = 0;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            seaf_warning ("[pack bend] Failed to open %s: %s.\n",
+                          path, strerror(errno));
+            ret = -1;
+        }
+        goto out;
+    }
+
+    if (fstat (fd, &st) < 0 || st.st_size < sizeof(IndexHeader)) {
+        seaf_warning ("[pack bend] Invalid index %s.\n", path);
+        ret = -1;
+        goto out;
+    }
+
+    repo->index_map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (repo->index_map == MAP_FAILED) {
+        seaf_warning ("[pack bend] Failed to mmap %s: %s.\n",
+                      path, strerror(errno));
+        repo->index_map = NULL;
+        ret = -1;
+        goto out;
+    }
+    repo->index_size = st.st_size;
+
+    hdr = repo->index_map;
+    if (memcmp (hdr->magic, INDEX_MAGIC, 8) != 0 ||
+        ntohl (hdr->version) != INDEX_VERSION ||
+        sizeof(IndexHeader) + ntoh64 (hdr->n_entries) * sizeof(IndexEntry) != st.st_size) {
+        seaf_warning ("[pack bend] Invalid index %s.\n", path);
+        unmap_index (repo);
+        ret = -1;
+        goto out;
+    }
+
+    repo->entries = (IndexEntry *)(hdr + 1);
+    repo->n_entries = ntoh64 (hdr->n_entries);
+    repo->tail_pack = ntohl (hdr->covered_pack);
+    repo->tail_offset = ntoh64 (hdr->covered_offset);
+    repo->index_st = st;
+
+out:
+    if (fd >= 0)
+        close (fd);
+    g_free (path);
+    return ret;
+}
+
+static gboolean
+index_changed (PackRepo *repo)
+{
+    char *path = g_build_filename (repo->dir, "index", NULL);
+    struct stat st;
+    int rc;
+
+    rc = stat (path, &st);
+    g_free (path);
+
+    if (rc < 0)
+        return repo->index_map != NULL;
+
+    return (st.st_ino != repo->index_st.st_ino ||
+            st.st_size != repo->index_st.st_size ||
+            st.st_mtime != repo->index_st.st_mtime);
+}
+
+static void
+add_recent (PackRepo *repo, const unsigned char *id, guint32 pack,
+            guint64 offset, guint32 len)
+{
+    ObjLocation *loc = g_new0 (ObjLocation, 1);
+
+    loc->pack = pack;
+    loc->offset = offset;
+    loc->len = len;
+    g_hash_table_remove (repo->deleted, id);
+    g_hash_table_replace (repo->recent, g_memdup (id, 20), loc);
+}
+
+static void
+add_deleted (PackRepo *repo, const unsigned char *id)
+{
+    g_hash_table_remove (repo->recent, id);
+    g_hash_table_replace (repo->deleted, g_memdup (id, 20), GINT_TO_POINTER(1));
+}
+
+/* Read records written after the last scanned position, possibly by other
+ * processes. A partial record at the end is left for the next scan.
+ */
+static void
+scan_tail (PackRepo *repo)
+{
+    RecordHeader rec;
+    char magic[PACK_MAGIC_LEN];
+    struct stat st;
+    guint32 len;
+    int fd;
+
+    while (1) {
+        fd = get_pack_fd (repo, repo->tail_pack);
+        if (fd < 0 || fstat (fd, &st) < 0)
+            return;
+
+        if (repo->tail_offset < PACK_MAGIC_LEN) {
+            if (pread (fd, magic, PACK_MAGIC_LEN, 0) != PACK_MAGIC_LEN ||
+                memcmp (magic, PACK_MAGIC, PACK_MAGIC_LEN) != 0)
+                return;
+            repo->tail_offset = PACK_MAGIC_LEN;
+        }
+
+        while (repo->tail_offset + sizeof(rec) <= st.st_size) {
+            if (pread (fd, &rec, sizeof(rec), repo->tail_offset) != sizeof(rec))
+                return;
+            len = ntohl (rec.len);
+            if (len == PACK_TOMBSTONE) {
+                add_deleted (repo, rec.id);
+                repo->tail_offset += sizeof(rec);
+                continue;
+            }
+            if (repo->tail_offset + sizeof(rec) + len > st.st_size)
+                return;
+            add_recent (repo, rec.id, repo->tail_pack,
+                        repo->tail_offset + sizeof(rec), len);
+            repo->tail_offset += sizeof(rec) + len;
+        }
+
+        /* Move on only when a newer pack exists. */
+        char *next = pack_path (repo, repo->tail_pack + 1);
+        gboolean has_next = g_file_test (next, G_FILE_TEST_EXISTS);
+        g_free (next);
+        if (!has_next)
+            return;
+        repo->tail_pack++;
+        repo->tail_offset = 0;
+    }
+}
+
+static void
+refresh_repo (PackRepo *repo)
+{
+    if (index_changed (repo))
+        load_index (repo);
+    scan_tail (repo);
+}
+
+static gboolean
+lookup_obj (PackRepo *repo, const unsigned char *id, ObjLocation *loc)
+{
+    ObjLocation *recent;
+    guint64 lo = 0, hi = repo->n_entries, mid;
+    IndexEntry *e;
+    int cmp;
+
+    recent = g_hash_table_lookup (repo->recent, id);
+    if (recent) {
+        *loc = *recent;
+        return TRUE;
+    }
+
+    if (g_hash_table_lookup (repo->deleted, id))
+        return FALSE;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        e = &repo->entries[mid];
+        cmp = memcmp (id, e->id, 20);
+        if (cmp == 0) {
+            loc->pack = ntohl (e->pack);
+            loc->offset = ntoh64 (e->offset);
+            loc->len = ntohl (e->len);
+            return TRUE;
+        }
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return FALSE;
+}
+
+/* Rewrite the index to cover everything scanned so far. */
+static int
+write_index (PackRepo *repo)
+{
+    char *path = g_build_filename (repo->dir, "index", NULL);
+    char *tmp_path = g_strconcat (path, ".tmp", NULL);
+    IndexEntry *recent = NULL, *merged = NULL, *e;
+    guint64 n_recent, n_merged = 0, i = 0, j = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+    ObjLocation *loc;
+    IndexHeader hdr;
+    int fd = -1;
+    int ret = 0;
+
+    n_recent = g_hash_table_size (repo->recent);
+    recent = g_new (IndexEntry, MAX (n_recent, 1));
+    g_hash_table_iter_init (&iter, repo->recent);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        loc = value;
+        e = &recent[i++];
+        memcpy (e->id, key, 20);
+        e->pack = htonl (loc->pack);
+        e->offset = hton64 (loc->offset);
+        e->len = htonl (loc->len);
+    }
+    qsort (recent, n_recent, sizeof(IndexEntry), compare_index_entries);
+
+    /* Merge, dropping deleted and superseded entries from the old index. */
+    merged = g_new (IndexEntry, MAX (repo->n_entries + n_recent, 1));
+    i = 0;
+    while (i < repo->n_entries || j < n_recent) {
+        if (j == n_recent ||
+            (i < repo->n_entries &&
+             memcmp (repo->entries[i].id, recent[j].id, 20) < 0)) {
+            e = &repo->entries[i++];
+            if (g_hash_table_lookup (repo->deleted, e->id))
+                continue;
+        } else {
+            if (i < repo->n_entries &&
+                memcmp (repo->entries[i].id, recent[j].id, 20) == 0)
+                ++i;
+            e = &recent[j++];
+        }
+        merged[n_merged++] = *e;
+    }
+
+    memcpy (hdr.magic, INDEX_MAGIC, 8);
+    hdr.version = htonl (INDEX_VERSION);
+    hdr.covered_pack = htonl (repo->tail_pack);
+    hdr.covered_offset = hton64 (repo->tail_offset);
+    hdr.n_entries = hton64 (n_merged);
+
+    fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        seaf_warning ("[pack bend] Failed to create %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (writen (fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        writen (fd, merged, n_merged * sizeof(IndexEntry)) !=
+        n_merged * sizeof(IndexEntry) ||
+        fsync (fd) < 0) {
+        seaf_warning ("[pack bend] Failed to write %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+    close (fd);
+    fd = -1;
+
+    if (rename (tmp_path, path) < 0) {
+        seaf_warning ("[pack bend] Failed to rename %s: %s.\n",
+                      tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    ret = load_index (repo);
+
+out:
+    if (fd >= 0) {
+        close (fd);
+        g_unlink (tmp_path);
+    }
+    g_free (recent);
+    g_free (merged);
+    g_free (path);
+    g_free (tmp_path);
+    return ret;
+}
+
+/* Append a record to the active pack. Called with the exclusive lock. */
+static int
+append_record (PackRepo *repo, const unsigned char *id,
+               const void *data, guint32 len, gboolean need_sync)
+{
+    guint32 rec_len = (len == PACK_TOMBSTONE) ? 0 : len;
+    RecordHeader *rec;
+    struct stat st;
+    char *path;
+    int fd;
+    int ret = 0;
+
+    if (repo->tail_offset > PACK_MAGIC_LEN &&
+        repo->tail_offset + sizeof(RecordHeader) + rec_len > MAX_PACK_SIZE) {
+        repo->tail_pack++;
+        repo->tail_offset = 0;
+    }
+
+    fd = get_pack_fd (repo, repo->tail_pack);
+    if (fd < 0) {
+        path = pack_path (repo, repo->tail_pack);
+        fd = open (path, O_RDWR | O_CREAT, 0644);
+        g_free (path);
+        if (fd < 0) {
+            seaf_warning ("[pack bend] Failed to create pack in %s: %s.\n",
+                          repo->dir, strerror(errno));
+            return -1;
+        }
+        g_hash_table_insert (repo->pack_fds, GUINT_TO_POINTER(repo->tail_pack),
+                             GINT_TO_POINTER(fd + 1));
+    }
+
+    if (repo->tail_offset < PACK_MAGIC_LEN) {
+        if (pwrite (fd, PACK_MAGIC, PACK_MAGIC_LEN, 0) != PACK_MAGIC_LEN)
+            return -1;
+        repo->tail_offset = PACK_MAGIC_LEN;
+    }
+
+    /* Drop a partial record left by a crashed writer. */
+    if (fstat (fd, &st) == 0 && st.st_size > repo->tail_offset)
+        ftruncate (fd, repo->tail_offset);
+
+    rec = g_malloc (sizeof(RecordHeader) + rec_len);
+    memcpy (rec->id, id, 20);
+    rec->len = htonl (len);
+    if (rec_len > 0)
+        memcpy (rec + 1, data, rec_len);
+
+    if (pwrite (fd, rec, sizeof(RecordHeader) + rec_len, repo->tail_offset) !=
+        sizeof(RecordHeader) + rec_len) {
+        seaf_warning ("[pack bend] Failed to write pack in %s: %s.\n",
+                      repo->dir, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (need_sync && fdatasync (fd) < 0) {
+        seaf_warning ("[pack bend] Failed to sync pack in %s: %s.\n",
+                      repo->dir, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    if (len == PACK_TOMBSTONE)
+        add_deleted (repo, id);
+    else
+        add_recent (repo, id, repo->tail_pack,
+                    repo->tail_offset + sizeof(RecordHeader), len);
+    repo->tail_offset += sizeof(RecordHeader) + rec_len;
+
+out:
+    g_free (rec);
+    return ret;
+}
+
+/* Fold the records after the index coverage, tombstones included, into the
+ * index once there are enough of them, so they aren't replayed on every
+ * open. Called with the exclusive lock.
+ */
+static int
+maybe_write_index (PackRepo *repo)
+{
+    if (g_hash_table_size (repo->recent) +
+        g_hash_table_size (repo->deleted) <= MAX_UNINDEXED_OBJS)
+        return 0;
+
+    return write_index (repo);
+}
+
+static void
+pack_repo_unref (PackRepo *repo)
+{
+    if (!g_atomic_int_dec_and_test (&repo->ref_count))
+        return;
+
+    unmap_index (repo);
+    g_hash_table_foreach (repo->pack_fds, close_pack_fd, NULL);
+    g_hash_table_destroy (repo->pack_fds);
+    g_hash_table_destroy (repo->recent);
+    g_hash_table_destroy (repo->deleted);
+    if (repo->lock_fd >= 0)
+        close (repo->lock_fd);
+    pthread_rwlock_destroy (&repo->lock);
+    g_free (repo->dir);
+    g_free (repo);
+}
+
+static PackRepo *
+pack_repo_open (PackPriv *priv, const char *repo_id, gboolean create)
+{
+    PackRepo *repo;
+    char *dir, *lock_path;
+    int lock_fd;
+
+    dir = g_build_filename (priv->pack_dir, repo_id, NULL);
+    if (create && g_mkdir_with_parents (dir, 0777) < 0) {
+        seaf_warning ("[pack bend] Failed to create %s: %s.\n",
+                      dir, strerror(errno));
+        g_free (dir);
+        return NULL;
+    }
+
+    lock_path = g_build_filename (dir, "lock", NULL);
+    lock_fd = open (lock_path, create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    g_free (lock_path);
+    if (lock_fd < 0) {
+        if (create)
+            seaf_warning ("[pack bend] Failed to open lock in %s: %s.\n",
+                          dir, strerror(errno));
+        g_free (dir);
+        return NULL;
+    }
+
+    repo = g_new0 (PackRepo, 1);
+    repo->dir = dir;
+    repo->ref_count = 1;
+    repo->lock_fd = lock_fd;
+    pthread_rwlock_init (&repo->lock, NULL);
+    repo->recent = g_hash_table_new_full (raw_id_hash, raw_id_equal,
+                                          g_free, g_free);
+    repo->deleted = g_hash_table_new_full (raw_id_hash, raw_id_equal,
+                                           g_free, NULL);
+    repo->pack_fds = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    flock (lock_fd, LOCK_SH);
+    load_index (repo);
+    scan_tail (repo);
+    flock (lock_fd, LOCK_UN);
+
+    return repo;
+}
+
+/* Look up an open repo and take a reference. Called with priv->lock. */
+static PackRepo *
+lookup_open_repo (PackPriv *priv, const char *repo_id)
+{
+    PackRepo *repo;
+    GList *link;
+
+    repo = g_hash_table_lookup (priv->repos, repo_id);
+    if (!repo)
+        return NULL;
+
+    link = g_queue_find_custom (priv->lru, repo_id, (GCompareFunc)strcmp);
+    g_queue_unlink (priv->lru, link);
+    g_queue_push_head_link (priv->lru, link);
+    g_atomic_int_inc (&repo->ref_count);
+    return repo;
+}
+
+/* Returns a new reference. Recently used repos are kept open. */
+static PackRepo *
+get_pack_repo (PackPriv *priv, const char *repo_id, gboolean create)
+{
+    PackRepo *repo, *opened, *evicted;
+    char *key;
+
+    pthread_mutex_lock (&priv->lock);
+    repo = lookup_open_repo (priv, repo_id);
+    pthread_mutex_unlock (&priv->lock);
+    if (repo)
+        return repo;
+
+    /* Opening waits for the file lock and loads the index. Don't hold
+     * priv->lock meanwhile, or other repos would wait too.
+     */
+    opened = pack_repo_open (priv, repo_id, create);
+    if (!opened)
+        return NULL;
+
+    pthread_mutex_lock (&priv->lock);
+
+    /* Another thread may have opened it in the meantime. */
+    repo = lookup_open_repo (priv, repo_id);
+    if (repo) {
+        pthread_mutex_unlock (&priv->lock);
+        pack_repo_unref (opened);
+        return repo;
+    }
+    repo = opened;
+
+    if (g_queue_get_length (priv->lru) >= MAX_OPEN_REPOS) {
+        key = g_queue_pop_tail (priv->lru);
+        evicted = g_hash_table_lookup (priv->repos, key);
+        g_hash_table_remove (priv->repos, key);
+        pack_repo_unref (evicted);
+        g_free (key);
+    }
+
+    key = g_strdup (repo_id);
+    g_hash_table_insert (priv->repos, key, repo);
+    g_queue_push_head (priv->lru, g_strdup (repo_id));
+    g_atomic_int_inc (&repo->ref_count);
+
+    pthread_mutex_unlock (&priv->lock);
+
+    return repo;
+}
+
+static int
+read_obj_data (PackRepo *repo, ObjLocation *loc, void **data, int *len)
+{
+    int fd = GPOINTER_TO_INT(g_hash_table_lookup (repo->pack_fds,
+                                                  GUINT_TO_POINTER(loc->pack))) - 1;
+    char *buf;
+
+    if (fd < 0)
+        return -1;
+
+    buf = g_malloc (loc->len);
+    if (pread (fd, buf, loc->len, loc->offset) != loc->len) {
+        g_free (buf);
+        return -1;
+    }
+
+    *data = buf;
+    *len = loc->len;
+    return 0;
+}
+
+static int
+obj_backend_pack_read (ObjBackend *bend,
+                       const char *repo_id,
+                       int version,
+                       const char *obj_id,
+                       void **data,
+                       int *len)
+{
+    PackRepo *repo;
+    unsigned char id[20];
+    ObjLocation loc;
+    int ret = -1;
+
+    repo = get_pack_repo (bend->priv, repo_id, FALSE);
+    if (!repo)
+        return -1;
+
+    hex_to_rawdata (obj_id, id, 20);
+
+    pthread_rwlock_rdlock (&repo->lock);
+    if (lookup_obj (repo, id, &loc))
+        ret = read_obj_data (repo, &loc, data, len);
+    pthread_rwlock_unlock (&repo->lock);
+
+    /* The object may have been written or moved by another process. */
+    if (ret < 0) {
+        pthread_rwlock_wrlock (&repo->lock);
+        flock (repo->lock_fd, LOCK_SH);
+        refresh_repo (repo);
+        if (lookup_obj (repo, id, &loc)) {
+            get_pack_fd (repo, loc.pack);
+            ret = read_obj_data (repo, &loc, data, len);
+        }
+        flock (repo->lock_fd, LOCK_UN);
+        pthread_rwlock_unlock (&repo->lock);
+    }
+
+    pack_repo_unref (repo);
+    return ret;
+}
+
+static int
+obj_backend_pack_write (ObjBackend *bend,
+                        const char *repo_id,
+                        int version,
+                        const char *obj_id,
+                        void *data,
+                        int len,
+                        gboolean need_sync)
+{
+    PackRepo *repo;
+    unsigned char id[20];
+    ObjLocation loc;
+    int ret = 0;
+
+    repo = get_pack_repo (bend->priv, repo_id, TRUE);
+    if (!repo)
+        return -1;
+
+    hex_to_rawdata (obj_id, id, 20);
+
+    pthread_rwlock_wrlock (&repo->lock);
+    flock (repo->lock_fd, LOCK_EX);
+
+    refresh_repo (repo);
+    if (lookup_obj (repo, id, &loc))
+        goto out;
+
+    ret = append_record (repo, id, data, len, need_sync);
+    if (ret == 0)
+        maybe_write_index (repo);
+
+out:
+    flock (repo->lock_fd, LOCK_UN);
+    pthread_rwlock_unlock (&repo->lock);
+    pack_repo_unref (repo);
+    return ret;
+}
+
+static gboolean
+obj_backend_pack_exists (ObjBackend *bend,
+                         const char *repo_id,
+                         int version,
+                         const char *obj_id)
+{
+    PackRepo *repo;
+    unsigned char id[20];
+    ObjLocation loc;
+    gboolean ret;
+
+    repo = get_pack_repo (bend->priv, repo_id, FALSE);
+    if (!repo)
+        return FALSE;
+
+    hex_to_rawdata (obj_id, id, 20);
+
+    pthread_rwlock_rdlock (&repo->lock);
+    ret = lookup_obj (repo, id, &loc);
+    pthread_rwlock_unlock (&repo->lock);
+
+    if (!ret) {
+        pthread_rwlock_wrlock (&repo->lock);
+        flock (repo->lock_fd, LOCK_SH);
+        refresh_repo (repo);
+        ret = lookup_obj (repo, id, &loc);
+        flock (repo->lock_fd, LOCK_UN);
+        pthread_rwlock_unlock (&repo->lock);
+    }
+
+    pack_repo_unref (repo);
+    return ret;
+}
+
+static void
+obj_backend_pack_exists_many (ObjBackend *bend,
+                              const char *repo_id,
+                              int version,
+                              char **obj_ids,
+                              int n_ids,
+                              gboolean *exists)
+{
+    PackRepo *repo;
+    unsigned char id[20];
+    ObjLocation loc;
+    int i;
+
+    memset (exists, 0, sizeof(gboolean) * n_ids);
+
+    repo = get_pack_repo (bend->priv, repo_id, FALSE);
+    if (!repo)
+        return;
+
+    /* All lookups are in memory, refresh once for the whole batch. */
+    pthread_rwlock_wrlock (&repo->lock);
+    flock (repo->lock_fd, LOCK_SH);
+    refresh_repo (repo);
+    flock (repo->lock_fd, LOCK_UN);
+
+    for (i = 0; i < n_ids; ++i) {
+        hex_to_rawdata (obj_ids[i], id, 20);
+        exists[i] = lookup_obj (repo, id, &loc);
+    }
+    pthread_rwlock_unlock (&repo->lock);
+
+    pack_repo_unref (repo);
+}
+
+static void
+obj_backend_pack_delete (ObjBackend *bend,
+                         const char *repo_id,
+                         int version,
+                         const char *obj_id)
+{
+    PackRepo *repo;
+    unsigned char id[20];
+    ObjLocation loc;
+
+    repo = get_pack_repo (bend->priv, repo_id, FALSE);
+    if (!repo)
+        return;
+
+    hex_to_rawdata (obj_id, id, 20);
+
+    pthread_rwlock_wrlock (&repo->lock);
+    flock (repo->lock_fd, LOCK_EX);
+
+    refresh_repo (repo);
+    if (lookup_obj (repo, id, &loc) &&
+        append_record (repo, id, NULL, PACK_TOMBSTONE, FALSE) == 0)
+        maybe_write_index (repo);
+
+    flock (repo->lock_fd, LOCK_UN);
+    pthread_rwlock_unlock (&repo->lock);
+    pack_repo_unref (repo);
+}
+
+static void
+collect_live_ids (PackRepo *repo, GPtrArray *ids)
+{
+    GHashTableIter iter;
+    gpointer key;
+    char hex[41];
+    guint64 i;
+
+    for (i = 0; i < repo->n_entries; ++i) {
+        if (g_hash_table_lookup (repo->recent, repo->entries[i].id) ||
+            g_hash_table_lookup (repo->deleted, repo->entries[i].id))
+            continue;
+        rawdata_to_hex (repo->entries[i].id, hex, 20);
+        g_ptr_array_add (ids, g_strdup (hex));
+    }
+
+    g_hash_table_iter_init (&iter, repo->recent);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        rawdata_to_hex (key, hex, 20);
+        g_ptr_array_add (ids, g_strdup (hex));
+    }
+}
+
+static int
+obj_backend_pack_foreach_obj (ObjBackend *bend,
+                              const char *repo_id,
+                              int version,
+                              SeafObjFunc process,
+                              void *user_data)
+{
+    PackRepo *repo;
+    GPtrArray *ids;
+    guint i;
+
+    repo = get_pack_repo (bend->priv, repo_id, FALSE);
+    if (!repo)
+        return 0;
+
+    ids = g_ptr_array_new_with_free_func (g_free);
+
+    pthread_rwlock_wrlock (&repo->lock);
+    flock (repo->lock_fd, LOCK_SH);
+    refresh_repo (repo);
+    flock (repo->lock_fd, LOCK_UN);
+    collect_live_ids (repo, ids);
+    pthread_rwlock_unlock (&repo->lock);
+
+    pack_repo_unref (repo);
+
+    /* Call back without holding locks, process() may delete objects. */
+    for (i = 0; i < ids->len; ++i) {
+        if (!process (repo_id, version, g_ptr_array_index (ids, i), user_data))
+            break;
+    }
+
+    g_ptr_array_free (ids, TRUE);
+    return 0;
+}
+
+static int
+obj_backend_pack_copy (ObjBackend *bend,
+                       const char *src_repo_id,
+                       int src_version,
+                       const char *dst_repo_id,
+                       int dst_version,
+                       const char *obj_id)
+{
+    void *data = NULL;
+    int len;
+    int ret;
+
+    if (obj_backend_pack_exists (bend, dst_repo_id, dst_version, obj_id))
+        return 0;
+
+    if (obj_backend_pack_read (bend, src_repo_id, src_version,
+                               obj_id, &data, &len) < 0) {
+        seaf_warning ("[pack bend] Failed to read obj %s from repo %s.\n",
+                      obj_id, src_repo_id);
+        return -1;
+    }
+
+    ret = obj_backend_pack_write (bend, dst_repo_id, dst_version,
+                                  obj_id, data, len, FALSE);
+    g_free (data);
+    return ret;
+}
+
+static int
+obj_backend_pack_remove_store (ObjBackend *bend, const char *store_id)
+{
+    PackPriv *priv = bend->priv;
+    PackRepo *repo;
+    GList *link;
+    char *dir;
+    GDir *d;
+    const char *dname;
+    char *path;
+    int ret = 0;
+
+    pthread_mutex_lock (&priv->lock);
+    repo = g_hash_table_lookup (priv->repos, store_id);
+    if (repo) {
+        link = g_queue_find_custom (priv->lru, store_id, (GCompareFunc)strcmp);
+        g_free (link->data);
+        g_queue_delete_link (priv->lru, link);
+        g_hash_table_remove (priv->repos, store_id);
+        pack_repo_unref (repo);
+    }
+    pthread_mutex_unlock (&priv->lock);
+
+    dir = g_build_filename (priv->pack_dir, store_id, NULL);
+    d = g_dir_open (dir, 0, NULL);
+    if (!d) {
+        g_free (dir);
+        return 0;
+    }
+
+    while ((dname = g_dir_read_name (d)) != NULL) {
+        path = g_build_filename (dir, dname, NULL);
+        if (g_unlink (path) < 0) {
+            seaf_warning ("[pack bend] Failed to remove %s: %s.\n",
+                          path, strerror(errno));
+            ret = -1;
+        }
+        g_free (path);
+    }
+    g_dir_close (d);
+
+    if (ret == 0 && g_rmdir (dir) < 0) {
+        seaf_warning ("[pack bend] Failed to remove %s: %s.\n",
+                      dir, strerror(errno));
+        ret = -1;
+    }
+
+    g_free (dir);
+    return ret;
+}
+
+typedef struct PackStat {
+    guint64 live;
+    guint64 size;
+} PackStat;
+
+static void
+account_live (GHashTable *stats, guint32 pack, guint32 len)
+{
+    PackStat *st = g_hash_table_lookup (stats, GUINT_TO_POINTER(pack));
+
+    if (!st) {
+        st = g_new0 (PackStat, 1);
+        g_hash_table_insert (stats, GUINT_TO_POINTER(pack), st);
+    }
+    st->live += sizeof(RecordHeader) + len;
+}
+
+/* Returns the number of objects moved, or -1 on error. */
+static int
+move_live_objects (PackRepo *repo, GHashTable *victims)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    IndexEntry *e;
+    ObjLocation loc, *rloc;
+    GArray *moving;
+    void *data;
+    int len;
+    guint i;
+    int ret = 0;
+
+    /* Collect first, append_record() changes the recent table. */
+    moving = g_array_new (FALSE, FALSE, sizeof(IndexEntry));
+    for (i = 0; i < repo->n_entries; ++i) {
+        e = &repo->entries[i];
+        if (!g_hash_table_lookup (victims, GUINT_TO_POINTER(ntohl (e->pack))) ||
+            g_hash_table_lookup (repo->recent, e->id) ||
+            g_hash_table_lookup (repo->deleted, e->id))
+            continue;
+        g_array_append_val (moving, *e);
+    }
+    g_hash_table_iter_init (&iter, repo->recent);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        IndexEntry re;
+        rloc = value;
+        if (!g_hash_table_lookup (victims, GUINT_TO_POINTER(rloc->pack)))
+            continue;
+        memcpy (re.id, key, 20);
+        re.pack = htonl (rloc->pack);
+        re.offset = hton64 (rloc->offset);
+        re.len = htonl (rloc->len);
+        g_array_append_val (moving, re);
+    }
+
+    for (i = 0; i < moving->len; ++i) {
+        e = &g_array_index (moving, IndexEntry, i);
+        loc.pack = ntohl (e->pack);
+        loc.offset = ntoh64 (e->offset);
+        loc.len = ntohl (e->len);
+        get_pack_fd (repo, loc.pack);
+        if (read_obj_data (repo, &loc, &data, &len) < 0) {
+            seaf_warning ("[pack bend] Failed to read object from pack %u in %s.\n",
+                          loc.pack, repo->dir);
+            ret = -1;
+            break;
+        }
+        ret = append_record (repo, e->id, data, len, FALSE);
+        g_free (data);
+        if (ret < 0)
+            break;
+    }
+
+    if (ret == 0)
+        ret = moving->len;
+
+    g_array_free (moving, TRUE);
+    return ret;
+}
+
+/*
+ * Copy live objects out of packs that are mostly garbage, then drop those
+ * packs. The active pack is never compacted.
+ */
+static int
+obj_backend_pack_compact (ObjBackend *bend, const char *repo_id)
+{
+    PackRepo *repo;
+    GHashTable *stats, *victims;
+    GHashTableIter iter;
+    gpointer key, value;
+    PackStat *st;
+    struct stat fst;
+    guint32 pack;
+    char *path;
+    guint64 i;
+    int fd, moved;
+    int ret = 0;
+
+    repo = get_pack_repo (bend->priv, repo_id, FALSE);
+    if (!repo)
+        return 0;
+
+    stats = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    victims = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    pthread_rwlock_wrlock (&repo->lock);
+    flock (repo->lock_fd, LOCK_EX);
+
+    refresh_repo (repo);
+
+    for (i = 0; i < repo->n_entries; ++i) {
+        IndexEntry *e = &repo->entries[i];
+        if (g_hash_table_lookup (repo->recent, e->id) ||
+            g_hash_table_lookup (repo->deleted, e->id))
+            continue;
+        account_live (stats, ntohl (e->pack), ntohl (e->len));
+    }
+    g_hash_table_iter_init (&iter, repo->recent);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        ObjLocation *loc = value;
+        account_live (stats, loc->pack, loc->len);
+    }
+
+    for (pack = 1; pack < repo->tail_pack; ++pack) {
+        fd = get_pack_fd (repo, pack);
+        if (fd < 0 || fstat (fd, &fst) < 0)
+            continue;
+        st = g_hash_table_lookup (stats, GUINT_TO_POINTER(pack));
+        if (!st || st->live < fst.st_size * COMPACT_LIVE_RATIO)
+            g_hash_table_insert (victims, GUINT_TO_POINTER(pack), GINT_TO_POINTER(1));
+    }
+
+    if (g_hash_table_size (victims) == 0)
+        goto out;
+
+    moved = move_live_objects (repo, victims);
+    if (moved < 0 ||
+        (moved > 0 && fdatasync (get_pack_fd (repo, repo->tail_pack)) < 0) ||
+        write_index (repo) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    g_hash_table_iter_init (&iter, victims);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        pack = GPOINTER_TO_UINT(key);
+        value = g_hash_table_lookup (repo->pack_fds, key);
+        if (value) {
+            close (GPOINTER_TO_INT(value) - 1);
+            g_hash_table_remove (repo->pack_fds, key);
+        }
+        path = pack_path (repo, pack);
+        g_unlink (path);
+        g_free (path);
+    }
+
+    seaf_message ("[pack bend] Compacted %u packs in %s.\n",
+                  g_hash_table_size (victims), repo->dir);
+
+out:
+    flock (repo->lock_fd, LOCK_UN);
+    pthread_rwlock_unlock (&repo->lock);
+    pack_repo_unref (repo);
+    g_hash_table_destroy (stats);
+    g_hash_table_destroy (victims);
+    return ret;
+}
+
+ObjBackend *
+obj_backend_pack_new (const char *seaf_dir, const char *obj_type)
+{
+    ObjBackend *bend;
+    PackPriv *priv;
+    char *dir_name;
+
+    bend = g_new0 (ObjBackend, 1);
+    priv = g_new0 (PackPriv, 1);
+    bend->priv = priv;
+
+    dir_name = g_strconcat (obj_type, "-packs", NULL);
+    priv->pack_dir = g_build_filename (seaf_dir, "storage", dir_name, NULL);
+    g_free (dir_name);
+
+    if (g_mkdir_with_parents (priv->pack_dir, 0777) < 0) {
+        seaf_warning ("[Obj Backend] Objects dir %s does not exist and"
+                      " is unable to create\n", priv->pack_dir);
+        goto onerror;
+    }
+
+    pthread_mutex_init (&priv->lock, NULL);
+    priv->repos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->lru = g_queue_new ();
+
+    bend->read = obj_backend_pack_read;
+    bend->write = obj_backend_pack_write;
+    bend->exists = obj_backend_pack_exists;
+    bend->exists_many = obj_backend_pack_exists_many;
+    bend->delete = obj_backend_pack_delete;
+    bend->foreach_obj = obj_backend_pack_foreach_obj;
+    bend->copy = obj_backend_pack_copy;
+    bend->remove_store = obj_backend_pack_remove_store;
+    bend->compact = obj_backend_pack_compact;
+
+    return bend;
+
+onerror:
+    g_free (priv->pack_dir);
+    g_free (priv);
+    g_free (bend);
+
+    return NULL;
+}
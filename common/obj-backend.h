@@ -27,6 +27,14 @@ struct ObjBackend {
                            int version,
                            const char *obj_id);
 
+    /* Optional. Sets @exists[i] for each of @obj_ids[i]. */
+    void        (*exists_many) (ObjBackend *bend,
+                                const char *repo_id,
+                                int version,
+                                char **obj_ids,
+                                int n_ids,
+                                gboolean *exists);
+
     void        (*delete) (ObjBackend *bend,
                            const char *repo_id,
                            int version,
@@ -48,6 +56,10 @@ struct ObjBackend {
     int        (*remove_store) (ObjBackend *bend,
                                 const char *store_id);
 
+    /* Optional. Reclaim space left by deleted objects of a repo. */
+    int        (*compact) (ObjBackend *bend,
+                           const char *repo_id);
+
     void *priv;
 };
 
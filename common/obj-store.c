@@ -11,12 +11,63 @@
 
 struct SeafObjStore {
     ObjBackend   *bend;
+    /* Objects written before the pack backend was enabled stay in their
+     * own files. They're still read and deleted through this backend,
+     * while new objects only go to the packs. NULL for the fs backend.
+     */
+    ObjBackend   *loose;
 };
 typedef struct SeafObjStore SeafObjStore;
 
 extern ObjBackend *
 obj_backend_fs_new (const char *seaf_dir, const char *obj_type);
 
+extern ObjBackend *
+obj_backend_pack_new (const char *seaf_dir, const char *obj_type);
+
+/*
+ * Backends for commit and fs objects can be chosen in seafile.conf:
+ *
+ * [commit_object_backend]
+ * name = pack
+ *
+ * [fs_object_backend]
+ * name = pack
+ *
+ * The default is one file per object. With packs, existing object files
+ * are read through @loose, so the backend can be switched on an existing
+ * installation.
+ */
+static ObjBackend *
+load_obj_backend (SeafileSession *seaf, const char *obj_type, ObjBackend **loose)
+{
+    char *group, *name;
+    ObjBackend *bend;
+
+    if (strcmp (obj_type, "commits") == 0)
+        group = "commit_object_backend";
+    else if (strcmp (obj_type, "fs") == 0)
+        group = "fs_object_backend";
+    else
+        return obj_backend_fs_new (seaf->seaf_dir, obj_type);
+
+    name = g_key_file_get_string (seaf->config, group, "name", NULL);
+    if (!name || strcmp (name, "fs") == 0) {
+        bend = obj_backend_fs_new (seaf->seaf_dir, obj_type);
+    } else if (strcmp (name, "pack") == 0) {
+        bend = obj_backend_pack_new (seaf->seaf_dir, obj_type);
+        if (bend)
+            *loose = obj_backend_fs_new (seaf->seaf_dir, obj_type);
+    } else {
+        seaf_warning ("[Object store] Unknown backend %s for %s objects.\n",
+                      name, obj_type);
+        bend = NULL;
+    }
+
+    g_free (name);
+    return bend;
+}
+
 struct SeafObjStore *
 seaf_obj_store_new (SeafileSession *seaf, const char *obj_type)
 {
@@ -25,7 +76,7 @@ seaf_obj_store_new (SeafileSession *seaf, const char *obj_type)
     if (!store)
         return NULL;
 
-    store->bend = obj_backend_fs_new (seaf->seaf_dir, obj_type);
+    store->bend = load_obj_backend (seaf, obj_type, &store->loose);
     if (!store->bend) {
         seaf_warning ("[Object store] Failed to load backend.\n");
         g_free (store);
@@ -55,7 +106,13 @@ seaf_obj_store_read_obj (struct SeafObjStore *obj_store,
         !obj_id || !is_object_id_valid(obj_id))
         return -1;
 
-    return bend->read (bend, repo_id, version, obj_id, data, len);
+    if (bend->read (bend, repo_id, version, obj_id, data, len) == 0)
+        return 0;
+
+    if (obj_store->loose)
+        return obj_store->loose->read (obj_store->loose, repo_id, version,
+                                       obj_id, data, len);
+    return -1;
 }
 
 int
@@ -88,7 +145,65 @@ seaf_obj_store_obj_exists (struct SeafObjStore *obj_store,
         !obj_id || !is_object_id_valid(obj_id))
         return FALSE;
 
-    return bend->exists (bend, repo_id, version, obj_id);
+    if (bend->exists (bend, repo_id, version, obj_id))
+        return TRUE;
+
+    return obj_store->loose &&
+        obj_store->loose->exists (obj_store->loose, repo_id, version, obj_id);
+}
+
+void
+seaf_obj_store_objs_exist (struct SeafObjStore *obj_store,
+                           const char *repo_id,
+                           int version,
+                           char **obj_ids,
+                           int n_ids,
+                           gboolean *exists)
+{
+    ObjBackend *bend = obj_store->bend;
+    char **valid_ids;
+    gboolean *valid_exists;
+    int *index;
+    int i, n_valid = 0;
+
+    memset (exists, 0, sizeof(gboolean) * n_ids);
+
+    if (!repo_id || !is_uuid_valid(repo_id) || n_ids <= 0)
+        return;
+
+    if (!bend->exists_many) {
+        for (i = 0; i < n_ids; ++i) {
+            if (obj_ids[i] && is_object_id_valid(obj_ids[i]))
+                exists[i] = bend->exists (bend, repo_id, version, obj_ids[i]);
+        }
+        return;
+    }
+
+    valid_ids = g_new (char *, n_ids);
+    valid_exists = g_new0 (gboolean, n_ids);
+    index = g_new (int, n_ids);
+    for (i = 0; i < n_ids; ++i) {
+        if (!obj_ids[i] || !is_object_id_valid(obj_ids[i]))
+            continue;
+        valid_ids[n_valid] = obj_ids[i];
+        index[n_valid] = i;
+        ++n_valid;
+    }
+
+    if (n_valid > 0)
+        bend->exists_many (bend, repo_id, version,
+                           valid_ids, n_valid, valid_exists);
+    for (i = 0; i < n_valid; ++i) {
+        exists[index[i]] = valid_exists[i];
+        if (!valid_exists[i] && obj_store->loose)
+            exists[index[i]] = obj_store->loose->exists (obj_store->loose,
+                                                         repo_id, version,
+                                                         valid_ids[i]);
+    }
+
+    g_free (valid_ids);
+    g_free (valid_exists);
+    g_free (index);
 }
 
 void
@@ -103,7 +218,43 @@ seaf_obj_store_delete_obj (struct SeafObjStore *obj_store,
         !obj_id || !is_object_id_valid(obj_id))
         return;
 
-    return bend->delete (bend, repo_id, version, obj_id);
+    bend->delete (bend, repo_id, version, obj_id);
+    if (obj_store->loose)
+        obj_store->loose->delete (obj_store->loose, repo_id, version, obj_id);
+}
+
+typedef struct ForeachData {
+    SeafObjStore *store;
+    SeafObjFunc process;
+    void *user_data;
+    gboolean stopped;
+} ForeachData;
+
+static gboolean
+foreach_obj_cb (const char *repo_id, int version,
+                const char *obj_id, void *user_data)
+{
+    ForeachData *data = user_data;
+
+    if (!data->process (repo_id, version, obj_id, data->user_data)) {
+        data->stopped = TRUE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+foreach_loose_obj_cb (const char *repo_id, int version,
+                      const char *obj_id, void *user_data)
+{
+    ForeachData *data = user_data;
+    ObjBackend *bend = data->store->bend;
+
+    /* Already visited in the packs. */
+    if (bend->exists (bend, repo_id, version, obj_id))
+        return TRUE;
+
+    return data->process (repo_id, version, obj_id, data->user_data);
 }
 
 int
@@ -114,8 +265,23 @@ seaf_obj_store_foreach_obj (struct SeafObjStore *obj_store,
                             void *user_data)
 {
     ObjBackend *bend = obj_store->bend;
+    ForeachData data;
+    int ret;
+
+    if (!obj_store->loose)
+        return bend->foreach_obj (bend, repo_id, version, process, user_data);
+
+    data.store = obj_store;
+    data.process = process;
+    data.user_data = user_data;
+    data.stopped = FALSE;
+
+    ret = bend->foreach_obj (bend, repo_id, version, foreach_obj_cb, &data);
+    if (ret < 0 || data.stopped)
+        return ret;
 
-    return bend->foreach_obj (bend, repo_id, version, process, user_data);
+    return obj_store->loose->foreach_obj (obj_store->loose, repo_id, version,
+                                          foreach_loose_obj_cb, &data);
 }
 
 int
@@ -127,11 +293,29 @@ seaf_obj_store_copy_obj (struct SeafObjStore *obj_store,
                          const char *obj_id)
 {
     ObjBackend *bend = obj_store->bend;
+    ObjBackend *loose = obj_store->loose;
+    void *data = NULL;
+    int len, ret;
 
     if (strcmp (obj_id, EMPTY_SHA1) == 0)
         return 0;
 
-    return bend->copy (bend, src_repo_id, src_version, dst_repo_id, dst_version, obj_id);
+    if (!loose ||
+        bend->exists (bend, src_repo_id, src_version, obj_id) ||
+        !loose->exists (loose, src_repo_id, src_version, obj_id))
+        return bend->copy (bend, src_repo_id, src_version, dst_repo_id, dst_version, obj_id);
+
+    /* Copy an object that isn't packed yet into the packs of @dst_repo_id. */
+    if (bend->exists (bend, dst_repo_id, dst_version, obj_id))
+        return 0;
+    if (loose->read (loose, src_repo_id, src_version, obj_id, &data, &len) < 0) {
+        seaf_warning ("[Object store] Failed to read obj %s from repo %s.\n",
+                      obj_id, src_repo_id);
+        return -1;
+    }
+    ret = bend->write (bend, dst_repo_id, dst_version, obj_id, data, len, FALSE);
+    g_free (data);
+    return ret;
 }
 
 int
@@ -140,5 +324,21 @@ seaf_obj_store_remove_store (struct SeafObjStore *obj_store,
 {
     ObjBackend *bend = obj_store->bend;
 
+    if (obj_store->loose &&
+        obj_store->loose->remove_store (obj_store->loose, store_id) < 0)
+        return -1;
+
     return bend->remove_store (bend, store_id);
 }
+
+int
+seaf_obj_store_compact (struct SeafObjStore *obj_store,
+                        const char *store_id)
+{
+    ObjBackend *bend = obj_store->bend;
+
+    if (!bend->compact)
+        return 0;
+
+    return bend->compact (bend, store_id);
+}
@@ -38,6 +38,15 @@ seaf_obj_store_obj_exists (struct SeafObjStore *obj_store,
                            int version,
                            const char *obj_id);
 
+/* Sets @exists[i] for each of @obj_ids[i]. Invalid ids don't exist. */
+void
+seaf_obj_store_objs_exist (struct SeafObjStore *obj_store,
+                           const char *repo_id,
+                           int version,
+                           char **obj_ids,
+                           int n_ids,
+                           gboolean *exists);
+
 void
 seaf_obj_store_delete_obj (struct SeafObjStore *obj_store,
                            const char *repo_id,
@@ -68,4 +77,8 @@ int
 seaf_obj_store_remove_store (struct SeafObjStore *obj_store,
                              const char *store_id);
 
+int
+seaf_obj_store_compact (struct SeafObjStore *obj_store,
+                        const char *store_id);
+
 #endif
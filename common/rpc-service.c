@@ -4065,6 +4065,46 @@ seafile_check_permission_by_path (const char *repo_id, const char *path,
     return seafile_check_permission (repo_id, user, error);
 }
 
+json_t *
+seafile_check_permissions (const char *repo_ids, const char *user, GError **error)
+{
+    char **tokens, **ptr;
+    GList *ids = NULL;
+    GHashTable *perms;
+    GHashTableIter iter;
+    gpointer key, value;
+    json_t *ret = NULL;
+
+    if (!repo_ids || !user) {
+        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_BAD_ARGS, "Arguments should not be empty");
+        return NULL;
+    }
+
+    tokens = g_strsplit (repo_ids, ",", -1);
+    for (ptr = tokens; *ptr; ptr++) {
+        if (!is_uuid_valid (*ptr)) {
+            g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_BAD_ARGS, "Invalid repo id");
+            goto out;
+        }
+        ids = g_list_prepend (ids, *ptr);
+    }
+
+    perms = seaf_repo_manager_check_permissions (seaf->repo_mgr, ids, user, error);
+    if (!perms)
+        goto out;
+
+    ret = json_object ();
+    g_hash_table_iter_init (&iter, perms);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        json_object_set_new (ret, (char *)key, json_string ((char *)value));
+    g_hash_table_destroy (perms);
+
+out:
+    g_list_free (ids);
+    g_strfreev (tokens);
+    return ret;
+}
+
 GList *
 seafile_list_dir_with_perm (const char *repo_id,
                             const char *path,
@@ -4800,6 +4840,19 @@ seafile_get_repo_status(const char *repo_id, GError **error)
     return (status == -1) ? 0 : status;
 }
 
+int
+seafile_schedule_file_history_update (const char *repo_id, GError **error)
+{
+    if (!is_uuid_valid (repo_id)) {
+        g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_BAD_ARGS, "Invalid repo id");
+        return -1;
+    }
+
+    seaf_file_history_manager_schedule_update (seaf->file_history_mgr, repo_id);
+
+    return 0;
+}
+
 GList *
 seafile_search_files (const char *repo_id, const char *str, GError **error)
 {
@@ -12,11 +12,22 @@
 #endif
 #include <sqlite3.h>
 #include <pthread.h>
+#include <time.h>
 
+/* Idle connections are kept in a free list. Checking one out doesn't ping
+ * the server, the keepalive thread checks idle connections instead, and
+ * connections that fail a query are closed when they're released.
+ */
 struct DBConnPool {
-    GPtrArray *connections;
     pthread_mutex_t lock;
+    pthread_cond_t idle_cond;
     int max_connections;
+    /* Idle connections, the most recently released at the head. */
+    GQueue *idle;
+    /* Connections open or being opened, idle or in use. */
+    int n_conns;
+    int n_in_use;
+    SeafDBPoolStats stats;
 };
 typedef struct DBConnPool DBConnPool;
 
@@ -26,8 +37,6 @@ struct SeafDB {
 };
 
 typedef struct DBConnection {
-    gboolean is_available;
-    gboolean delete_pending;
     DBConnPool *pool;
 } DBConnection;
 
@@ -91,70 +100,81 @@ static int
 mysql_db_row_get_column_int (SeafDBRow *row, int idx);
 static gint64
 mysql_db_row_get_column_int64 (SeafDBRow *row, int idx);
-static gboolean
-mysql_db_connection_ping (DBConnection *vconn);
 
 static DBConnPool *
 init_conn_pool_common (int max_connections)
 {
     DBConnPool *pool = g_new0(DBConnPool, 1);
-    pool->connections = g_ptr_array_sized_new (max_connections);
     pthread_mutex_init (&pool->lock, NULL);
+    pthread_cond_init (&pool->idle_cond, NULL);
     pool->max_connections = max_connections;
+    pool->idle = g_queue_new ();
 
     return pool;
 }
 
+/* How long to wait for a connection when all of them are in use. */
+#define POOL_WAIT_TIMEOUT 10 /* seconds */
+
 static DBConnection *
 mysql_conn_pool_get_connection (SeafDB *db)
 {
     DBConnPool *pool = db->pool;
     DBConnection *conn = NULL;
-    DBConnection *d_conn = NULL;
+    struct timespec deadline;
+    gint64 wait_start = 0;
+    int rc = 0;
 
     if (pool->max_connections == 0) {
         conn = mysql_db_get_connection (db);
-        conn->pool = pool;
+        if (conn)
+            conn->pool = pool;
         return conn;
     }
 
     pthread_mutex_lock (&pool->lock);
 
-    guint i, size = pool->connections->len;
-    for (i = 0; i < size; ++i) {
-        conn = g_ptr_array_index (pool->connections, i);
-        if (!conn->is_available) {
-            continue;
+    while (g_queue_is_empty (pool->idle) &&
+           pool->n_conns >= pool->max_connections) {
+        if (rc == ETIMEDOUT) {
+            ++(pool->stats.wait_timeouts);
+            pool->stats.wait_usec += g_get_monotonic_time () - wait_start;
+            pthread_mutex_unlock (&pool->lock);
+            seaf_warning ("No database connection available after %d seconds.\n",
+                          POOL_WAIT_TIMEOUT);
+            return NULL;
         }
-        if (mysql_db_connection_ping (conn)) {
-            conn->is_available = FALSE;
-            goto out;
+        if (wait_start == 0) {
+            ++(pool->stats.waits);
+            wait_start = g_get_monotonic_time ();
+            clock_gettime (CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += POOL_WAIT_TIMEOUT;
         }
-        conn->is_available = FALSE;
-        conn->delete_pending = TRUE;
+        rc = pthread_cond_timedwait (&pool->idle_cond, &pool->lock, &deadline);
     }
-    conn = NULL;
-    if (size < pool->max_connections) {
+    if (wait_start != 0)
+        pool->stats.wait_usec += g_get_monotonic_time () - wait_start;
+
+    conn = g_queue_pop_head (pool->idle);
+    if (!conn) {
+        /* Reserve the slot, then connect without holding the lock. */
+        ++(pool->n_conns);
+        pthread_mutex_unlock (&pool->lock);
+
         conn = mysql_db_get_connection (db);
-        if (conn) {
-            conn->pool = pool;
-            conn->is_available = FALSE;
-            g_ptr_array_add (pool->connections, conn);
-        }
-    }
 
-out:
-    size = pool->connections->len;
-    if (size > 0) {
-        int index;
-        for (index = size - 1; index >= 0; index--) {
-            d_conn = g_ptr_array_index (pool->connections, index);
-            if (d_conn->delete_pending) {
-                g_ptr_array_remove (pool->connections, d_conn);
-                mysql_db_release_connection (d_conn);
-            }
+        pthread_mutex_lock (&pool->lock);
+        if (!conn) {
+            --(pool->n_conns);
+            pthread_cond_signal (&pool->idle_cond);
+            pthread_mutex_unlock (&pool->lock);
+            return NULL;
         }
+        conn->pool = pool;
     }
+    ++(pool->n_in_use);
+    ++(pool->stats.checkouts);
+
     pthread_mutex_unlock (&pool->lock);
     return conn;
 }
@@ -162,66 +182,70 @@ out:
 static void
 mysql_conn_pool_release_connection (DBConnection *conn, gboolean need_close)
 {
+    DBConnPool *pool;
+
     if (!conn)
         return;
 
-    if (conn->pool->max_connections == 0) {
+    pool = conn->pool;
+
+    if (pool->max_connections == 0) {
         mysql_db_release_connection (conn);
         return;
     }
 
     if (need_close) {
-        pthread_mutex_lock (&conn->pool->lock);
-        g_ptr_array_remove (conn->pool->connections, conn);
-        pthread_mutex_unlock (&conn->pool->lock);
         mysql_db_release_connection (conn);
-        return;
+        pthread_mutex_lock (&pool->lock);
+        --(pool->n_conns);
+    } else {
+        pthread_mutex_lock (&pool->lock);
+        g_queue_push_head (pool->idle, conn);
     }
-
-    pthread_mutex_lock (&conn->pool->lock);
-    conn->is_available = TRUE;
-    pthread_mutex_unlock (&conn->pool->lock);
+    --(pool->n_in_use);
+    pthread_cond_signal (&pool->idle_cond);
+    pthread_mutex_unlock (&pool->lock);
 }
 
 #define KEEPALIVE_INTERVAL 30
+/* Checks the idle connections one by one, taking each out of the pool only
+ * while it's being checked, and closes the broken ones.
+ */
 static void *
 mysql_conn_keepalive (void *arg)
 {
     DBConnPool *pool = arg;
     DBConnection *conn = NULL;
-    DBConnection *d_conn = NULL;
     char *sql = "SELECT 1;";
     int rc = 0;
     va_list args;
 
     while (1) {
         pthread_mutex_lock (&pool->lock);
+        guint i, size = g_queue_get_length (pool->idle);
+        pthread_mutex_unlock (&pool->lock);
 
-        guint i, size = pool->connections->len;
         for (i = 0; i < size; ++i) {
-            conn = g_ptr_array_index (pool->connections, i);
-            if (conn->is_available) {
-                rc = db_ops.execute_sql (conn, sql, 0, args, NULL);
-                if (rc < 0) {
-                    conn->is_available = FALSE;
-                    conn->delete_pending = TRUE;
-                }
-            }
-        }
+            pthread_mutex_lock (&pool->lock);
+            conn = g_queue_pop_tail (pool->idle);
+            pthread_mutex_unlock (&pool->lock);
+            if (!conn)
+                break;
 
-        if (size > 0) {
-            int index;
-            for (index = size - 1; index >= 0; index--) {
-                d_conn = g_ptr_array_index (pool->connections, index);
-                if (d_conn->delete_pending) {
-                    g_ptr_array_remove (pool->connections, d_conn);
-                    mysql_db_release_connection (d_conn);
-                }
+            rc = db_ops.execute_sql (conn, sql, 0, args, NULL);
+
+            if (rc < 0) {
+                mysql_db_release_connection (conn);
+                pthread_mutex_lock (&pool->lock);
+                --(pool->n_conns);
+            } else {
+                pthread_mutex_lock (&pool->lock);
+                g_queue_push_head (pool->idle, conn);
             }
+            pthread_cond_signal (&pool->idle_cond);
+            pthread_mutex_unlock (&pool->lock);
         }
 
-        pthread_mutex_unlock (&pool->lock);
-
         sleep (KEEPALIVE_INTERVAL);
     }
 
@@ -758,21 +782,43 @@ typedef struct MySQLDB {
     gboolean skip_verify;
     char *ca_path;
     char *charset;
+    int stmt_cache_size;
 } MySQLDB;
 
+/* Prepared statements are kept open on their connection and reused by later
+ * queries with the same SQL text, saving a prepare round trip per query.
+ */
+
+typedef struct MySQLCachedStmt {
+    char *sql;
+    MYSQL_STMT *stmt;
+    gboolean in_use;
+    /* Link in the connection's LRU list, NULL if the statement isn't cached. */
+    GList *lru_link;
+    /* Result buffers, reused by every execution of the statement. */
+    int column_count;
+    MYSQL_BIND *results;
+    MYSQL_BIND *new_binds;
+} MySQLCachedStmt;
+
 typedef struct MySQLDBConnection {
     struct DBConnection parent;
     MYSQL *db_conn;
+    /* Statements only live as long as the server session they were
+     * prepared in. A changed thread id means the session was replaced.
+     */
+    unsigned long thread_id;
+    /* For the statement cache size, which can change while connections
+     * are open.
+     */
+    MySQLDB *db;
+    /* SQL text -> MySQLCachedStmt, most recently used at the head of
+     * stmt_lru.
+     */
+    GHashTable *stmt_cache;
+    GQueue *stmt_lru;
 } MySQLDBConnection;
 
-static gboolean
-mysql_db_connection_ping (DBConnection *vconn)
-{
-    MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
-
-    return (mysql_ping (conn->db_conn) == 0);
-}
-
 static SeafDB *
 mysql_db_new (const char *host,
               int port,
@@ -797,6 +843,7 @@ mysql_db_new (const char *host,
     db->skip_verify = skip_verify;
     db->ca_path = g_strdup(ca_path);
     db->charset = g_strdup(charset);
+    db->stmt_cache_size = DEFAULT_STMT_CACHE_SIZE;
 
     mysql_library_init (0, NULL, NULL);
 
@@ -871,10 +918,17 @@ mysql_db_get_connection (SeafDB *vdb)
 
     conn = g_new0 (MySQLDBConnection, 1);
     conn->db_conn = db_conn;
+    conn->thread_id = mysql_thread_id (db_conn);
+    conn->db = db;
+    conn->stmt_cache = g_hash_table_new (g_str_hash, g_str_equal);
+    conn->stmt_lru = g_queue_new ();
 
     return (DBConnection *)conn;
 }
 
+static void
+stmt_cache_clear (MySQLDBConnection *conn);
+
 static void
 mysql_db_release_connection (DBConnection *vconn)
 {
@@ -883,6 +937,10 @@ mysql_db_release_connection (DBConnection *vconn)
 
     MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
 
+    stmt_cache_clear (conn);
+    g_hash_table_destroy (conn->stmt_cache);
+    g_queue_free (conn->stmt_lru);
+
     mysql_close (conn->db_conn);
 
     g_free (conn);
@@ -933,6 +991,140 @@ _prepare_stmt_mysql (MYSQL *db, const char *sql, gboolean *retry)
     return stmt;
 }
 
+static void
+free_result_binds (MYSQL_BIND *binds, int n)
+{
+    int i;
+
+    if (!binds)
+        return;
+
+    for (i = 0; i < n; ++i) {
+        g_free (binds[i].buffer);
+        g_free (binds[i].length);
+        g_free (binds[i].is_null);
+    }
+    g_free (binds);
+}
+
+static void
+cached_stmt_free (MySQLCachedStmt *cstmt)
+{
+    mysql_stmt_close (cstmt->stmt);
+    free_result_binds (cstmt->results, cstmt->column_count);
+    free_result_binds (cstmt->new_binds, cstmt->column_count);
+    g_free (cstmt->sql);
+    g_free (cstmt);
+}
+
+static void
+stmt_cache_remove (MySQLDBConnection *conn, MySQLCachedStmt *cstmt)
+{
+    g_hash_table_remove (conn->stmt_cache, cstmt->sql);
+    g_queue_delete_link (conn->stmt_lru, cstmt->lru_link);
+    cstmt->lru_link = NULL;
+}
+
+/* Statements still in use are freed when they're put back. */
+static void
+stmt_cache_clear (MySQLDBConnection *conn)
+{
+    MySQLCachedStmt *cstmt;
+
+    while ((cstmt = g_queue_pop_head (conn->stmt_lru)) != NULL) {
+        cstmt->lru_link = NULL;
+        if (!cstmt->in_use)
+            cached_stmt_free (cstmt);
+    }
+    g_hash_table_remove_all (conn->stmt_cache);
+}
+
+static void
+stmt_cache_evict (MySQLDBConnection *conn)
+{
+    GList *ptr, *prev;
+    MySQLCachedStmt *cstmt;
+
+    for (ptr = conn->stmt_lru->tail;
+         ptr && conn->stmt_lru->length >= conn->db->stmt_cache_size;
+         ptr = prev) {
+        prev = ptr->prev;
+        cstmt = ptr->data;
+        if (cstmt->in_use)
+            continue;
+        stmt_cache_remove (conn, cstmt);
+        cached_stmt_free (cstmt);
+    }
+}
+
+/* Returns a prepared statement for @sql, from the connection's cache if
+ * possible. It must be given back with put_stmt_mysql().
+ */
+static MySQLCachedStmt *
+get_stmt_mysql (MySQLDBConnection *conn, const char *sql, gboolean *retry)
+{
+    MySQLCachedStmt *cstmt;
+    MYSQL_STMT *stmt;
+    int cache_size = conn->db->stmt_cache_size;
+    gboolean can_cache;
+
+    if (mysql_thread_id (conn->db_conn) != conn->thread_id ||
+        (cache_size == 0 && !g_queue_is_empty (conn->stmt_lru))) {
+        stmt_cache_clear (conn);
+        conn->thread_id = mysql_thread_id (conn->db_conn);
+    }
+
+    cstmt = g_hash_table_lookup (conn->stmt_cache, sql);
+    if (cstmt && !cstmt->in_use) {
+        g_queue_unlink (conn->stmt_lru, cstmt->lru_link);
+        g_queue_push_head_link (conn->stmt_lru, cstmt->lru_link);
+        cstmt->in_use = TRUE;
+        return cstmt;
+    }
+
+    /* The same statement may be run again from a row callback while it's
+     * still in use. Such nested statements aren't cached.
+     */
+    can_cache = (!cstmt && cache_size > 0);
+
+    stmt = _prepare_stmt_mysql (conn->db_conn, sql, retry);
+    if (!stmt) {
+        return NULL;
+    }
+
+    cstmt = g_new0 (MySQLCachedStmt, 1);
+    cstmt->sql = g_strdup (sql);
+    cstmt->stmt = stmt;
+    cstmt->in_use = TRUE;
+
+    if (can_cache) {
+        stmt_cache_evict (conn);
+        g_queue_push_head (conn->stmt_lru, cstmt);
+        cstmt->lru_link = conn->stmt_lru->head;
+        g_hash_table_insert (conn->stmt_cache, cstmt->sql, cstmt);
+    }
+
+    return cstmt;
+}
+
+/* A statement that failed is dropped from the cache, since the error may
+ * have left it unusable.
+ */
+static void
+put_stmt_mysql (MySQLDBConnection *conn, MySQLCachedStmt *cstmt, gboolean failed)
+{
+    cstmt->in_use = FALSE;
+
+    if (cstmt->lru_link && !failed) {
+        mysql_stmt_free_result (cstmt->stmt);
+        return;
+    }
+
+    if (cstmt->lru_link)
+        stmt_cache_remove (conn, cstmt);
+    cached_stmt_free (cstmt);
+}
+
 static int
 _bind_params_mysql (MYSQL_STMT *stmt, MYSQL_BIND *params, int n, va_list args)
 {
@@ -988,15 +1180,16 @@ static int
 mysql_db_execute_sql (DBConnection *vconn, const char *sql, int n, va_list args, gboolean *retry)
 {
     MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
-    MYSQL *db = conn->db_conn;
+    MySQLCachedStmt *cstmt = NULL;
     MYSQL_STMT *stmt = NULL;
     MYSQL_BIND *params = NULL;
     int ret = 0;
 
-    stmt = _prepare_stmt_mysql (db, sql, retry);
-    if (!stmt) {
+    cstmt = get_stmt_mysql (conn, sql, retry);
+    if (!cstmt) {
         return -1;
     }
+    stmt = cstmt->stmt;
 
     if (n > 0) {
         params = g_new0 (MYSQL_BIND, n);
@@ -1022,8 +1215,7 @@ out:
                 *retry = TRUE;
         }
     }
-    if (stmt)
-        mysql_stmt_close (stmt);
+    put_stmt_mysql (conn, cstmt, ret < 0);
     if (params) {
         int i;
         for (i = 0; i < n; ++i) {
@@ -1046,13 +1238,55 @@ typedef struct MySQLDBRow {
 
 #define DEFAULT_MYSQL_COLUMN_SIZE 1024
 
+/* Result buffers are allocated once per cached statement, and again only
+ * if the number of columns changes.
+ */
+static void
+alloc_result_binds (MySQLCachedStmt *cstmt, int column_count)
+{
+    int i;
+
+    if (cstmt->results && cstmt->column_count == column_count)
+        return;
+
+    free_result_binds (cstmt->results, cstmt->column_count);
+    free_result_binds (cstmt->new_binds, cstmt->column_count);
+
+    cstmt->column_count = column_count;
+    cstmt->results = g_new0 (MYSQL_BIND, column_count);
+    for (i = 0; i < column_count; ++i) {
+        cstmt->results[i].buffer = g_malloc (DEFAULT_MYSQL_COLUMN_SIZE + 1);
+        /* Ask MySQL to convert fields to string, to avoid the trouble of
+         * checking field types.
+         */
+        cstmt->results[i].buffer_type = MYSQL_TYPE_STRING;
+        cstmt->results[i].buffer_length = DEFAULT_MYSQL_COLUMN_SIZE;
+        cstmt->results[i].length = g_new0 (unsigned long, 1);
+        cstmt->results[i].is_null = g_new0 (my_bool, 1);
+    }
+    cstmt->new_binds = g_new0 (MYSQL_BIND, column_count);
+}
+
+static void
+clear_new_binds (MySQLDBRow *row)
+{
+    int i;
+
+    for (i = 0; i < row->column_count; ++i) {
+        g_free (row->new_binds[i].buffer);
+        g_free (row->new_binds[i].length);
+        g_free (row->new_binds[i].is_null);
+        memset (&row->new_binds[i], 0, sizeof(MYSQL_BIND));
+    }
+}
+
 static int
 mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
                             SeafDBRowFunc callback, void *data,
                             int n, va_list args, gboolean *retry)
 {
     MySQLDBConnection *conn = (MySQLDBConnection *)vconn;
-    MYSQL *db = conn->db_conn;
+    MySQLCachedStmt *cstmt = NULL;
     MYSQL_STMT *stmt = NULL;
     MYSQL_BIND *params = NULL;
     MySQLDBRow row;
@@ -1062,10 +1296,11 @@ mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
 
     memset (&row, 0, sizeof(row));
 
-    stmt = _prepare_stmt_mysql (db, sql, retry);
-    if (!stmt) {
+    cstmt = get_stmt_mysql (conn, sql, retry);
+    if (!cstmt) {
         return -1;
     }
+    stmt = cstmt->stmt;
 
     if (n > 0) {
         params = g_new0 (MYSQL_BIND, n);
@@ -1091,20 +1326,11 @@ mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
         goto out;
     }
 
-    row.column_count = mysql_stmt_field_count (stmt);
+    alloc_result_binds (cstmt, mysql_stmt_field_count (stmt));
+    row.column_count = cstmt->column_count;
     row.stmt = stmt;
-    row.results = g_new0 (MYSQL_BIND, row.column_count);
-    for (i = 0; i < row.column_count; ++i) {
-        row.results[i].buffer = g_malloc (DEFAULT_MYSQL_COLUMN_SIZE + 1);
-        /* Ask MySQL to convert fields to string, to avoid the trouble of
-         * checking field types.
-         */
-        row.results[i].buffer_type = MYSQL_TYPE_STRING;
-        row.results[i].buffer_length = DEFAULT_MYSQL_COLUMN_SIZE;
-        row.results[i].length = g_new0 (unsigned long, 1);
-        row.results[i].is_null = g_new0 (my_bool, 1);
-    }
-    row.new_binds = g_new0 (MYSQL_BIND, row.column_count);
+    row.results = cstmt->results;
+    row.new_binds = cstmt->new_binds;
 
     if (mysql_stmt_bind_result (stmt, row.results) != 0) {
         seaf_warning ("Failed to bind result for sql %s: %s\n", sql, mysql_stmt_error(stmt));
@@ -1137,22 +1363,16 @@ mysql_db_query_foreach_row (DBConnection *vconn, const char *sql,
         if (callback)
             next_row = callback ((SeafDBRow *)&row, data);
 
-        for (i = 0; i < row.column_count; ++i) {
-            g_free (row.new_binds[i].buffer);
-            g_free (row.new_binds[i].length);
-            g_free (row.new_binds[i].is_null);
-            memset (&row.new_binds[i], 0, sizeof(MYSQL_BIND));
-        }
+        clear_new_binds (&row);
 
         if (!next_row)
             break;
     }
 
 out:
-    if (stmt) {
-        mysql_stmt_free_result (stmt);
-        mysql_stmt_close (stmt);
-    }
+    if (row.new_binds)
+        clear_new_binds (&row);
+    put_stmt_mysql (conn, cstmt, nrows < 0);
     if (params) {
         for (i = 0; i < n; ++i) {
             g_free (params[i].buffer);
@@ -1160,22 +1380,6 @@ out:
         }
         g_free (params);
     }
-    if (row.results) {
-        for (i = 0; i < row.column_count; ++i) {
-            g_free (row.results[i].buffer);
-            g_free (row.results[i].length);
-            g_free (row.results[i].is_null);
-        }
-        g_free (row.results);
-    }
-    if (row.new_binds) {
-        for (i = 0; i < row.column_count; ++i) {
-            g_free (row.new_binds[i].buffer);
-            g_free (row.new_binds[i].length);
-            g_free (row.new_binds[i].is_null);
-        }
-        g_free (row.new_binds);
-    }
     return nrows;
 }
 
@@ -1266,6 +1470,31 @@ mysql_db_row_get_column_int64 (SeafDBRow *vrow, int idx)
 
 #endif  /* HAVE_MYSQL */
 
+void
+seaf_db_get_pool_stats (SeafDB *db, SeafDBPoolStats *stats)
+{
+    DBConnPool *pool = db->pool;
+
+    memset (stats, 0, sizeof(SeafDBPoolStats));
+    if (!pool)
+        return;
+
+    pthread_mutex_lock (&pool->lock);
+    *stats = pool->stats;
+    stats->connections = pool->n_conns;
+    stats->in_use = pool->n_in_use;
+    pthread_mutex_unlock (&pool->lock);
+}
+
+void
+seaf_db_set_stmt_cache_size (SeafDB *db, int size)
+{
+#ifdef HAVE_MYSQL
+    if (db->type == SEAF_DB_TYPE_MYSQL)
+        ((MySQLDB *)db)->stmt_cache_size = size;
+#endif
+}
+
 /* SQLite DB */
 
 /* SQLite thread synchronization rountines.
@@ -47,6 +47,28 @@ seaf_db_new_sqlite (const char *db_path, int max_connections);
 int
 seaf_db_type (SeafDB *db);
 
+typedef struct SeafDBPoolStats {
+    int connections;
+    int in_use;
+    /* Counters since the pool was created. */
+    gint64 checkouts;
+    gint64 waits;
+    gint64 wait_usec;
+    gint64 wait_timeouts;
+} SeafDBPoolStats;
+
+/* Connection pool statistics, all zero for databases without a pool. */
+void
+seaf_db_get_pool_stats (SeafDB *db, SeafDBPoolStats *stats);
+
+#define DEFAULT_STMT_CACHE_SIZE 64
+
+/* Number of prepared statements kept open per connection, 0 disables the
+ * cache. Applies to open connections from their next statement. MySQL only.
+ */
+void
+seaf_db_set_stmt_cache_size (SeafDB *db, int size);
+
 int
 seaf_db_query (SeafDB *db, const char *sql);
 
@@ -72,6 +72,7 @@ typedef struct DBOption {
     gboolean skip_verify;
     int port;
     int max_connections;
+    int stmt_cache_size;
 } DBOption;
 
 static void
@@ -179,6 +180,15 @@ load_db_option (SeafileSession *session)
         option->max_connections = DEFAULT_MAX_CONNECTIONS;
     }
 
+    option->stmt_cache_size = g_key_file_get_integer (session->config,
+                                                      "database", "stmt_cache_size",
+                                                      &error);
+    if (error || option->stmt_cache_size < 0) {
+        if (error)
+            g_clear_error (&error);
+        option->stmt_cache_size = DEFAULT_STMT_CACHE_SIZE;
+    }
+
     load_db_option_from_env (option);
 
     if (!option->host) {
@@ -237,6 +247,7 @@ mysql_db_start (SeafileSession *session)
         seaf_warning ("Failed to start mysql db.\n");
         return -1;
     }
+    seaf_db_set_stmt_cache_size (session->db, option->stmt_cache_size);
 
     db_option_free (option);
     return 0;
@@ -368,6 +379,7 @@ ccnet_init_mysql_database (SeafileSession *session)
         seaf_warning ("Failed to open ccnet database.\n");
         return -1;
     }
+    seaf_db_set_stmt_cache_size (session->ccnet_db, option->stmt_cache_size);
 
     db_option_free (option);
     return 0;
@@ -347,6 +347,110 @@ seafile_update_random_key (const char *old_passwd, const char *old_random_key,
     return 0;
 }
 
+static const EVP_CIPHER *
+get_cipher (int version)
+{
+    if (version == 1)
+        return EVP_aes_128_cbc ();
+    else if (version == 3)
+        return EVP_aes_128_ecb ();
+    else
+        return EVP_aes_256_cbc ();
+}
+
+static int
+get_key_len (int version)
+{
+    return (version == 1 || version == 3) ? 16 : 32;
+}
+
+/*
+ * Cipher contexts are cached per thread, so that the key schedule of a
+ * repo is expanded once rather than for every block. Each entry is for
+ * one direction of one key.
+ */
+#define CIPHER_CACHE_SIZE 8
+
+typedef struct CachedCipher {
+    EVP_CIPHER_CTX *ctx;
+    int version;
+    int enc;
+    unsigned char key[32];
+} CachedCipher;
+
+typedef struct CipherCache {
+    CachedCipher ciphers[CIPHER_CACHE_SIZE];
+    int next;
+} CipherCache;
+
+static void
+cipher_cache_free (gpointer p)
+{
+    CipherCache *cache = p;
+    int i;
+
+    for (i = 0; i < CIPHER_CACHE_SIZE; ++i) {
+        if (cache->ciphers[i].ctx)
+            EVP_CIPHER_CTX_free (cache->ciphers[i].ctx);
+    }
+    g_free (cache);
+}
+
+static GPrivate cipher_cache_key = G_PRIVATE_INIT (cipher_cache_free);
+
+/*
+ * Returns a context of the calling thread, ready to encrypt or decrypt
+ * with @crypt. The context may be reused by the next call in the same
+ * thread, so it must not be kept after the operation is finished.
+ */
+static EVP_CIPHER_CTX *
+get_cached_cipher (SeafileCrypt *crypt, int enc)
+{
+    CipherCache *cache;
+    CachedCipher *cipher;
+    int key_len = get_key_len (crypt->version);
+    int i;
+
+    cache = g_private_get (&cipher_cache_key);
+    if (!cache) {
+        cache = g_new0 (CipherCache, 1);
+        g_private_set (&cipher_cache_key, cache);
+    }
+
+    for (i = 0; i < CIPHER_CACHE_SIZE; ++i) {
+        cipher = &cache->ciphers[i];
+        if (cipher->ctx && cipher->version == crypt->version &&
+            cipher->enc == enc && memcmp (cipher->key, crypt->key, key_len) == 0) {
+            /* Only reset the IV and the cipher state, keep the key schedule. */
+            if (EVP_CipherInit_ex (cipher->ctx, NULL, NULL, NULL,
+                                   crypt->iv, enc) != 1) {
+                EVP_CIPHER_CTX_free (cipher->ctx);
+                cipher->ctx = NULL;
+                return NULL;
+            }
+            return cipher->ctx;
+        }
+    }
+
+    cipher = &cache->ciphers[cache->next];
+    cache->next = (cache->next + 1) % CIPHER_CACHE_SIZE;
+
+    if (cipher->ctx)
+        EVP_CIPHER_CTX_free (cipher->ctx);
+    cipher->ctx = EVP_CIPHER_CTX_new ();
+    if (EVP_CipherInit_ex (cipher->ctx, get_cipher (crypt->version), NULL,
+                           crypt->key, crypt->iv, enc) != 1) {
+        EVP_CIPHER_CTX_free (cipher->ctx);
+        cipher->ctx = NULL;
+        return NULL;
+    }
+    cipher->version = crypt->version;
+    cipher->enc = enc;
+    memcpy (cipher->key, crypt->key, key_len);
+
+    return cipher->ctx;
+}
+
 int
 seafile_encrypt (char **data_out,
                  int *out_len,
@@ -368,31 +472,10 @@ seafile_encrypt (char **data_out,
     int blks;
 
     /* Prepare CTX for encryption. */
-    ctx = EVP_CIPHER_CTX_new ();
-
-    if (crypt->version == 1)
-        ret = EVP_EncryptInit_ex (ctx,
-                                  EVP_aes_128_cbc(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  crypt->key,  /* derived key */
-                                  crypt->iv);  /* initial vector */
-    else if (crypt->version == 3)
-        ret = EVP_EncryptInit_ex (ctx,
-                                  EVP_aes_128_ecb(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  crypt->key,  /* derived key */
-                                  crypt->iv);  /* initial vector */
-    else
-        ret = EVP_EncryptInit_ex (ctx,
-                                  EVP_aes_256_cbc(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  crypt->key,  /* derived key */
-                                  crypt->iv);  /* initial vector */
-
-    if (ret == ENC_FAILURE) {
-        EVP_CIPHER_CTX_free (ctx);
+    ctx = get_cached_cipher (crypt, 1);
+    if (!ctx)
         return -1;
-    }
+
     /* Allocating output buffer. */
     
     /*
@@ -434,14 +517,10 @@ seafile_encrypt (char **data_out,
     if (ret == ENC_FAILURE || *out_len != (blks * BLK_SIZE))
         goto enc_error;
     
-    EVP_CIPHER_CTX_free (ctx);
-
     return 0;
 
 enc_error:
 
-    EVP_CIPHER_CTX_free (ctx);
-
     *out_len = -1;
 
     if (*data_out != NULL)
@@ -479,31 +558,10 @@ seafile_decrypt (char **data_out,
     int ret;
 
     /* Prepare CTX for decryption. */
-    ctx = EVP_CIPHER_CTX_new ();
-
-    if (crypt->version == 1)
-        ret = EVP_DecryptInit_ex (ctx,
-                                  EVP_aes_128_cbc(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  crypt->key,  /* derived key */
-                                  crypt->iv);  /* initial vector */
-    else if (crypt->version == 3)
-        ret = EVP_DecryptInit_ex (ctx,
-                                  EVP_aes_128_ecb(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  crypt->key,  /* derived key */
-                                  crypt->iv);  /* initial vector */
-    else
-        ret = EVP_DecryptInit_ex (ctx,
-                                  EVP_aes_256_cbc(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  crypt->key,  /* derived key */
-                                  crypt->iv);  /* initial vector */
-
-    if (ret == DEC_FAILURE) {
-        EVP_CIPHER_CTX_free (ctx);
+    ctx = get_cached_cipher (crypt, 0);
+    if (!ctx)
         return -1;
-    }
+
     /* Allocating output buffer. */
     
     *data_out = (char *)g_malloc (in_len);
@@ -537,14 +595,10 @@ seafile_decrypt (char **data_out,
     if (ret == DEC_FAILURE || *out_len > in_len)
         goto dec_error;
 
-    EVP_CIPHER_CTX_free (ctx);
-    
     return 0;
 
 dec_error:
 
-    EVP_CIPHER_CTX_free (ctx);
-
     *out_len = -1;
     if (*data_out != NULL)
         g_free (*data_out);
@@ -566,27 +620,98 @@ seafile_decrypt_init (EVP_CIPHER_CTX **ctx,
     /* Prepare CTX for decryption. */
     *ctx = EVP_CIPHER_CTX_new ();
 
-    if (version == 1)
-        ret = EVP_DecryptInit_ex (*ctx,
-                                  EVP_aes_128_cbc(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  key,  /* derived key */
-                                  iv);  /* initial vector */
-    else if (version == 3)
-        ret = EVP_DecryptInit_ex (*ctx,
-                                  EVP_aes_128_ecb(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  key,  /* derived key */
-                                  iv);  /* initial vector */
-    else
-        ret = EVP_DecryptInit_ex (*ctx,
-                                  EVP_aes_256_cbc(), /* cipher mode */
-                                  NULL, /* engine, NULL for default */
-                                  key,  /* derived key */
-                                  iv);  /* initial vector */
+    ret = EVP_DecryptInit_ex (*ctx,
+                              get_cipher (version), /* cipher mode */
+                              NULL, /* engine, NULL for default */
+                              key,  /* derived key */
+                              iv);  /* initial vector */
 
     if (ret == DEC_FAILURE)
         return -1;
 
     return 0;
 }
+
+struct SeafileDecryptStream {
+    EVP_CIPHER_CTX *ctx;
+    unsigned char iv[16];
+    /* Output buffer reused by every update. */
+    char *out;
+    int out_size;
+};
+
+SeafileDecryptStream *
+seafile_decrypt_stream_new (SeafileCrypt *crypt)
+{
+    SeafileDecryptStream *stream = g_new0 (SeafileDecryptStream, 1);
+
+    stream->ctx = EVP_CIPHER_CTX_new ();
+    if (EVP_DecryptInit_ex (stream->ctx, get_cipher (crypt->version), NULL,
+                            crypt->key, crypt->iv) == DEC_FAILURE) {
+        seaf_warning ("Failed to init decrypt.\n");
+        EVP_CIPHER_CTX_free (stream->ctx);
+        g_free (stream);
+        return NULL;
+    }
+    memcpy (stream->iv, crypt->iv, 16);
+
+    return stream;
+}
+
+int
+seafile_decrypt_stream_reset (SeafileDecryptStream *stream)
+{
+    if (EVP_DecryptInit_ex (stream->ctx, NULL, NULL, NULL,
+                            stream->iv) == DEC_FAILURE)
+        return -1;
+    return 0;
+}
+
+int
+seafile_decrypt_stream_update (SeafileDecryptStream *stream,
+                               const char *data_in,
+                               int in_len,
+                               char **data_out,
+                               int *out_len)
+{
+    /* The output may include a block held back by the last update. */
+    if (stream->out_size < in_len + BLK_SIZE) {
+        stream->out_size = in_len + BLK_SIZE;
+        stream->out = g_realloc (stream->out, stream->out_size);
+    }
+
+    *data_out = stream->out;
+    if (EVP_DecryptUpdate (stream->ctx,
+                           (unsigned char *)stream->out, out_len,
+                           (unsigned char *)data_in, in_len) == DEC_FAILURE)
+        return -1;
+    return 0;
+}
+
+int
+seafile_decrypt_stream_final (SeafileDecryptStream *stream,
+                              char **data_out,
+                              int *out_len)
+{
+    if (stream->out_size < BLK_SIZE) {
+        stream->out_size = BLK_SIZE;
+        stream->out = g_realloc (stream->out, stream->out_size);
+    }
+
+    *data_out = stream->out;
+    if (EVP_DecryptFinal_ex (stream->ctx,
+                             (unsigned char *)stream->out,
+                             out_len) == DEC_FAILURE)
+        return -1;
+    return 0;
+}
+
+void
+seafile_decrypt_stream_free (SeafileDecryptStream *stream)
+{
+    if (!stream)
+        return;
+    EVP_CIPHER_CTX_free (stream->ctx);
+    g_free (stream->out);
+    g_free (stream);
+}
@@ -134,4 +134,40 @@ seafile_decrypt_init (EVP_CIPHER_CTX **ctx,
                       const unsigned char *key,
                       const unsigned char *iv);
 
+/*
+  Decrypts a sequence of blocks piece by piece. The key schedule is set
+  up once by seafile_decrypt_stream_new(), and seafile_decrypt_stream_reset()
+  starts the next block.
+
+  The output of seafile_decrypt_stream_update() and
+  seafile_decrypt_stream_final() is in a buffer owned by the stream, which
+  is valid until the next call on the stream. The update output is at most
+  @in_len + BLK_SIZE bytes, since the last block is held back until the
+  final call strips the padding.
+
+  A stream must not be shared by threads.
+*/
+typedef struct SeafileDecryptStream SeafileDecryptStream;
+
+SeafileDecryptStream *
+seafile_decrypt_stream_new (SeafileCrypt *crypt);
+
+int
+seafile_decrypt_stream_reset (SeafileDecryptStream *stream);
+
+int
+seafile_decrypt_stream_update (SeafileDecryptStream *stream,
+                               const char *data_in,
+                               int in_len,
+                               char **data_out,
+                               int *out_len);
+
+int
+seafile_decrypt_stream_final (SeafileDecryptStream *stream,
+                              char **data_out,
+                              int *out_len);
+
+void
+seafile_decrypt_stream_free (SeafileDecryptStream *stream);
+
 #endif  /* _SEAFILE_CRYPT_H */
@@ -47,12 +47,12 @@ commit_tree_to_hash (SeafCommit *head)
 
     hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-    res = seaf_commit_manager_traverse_commit_tree (seaf->commit_mgr,
-                                                    head->repo_id,
-                                                    head->version,
-                                                    head->commit_id,
-                                                    add_to_commit_hash,
-                                                    hash, FALSE);
+    res = seaf_commit_manager_traverse_commit_graph (seaf->commit_mgr,
+                                                     head->repo_id,
+                                                     head->version,
+                                                     head->commit_id,
+                                                     add_to_commit_hash,
+                                                     hash, FALSE);
     if (!res)
         goto fail;
 
@@ -172,12 +172,12 @@ merge_bases_many (SeafCommit *one, int n, SeafCommit **twos)
     data.result = NULL;
 
     for (i = 0; i < n; i++) {
-        res = seaf_commit_manager_traverse_commit_tree (seaf->commit_mgr,
-                                                        twos[i]->repo_id,
-                                                        twos[i]->version,
-                                                        twos[i]->commit_id,
-                                                        get_merge_bases,
-                                                        &data, FALSE);
+        res = seaf_commit_manager_traverse_commit_graph (seaf->commit_mgr,
+                                                         twos[i]->repo_id,
+                                                         twos[i]->version,
+                                                         twos[i]->commit_id,
+                                                         get_merge_bases,
+                                                         &data, FALSE);
         if (!res)
             goto fail;
     }
@@ -208,6 +208,8 @@ fail:
  * Returns common ancesstor for two branches.
  * Any two commits should have a common ancestor.
  * So returning NULL indicates an error, for e.g. corupt commit.
+ * The returned commit comes from the commit graph, see
+ * seaf_commit_manager_get_graph_commit().
  */
 SeafCommit *
 get_merge_base (SeafCommit *head, SeafCommit *remote)
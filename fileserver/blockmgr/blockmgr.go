@@ -39,6 +39,11 @@ func Exists(repoID string, blockID string) bool {
 	return ret
 }
 
+// ExistsMany checks whether each of the blocks exists.
+func ExistsMany(repoID string, blockIDs []string) []bool {
+	return store.ExistsMany(repoID, blockIDs)
+}
+
 // Stat calculates block size.
 func Stat(repoID string, blockID string) (int64, error) {
 	ret, err := store.Stat(repoID, blockID)
@@ -0,0 +1,121 @@
+package main
+
+import (
+	"fmt"
+	"io"
+	"math/bits"
+)
+
+// FastCDC content-defined chunking. A gear hash rolls over the data and a
+// block ends where the hash matches a mask. Blocks shorter than the average
+// size are cut with a stricter mask and longer ones with a looser mask, which
+// keeps the block sizes close to the average. Since cut points depend only on
+// the last 64 bytes, an edit only changes the blocks around it.
+//
+// The blocks are ordinary seafile blocks, so the chunking mode doesn't
+// change the object format. Only dedup against earlier uploads depends on
+// the gear table and the block sizes staying the same.
+
+// Must be the same as GEAR_SEED in common/cdc/gear-checksum.c, so that the
+// C and Go servers cut files at the same points.
+const cdcGearSeed = 0x2f5e3c1a9d7b4861
+
+var cdcGear [256]uint64
+
+func init() {
+	// splitmix64 with a fixed seed, so that cut points are stable across
+	// servers and restarts.
+	seed := uint64(cdcGearSeed)
+	for i := range cdcGear {
+		seed += 0x9e3779b97f4a7c15
+		z := seed
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb
+		cdcGear[i] = z ^ (z >> 31)
+	}
+}
+
+type cdcChunker struct {
+	minSize int
+	avgSize int
+	maxSize int
+	// Masks of the high bits, since the low bits of the hash only depend on
+	// the last few bytes.
+	maskS uint64
+	maskL uint64
+}
+
+func newCDCChunker(minSize, avgSize, maxSize int) *cdcChunker {
+	c := &cdcChunker{minSize: minSize, avgSize: avgSize, maxSize: maxSize}
+	avgBits := bits.Len(uint(avgSize)) - 1
+	c.maskS = ^uint64(0) << (64 - (avgBits + 2))
+	c.maskL = ^uint64(0) << (64 - (avgBits - 2))
+	return c
+}
+
+// cut returns the length of the block at the start of data. data must hold
+// at least maxSize bytes unless it's the end of the file.
+func (c *cdcChunker) cut(data []byte) int {
+	n := len(data)
+	if n <= c.minSize {
+		return n
+	}
+	if n > c.maxSize {
+		n = c.maxSize
+	}
+	normal := c.avgSize
+	if normal > n {
+		normal = n
+	}
+
+	var fp uint64
+	i := c.minSize
+	for ; i < normal; i++ {
+		fp = (fp << 1) + cdcGear[data[i]]
+		if fp&c.maskS == 0 {
+			return i + 1
+		}
+	}
+	for ; i < n; i++ {
+		fp = (fp << 1) + cdcGear[data[i]]
+		if fp&c.maskL == 0 {
+			return i + 1
+		}
+	}
+	return n
+}
+
+// split scans the file and calls fn with the offset and length of each
+// block in order, until fn returns false.
+func (c *cdcChunker) split(file io.ReaderAt, size int64, fn func(offset, length int64) bool) error {
+	buf := make([]byte, 2*c.maxSize)
+	var start, end int
+	var offset, readOffset int64
+
+	for offset < size {
+		// Keep at least maxSize bytes ahead unless the file ends earlier.
+		if end-start < c.maxSize && readOffset < size {
+			copy(buf, buf[start:end])
+			end -= start
+			start = 0
+			n, err := file.ReadAt(buf[end:], readOffset)
+			if n == 0 && err != nil {
+				return fmt.Errorf("failed to read file: %v", err)
+			}
+			if err != nil && err != io.EOF {
+				return fmt.Errorf("failed to read file: %v", err)
+			}
+			end += n
+			readOffset += int64(n)
+		}
+
+		length := c.cut(buf[start:end])
+		if !fn(offset, int64(length)) {
+			return nil
+		}
+		start += length
+		offset += int64(length)
+	}
+
+	return nil
+}
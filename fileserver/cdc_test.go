@@ -0,0 +1,189 @@
+package main
+
+import (
+	"bytes"
+	"crypto/sha1"
+	"fmt"
+	"math/rand"
+	"testing"
+
+	"github.com/haiwen/seafile-server/fileserver/option"
+)
+
+type cdcTestBlock struct {
+	offset int64
+	length int64
+}
+
+func cdcTestSplit(tb testing.TB, c *cdcChunker, data []byte) []cdcTestBlock {
+	var blocks []cdcTestBlock
+	err := c.split(bytes.NewReader(data), int64(len(data)), func(offset, length int64) bool {
+		blocks = append(blocks, cdcTestBlock{offset, length})
+		return true
+	})
+	if err != nil {
+		tb.Fatalf("failed to split data: %v", err)
+	}
+	return blocks
+}
+
+func cdcTestIDs(data []byte, blocks []cdcTestBlock) map[[20]byte]int64 {
+	ids := make(map[[20]byte]int64)
+	for _, blk := range blocks {
+		ids[sha1.Sum(data[blk.offset:blk.offset+blk.length])] = blk.length
+	}
+	return ids
+}
+
+func TestCDCGearTable(t *testing.T) {
+	// Entries of the table built by common/cdc/gear-checksum.c.
+	expected := map[int]uint64{
+		0:   0x955183a487026d06,
+		1:   0x3cc0a756bcf24ccf,
+		255: 0x6c14bb230e3bf653,
+	}
+	for i, v := range expected {
+		if cdcGear[i] != v {
+			t.Errorf("gear[%d] is %#x, expected %#x", i, cdcGear[i], v)
+		}
+	}
+}
+
+func TestCDCSplit(t *testing.T) {
+	c := newCDCChunker(2048, 8192, 32768)
+	data := zipTestRandom(1 << 20)
+
+	blocks := cdcTestSplit(t, c, data)
+	var offset int64
+	for i, blk := range blocks {
+		if blk.offset != offset {
+			t.Fatalf("block %d starts at %d, expected %d", i, blk.offset, offset)
+		}
+		if blk.length > 32768 || (blk.length < 2048 && i != len(blocks)-1) {
+			t.Errorf("block %d has invalid size %d", i, blk.length)
+		}
+		offset += blk.length
+	}
+	if offset != int64(len(data)) {
+		t.Fatalf("blocks cover %d bytes, expected %d", offset, len(data))
+	}
+	if avg := len(data) / len(blocks); avg < 4096 || avg > 16384 {
+		t.Errorf("average block size is %d, expected about 8192", avg)
+	}
+
+	// Inserting a byte only changes the blocks around it.
+	edited := append(append(append([]byte(nil), data[:1000]...), 'x'), data[1000:]...)
+	oldIDs := cdcTestIDs(data, blocks)
+	newBlocks := cdcTestSplit(t, c, edited)
+	changed := 0
+	for id := range cdcTestIDs(edited, newBlocks) {
+		if _, ok := oldIDs[id]; !ok {
+			changed++
+		}
+	}
+	if changed > 2 {
+		t.Errorf("%d blocks changed after inserting one byte", changed)
+	}
+
+	// Short input is a single block.
+	if blocks := cdcTestSplit(t, c, data[:100]); len(blocks) != 1 || blocks[0].length != 100 {
+		t.Errorf("wrong blocks %v of short input", blocks)
+	}
+}
+
+func TestIndexBlocksCDC(t *testing.T) {
+	oldCDC, oldMin, oldAvg, oldMax := option.ContentDefinedChunking, option.CDCMinBlockSize, option.CDCAvgBlockSize, option.CDCMaxBlockSize
+	option.ContentDefinedChunking = true
+	option.CDCMinBlockSize, option.CDCAvgBlockSize, option.CDCMaxBlockSize = 256, 1024, 4096
+	defer func() {
+		option.ContentDefinedChunking, option.CDCMinBlockSize, option.CDCAvgBlockSize, option.CDCMaxBlockSize = oldCDC, oldMin, oldAvg, oldMax
+	}()
+
+	testIndexBlocks(t, nil)
+	testIndexBlocks(t, &seafileCrypt{key: zipTestRandom(32), iv: zipTestRandom(16), version: 2})
+}
+
+// cdcTestVersions makes a document of text and a series of versions, each
+// with a few small inserts, deletes and overwrites at random places.
+func cdcTestVersions(size, versions int) [][]byte {
+	rnd := rand.New(rand.NewSource(1))
+	words := []string{"seafile", "library", "block", "commit", "upload", "the", "of", "and", "file", "server"}
+	var doc bytes.Buffer
+	for doc.Len() < size {
+		doc.WriteString(words[rnd.Intn(len(words))])
+		if rnd.Intn(12) == 0 {
+			doc.WriteString(".\n")
+		} else {
+			doc.WriteByte(' ')
+		}
+	}
+
+	result := [][]byte{doc.Bytes()}
+	for v := 1; v < versions; v++ {
+		cur := append([]byte(nil), result[v-1]...)
+		for e := 0; e < 3; e++ {
+			pos := rnd.Intn(len(cur))
+			switch rnd.Intn(3) {
+			case 0:
+				ins := []byte(fmt.Sprintf("edit %d.%d ", v, e))
+				cur = append(cur[:pos], append(ins, cur[pos:]...)...)
+			case 1:
+				end := pos + rnd.Intn(100)
+				if end > len(cur) {
+					end = len(cur)
+				}
+				cur = append(cur[:pos], cur[end:]...)
+			default:
+				copy(cur[pos:], "changed")
+			}
+		}
+		result = append(result, cur)
+	}
+	return result
+}
+
+// BenchmarkCDCDedup splits 10 versions of an edited 32MB document with the
+// default fixed and content-defined block sizes. It reports the chunking
+// throughput and the dedup ratio, the size of all versions divided by the
+// size of the distinct blocks.
+func BenchmarkCDCDedup(b *testing.B) {
+	versions := cdcTestVersions(32<<20, 10)
+	var total int64
+	for _, v := range versions {
+		total += int64(len(v))
+	}
+
+	splitters := []struct {
+		name  string
+		split func(data []byte, fn func(offset, length int64) bool)
+	}{
+		{"fixed", func(data []byte, fn func(offset, length int64) bool) {
+			splitFixedBlocks(int64(len(data)), 1<<23, fn)
+		}},
+		{"cdc", func(data []byte, fn func(offset, length int64) bool) {
+			c := newCDCChunker(1<<18, 1<<20, 1<<22)
+			c.split(bytes.NewReader(data), int64(len(data)), fn)
+		}},
+	}
+	for _, s := range splitters {
+		b.Run(s.name, func(b *testing.B) {
+			var stored int64
+			b.SetBytes(total)
+			for i := 0; i < b.N; i++ {
+				ids := make(map[[20]byte]bool)
+				stored = 0
+				for _, data := range versions {
+					s.split(data, func(offset, length int64) bool {
+						id := sha1.Sum(data[offset : offset+length])
+						if !ids[id] {
+							ids[id] = true
+							stored += length
+						}
+						return true
+					})
+				}
+			}
+			b.ReportMetric(float64(total)/float64(stored), "dedup-ratio")
+		})
+	}
+}
@@ -1,9 +1,10 @@
 package main
 
 import (
-	"bytes"
 	"crypto/aes"
 	"crypto/cipher"
+	"fmt"
+	"sync"
 )
 
 type seafileCrypt struct {
@@ -12,7 +13,29 @@ type seafileCrypt struct {
 	version int
 }
 
-func (crypt *seafileCrypt) encrypt(input []byte) ([]byte, error) {
+// Expanded AES keys are cached across requests, so that blocks of the same
+// repo don't set up the key schedule again.
+const maxCachedCiphers = 1024
+
+type cipherCacheKey struct {
+	version int
+	key     string
+}
+
+var cipherCache = struct {
+	sync.Mutex
+	blocks map[cipherCacheKey]cipher.Block
+}{blocks: make(map[cipherCacheKey]cipher.Block)}
+
+func (crypt *seafileCrypt) cipherBlock() (cipher.Block, error) {
+	cacheKey := cipherCacheKey{crypt.version, string(crypt.key)}
+	cipherCache.Lock()
+	block, ok := cipherCache.blocks[cacheKey]
+	cipherCache.Unlock()
+	if ok {
+		return block, nil
+	}
+
 	key := crypt.key
 	if crypt.version == 3 {
 		key = to16Bytes(key)
@@ -21,62 +44,113 @@ func (crypt *seafileCrypt) encrypt(input []byte) ([]byte, error) {
 	if err != nil {
 		return nil, err
 	}
-	size := block.BlockSize()
-	input = pkcs7Padding(input, size)
-	out := make([]byte, len(input))
 
-	if crypt.version == 3 {
-		for bs, be := 0, size; bs < len(input); bs, be = bs+size, be+size {
-			block.Encrypt(out[bs:be], input[bs:be])
-		}
-		return out, nil
+	cipherCache.Lock()
+	if len(cipherCache.blocks) >= maxCachedCiphers {
+		cipherCache.blocks = make(map[cipherCacheKey]cipher.Block)
 	}
+	cipherCache.blocks[cacheKey] = block
+	cipherCache.Unlock()
 
-	blockMode := cipher.NewCBCEncrypter(block, crypt.iv)
-	blockMode.CryptBlocks(out, input)
-
-	return out, nil
+	return block, nil
 }
 
-func (crypt *seafileCrypt) decrypt(input []byte) ([]byte, error) {
-	key := crypt.key
+// blockMode returns the mode of the repo's encryption version. Version 3
+// uses ECB, the others use CBC.
+func (crypt *seafileCrypt) blockMode(encrypt bool) (cipher.BlockMode, error) {
+	block, err := crypt.cipherBlock()
+	if err != nil {
+		return nil, err
+	}
 	if crypt.version == 3 {
-		key = to16Bytes(key)
+		return ecbMode{block, encrypt}, nil
 	}
-	block, err := aes.NewCipher(key)
+	if encrypt {
+		return cipher.NewCBCEncrypter(block, crypt.iv), nil
+	}
+	return cipher.NewCBCDecrypter(block, crypt.iv), nil
+}
+
+func (crypt *seafileCrypt) encrypt(input []byte) ([]byte, error) {
+	buf := make([]byte, len(input), len(input)+aes.BlockSize)
+	copy(buf, input)
+	return crypt.encryptInPlace(buf)
+}
+
+// encryptInPlace pads and encrypts the input in its backing array, which is
+// only reallocated if it has no room for the padding.
+func (crypt *seafileCrypt) encryptInPlace(input []byte) ([]byte, error) {
+	mode, err := crypt.blockMode(true)
 	if err != nil {
 		return nil, err
 	}
-	out := make([]byte, len(input))
-	size := block.BlockSize()
+	input = pkcs7Padding(input, mode.BlockSize())
+	mode.CryptBlocks(input, input)
 
-	if crypt.version == 3 {
-		// Encryption repo v3 uses AES_128_ecb mode to encrypt and decrypt, each block is encrypted and decrypted independently,
-		// there is no relationship before and after, and iv is not required.
-		for bs, be := 0, size; bs < len(input); bs, be = bs+size, be+size {
-			block.Decrypt(out[bs:be], input[bs:be])
-		}
-		out = pkcs7UnPadding(out)
-		return out, nil
+	return input, nil
+}
+
+func (crypt *seafileCrypt) decrypt(input []byte) ([]byte, error) {
+	buf := make([]byte, len(input))
+	copy(buf, input)
+	return crypt.decryptInPlace(buf)
+}
+
+// decryptInPlace decrypts the input in its backing array and returns the
+// unpadded plaintext.
+func (crypt *seafileCrypt) decryptInPlace(input []byte) ([]byte, error) {
+	mode, err := crypt.blockMode(false)
+	if err != nil {
+		return nil, err
 	}
+	if len(input)%mode.BlockSize() != 0 {
+		return nil, fmt.Errorf("invalid encrypted data size %d", len(input))
+	}
+	mode.CryptBlocks(input, input)
+
+	return pkcs7UnPadding(input, mode.BlockSize())
+}
 
-	blockMode := cipher.NewCBCDecrypter(block, crypt.iv)
-	blockMode.CryptBlocks(out, input)
-	out = pkcs7UnPadding(out)
+// ecbMode encrypts and decrypts each block independently, as encryption
+// repo v3 does with AES-128 ECB. No iv is required.
+type ecbMode struct {
+	block   cipher.Block
+	encrypt bool
+}
 
-	return out, nil
+func (m ecbMode) BlockSize() int {
+	return m.block.BlockSize()
+}
+
+func (m ecbMode) CryptBlocks(dst, src []byte) {
+	size := m.block.BlockSize()
+	for bs := 0; bs < len(src); bs += size {
+		if m.encrypt {
+			m.block.Encrypt(dst[bs:bs+size], src[bs:bs+size])
+		} else {
+			m.block.Decrypt(dst[bs:bs+size], src[bs:bs+size])
+		}
+	}
 }
 
 func pkcs7Padding(p []byte, blockSize int) []byte {
 	padding := blockSize - len(p)%blockSize
-	padtext := bytes.Repeat([]byte{byte(padding)}, padding)
-	return append(p, padtext...)
+	for i := 0; i < padding; i++ {
+		p = append(p, byte(padding))
+	}
+	return p
 }
 
-func pkcs7UnPadding(p []byte) []byte {
+func pkcs7UnPadding(p []byte, blockSize int) ([]byte, error) {
 	length := len(p)
+	if length == 0 {
+		return nil, fmt.Errorf("empty encrypted data")
+	}
 	paddLen := int(p[length-1])
-	return p[:(length - paddLen)]
+	if paddLen == 0 || paddLen > blockSize {
+		return nil, fmt.Errorf("invalid padding")
+	}
+	return p[:(length - paddLen)], nil
 }
 
 func to16Bytes(input []byte) []byte {
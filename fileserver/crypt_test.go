@@ -0,0 +1,116 @@
+package main
+
+import (
+	"bytes"
+	"crypto/aes"
+	"crypto/cipher"
+	"fmt"
+	"testing"
+)
+
+func cryptTestKey(version int) *seafileCrypt {
+	keyLen := 32
+	if version == 1 {
+		keyLen = 16
+	}
+	return &seafileCrypt{key: zipTestRandom(keyLen), iv: zipTestRandom(16), version: version}
+}
+
+// cryptTestEncrypt encrypts with the standard library modes, as the repo
+// format defines.
+func cryptTestEncrypt(crypt *seafileCrypt, input []byte) []byte {
+	key := crypt.key
+	if crypt.version == 3 {
+		key = to16Bytes(key)
+	}
+	block, _ := aes.NewCipher(key)
+	padded := pkcs7Padding(append([]byte(nil), input...), aes.BlockSize)
+	out := make([]byte, len(padded))
+	if crypt.version == 3 {
+		for bs := 0; bs < len(padded); bs += aes.BlockSize {
+			block.Encrypt(out[bs:], padded[bs:])
+		}
+	} else {
+		cipher.NewCBCEncrypter(block, crypt.iv).CryptBlocks(out, padded)
+	}
+	return out
+}
+
+func TestCrypt(t *testing.T) {
+	for _, version := range []int{1, 2, 3, 4} {
+		crypt := cryptTestKey(version)
+		for _, size := range []int{0, 1, 15, 16, 17, 4096, 100000} {
+			input := zipTestRandom(size)
+			encoded, err := crypt.encrypt(input)
+			if err != nil {
+				t.Fatalf("failed to encrypt with version %d: %v", version, err)
+			}
+			if !bytes.Equal(encoded, cryptTestEncrypt(crypt, input)) {
+				t.Errorf("wrong encrypted data with version %d, size %d", version, size)
+			}
+
+			decoded, err := crypt.decrypt(encoded)
+			if err != nil {
+				t.Fatalf("failed to decrypt with version %d: %v", version, err)
+			}
+			if !bytes.Equal(decoded, input) {
+				t.Errorf("wrong decrypted data with version %d, size %d", version, size)
+			}
+
+			// In-place operations share the buffer of the input.
+			buf := make([]byte, size, size+aes.BlockSize)
+			copy(buf, input)
+			encoded, _ = crypt.encryptInPlace(buf)
+			if &encoded[0] != &buf[:1][0] {
+				t.Errorf("encryption with version %d, size %d is not in place", version, size)
+			}
+			decoded, err = crypt.decryptInPlace(encoded)
+			if err != nil || !bytes.Equal(decoded, input) {
+				t.Errorf("wrong in-place decrypted data with version %d, size %d", version, size)
+			}
+		}
+
+		if _, err := crypt.decrypt(zipTestRandom(17)); err == nil {
+			t.Errorf("decrypting data of invalid size with version %d should fail", version)
+		}
+	}
+
+	wrongKey := &seafileCrypt{key: zipTestRandom(33)[:32], iv: zipTestRandom(16), version: 2}
+	encoded, _ := cryptTestKey(2).encrypt([]byte("hello"))
+	if decoded, err := wrongKey.decrypt(encoded); err == nil && bytes.Equal(decoded, []byte("hello")) {
+		t.Errorf("decrypting with a wrong key should not succeed")
+	}
+}
+
+// BenchmarkCrypt measures the throughput of encrypting and decrypting 8MB
+// blocks in place with each encryption version.
+func BenchmarkCrypt(b *testing.B) {
+	const blkSize = 8 << 20
+	for _, version := range []int{1, 2, 3, 4} {
+		crypt := cryptTestKey(version)
+		input := zipTestRandom(blkSize)
+		buf := make([]byte, blkSize, blkSize+aes.BlockSize)
+		encoded, _ := crypt.encrypt(input)
+
+		b.Run(fmt.Sprintf("encrypt-v%d", version), func(b *testing.B) {
+			b.SetBytes(blkSize)
+			for i := 0; i < b.N; i++ {
+				buf = buf[:blkSize]
+				copy(buf, input)
+				if _, err := crypt.encryptInPlace(buf); err != nil {
+					b.Fatalf("failed to encrypt: %v", err)
+				}
+			}
+		})
+		b.Run(fmt.Sprintf("decrypt-v%d", version), func(b *testing.B) {
+			b.SetBytes(blkSize)
+			for i := 0; i < b.N; i++ {
+				buf = buf[:len(encoded)]
+				copy(buf, encoded)
+				if _, err := crypt.decryptInPlace(buf); err != nil {
+					b.Fatalf("failed to decrypt: %v", err)
+				}
+			}
+		})
+	}
+}
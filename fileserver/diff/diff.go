@@ -6,6 +6,7 @@ import (
 	"io"
 	"path/filepath"
 	"strings"
+	"sync"
 
 	"github.com/haiwen/seafile-server/fileserver/commitmgr"
 	"github.com/haiwen/seafile-server/fileserver/fsmgr"
@@ -17,6 +18,10 @@ const (
 	EmptySha1 = "0000000000000000000000000000000000000000"
 )
 
+// DefaultConcurrency is the number of goroutines loading dirs for callers
+// that diff large trees.
+const DefaultConcurrency = 8
+
 type fileCB func(context.Context, string, []*fsmgr.SeafDirent, interface{}) error
 type dirCB func(context.Context, string, []*fsmgr.SeafDirent, interface{}, *bool) error
 
@@ -27,6 +32,15 @@ type DiffOptions struct {
 	Ctx    context.Context
 	Data   interface{}
 	Reader io.ReadCloser
+	// Concurrency > 1 loads subdirs with that many goroutines ahead of
+	// the walk. Callbacks are still called from the calling goroutine,
+	// in the same order as a sequential diff.
+	Concurrency int
+
+	// foldDirs is set when DirCB doesn't recurse into dirs that are
+	// missing from one of the trees, so they aren't loaded ahead.
+	foldDirs bool
+	loader   *dirLoader
 }
 
 type diffData struct {
@@ -54,10 +68,55 @@ func DiffTrees(roots []string, opt *DiffOptions) error {
 		trees[i] = root
 	}
 
+	if opt.Concurrency > 1 {
+		ctx := opt.Ctx
+		if ctx == nil {
+			ctx = context.Background()
+		}
+		opt.loader = newDirLoader(ctx, opt.RepoID, opt.Concurrency)
+		if opt.foldDirs {
+			opt.loader.foldTrees = n
+		}
+		defer func() {
+			opt.loader.close()
+			opt.loader = nil
+		}()
+	}
+
 	return diffTreesRecursive(trees, "", opt)
 }
 
 func diffTreesRecursive(trees []*fsmgr.SeafDir, baseDir string, opt *DiffOptions) error {
+	steps := mergeEntries(trees)
+
+	var loads []*dirLoad
+	var next int
+	if opt.loader != nil {
+		loads = make([]*dirLoad, len(steps))
+	}
+
+	for i, dents := range steps {
+		var load *dirLoad
+		if loads != nil {
+			next = opt.loader.prefetch(steps, loads, i, next)
+			load = loads[i]
+		}
+
+		if err := diffFiles(baseDir, dents, opt); err != nil {
+			return err
+		}
+		if err := diffDirectories(baseDir, dents, load, opt); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// mergeEntries returns the entries with the same name in the trees, in
+// the order of the dirs. Entries that are the same in all trees are
+// skipped.
+func mergeEntries(trees []*fsmgr.SeafDir) [][]*fsmgr.SeafDirent {
+	var steps [][]*fsmgr.SeafDirent
 	n := len(trees)
 	ptrs := make([][]*fsmgr.SeafDirent, 3)
 
@@ -114,14 +173,9 @@ func diffTreesRecursive(trees []*fsmgr.SeafDir, baseDir string, opt *DiffOptions
 			continue
 		}
 
-		if err := diffFiles(baseDir, dents, opt); err != nil {
-			return err
-		}
-		if err := diffDirectories(baseDir, dents, opt); err != nil {
-			return err
-		}
+		steps = append(steps, dents)
 	}
-	return nil
+	return steps
 }
 
 func diffFiles(baseDir string, dents []*fsmgr.SeafDirent, opt *DiffOptions) error {
@@ -142,7 +196,7 @@ func diffFiles(baseDir string, dents []*fsmgr.SeafDirent, opt *DiffOptions) erro
 	return opt.FileCB(opt.Ctx, baseDir, files, opt.Data)
 }
 
-func diffDirectories(baseDir string, dents []*fsmgr.SeafDirent, opt *DiffOptions) error {
+func diffDirectories(baseDir string, dents []*fsmgr.SeafDirent, load *dirLoad, opt *DiffOptions) error {
 	n := len(dents)
 	dirs := make([]*fsmgr.SeafDirent, 3)
 	subDirs := make([]*fsmgr.SeafDir, 3)
@@ -168,15 +222,25 @@ func diffDirectories(baseDir string, dents []*fsmgr.SeafDirent, opt *DiffOptions
 		return nil
 	}
 
+	if load != nil {
+		if err := load.wait(); err != nil {
+			return err
+		}
+	}
+
 	var dirName string
 	for i := 0; i < n; i++ {
 		if dents[i] != nil && fsmgr.IsDir(dents[i].Mode) {
-			dir, err := fsmgr.GetSeafdirWithZlibReader(opt.RepoID, dents[i].ID, opt.Reader)
-			if err != nil {
-				err := fmt.Errorf("Failed to find dir %s:%s", opt.RepoID, dents[i].ID)
-				return err
+			if load != nil {
+				subDirs[i] = load.dirs[i]
+			} else {
+				dir, err := fsmgr.GetSeafdirWithZlibReader(opt.RepoID, dents[i].ID, opt.Reader)
+				if err != nil {
+					err := fmt.Errorf("Failed to find dir %s:%s", opt.RepoID, dents[i].ID)
+					return err
+				}
+				subDirs[i] = dir
 			}
-			subDirs[i] = dir
 			dirName = dents[i].Name
 		}
 	}
@@ -185,6 +249,105 @@ func diffDirectories(baseDir string, dents []*fsmgr.SeafDirent, opt *DiffOptions
 	return diffTreesRecursive(subDirs, newBaseDir, opt)
 }
 
+// dirLoad is the subdirs of one entry loaded ahead of the walk.
+type dirLoad struct {
+	dents []*fsmgr.SeafDirent
+	dirs  []*fsmgr.SeafDir
+	err   error
+	done  chan struct{}
+}
+
+func (load *dirLoad) wait() error {
+	<-load.done
+	return load.err
+}
+
+type dirLoader struct {
+	ctx    context.Context
+	cancel context.CancelFunc
+	repoID string
+	window int
+	jobs   chan *dirLoad
+	wg     sync.WaitGroup
+	// foldTrees is the number of trees when the dirs are folded, or 0.
+	foldTrees int
+}
+
+func newDirLoader(ctx context.Context, repoID string, workers int) *dirLoader {
+	loader := new(dirLoader)
+	loader.ctx, loader.cancel = context.WithCancel(ctx)
+	loader.repoID = repoID
+	loader.window = workers * 2
+	loader.jobs = make(chan *dirLoad, workers)
+
+	for i := 0; i < workers; i++ {
+		loader.wg.Add(1)
+		go loader.run()
+	}
+
+	return loader
+}
+
+func (loader *dirLoader) run() {
+	defer loader.wg.Done()
+
+	reader := fsmgr.GetOneZlibReader()
+	defer fsmgr.ReturnOneZlibReader(reader)
+
+	for load := range loader.jobs {
+		load.dirs = make([]*fsmgr.SeafDir, len(load.dents))
+		for i, dent := range load.dents {
+			if err := loader.ctx.Err(); err != nil {
+				load.err = err
+				break
+			}
+			if dent == nil || !fsmgr.IsDir(dent.Mode) {
+				continue
+			}
+			dir, err := fsmgr.GetSeafdirWithZlibReader(loader.repoID, dent.ID, reader)
+			if err != nil {
+				load.err = fmt.Errorf("Failed to find dir %s:%s", loader.repoID, dent.ID)
+				break
+			}
+			load.dirs[i] = dir
+		}
+		close(load.done)
+	}
+}
+
+// prefetch starts loading the subdirs of the entries in steps[i:i+window]
+// that haven't been started, beginning at next. It returns the new next.
+// When the dirs are folded, only entries that are dirs in all trees are
+// loaded, since DirCB won't recurse into the others.
+func (loader *dirLoader) prefetch(steps [][]*fsmgr.SeafDirent, loads []*dirLoad, i, next int) int {
+	if next < i {
+		next = i
+	}
+	for ; next < len(steps) && next < i+loader.window; next++ {
+		nDirs := 0
+		for _, dent := range steps[next] {
+			if dent != nil && fsmgr.IsDir(dent.Mode) {
+				nDirs++
+			}
+		}
+		if nDirs == 0 || nDirs < loader.foldTrees {
+			continue
+		}
+		load := &dirLoad{dents: steps[next], done: make(chan struct{})}
+		loads[next] = load
+		loader.jobs <- load
+	}
+	return next
+}
+
+// close stops loading and waits for the goroutines to exit. Subdirs that
+// were loaded ahead but not walked, e.g. after an error, are dropped.
+func (loader *dirLoader) close() {
+	loader.cancel()
+	close(loader.jobs)
+	loader.wg.Wait()
+}
+
 func direntSame(dentA, dentB *fsmgr.SeafDirent) bool {
 	return dentA.ID == dentB.ID &&
 		dentA.Mode == dentB.Mode &&
@@ -331,6 +494,8 @@ func DiffCommits(commit1, commit2 *commitmgr.Commit, results *[]*DiffEntry, fold
 	opt.FileCB = twowayDiffFiles
 	opt.DirCB = twowayDiffDirs
 	opt.Data = diffData{foldDirDiff, results}
+	opt.Concurrency = DefaultConcurrency
+	opt.foldDirs = foldDirDiff
 
 	err := DiffTrees(roots, opt)
 	if err != nil {
@@ -2,8 +2,11 @@ package diff
 
 import (
 	"context"
+	"crypto/sha1"
 	"fmt"
 	"os"
+	"reflect"
+	"sort"
 	"syscall"
 	"testing"
 
@@ -57,6 +60,8 @@ func TestDiffTrees(t *testing.T) {
 	t.Run("test3", testDiffTrees3)
 	t.Run("test4", testDiffTrees4)
 	t.Run("test5", testDiffTrees5)
+	t.Run("concurrent", testDiffTreesConcurrent)
+	t.Run("cancel", testDiffTreesCancel)
 
 	err = diffTestDelFile()
 	if err != nil {
@@ -278,3 +283,180 @@ func diffTestDirCB(ctx context.Context, baseDir string, dirs []*fsmgr.SeafDirent
 
 	return nil
 }
+
+// diffTestCreateTree creates a tree with width subdirs in each dir down
+// to depth, and files in every dir. The trees of versions 1 and 2 differ:
+// of every four names, one is the same in both, one is modified, one is
+// only in version 1 and one is only in version 2.
+func diffTestCreateTree(width, depth, files, version int) (string, error) {
+	modeDir := uint32(syscall.S_IFDIR | 0644)
+	modeFile := uint32(syscall.S_IFREG | 0644)
+
+	exists := func(i int) bool {
+		return !(i%4 == 2 && version == 2) && !(i%4 == 3 && version == 1)
+	}
+
+	var create func(path string, level int) (string, error)
+	create = func(path string, level int) (string, error) {
+		var dents []*fsmgr.SeafDirent
+		for i := 0; i < files; i++ {
+			if !exists(i) {
+				continue
+			}
+			name := fmt.Sprintf("f%04d", i)
+			key := path + name
+			if i%4 == 1 {
+				key = fmt.Sprintf("%s:%d", key, version)
+			}
+			id := fmt.Sprintf("%x", sha1.Sum([]byte(key)))
+			dent := &fsmgr.SeafDirent{ID: id, Name: name, Mode: modeFile, Size: 1}
+			dents = append(dents, dent)
+		}
+		if level < depth {
+			for i := 0; i < width; i++ {
+				if !exists(i) {
+					continue
+				}
+				name := fmt.Sprintf("d%04d", i)
+				id, err := create(path+name+"/", level+1)
+				if err != nil {
+					return "", err
+				}
+				dent := &fsmgr.SeafDirent{ID: id, Name: name, Mode: modeDir}
+				dents = append(dents, dent)
+			}
+		}
+		// Entries are sorted by name in descending order.
+		sort.Slice(dents, func(i, j int) bool {
+			return dents[i].Name > dents[j].Name
+		})
+		return diffTestCreateSeafdir(dents)
+	}
+
+	return create("/", 0)
+}
+
+func diffTestCollect(ctx context.Context, roots []string, concurrency int) ([]interface{}, error) {
+	var results []interface{}
+	opt := &DiffOptions{
+		FileCB:      diffTestFileCB,
+		DirCB:       diffTestDirCB,
+		Ctx:         ctx,
+		RepoID:      diffTestRepoID,
+		Concurrency: concurrency}
+	opt.Data = &results
+	err := DiffTrees(roots, opt)
+	return results, err
+}
+
+func diffTestCollectTwoway(roots []string, concurrency int, foldDirDiff bool) ([]*DiffEntry, error) {
+	var results []*DiffEntry
+	opt := &DiffOptions{
+		FileCB:      twowayDiffFiles,
+		DirCB:       twowayDiffDirs,
+		RepoID:      diffTestRepoID,
+		Concurrency: concurrency,
+		foldDirs:    foldDirDiff}
+	opt.Data = diffData{foldDirDiff, &results}
+	err := DiffTrees(roots, opt)
+	return results, err
+}
+
+func testDiffTreesConcurrent(t *testing.T) {
+	tree1, err := diffTestCreateTree(4, 3, 5, 1)
+	if err != nil {
+		t.Fatalf("failed to create tree: %v", err)
+	}
+	tree2, err := diffTestCreateTree(4, 3, 5, 2)
+	if err != nil {
+		t.Fatalf("failed to create tree: %v", err)
+	}
+
+	for _, roots := range [][]string{{tree1, tree2}, {tree2, tree1}, {tree1, diffTestTree1}} {
+		expected, err := diffTestCollect(context.Background(), roots, 0)
+		if err != nil {
+			t.Fatalf("failed to diff trees: %v", err)
+		}
+		if len(expected) == 0 {
+			t.Fatalf("no difference found")
+		}
+		results, err := diffTestCollect(context.Background(), roots, 4)
+		if err != nil {
+			t.Fatalf("failed to diff trees concurrently: %v", err)
+		}
+		if fmt.Sprint(results) != fmt.Sprint(expected) {
+			t.Errorf("concurrent diff results differ from sequential ones")
+		}
+	}
+
+	for _, foldDirDiff := range []bool{false, true} {
+		roots := []string{tree1, tree2}
+		expected, err := diffTestCollectTwoway(roots, 0, foldDirDiff)
+		if err != nil {
+			t.Fatalf("failed to diff trees: %v", err)
+		}
+		status := make(map[rune]int)
+		for _, de := range expected {
+			status[de.Status]++
+		}
+		// Added dirs are only reported when they are folded.
+		for _, s := range []rune{DiffStatusAdded, DiffStatusDeleted, DiffStatusModified,
+			DiffStatusDirAdded, DiffStatusDirDeleted} {
+			if status[s] == 0 && (s != DiffStatusDirAdded || foldDirDiff) {
+				t.Errorf("no entry with status %c found, fold %v", s, foldDirDiff)
+			}
+		}
+		results, err := diffTestCollectTwoway(roots, 4, foldDirDiff)
+		if err != nil {
+			t.Fatalf("failed to diff trees concurrently: %v", err)
+		}
+		if !reflect.DeepEqual(results, expected) {
+			t.Errorf("concurrent diff results differ from sequential ones, fold %v", foldDirDiff)
+		}
+	}
+}
+
+func testDiffTreesCancel(t *testing.T) {
+	tree1, _ := diffTestCreateTree(4, 2, 1, 1)
+	tree2, _ := diffTestCreateTree(4, 2, 1, 2)
+
+	ctx, cancel := context.WithCancel(context.Background())
+	cancel()
+	if _, err := diffTestCollect(ctx, []string{tree1, tree2}, 4); err == nil {
+		t.Errorf("diff with a canceled context should fail")
+	}
+}
+
+func benchmarkDiffTrees(b *testing.B, width, depth, files int) {
+	fsmgr.Init(diffTestSeafileConfPath, diffTestSeafileDataDir, 2<<30)
+	defer diffTestDelFile()
+
+	tree1, err := diffTestCreateTree(width, depth, files, 1)
+	if err != nil {
+		b.Fatalf("failed to create tree: %v", err)
+	}
+	tree2, err := diffTestCreateTree(width, depth, files, 2)
+	if err != nil {
+		b.Fatalf("failed to create tree: %v", err)
+	}
+
+	for _, concurrency := range []int{0, DefaultConcurrency} {
+		b.Run(fmt.Sprintf("concurrency-%d", concurrency), func(b *testing.B) {
+			for i := 0; i < b.N; i++ {
+				if _, err := diffTestCollect(context.Background(), []string{tree1, tree2}, concurrency); err != nil {
+					b.Fatalf("failed to diff trees: %v", err)
+				}
+			}
+		})
+	}
+}
+
+// BenchmarkDiffTreesWide diffs trees with 1000 subdirs under the root.
+func BenchmarkDiffTreesWide(b *testing.B) {
+	benchmarkDiffTrees(b, 1000, 1, 10)
+}
+
+// BenchmarkDiffTreesDeep diffs binary trees of 11 levels.
+func BenchmarkDiffTreesDeep(b *testing.B) {
+	benchmarkDiffTrees(b, 2, 10, 10)
+}
@@ -4,6 +4,7 @@ import (
 	"archive/zip"
 	"bytes"
 	"context"
+	"crypto/aes"
 	"crypto/sha1"
 	"encoding/hex"
 	"encoding/json"
@@ -414,10 +415,16 @@ func doFile(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, fileID
 	}
 
 	if cryptKey != nil {
+		// Blocks are decrypted in place in the read buffers.
+		reader := newBlockReader(repo.StoreID, file.BlkIDs, blockmgr.Read, blockmgr.Stat)
+		defer reader.close()
 		for _, blkID := range file.BlkIDs {
-			var buf bytes.Buffer
-			blockmgr.Read(repo.StoreID, blkID, &buf)
-			decoded, err := cryptKey.decrypt(buf.Bytes())
+			data, err := reader.nextBlock()
+			if err != nil {
+				log.Errorf("failed to read block %s: %v", blkID, err)
+				return nil
+			}
+			decoded, err := cryptKey.decryptInPlace(data)
 			if err != nil {
 				err := fmt.Errorf("failed to decrypt block %s: %v", blkID, err)
 				return &appError{err, "", http.StatusInternalServerError}
@@ -430,13 +437,28 @@ func doFile(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, fileID
 		return nil
 	}
 
-	for _, blkID := range file.BlkIDs {
-		err := blockmgr.Read(repo.StoreID, blkID, rsp)
-		if err != nil {
-			if !isNetworkErr(err) {
+	if option.ReadAheadBlocks == 0 {
+		for _, blkID := range file.BlkIDs {
+			err := blockmgr.Read(repo.StoreID, blkID, rsp)
+			if err != nil {
+				if !isNetworkErr(err) {
+					log.Errorf("failed to read block %s: %v", blkID, err)
+				}
+				return nil
+			}
+		}
+	} else {
+		reader := newBlockReader(repo.StoreID, file.BlkIDs, blockmgr.Read, blockmgr.Stat)
+		defer reader.close()
+		for _, blkID := range file.BlkIDs {
+			data, err := reader.nextBlock()
+			if err != nil {
 				log.Errorf("failed to read block %s: %v", blkID, err)
+				return nil
+			}
+			if _, err := rsp.Write(data); err != nil {
+				return nil
 			}
-			return nil
 		}
 	}
 
@@ -522,85 +544,52 @@ func doFileRange(rsp http.ResponseWriter, r *http.Request, repo *repomgr.Repo, f
 		}
 	}
 
+	// Find the blocks that hold the range, and the position of the range
+	// start in the first one.
 	var off uint64
 	var pos uint64
-	var startBlock int
+	startBlock, endBlock := -1, len(blkSize)-1
 	for i, v := range blkSize {
-		pos = start - off
-		off += v
-		if off > start {
+		if startBlock < 0 && start < off+v {
 			startBlock = i
+			pos = start - off
+		}
+		if end < off+v {
+			endBlock = i
 			break
 		}
+		off += v
+	}
+	if startBlock < 0 {
+		log.Errorf("range %d-%d is beyond the blocks of file %s", start, end, fileID)
+		return nil
 	}
 
-	// Read block from the start block and specified position
-	var i int
-	for ; i < len(file.BlkIDs); i++ {
-		if i < startBlock {
-			continue
-		}
-
-		blkID := file.BlkIDs[i]
-		var buf bytes.Buffer
-		if end-start+1 <= blkSize[i]-pos {
-			err := blockmgr.Read(repo.StoreID, blkID, &buf)
-			if err != nil {
-				if !isNetworkErr(err) {
-					log.Errorf("failed to read block %s: %v", blkID, err)
-				}
-				return nil
-			}
-			recvBuf := buf.Bytes()
-			rsp.Write(recvBuf[pos : pos+end-start+1])
-			return nil
-		}
+	reader := newBlockReader(repo.StoreID, file.BlkIDs[startBlock:endBlock+1], blockmgr.Read, blockmgr.Stat)
+	defer reader.close()
 
-		err := blockmgr.Read(repo.StoreID, blkID, &buf)
+	remain := end - start + 1
+	for remain > 0 {
+		data, err := reader.nextBlock()
 		if err != nil {
 			if !isNetworkErr(err) {
-				log.Errorf("failed to read block %s: %v", blkID, err)
+				log.Errorf("failed to read block of file %s: %v", fileID, err)
 			}
 			return nil
 		}
-		recvBuf := buf.Bytes()
-		_, err = rsp.Write(recvBuf[pos:])
-		if err != nil {
+		if pos > uint64(len(data)) {
+			log.Errorf("block of file %s is shorter than its recorded size", fileID)
 			return nil
 		}
-		start += blkSize[i] - pos
-		i++
-		break
-	}
-
-	// Always read block from the remaining block and pos=0
-	for ; i < len(file.BlkIDs); i++ {
-		blkID := file.BlkIDs[i]
-		var buf bytes.Buffer
-		if end-start+1 <= blkSize[i] {
-			err := blockmgr.Read(repo.StoreID, blkID, &buf)
-			if err != nil {
-				if !isNetworkErr(err) {
-					log.Errorf("failed to read block %s: %v", blkID, err)
-				}
-				return nil
-			}
-			recvBuf := buf.Bytes()
-			_, err = rsp.Write(recvBuf[:end-start+1])
-			if err != nil {
-				return nil
-			}
-			break
-		} else {
-			err := blockmgr.Read(repo.StoreID, blkID, rsp)
-			if err != nil {
-				if !isNetworkErr(err) {
-					log.Errorf("failed to read block %s: %v", blkID, err)
-				}
-				return nil
-			}
-			start += blkSize[i]
+		data = data[pos:]
+		pos = 0
+		if uint64(len(data)) > remain {
+			data = data[:remain]
 		}
+		if _, err := rsp.Write(data); err != nil {
+			return nil
+		}
+		remain -= uint64(len(data))
 	}
 
 	oper := "web-file-download"
@@ -861,6 +850,13 @@ func downloadZipFile(rsp http.ResponseWriter, r *http.Request, data, repoID, use
 	ar := zip.NewWriter(rsp)
 	defer ar.Close()
 
+	packer := newZipPacker(ar, repo.StoreID, cryptKey, blockmgr.Read)
+	defer func() {
+		if err := packer.close(); err != nil && !isNetworkErr(err) {
+			log.Errorf("failed to pack zip for repo %s: %v", repoID, err)
+		}
+	}()
+
 	if op == "download-dir" || op == "download-dir-link" {
 		dirName, ok := obj["dir_name"].(string)
 		if !ok || dirName == "" {
@@ -883,7 +879,7 @@ func downloadZipFile(rsp http.ResponseWriter, r *http.Request, data, repoID, use
 		rsp.Header().Set("Content-Disposition", contFileName)
 		rsp.Header().Set("Content-Type", "application/octet-stream")
 
-		err := packDir(ar, repo, objID, dirName, cryptKey)
+		err := packDir(packer, repo, objID, dirName)
 		if err != nil {
 			log.Errorf("failed to pack dir %s: %v", dirName, err)
 			return nil
@@ -907,14 +903,14 @@ func downloadZipFile(rsp http.ResponseWriter, r *http.Request, data, repoID, use
 			uniqueName := genUniqueFileName(v.Name, fileList)
 			fileList = append(fileList, uniqueName)
 			if fsmgr.IsDir(v.Mode) {
-				if err := packDir(ar, repo, v.ID, uniqueName, cryptKey); err != nil {
+				if err := packDir(packer, repo, v.ID, uniqueName); err != nil {
 					if !isNetworkErr(err) {
 						log.Errorf("failed to pack dir %s: %v", v.Name, err)
 					}
 					return nil
 				}
 			} else {
-				if err := packFiles(ar, &v, repo, "", uniqueName, cryptKey); err != nil {
+				if err := packFiles(packer, &v, repo, "", uniqueName); err != nil {
 					if !isNetworkErr(err) {
 						log.Errorf("failed to pack file %s: %v", v.Name, err)
 					}
@@ -1019,7 +1015,7 @@ func parseDirFilelist(repo *repomgr.Repo, obj map[string]interface{}) ([]fsmgr.S
 	return direntList, nil
 }
 
-func packDir(ar *zip.Writer, repo *repomgr.Repo, dirID, dirPath string, cryptKey *seafileCrypt) error {
+func packDir(packer *zipPacker, repo *repomgr.Repo, dirID, dirPath string) error {
 	dirent, err := fsmgr.GetSeafdir(repo.StoreID, dirID)
 	if err != nil {
 		err := fmt.Errorf("failed to get dir for zip: %v", err)
@@ -1029,13 +1025,7 @@ func packDir(ar *zip.Writer, repo *repomgr.Repo, dirID, dirPath string, cryptKey
 	if dirent.Entries == nil {
 		fileDir := filepath.Join(dirPath)
 		fileDir = strings.TrimLeft(fileDir, "/")
-		_, err := ar.Create(fileDir + "/")
-		if err != nil {
-			err := fmt.Errorf("failed to create zip dir: %v", err)
-			return err
-		}
-
-		return nil
+		return packer.addDir(fileDir)
 	}
 
 	entries := dirent.Entries
@@ -1044,11 +1034,11 @@ func packDir(ar *zip.Writer, repo *repomgr.Repo, dirID, dirPath string, cryptKey
 		fileDir := filepath.Join(dirPath, v.Name)
 		fileDir = strings.TrimLeft(fileDir, "/")
 		if fsmgr.IsDir(v.Mode) {
-			if err := packDir(ar, repo, v.ID, fileDir, cryptKey); err != nil {
+			if err := packDir(packer, repo, v.ID, fileDir); err != nil {
 				return err
 			}
 		} else {
-			if err := packFiles(ar, v, repo, dirPath, v.Name, cryptKey); err != nil {
+			if err := packFiles(packer, v, repo, dirPath, v.Name); err != nil {
 				return err
 			}
 		}
@@ -1057,7 +1047,9 @@ func packDir(ar *zip.Writer, repo *repomgr.Repo, dirID, dirPath string, cryptKey
 	return nil
 }
 
-func packFiles(ar *zip.Writer, dirent *fsmgr.SeafDirent, repo *repomgr.Repo, parentPath, baseName string, cryptKey *seafileCrypt) error {
+// packFiles queues the file for packing. Errors of queued files are
+// returned by the following calls or by packer.close().
+func packFiles(packer *zipPacker, dirent *fsmgr.SeafDirent, repo *repomgr.Repo, parentPath, baseName string) error {
 	file, err := fsmgr.GetSeafile(repo.StoreID, dirent.ID)
 	if err != nil {
 		err := fmt.Errorf("failed to get seafile : %v", err)
@@ -1067,41 +1059,7 @@ func packFiles(ar *zip.Writer, dirent *fsmgr.SeafDirent, repo *repomgr.Repo, par
 	filePath := filepath.Join(parentPath, baseName)
 	filePath = strings.TrimLeft(filePath, "/")
 
-	fileHeader := new(zip.FileHeader)
-	fileHeader.Name = filePath
-	fileHeader.Modified = time.Unix(dirent.Mtime, 0)
-	fileHeader.Method = zip.Deflate
-	zipFile, err := ar.CreateHeader(fileHeader)
-	if err != nil {
-		err := fmt.Errorf("failed to create zip file : %v", err)
-		return err
-	}
-
-	if cryptKey != nil {
-		for _, blkID := range file.BlkIDs {
-			var buf bytes.Buffer
-			blockmgr.Read(repo.StoreID, blkID, &buf)
-			decoded, err := cryptKey.decrypt(buf.Bytes())
-			if err != nil {
-				err := fmt.Errorf("failed to decrypt block %s: %v", blkID, err)
-				return err
-			}
-			_, err = zipFile.Write(decoded)
-			if err != nil {
-				return err
-			}
-		}
-		return nil
-	}
-
-	for _, blkID := range file.BlkIDs {
-		err := blockmgr.Read(repo.StoreID, blkID, zipFile)
-		if err != nil {
-			return err
-		}
-	}
-
-	return nil
+	return packer.addFile(filePath, dirent.Mtime, file.BlkIDs)
 }
 
 type recvData struct {
@@ -2147,6 +2105,7 @@ func onBranchUpdated(repoID string, commitID string, updateRepoInfo bool) error
 		if err := repomgr.UpdateRepoInfo(repoID, commitID); err != nil {
 			return err
 		}
+		go scheduleFileHistoryUpdate(repoID)
 	}
 
 	if option.EnableNotification {
@@ -2398,8 +2357,17 @@ func shouldIgnoreFile(fileName string) bool {
 }
 
 func indexBlocks(ctx context.Context, repoID string, version int, filePath string, handler *multipart.FileHeader, cryptKey *seafileCrypt) (string, int64, error) {
+	// The file is opened once and shared by all chunking workers, which
+	// read their blocks with positional reads.
+	var file multipart.File
 	var size int64
 	if handler != nil {
+		f, err := handler.Open()
+		if err != nil {
+			err := fmt.Errorf("failed to open file for read: %v", err)
+			return "", -1, err
+		}
+		file = f
 		size = handler.Size
 	} else {
 		f, err := os.Open(filePath)
@@ -2407,16 +2375,18 @@ func indexBlocks(ctx context.Context, repoID string, version int, filePath strin
 			err := fmt.Errorf("failed to open file: %s: %v", filePath, err)
 			return "", -1, err
 		}
-		defer f.Close()
 		fileInfo, err := f.Stat()
 		if err != nil {
+			f.Close()
 			err := fmt.Errorf("failed to stat file %s: %v", filePath, err)
 			return "", -1, err
 		}
+		file = f
 		size = fileInfo.Size()
 	}
 
 	if size == 0 {
+		file.Close()
 		return fsmgr.EmptySha1, 0, nil
 	}
 
@@ -2424,55 +2394,58 @@ func indexBlocks(ctx context.Context, repoID string, version int, filePath strin
 	results := make(chan chunkingResult, 10)
 	go createChunkPool(ctx, int(option.MaxIndexingThreads), chunkJobs, results)
 
-	var blkSize int64
-	var offset int64
-
-	jobNum := (uint64(size) + option.FixedBlockSize - 1) / option.FixedBlockSize
-	blkIDs := make([]string, jobNum)
-
-	left := size
-	for {
-		if uint64(left) >= option.FixedBlockSize {
-			blkSize = int64(option.FixedBlockSize)
-		} else {
-			blkSize = left
+	var blkIDs []string
+	setBlkID := func(result chunkingResult) {
+		for int64(len(blkIDs)) <= result.idx {
+			blkIDs = append(blkIDs, "")
 		}
-		if left > 0 {
-			job := chunkingData{repoID, filePath, handler, offset, cryptKey}
+		blkIDs[result.idx] = result.blkID
+	}
+
+	var jobNum int64
+	var chunkErr error
+	queueJob := func(offset, blkSize int64) bool {
+		job := chunkingData{repoID, file, jobNum, offset, blkSize, cryptKey}
+		for {
 			select {
 			case chunkJobs <- job:
-				left -= blkSize
-				offset += blkSize
+				jobNum++
+				return true
 			case result := <-results:
 				if result.err != nil {
-					close(chunkJobs)
-
-					go RecoverWrapper(func() {
-						for result := range results {
-							_ = result
-						}
-					})
-					return "", -1, result.err
-				}
-				blkIDs[result.idx] = result.blkID
-			}
-		} else {
-			close(chunkJobs)
-			for result := range results {
-				if result.err != nil {
-					go RecoverWrapper(func() {
-						for result := range results {
-							_ = result
-						}
-					})
-					return "", -1, result.err
+					chunkErr = result.err
+					return false
 				}
-				blkIDs[result.idx] = result.blkID
+				setBlkID(result)
 			}
-			break
 		}
 	}
 
+	var err error
+	if option.ContentDefinedChunking {
+		chunker := newCDCChunker(int(option.CDCMinBlockSize), int(option.CDCAvgBlockSize), int(option.CDCMaxBlockSize))
+		err = chunker.split(file, size, queueJob)
+	} else {
+		splitFixedBlocks(size, int64(option.FixedBlockSize), queueJob)
+	}
+	if chunkErr != nil {
+		err = chunkErr
+	}
+	close(chunkJobs)
+	if err != nil {
+		drainChunkResults(results, file)
+		return "", -1, err
+	}
+
+	for result := range results {
+		if result.err != nil {
+			drainChunkResults(results, file)
+			return "", -1, result.err
+		}
+		setBlkID(result)
+	}
+	file.Close()
+
 	fileID, err := writeSeafile(repoID, version, size, blkIDs)
 	if err != nil {
 		err := fmt.Errorf("failed to write seafile: %v", err)
@@ -2482,6 +2455,31 @@ func indexBlocks(ctx context.Context, repoID string, version int, filePath strin
 	return fileID, size, nil
 }
 
+// splitFixedBlocks calls fn with the offset and length of each block of
+// blkSize bytes, until fn returns false.
+func splitFixedBlocks(size, blkSize int64, fn func(offset, length int64) bool) {
+	for offset := int64(0); offset < size; offset += blkSize {
+		length := blkSize
+		if size-offset < length {
+			length = size - offset
+		}
+		if !fn(offset, length) {
+			return
+		}
+	}
+}
+
+// drainChunkResults discards the remaining results and closes the file
+// once all workers have stopped reading it.
+func drainChunkResults(results chan chunkingResult, file io.Closer) {
+	go RecoverWrapper(func() {
+		for result := range results {
+			_ = result
+		}
+		file.Close()
+	})
+}
+
 func writeSeafile(repoID string, version int, fileSize int64, blkIDs []string) (string, error) {
 	seafile, err := fsmgr.NewSeafile(version, fileSize, blkIDs)
 	if err != nil {
@@ -2500,9 +2498,10 @@ func writeSeafile(repoID string, version int, fileSize int64, blkIDs []string) (
 
 type chunkingData struct {
 	repoID   string
-	filePath string
-	handler  *multipart.FileHeader
+	file     io.ReaderAt
+	idx      int64
 	offset   int64
+	size     int64
 	cryptKey *seafileCrypt
 }
 
@@ -2546,52 +2545,42 @@ func chunkingWorker(ctx context.Context, wg *sync.WaitGroup, chunkJobs chan chun
 
 		job := job
 		blkID, err := chunkFile(job)
-		idx := job.offset / int64(option.FixedBlockSize)
-		result := chunkingResult{idx, blkID, err}
+		result := chunkingResult{job.idx, blkID, err}
 		res <- result
 	}
 	wg.Done()
 }
 
-func chunkFile(job chunkingData) (string, error) {
-	repoID := job.repoID
-	offset := job.offset
-	filePath := job.filePath
-	handler := job.handler
-	blkSize := option.FixedBlockSize
-	cryptKey := job.cryptKey
-	var file multipart.File
-	if handler != nil {
-		f, err := handler.Open()
-		if err != nil {
-			err := fmt.Errorf("failed to open file for read: %v", err)
-			return "", err
+// Block buffers have room for the padding added by in-place encryption.
+var blockBufPool = sync.Pool{
+	New: func() interface{} {
+		blkSize := option.FixedBlockSize
+		if option.ContentDefinedChunking && option.CDCMaxBlockSize > blkSize {
+			blkSize = option.CDCMaxBlockSize
 		}
-		defer f.Close()
-		file = f
-	} else {
-		f, err := os.Open(filePath)
-		if err != nil {
-			err := fmt.Errorf("failed to open file for read: %v", err)
-			return "", err
-		}
-		defer f.Close()
-		file = f
-	}
-	_, err := file.Seek(offset, io.SeekStart)
-	if err != nil {
-		err := fmt.Errorf("failed to seek file: %v", err)
-		return "", err
+		buf := make([]byte, blkSize+aes.BlockSize)
+		return &buf
+	},
+}
+
+func chunkFile(job chunkingData) (string, error) {
+	bufp := blockBufPool.Get().(*[]byte)
+	defer blockBufPool.Put(bufp)
+	if int64(cap(*bufp)) < job.size+aes.BlockSize {
+		*bufp = make([]byte, job.size+aes.BlockSize)
 	}
-	buf := make([]byte, blkSize)
-	n, err := file.Read(buf)
-	if err != nil {
-		err := fmt.Errorf("failed to seek file: %v", err)
+	buf := (*bufp)[:job.size]
+
+	n, err := job.file.ReadAt(buf, job.offset)
+	if n < len(buf) {
+		if err == nil || err == io.EOF {
+			err = io.ErrUnexpectedEOF
+		}
+		err := fmt.Errorf("failed to read file: %v", err)
 		return "", err
 	}
-	buf = buf[:n]
 
-	blkID, err := writeChunk(repoID, buf, int64(n), cryptKey)
+	blkID, err := writeChunk(job.repoID, buf, job.cryptKey)
 	if err != nil {
 		err := fmt.Errorf("failed to write chunk: %v", err)
 		return "", err
@@ -2600,37 +2589,30 @@ func chunkFile(job chunkingData) (string, error) {
 	return blkID, nil
 }
 
-func writeChunk(repoID string, input []byte, blkSize int64, cryptKey *seafileCrypt) (string, error) {
-	var blkID string
-	if cryptKey != nil && blkSize > 0 {
-		encoded, err := cryptKey.encrypt(input)
+// writeChunk writes a block if it doesn't exist yet. An encrypted block is
+// encrypted in the input buffer, which needs one AES block of spare
+// capacity to avoid a copy.
+func writeChunk(repoID string, input []byte, cryptKey *seafileCrypt) (string, error) {
+	data := input
+	if cryptKey != nil && len(input) > 0 {
+		encoded, err := cryptKey.encryptInPlace(input)
 		if err != nil {
 			err := fmt.Errorf("failed to encrypt block: %v", err)
 			return "", err
 		}
-		checkSum := sha1.Sum(encoded)
-		blkID = hex.EncodeToString(checkSum[:])
-		if blockmgr.Exists(repoID, blkID) {
-			return blkID, nil
-		}
-		reader := bytes.NewReader(encoded)
-		err = blockmgr.Write(repoID, blkID, reader)
-		if err != nil {
-			err := fmt.Errorf("failed to write block: %v", err)
-			return "", err
-		}
-	} else {
-		checkSum := sha1.Sum(input)
-		blkID = hex.EncodeToString(checkSum[:])
-		if blockmgr.Exists(repoID, blkID) {
-			return blkID, nil
-		}
-		reader := bytes.NewReader(input)
-		err := blockmgr.Write(repoID, blkID, reader)
-		if err != nil {
-			err := fmt.Errorf("failed to write block: %v", err)
-			return "", err
-		}
+		data = encoded
+	}
+
+	checkSum := sha1.Sum(data)
+	blkID := hex.EncodeToString(checkSum[:])
+	if blockmgr.Exists(repoID, blkID) {
+		return blkID, nil
+	}
+	reader := bytes.NewReader(data)
+	err := blockmgr.Write(repoID, blkID, reader)
+	if err != nil {
+		err := fmt.Errorf("failed to write block: %v", err)
+		return "", err
 	}
 
 	return blkID, nil
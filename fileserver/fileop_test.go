@@ -0,0 +1,125 @@
+package main
+
+import (
+	"bytes"
+	"context"
+	"os"
+	"path/filepath"
+	"runtime"
+	"testing"
+
+	"github.com/haiwen/seafile-server/fileserver/blockmgr"
+	"github.com/haiwen/seafile-server/fileserver/fsmgr"
+	"github.com/haiwen/seafile-server/fileserver/option"
+)
+
+const indexTestRepoID = "e8e9ed5c-9a41-4b12-8c18-d1a2bd0e4c6b"
+
+// indexTestInit sets up the block and fs stores in a temporary directory.
+func indexTestInit(tb testing.TB, blkSize uint64, threads uint32) string {
+	dataDir := tb.TempDir()
+	blockmgr.Init(dataDir, dataDir)
+	fsmgr.Init(dataDir, dataDir, option.FsCacheLimit)
+
+	oldBlkSize, oldThreads := option.FixedBlockSize, option.MaxIndexingThreads
+	option.FixedBlockSize = blkSize
+	option.MaxIndexingThreads = threads
+	tb.Cleanup(func() {
+		option.FixedBlockSize, option.MaxIndexingThreads = oldBlkSize, oldThreads
+	})
+
+	return dataDir
+}
+
+func indexTestWriteFile(tb testing.TB, dir string, content []byte) string {
+	path := filepath.Join(dir, "upload")
+	if err := os.WriteFile(path, content, 0644); err != nil {
+		tb.Fatalf("failed to write file: %v", err)
+	}
+	return path
+}
+
+func testIndexBlocks(t *testing.T, cryptKey *seafileCrypt) {
+	dataDir := indexTestInit(t, 1000, 3)
+	for _, size := range []int{0, 1, 999, 1000, 1001, 12345} {
+		content := zipTestRandom(size)
+		path := indexTestWriteFile(t, dataDir, content)
+
+		fileID, fileSize, err := indexBlocks(context.Background(), indexTestRepoID, 1, path, nil, cryptKey)
+		if err != nil {
+			t.Fatalf("failed to index file of size %d: %v", size, err)
+		}
+		if fileSize != int64(size) {
+			t.Errorf("indexed size is %d, expected %d", fileSize, size)
+		}
+		if size == 0 {
+			if fileID != fsmgr.EmptySha1 {
+				t.Errorf("empty file has id %s", fileID)
+			}
+			continue
+		}
+
+		file, err := fsmgr.GetSeafile(indexTestRepoID, fileID)
+		if err != nil {
+			t.Fatalf("failed to get seafile %s: %v", fileID, err)
+		}
+		var data []byte
+		for _, blkID := range file.BlkIDs {
+			var buf bytes.Buffer
+			if err := blockmgr.Read(indexTestRepoID, blkID, &buf); err != nil {
+				t.Fatalf("failed to read block %s: %v", blkID, err)
+			}
+			blk := buf.Bytes()
+			if cryptKey != nil {
+				blk, err = cryptKey.decrypt(blk)
+				if err != nil {
+					t.Fatalf("failed to decrypt block %s: %v", blkID, err)
+				}
+			}
+			data = append(data, blk...)
+		}
+		if !bytes.Equal(data, content) {
+			t.Errorf("wrong content of indexed file of size %d", size)
+		}
+	}
+}
+
+func TestIndexBlocks(t *testing.T) {
+	testIndexBlocks(t, nil)
+	testIndexBlocks(t, &seafileCrypt{key: zipTestRandom(32), iv: zipTestRandom(16), version: 2})
+	testIndexBlocks(t, &seafileCrypt{key: zipTestRandom(32), iv: zipTestRandom(16), version: 3})
+}
+
+// BenchmarkIndexBlocks indexes a 64MB file with the default block size and
+// reports the bytes allocated per GB uploaded. The blocks are stored by the
+// first iteration, so later ones measure reading, encryption and hashing.
+func BenchmarkIndexBlocks(b *testing.B) {
+	for _, bench := range []struct {
+		name     string
+		cryptKey *seafileCrypt
+	}{
+		{"plain", nil},
+		{"encrypted", &seafileCrypt{key: zipTestRandom(32), iv: zipTestRandom(16), version: 2}},
+	} {
+		b.Run(bench.name, func(b *testing.B) {
+			dataDir := indexTestInit(b, 1<<23, 4)
+			content := zipTestRandom(64 << 20)
+			path := indexTestWriteFile(b, dataDir, content)
+
+			var before, after runtime.MemStats
+			b.SetBytes(int64(len(content)))
+			b.ReportAllocs()
+			b.ResetTimer()
+			runtime.ReadMemStats(&before)
+			for i := 0; i < b.N; i++ {
+				if _, _, err := indexBlocks(context.Background(), indexTestRepoID, 1, path, nil, bench.cryptKey); err != nil {
+					b.Fatalf("failed to index file: %v", err)
+				}
+			}
+			runtime.ReadMemStats(&after)
+			gb := float64(b.N) * float64(len(content)) / (1 << 30)
+			b.ReportMetric(float64(after.TotalAlloc-before.TotalAlloc)/gb, "B/GB")
+			b.ReportMetric(float64(after.Mallocs-before.Mallocs)/gb, "allocs/GB")
+		})
+	}
+}
@@ -0,0 +1,284 @@
+package main
+
+import (
+	"fmt"
+	"net/http"
+	"os"
+	"path/filepath"
+	"strconv"
+	"sync"
+
+	"github.com/haiwen/seafile-server/fileserver/metrics"
+)
+
+// Fs id lists are encoded as a JSON array while the diff runs, and sent to
+// the client in chunks. Chunks the client hasn't received yet are kept in
+// memory up to fsIDListMemLimit; after that they're spilled to a temp file,
+// so a slow client doesn't make the server hold a large list in memory.
+var (
+	fsIDListChunkSize = 64 << 10
+	fsIDListMemLimit  = 4 << 20
+)
+
+// fsIDSpool holds the chunks produced by the diff until they're sent.
+type fsIDSpool struct {
+	sync.Mutex
+	cond *sync.Cond
+
+	chunks  [][]byte
+	memSize int
+
+	// Once the spool spills, all later chunks go to the file, so chunks in
+	// memory are always older than the data in the file.
+	dir      string
+	file     *os.File
+	fileSize int64
+	readOff  int64
+
+	closed   bool
+	aborted  bool
+	writeErr error
+}
+
+func newFsIDSpool(dir string) *fsIDSpool {
+	spool := &fsIDSpool{dir: dir}
+	spool.cond = sync.NewCond(spool)
+	return spool
+}
+
+func (s *fsIDSpool) put(chunk []byte) error {
+	s.Lock()
+	defer s.Unlock()
+
+	if s.writeErr != nil {
+		return s.writeErr
+	}
+
+	if s.file == nil && s.memSize+len(chunk) <= fsIDListMemLimit {
+		s.chunks = append(s.chunks, chunk)
+		s.memSize += len(chunk)
+		metrics.FsIDList.MemBytes.Add(int64(len(chunk)))
+		s.cond.Signal()
+		return nil
+	}
+
+	if s.file == nil {
+		f, err := os.CreateTemp(s.dir, "fs-id-list-")
+		if err != nil {
+			return fmt.Errorf("failed to create temp file: %w", err)
+		}
+		// Only this spool uses the file.
+		os.Remove(f.Name())
+		s.file = f
+	}
+	if _, err := s.file.WriteAt(chunk, s.fileSize); err != nil {
+		return fmt.Errorf("failed to write temp file: %w", err)
+	}
+	s.fileSize += int64(len(chunk))
+	metrics.FsIDList.SpilledBytes.Add(int64(len(chunk)))
+	s.cond.Signal()
+
+	return nil
+}
+
+// next returns the next chunk to send, or nil when there's nothing more.
+func (s *fsIDSpool) next(buf []byte) ([]byte, error) {
+	s.Lock()
+	defer s.Unlock()
+
+	for len(s.chunks) == 0 && s.readOff == s.fileSize && !s.closed && !s.aborted {
+		s.cond.Wait()
+	}
+	if s.aborted {
+		return nil, nil
+	}
+
+	if len(s.chunks) > 0 {
+		chunk := s.chunks[0]
+		s.chunks[0] = nil
+		s.chunks = s.chunks[1:]
+		s.memSize -= len(chunk)
+		metrics.FsIDList.MemBytes.Add(-int64(len(chunk)))
+		return chunk, nil
+	}
+
+	if s.readOff < s.fileSize {
+		n := int64(len(buf))
+		if left := s.fileSize - s.readOff; left < n {
+			n = left
+		}
+		if _, err := s.file.ReadAt(buf[:n], s.readOff); err != nil {
+			return nil, fmt.Errorf("failed to read temp file: %w", err)
+		}
+		s.readOff += n
+		return buf[:n], nil
+	}
+
+	return nil, nil
+}
+
+func (s *fsIDSpool) fail(err error) {
+	s.Lock()
+	s.writeErr = err
+	s.Unlock()
+}
+
+func (s *fsIDSpool) close(aborted bool) {
+	s.Lock()
+	s.closed = true
+	s.aborted = aborted
+	s.cond.Signal()
+	s.Unlock()
+}
+
+func (s *fsIDSpool) release() {
+	s.Lock()
+	defer s.Unlock()
+
+	metrics.FsIDList.MemBytes.Add(-int64(s.memSize))
+	s.chunks = nil
+	s.memSize = 0
+	if s.file != nil {
+		metrics.FsIDList.SpilledBytes.Add(-s.fileSize)
+		s.file.Close()
+		s.file = nil
+	}
+}
+
+// fsIDListWriter writes an fs id list as a JSON array. Lists that fit in one
+// chunk are sent as a normal reply, so that errors in the diff can still be
+// reported with a status code. Longer lists are streamed as soon as the
+// first chunk is full.
+type fsIDListWriter struct {
+	rsp    http.ResponseWriter
+	tmpDir string
+	chunk  []byte
+	count  int
+
+	spool *fsIDSpool
+	done  chan error
+}
+
+func newFsIDListWriter(rsp http.ResponseWriter, tmpDir string) *fsIDListWriter {
+	metrics.FsIDList.Requests.Add(1)
+
+	w := new(fsIDListWriter)
+	w.rsp = rsp
+	w.tmpDir = tmpDir
+	w.chunk = make([]byte, 0, fsIDListChunkSize+64)
+	w.chunk = append(w.chunk, '[')
+	return w
+}
+
+func (w *fsIDListWriter) add(id string) error {
+	if w.count > 0 {
+		w.chunk = append(w.chunk, ',')
+	}
+	w.chunk = append(w.chunk, '"')
+	w.chunk = append(w.chunk, id...)
+	w.chunk = append(w.chunk, '"')
+	w.count++
+
+	if len(w.chunk) < fsIDListChunkSize {
+		return nil
+	}
+	return w.flush()
+}
+
+func (w *fsIDListWriter) flush() error {
+	if w.spool == nil {
+		w.startStreaming()
+	}
+
+	chunk := w.chunk
+	w.chunk = make([]byte, 0, fsIDListChunkSize+64)
+	return w.spool.put(chunk)
+}
+
+func (w *fsIDListWriter) startStreaming() {
+	w.spool = newFsIDSpool(w.tmpDir)
+	w.done = make(chan error, 1)
+
+	w.rsp.WriteHeader(http.StatusOK)
+	go func() {
+		err := fmt.Errorf("panic in sending fs id list")
+		RecoverWrapper(func() {
+			err = w.send()
+		})
+		w.done <- err
+	}()
+}
+
+func (w *fsIDListWriter) send() error {
+	flusher, _ := w.rsp.(http.Flusher)
+	buf := make([]byte, fsIDListChunkSize)
+
+	for {
+		chunk, err := w.spool.next(buf)
+		if err != nil {
+			w.spool.fail(err)
+			return err
+		}
+		if chunk == nil {
+			return nil
+		}
+		if _, err := w.rsp.Write(chunk); err != nil {
+			err := fmt.Errorf("failed to send fs id list: %w", err)
+			w.spool.fail(err)
+			return err
+		}
+		if flusher != nil {
+			flusher.Flush()
+		}
+	}
+}
+
+// finish ends the array. If the list is streamed, the rest of it is sent in
+// the background until wait returns.
+func (w *fsIDListWriter) finish() error {
+	w.chunk = append(w.chunk, ']')
+
+	if w.spool == nil {
+		w.rsp.Header().Set("Content-Length", strconv.Itoa(len(w.chunk)))
+		w.rsp.WriteHeader(http.StatusOK)
+		w.rsp.Write(w.chunk)
+		w.chunk = nil
+		return nil
+	}
+
+	err := w.spool.put(w.chunk)
+	w.chunk = nil
+	w.spool.close(err != nil)
+	return err
+}
+
+// abort stops sending the list. The closing bracket is never sent, so the
+// client can't take a cut off list as complete.
+func (w *fsIDListWriter) abort() {
+	w.chunk = nil
+	if w.spool != nil {
+		w.spool.close(true)
+	}
+}
+
+// streaming reports whether the reply has been started, after which errors
+// can't be reported with a status code.
+func (w *fsIDListWriter) streaming() bool {
+	return w.spool != nil
+}
+
+// wait waits until the list is sent and releases its buffers. It must be
+// called once for every writer.
+func (w *fsIDListWriter) wait() error {
+	var err error
+	if w.spool != nil {
+		err = <-w.done
+		w.spool.release()
+	}
+	metrics.FsIDList.Requests.Add(-1)
+	return err
+}
+
+func fsIDListTmpDir() string {
+	return filepath.Join(absDataDir, "httptemp")
+}
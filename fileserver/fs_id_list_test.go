@@ -0,0 +1,144 @@
+package main
+
+import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"net/http"
+	"net/http/httptest"
+	"sync"
+	"testing"
+
+	"github.com/haiwen/seafile-server/fileserver/metrics"
+)
+
+func fsIDListTestIDs(n int) []string {
+	ids := make([]string, n)
+	for i := range ids {
+		ids[i] = fmt.Sprintf("%040x", i)
+	}
+	return ids
+}
+
+func fsIDListTestCheck(t *testing.T, body []byte, ids []string) {
+	var got []string
+	if err := json.Unmarshal(body, &got); err != nil {
+		t.Fatalf("failed to decode fs id list: %v", err)
+	}
+	if len(got) != len(ids) {
+		t.Fatalf("got %d ids, want %d", len(got), len(ids))
+	}
+	for i := range ids {
+		if got[i] != ids[i] {
+			t.Fatalf("id %d is %s, want %s", i, got[i], ids[i])
+		}
+	}
+}
+
+func TestFsIDListWriterShort(t *testing.T) {
+	for _, n := range []int{0, 1, 100} {
+		rec := httptest.NewRecorder()
+		w := newFsIDListWriter(rec, t.TempDir())
+		ids := fsIDListTestIDs(n)
+		for _, id := range ids {
+			if err := w.add(id); err != nil {
+				t.Fatalf("failed to add id: %v", err)
+			}
+		}
+		if err := w.finish(); err != nil {
+			t.Fatalf("failed to finish list: %v", err)
+		}
+		if w.streaming() {
+			t.Fatalf("short list shouldn't be streamed")
+		}
+		if err := w.wait(); err != nil {
+			t.Fatalf("failed to send list: %v", err)
+		}
+		if rec.Header().Get("Content-Length") == "" {
+			t.Fatalf("short list should have a content length")
+		}
+		fsIDListTestCheck(t, rec.Body.Bytes(), ids)
+	}
+}
+
+// fsIDListSlowWriter blocks writes until it's released.
+type fsIDListSlowWriter struct {
+	header  http.Header
+	release chan struct{}
+	mu      sync.Mutex
+	body    bytes.Buffer
+}
+
+func (w *fsIDListSlowWriter) Header() http.Header        { return w.header }
+func (w *fsIDListSlowWriter) WriteHeader(statusCode int) {}
+func (w *fsIDListSlowWriter) Write(p []byte) (int, error) {
+	<-w.release
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	return w.body.Write(p)
+}
+
+func TestFsIDListWriterSpill(t *testing.T) {
+	oldChunkSize, oldMemLimit := fsIDListChunkSize, fsIDListMemLimit
+	fsIDListChunkSize, fsIDListMemLimit = 1024, 4096
+	defer func() {
+		fsIDListChunkSize, fsIDListMemLimit = oldChunkSize, oldMemLimit
+	}()
+
+	rsp := &fsIDListSlowWriter{header: make(http.Header), release: make(chan struct{})}
+	w := newFsIDListWriter(rsp, t.TempDir())
+	ids := fsIDListTestIDs(5000)
+	for _, id := range ids {
+		if err := w.add(id); err != nil {
+			t.Fatalf("failed to add id: %v", err)
+		}
+	}
+
+	if !w.streaming() {
+		t.Fatalf("long list should be streamed")
+	}
+	if mem := metrics.FsIDList.MemBytes.Load(); mem > int64(fsIDListMemLimit) {
+		t.Fatalf("%d bytes buffered in memory, limit is %d", mem, fsIDListMemLimit)
+	}
+	if metrics.FsIDList.SpilledBytes.Load() == 0 {
+		t.Fatalf("list to slow client should be spilled")
+	}
+
+	if err := w.finish(); err != nil {
+		t.Fatalf("failed to finish list: %v", err)
+	}
+	close(rsp.release)
+	if err := w.wait(); err != nil {
+		t.Fatalf("failed to send list: %v", err)
+	}
+	fsIDListTestCheck(t, rsp.body.Bytes(), ids)
+
+	if metrics.FsIDList.Requests.Load() != 0 ||
+		metrics.FsIDList.MemBytes.Load() != 0 ||
+		metrics.FsIDList.SpilledBytes.Load() != 0 {
+		t.Fatalf("metrics not reset after request")
+	}
+}
+
+func TestFsIDListWriterAbort(t *testing.T) {
+	oldChunkSize := fsIDListChunkSize
+	fsIDListChunkSize = 1024
+	defer func() {
+		fsIDListChunkSize = oldChunkSize
+	}()
+
+	rec := httptest.NewRecorder()
+	w := newFsIDListWriter(rec, t.TempDir())
+	for _, id := range fsIDListTestIDs(100) {
+		if err := w.add(id); err != nil {
+			t.Fatalf("failed to add id: %v", err)
+		}
+	}
+	w.abort()
+	w.wait()
+
+	var got []string
+	if err := json.Unmarshal(rec.Body.Bytes(), &got); err == nil {
+		t.Fatalf("aborted list shouldn't be valid JSON")
+	}
+}
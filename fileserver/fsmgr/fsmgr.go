@@ -756,6 +756,17 @@ func Exists(repoID string, objID string) (bool, error) {
 	return store.Exists(repoID, objID)
 }
 
+// ExistsMany checks whether each of the fs objects exists.
+func ExistsMany(repoID string, objIDs []string) []bool {
+	res := store.ExistsMany(repoID, objIDs)
+	for i, objID := range objIDs {
+		if objID == EmptySha1 {
+			res[i] = true
+		}
+	}
+	return res
+}
+
 func comp(c rune) bool {
 	return c == '/'
 }
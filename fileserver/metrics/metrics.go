@@ -8,6 +8,7 @@ import (
 	"net/http"
 	"runtime/debug"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/dgraph-io/ristretto/z"
@@ -54,6 +55,21 @@ func (m *MetricMgr) DecReq(e *list.Element) {
 	m.inFlightRequestList.Remove(e)
 }
 
+// FsIDList tracks the fs id list requests being served, and how much of
+// their results are buffered in memory or spilled to disk.
+var FsIDList struct {
+	Requests     atomic.Int64
+	MemBytes     atomic.Int64
+	SpilledBytes atomic.Int64
+}
+
+// Download counts the blocks of file downloads that were read ahead, and
+// whether they were ready when the download got to them.
+var Download struct {
+	PrefetchHits   atomic.Int64
+	PrefetchStalls atomic.Int64
+}
+
 var (
 	client *redis.Client
 	closer *z.Closer
@@ -135,21 +151,55 @@ func publishMetrics() error {
 	inFlightRequestCount := metricMgr.inFlightRequestList.Len()
 	metricMgr.Unlock()
 
-	msg := &MetricMessage{MetricName: "in_flight_request_total",
-		MetricValue:   inFlightRequestCount,
-		MetricType:    "gauge",
-		ComponentName: ComponentName,
-		MetricHelp:    "The number of currently running http requests.",
+	msgs := []*MetricMessage{
+		{MetricName: "in_flight_request_total",
+			MetricValue:   inFlightRequestCount,
+			MetricType:    "gauge",
+			ComponentName: ComponentName,
+			MetricHelp:    "The number of currently running http requests.",
+		},
+		{MetricName: "fs_id_list_request_total",
+			MetricValue:   FsIDList.Requests.Load(),
+			MetricType:    "gauge",
+			ComponentName: ComponentName,
+			MetricHelp:    "The number of fs id list requests being served.",
+		},
+		{MetricName: "fs_id_list_memory_bytes",
+			MetricValue:   FsIDList.MemBytes.Load(),
+			MetricType:    "gauge",
+			ComponentName: ComponentName,
+			MetricHelp:    "The bytes of fs id lists buffered in memory.",
+		},
+		{MetricName: "fs_id_list_spilled_bytes",
+			MetricValue:   FsIDList.SpilledBytes.Load(),
+			MetricType:    "gauge",
+			ComponentName: ComponentName,
+			MetricHelp:    "The bytes of fs id lists spilled to temp files.",
+		},
+		{MetricName: "download_prefetch_hit_total",
+			MetricValue:   Download.PrefetchHits.Load(),
+			MetricType:    "counter",
+			ComponentName: ComponentName,
+			MetricHelp:    "The number of read-ahead blocks that were ready when needed.",
+		},
+		{MetricName: "download_prefetch_stall_total",
+			MetricValue:   Download.PrefetchStalls.Load(),
+			MetricType:    "counter",
+			ComponentName: ComponentName,
+			MetricHelp:    "The number of read-ahead blocks that downloads had to wait for.",
+		},
 	}
 
-	data, err := json.Marshal(msg)
-	if err != nil {
-		return err
-	}
+	for _, msg := range msgs {
+		data, err := json.Marshal(msg)
+		if err != nil {
+			return err
+		}
 
-	err = publishRedisMsg(RedisChannel, data)
-	if err != nil {
-		return err
+		err = publishRedisMsg(RedisChannel, data)
+		if err != nil {
+			return err
+		}
 	}
 
 	return nil
@@ -5,6 +5,12 @@ import (
 	"io"
 	"os"
 	"path"
+	"sync"
+)
+
+const (
+	existsBatchSize  = 256
+	existsMaxWorkers = 16
 )
 
 type fsBackend struct {
@@ -92,6 +98,44 @@ func (b *fsBackend) exists(repoID string, objID string) (bool, error) {
 	return true, nil
 }
 
+func (b *fsBackend) existsMany(repoID string, objIDs []string) []bool {
+	res := make([]bool, len(objIDs))
+	checkRange := func(start, end int) {
+		for i := start; i < end; i++ {
+			res[i], _ = b.exists(repoID, objIDs[i])
+		}
+	}
+
+	if len(objIDs) <= existsBatchSize {
+		checkRange(0, len(objIDs))
+		return res
+	}
+
+	// Stat the objects in parallel, each worker takes a batch at a time.
+	batches := make(chan int)
+	var wg sync.WaitGroup
+	for w := 0; w < existsMaxWorkers; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for start := range batches {
+				end := start + existsBatchSize
+				if end > len(objIDs) {
+					end = len(objIDs)
+				}
+				checkRange(start, end)
+			}
+		}()
+	}
+	for start := 0; start < len(objIDs); start += existsBatchSize {
+		batches <- start
+	}
+	close(batches)
+	wg.Wait()
+
+	return res
+}
+
 func (b *fsBackend) stat(repoID string, objID string) (int64, error) {
 	path := path.Join(b.objDir, repoID, objID[:2], objID[2:])
 	fileInfo, err := os.Stat(path)
@@ -0,0 +1,707 @@
+// Implementation of pack file storage backend.
+//
+// Objects of a repo are appended to large pack files instead of one file per
+// object. The on-disk format is shared with common/obj-backend-pack.c, so the
+// C server, GC and this fileserver can use the same packs:
+//
+//	<seafileDataDir>/storage/<objType>-packs/<repoID>/
+//	    NNNNNNNN.pack  "SEAFPACK" followed by records: 20-byte raw object id,
+//	                   32-bit big-endian length, data. A length of
+//	                   packTombstone marks a deleted object.
+//	    index          Header and entries (id, pack, offset, len) sorted by
+//	                   id, covering every record before (coveredPack,
+//	                   coveredOffset). Read through mmap.
+//	    lock           flock()ed shared to read and exclusive to write.
+package objstore
+
+import (
+	"bytes"
+	"container/list"
+	"encoding/binary"
+	"encoding/hex"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"sync"
+	"syscall"
+)
+
+const (
+	packMagic        = "SEAFPACK"
+	indexMagic       = "SEAFPIDX"
+	indexVersion     = 1
+	packTombstone    = 0xFFFFFFFF
+	maxPackSize      = 256 << 20
+	maxUnindexedObjs = 4096
+	maxOpenRepos     = 256
+
+	recordHeaderSize = 24
+	indexHeaderSize  = 32
+	indexEntrySize   = 36
+)
+
+type objLocation struct {
+	pack   uint32
+	offset uint64
+	len    uint32
+}
+
+type packRepo struct {
+	dir    string
+	lock   sync.RWMutex
+	lockFd *os.File
+
+	indexMap  []byte
+	nEntries  int
+	indexStat os.FileInfo
+
+	tailPack   uint32
+	tailOffset uint64
+
+	recent  map[[20]byte]objLocation
+	deleted map[[20]byte]bool
+
+	packs map[uint32]*os.File
+
+	// Number of users, the repo is closed when it drops to zero after eviction.
+	refs    int
+	evicted bool
+}
+
+type packBackend struct {
+	packDir string
+
+	mu    sync.Mutex
+	repos map[string]*list.Element
+	lru   *list.List
+}
+
+func newPackBackend(seafileDataDir string, objType string) (*packBackend, error) {
+	packDir := filepath.Join(seafileDataDir, "storage", objType+"-packs")
+	err := os.MkdirAll(packDir, os.ModePerm)
+	if err != nil {
+		return nil, err
+	}
+	backend := new(packBackend)
+	backend.packDir = packDir
+	backend.repos = make(map[string]*list.Element)
+	backend.lru = list.New()
+	return backend, nil
+}
+
+func (r *packRepo) packPath(pack uint32) string {
+	return filepath.Join(r.dir, fmt.Sprintf("%08d.pack", pack))
+}
+
+func (r *packRepo) getPack(pack uint32) *os.File {
+	if f, ok := r.packs[pack]; ok {
+		return f
+	}
+	f, err := os.OpenFile(r.packPath(pack), os.O_RDWR, 0)
+	if err != nil {
+		return nil
+	}
+	r.packs[pack] = f
+	return f
+}
+
+// closeRemovedPacks closes packs that have been removed by compaction in
+// another process, their disk space isn't freed while they are open.
+func (r *packRepo) closeRemovedPacks() {
+	for pack, f := range r.packs {
+		info, err := f.Stat()
+		if err == nil {
+			if st, ok := info.Sys().(*syscall.Stat_t); !ok || st.Nlink > 0 {
+				continue
+			}
+		}
+		f.Close()
+		delete(r.packs, pack)
+	}
+}
+
+func (r *packRepo) unmapIndex() {
+	if r.indexMap != nil {
+		syscall.Munmap(r.indexMap)
+	}
+	r.indexMap = nil
+	r.nEntries = 0
+	r.indexStat = nil
+}
+
+// loadIndex maps the index and resets in-memory state to the index coverage.
+func (r *packRepo) loadIndex() error {
+	r.unmapIndex()
+	r.closeRemovedPacks()
+	r.recent = make(map[[20]byte]objLocation)
+	r.deleted = make(map[[20]byte]bool)
+	r.tailPack = 1
+	r.tailOffset = 0
+
+	f, err := os.Open(filepath.Join(r.dir, "index"))
+	if err != nil {
+		if os.IsNotExist(err) {
+			return nil
+		}
+		return err
+	}
+	defer f.Close()
+
+	info, err := f.Stat()
+	if err != nil {
+		return err
+	}
+	if info.Size() < indexHeaderSize {
+		return fmt.Errorf("invalid index in %s", r.dir)
+	}
+
+	data, err := syscall.Mmap(int(f.Fd()), 0, int(info.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return err
+	}
+
+	nEntries := binary.BigEndian.Uint64(data[24:32])
+	if string(data[:8]) != indexMagic ||
+		binary.BigEndian.Uint32(data[8:12]) != indexVersion ||
+		uint64(indexHeaderSize)+nEntries*indexEntrySize != uint64(info.Size()) {
+		syscall.Munmap(data)
+		return fmt.Errorf("invalid index in %s", r.dir)
+	}
+
+	r.indexMap = data
+	r.nEntries = int(nEntries)
+	r.tailPack = binary.BigEndian.Uint32(data[12:16])
+	r.tailOffset = binary.BigEndian.Uint64(data[16:24])
+	r.indexStat = info
+	return nil
+}
+
+func (r *packRepo) indexChanged() bool {
+	info, err := os.Stat(filepath.Join(r.dir, "index"))
+	if err != nil {
+		return r.indexMap != nil
+	}
+	if r.indexStat == nil {
+		return true
+	}
+	return !os.SameFile(info, r.indexStat) ||
+		info.Size() != r.indexStat.Size() ||
+		!info.ModTime().Equal(r.indexStat.ModTime())
+}
+
+func (r *packRepo) addRecent(id [20]byte, loc objLocation) {
+	delete(r.deleted, id)
+	r.recent[id] = loc
+}
+
+func (r *packRepo) addDeleted(id [20]byte) {
+	delete(r.recent, id)
+	r.deleted[id] = true
+}
+
+// scanTail reads records written after the last scanned position, possibly
+// by other processes. A partial record at the end is left for the next scan.
+func (r *packRepo) scanTail() {
+	var hdr [recordHeaderSize]byte
+	for {
+		f := r.getPack(r.tailPack)
+		if f == nil {
+			return
+		}
+		info, err := f.Stat()
+		if err != nil {
+			return
+		}
+		size := uint64(info.Size())
+
+		if r.tailOffset < uint64(len(packMagic)) {
+			magic := make([]byte, len(packMagic))
+			if _, err := f.ReadAt(magic, 0); err != nil || string(magic) != packMagic {
+				return
+			}
+			r.tailOffset = uint64(len(packMagic))
+		}
+
+		for r.tailOffset+recordHeaderSize <= size {
+			if _, err := f.ReadAt(hdr[:], int64(r.tailOffset)); err != nil {
+				return
+			}
+			var id [20]byte
+			copy(id[:], hdr[:20])
+			l := binary.BigEndian.Uint32(hdr[20:])
+			if l == packTombstone {
+				r.addDeleted(id)
+				r.tailOffset += recordHeaderSize
+				continue
+			}
+			if r.tailOffset+recordHeaderSize+uint64(l) > size {
+				return
+			}
+			r.addRecent(id, objLocation{r.tailPack, r.tailOffset + recordHeaderSize, l})
+			r.tailOffset += recordHeaderSize + uint64(l)
+		}
+
+		// Move on only when a newer pack exists.
+		if _, err := os.Stat(r.packPath(r.tailPack + 1)); err != nil {
+			return
+		}
+		r.tailPack++
+		r.tailOffset = 0
+	}
+}
+
+func (r *packRepo) refresh() {
+	if r.indexChanged() {
+		r.loadIndex()
+	}
+	r.scanTail()
+}
+
+func (r *packRepo) entry(i int) []byte {
+	off := indexHeaderSize + i*indexEntrySize
+	return r.indexMap[off : off+indexEntrySize]
+}
+
+func (r *packRepo) lookup(id [20]byte) (objLocation, bool) {
+	if loc, ok := r.recent[id]; ok {
+		return loc, true
+	}
+	if r.deleted[id] {
+		return objLocation{}, false
+	}
+	i := sort.Search(r.nEntries, func(i int) bool {
+		return bytes.Compare(r.entry(i)[:20], id[:]) >= 0
+	})
+	if i < r.nEntries {
+		e := r.entry(i)
+		if bytes.Equal(e[:20], id[:]) {
+			return objLocation{
+				pack:   binary.BigEndian.Uint32(e[20:24]),
+				offset: binary.BigEndian.Uint64(e[24:32]),
+				len:    binary.BigEndian.Uint32(e[32:36]),
+			}, true
+		}
+	}
+	return objLocation{}, false
+}
+
+// writeIndex rewrites the index to cover everything scanned so far.
+func (r *packRepo) writeIndex() error {
+	type indexEntry struct {
+		id  [20]byte
+		loc objLocation
+	}
+
+	recent := make([]indexEntry, 0, len(r.recent))
+	for id, loc := range r.recent {
+		recent = append(recent, indexEntry{id, loc})
+	}
+	sort.Slice(recent, func(i, j int) bool {
+		return bytes.Compare(recent[i].id[:], recent[j].id[:]) < 0
+	})
+
+	buf := new(bytes.Buffer)
+	buf.Grow(indexHeaderSize + (r.nEntries+len(recent))*indexEntrySize)
+	buf.Write(make([]byte, indexHeaderSize))
+
+	var n uint64
+	writeEntry := func(id []byte, loc objLocation) {
+		var e [indexEntrySize]byte
+		copy(e[:20], id)
+		binary.BigEndian.PutUint32(e[20:24], loc.pack)
+		binary.BigEndian.PutUint64(e[24:32], loc.offset)
+		binary.BigEndian.PutUint32(e[32:36], loc.len)
+		buf.Write(e[:])
+		n++
+	}
+
+	// Merge, dropping deleted and superseded entries from the old index.
+	i, j := 0, 0
+	for i < r.nEntries || j < len(recent) {
+		if j == len(recent) || (i < r.nEntries && bytes.Compare(r.entry(i)[:20], recent[j].id[:]) < 0) {
+			e := r.entry(i)
+			i++
+			var id [20]byte
+			copy(id[:], e[:20])
+			if r.deleted[id] {
+				continue
+			}
+			buf.Write(e)
+			n++
+			continue
+		}
+		if i < r.nEntries && bytes.Equal(r.entry(i)[:20], recent[j].id[:]) {
+			i++
+		}
+		writeEntry(recent[j].id[:], recent[j].loc)
+		j++
+	}
+
+	data := buf.Bytes()
+	copy(data[:8], indexMagic)
+	binary.BigEndian.PutUint32(data[8:12], indexVersion)
+	binary.BigEndian.PutUint32(data[12:16], r.tailPack)
+	binary.BigEndian.PutUint64(data[16:24], r.tailOffset)
+	binary.BigEndian.PutUint64(data[24:32], n)
+
+	indexPath := filepath.Join(r.dir, "index")
+	tmpPath := indexPath + ".tmp"
+	f, err := os.OpenFile(tmpPath, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, 0644)
+	if err != nil {
+		return err
+	}
+	if _, err := f.Write(data); err != nil {
+		f.Close()
+		os.Remove(tmpPath)
+		return err
+	}
+	if err := f.Sync(); err != nil {
+		f.Close()
+		os.Remove(tmpPath)
+		return err
+	}
+	f.Close()
+
+	if err := os.Rename(tmpPath, indexPath); err != nil {
+		return err
+	}
+
+	return r.loadIndex()
+}
+
+// appendRecord appends a record to the active pack. Called with the
+// exclusive lock held. data is nil for a tombstone.
+func (r *packRepo) appendRecord(id [20]byte, data []byte, tombstone bool) error {
+	recLen := uint64(recordHeaderSize + len(data))
+	if r.tailOffset > uint64(len(packMagic)) && r.tailOffset+recLen > maxPackSize {
+		r.tailPack++
+		r.tailOffset = 0
+	}
+
+	f := r.getPack(r.tailPack)
+	if f == nil {
+		var err error
+		f, err = os.OpenFile(r.packPath(r.tailPack), os.O_RDWR|os.O_CREATE, 0644)
+		if err != nil {
+			return err
+		}
+		r.packs[r.tailPack] = f
+	}
+
+	if r.tailOffset < uint64(len(packMagic)) {
+		if _, err := f.WriteAt([]byte(packMagic), 0); err != nil {
+			return err
+		}
+		r.tailOffset = uint64(len(packMagic))
+	}
+
+	// Drop a partial record left by a crashed writer.
+	if info, err := f.Stat(); err == nil && uint64(info.Size()) > r.tailOffset {
+		f.Truncate(int64(r.tailOffset))
+	}
+
+	rec := make([]byte, recLen)
+	copy(rec[:20], id[:])
+	if tombstone {
+		binary.BigEndian.PutUint32(rec[20:24], packTombstone)
+	} else {
+		binary.BigEndian.PutUint32(rec[20:24], uint32(len(data)))
+		copy(rec[recordHeaderSize:], data)
+	}
+	if _, err := f.WriteAt(rec, int64(r.tailOffset)); err != nil {
+		return err
+	}
+
+	if tombstone {
+		r.addDeleted(id)
+	} else {
+		r.addRecent(id, objLocation{r.tailPack, r.tailOffset + recordHeaderSize, uint32(len(data))})
+	}
+	r.tailOffset += recLen
+	return nil
+}
+
+func (r *packRepo) readData(loc objLocation) ([]byte, error) {
+	f, ok := r.packs[loc.pack]
+	if !ok {
+		return nil, os.ErrNotExist
+	}
+	data := make([]byte, loc.len)
+	if _, err := f.ReadAt(data, int64(loc.offset)); err != nil {
+		return nil, err
+	}
+	return data, nil
+}
+
+func (r *packRepo) flock(how int) {
+	syscall.Flock(int(r.lockFd.Fd()), how)
+}
+
+func (r *packRepo) close() {
+	r.unmapIndex()
+	for _, f := range r.packs {
+		f.Close()
+	}
+	r.lockFd.Close()
+}
+
+func (b *packBackend) openRepo(repoID string, create bool) (*packRepo, error) {
+	dir := filepath.Join(b.packDir, repoID)
+	if create {
+		if err := os.MkdirAll(dir, os.ModePerm); err != nil {
+			return nil, err
+		}
+	}
+	flag := os.O_RDWR
+	if create {
+		flag |= os.O_CREATE
+	}
+	lockFd, err := os.OpenFile(filepath.Join(dir, "lock"), flag, 0644)
+	if err != nil {
+		return nil, err
+	}
+
+	r := new(packRepo)
+	r.dir = dir
+	r.lockFd = lockFd
+	r.packs = make(map[uint32]*os.File)
+
+	r.flock(syscall.LOCK_SH)
+	r.loadIndex()
+	r.scanTail()
+	r.flock(syscall.LOCK_UN)
+
+	return r, nil
+}
+
+// getRepo returns an open repo, which must be released with putRepo.
+// Recently used repos are kept open.
+func (b *packBackend) getRepo(repoID string, create bool) (*packRepo, error) {
+	b.mu.Lock()
+	r := b.lookupRepo(repoID)
+	b.mu.Unlock()
+	if r != nil {
+		return r, nil
+	}
+
+	// Opening waits for the file lock and loads the index. Don't hold b.mu
+	// meanwhile, or other repos would wait too.
+	opened, err := b.openRepo(repoID, create)
+	if err != nil {
+		return nil, err
+	}
+
+	b.mu.Lock()
+	defer b.mu.Unlock()
+
+	// Another goroutine may have opened it in the meantime.
+	if r := b.lookupRepo(repoID); r != nil {
+		opened.close()
+		return r, nil
+	}
+	r = opened
+
+	if b.lru.Len() >= maxOpenRepos {
+		b.evict(b.lru.Back())
+	}
+	b.repos[repoID] = b.lru.PushFront(r)
+	r.refs += 2
+	return r, nil
+}
+
+// lookupRepo returns an open repo and takes a reference. Called with b.mu.
+func (b *packBackend) lookupRepo(repoID string) *packRepo {
+	elem, ok := b.repos[repoID]
+	if !ok {
+		return nil
+	}
+	b.lru.MoveToFront(elem)
+	r := elem.Value.(*packRepo)
+	r.refs++
+	return r
+}
+
+func (b *packBackend) evict(elem *list.Element) {
+	r := elem.Value.(*packRepo)
+	b.lru.Remove(elem)
+	delete(b.repos, filepath.Base(r.dir))
+	r.evicted = true
+	r.refs--
+	if r.refs == 0 {
+		r.close()
+	}
+}
+
+func (b *packBackend) putRepo(r *packRepo) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	r.refs--
+	if r.refs == 0 && r.evicted {
+		r.close()
+	}
+}
+
+func parseObjID(objID string) ([20]byte, error) {
+	var id [20]byte
+	raw, err := hex.DecodeString(objID)
+	if err != nil || len(raw) != 20 {
+		return id, fmt.Errorf("invalid object id %s", objID)
+	}
+	copy(id[:], raw)
+	return id, nil
+}
+
+// find looks up an object, refreshing from disk if it's not known yet.
+func (b *packBackend) find(r *packRepo, id [20]byte, withData bool) (objLocation, []byte, bool) {
+	r.lock.RLock()
+	loc, ok := r.lookup(id)
+	var data []byte
+	var err error
+	if ok && withData {
+		data, err = r.readData(loc)
+	}
+	r.lock.RUnlock()
+	if ok && err == nil {
+		return loc, data, true
+	}
+
+	// The object may have been written or moved by another process.
+	r.lock.Lock()
+	defer r.lock.Unlock()
+	r.flock(syscall.LOCK_SH)
+	r.refresh()
+	r.flock(syscall.LOCK_UN)
+	loc, ok = r.lookup(id)
+	if !ok {
+		return loc, nil, false
+	}
+	if withData {
+		r.getPack(loc.pack)
+		data, err = r.readData(loc)
+		if err != nil {
+			return loc, nil, false
+		}
+	}
+	return loc, data, true
+}
+
+func (b *packBackend) read(repoID string, objID string, w io.Writer) error {
+	id, err := parseObjID(objID)
+	if err != nil {
+		return err
+	}
+	r, err := b.getRepo(repoID, false)
+	if err != nil {
+		return err
+	}
+	defer b.putRepo(r)
+
+	_, data, ok := b.find(r, id, true)
+	if !ok {
+		return os.ErrNotExist
+	}
+	_, err = w.Write(data)
+	return err
+}
+
+func (b *packBackend) write(repoID string, objID string, rd io.Reader, sync bool) error {
+	id, err := parseObjID(objID)
+	if err != nil {
+		return err
+	}
+	data, err := io.ReadAll(rd)
+	if err != nil {
+		return err
+	}
+	r, err := b.getRepo(repoID, true)
+	if err != nil {
+		return err
+	}
+	defer b.putRepo(r)
+
+	r.lock.Lock()
+	defer r.lock.Unlock()
+	r.flock(syscall.LOCK_EX)
+	defer r.flock(syscall.LOCK_UN)
+
+	r.refresh()
+	if _, ok := r.lookup(id); ok {
+		return nil
+	}
+	if err := r.appendRecord(id, data, false); err != nil {
+		return err
+	}
+	if sync {
+		if err := r.packs[r.tailPack].Sync(); err != nil {
+			return err
+		}
+	}
+	// Tombstones written by GC count too, they're dropped from the index.
+	if len(r.recent)+len(r.deleted) > maxUnindexedObjs {
+		return r.writeIndex()
+	}
+	return nil
+}
+
+func (b *packBackend) exists(repoID string, objID string) (bool, error) {
+	id, err := parseObjID(objID)
+	if err != nil {
+		return false, err
+	}
+	r, err := b.getRepo(repoID, false)
+	if err != nil {
+		if os.IsNotExist(err) {
+			return false, err
+		}
+		return true, err
+	}
+	defer b.putRepo(r)
+
+	_, _, ok := b.find(r, id, false)
+	return ok, nil
+}
+
+func (b *packBackend) existsMany(repoID string, objIDs []string) []bool {
+	res := make([]bool, len(objIDs))
+	r, err := b.getRepo(repoID, false)
+	if err != nil {
+		return res
+	}
+	defer b.putRepo(r)
+
+	// All lookups are in memory, refresh once for the whole batch.
+	r.lock.Lock()
+	defer r.lock.Unlock()
+	r.flock(syscall.LOCK_SH)
+	r.refresh()
+	r.flock(syscall.LOCK_UN)
+
+	for i, objID := range objIDs {
+		id, err := parseObjID(objID)
+		if err != nil {
+			continue
+		}
+		_, res[i] = r.lookup(id)
+	}
+	return res
+}
+
+func (b *packBackend) stat(repoID string, objID string) (int64, error) {
+	id, err := parseObjID(objID)
+	if err != nil {
+		return -1, err
+	}
+	r, err := b.getRepo(repoID, false)
+	if err != nil {
+		return -1, err
+	}
+	defer b.putRepo(r)
+
+	loc, _, ok := b.find(r, id, false)
+	if !ok {
+		return -1, os.ErrNotExist
+	}
+	return int64(loc.len), nil
+}
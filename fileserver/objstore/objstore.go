@@ -4,6 +4,10 @@ package objstore
 
 import (
 	"io"
+	"os"
+	"path/filepath"
+
+	"gopkg.in/ini.v1"
 )
 
 // ObjectStore is a container to access storage backend
@@ -11,6 +15,10 @@ type ObjectStore struct {
 	// can be "commit", "fs", or "block"
 	ObjType string
 	backend storageBackend
+	// loose holds the objects written before the pack backend was enabled.
+	// They are still read from their own files, new objects only go to the
+	// packs. It's nil for the fs backend.
+	loose storageBackend
 }
 
 // storageBackend is the interface implemented by storage backends.
@@ -22,6 +30,8 @@ type storageBackend interface {
 	write(repoID string, objID string, r io.Reader, sync bool) (err error)
 	// exists checks whether an object exists.
 	exists(repoID string, objID string) (res bool, err error)
+	// existsMany checks a batch of objects, res[i] is the result for objIDs[i].
+	existsMany(repoID string, objIDs []string) (res []bool)
 	// stat calculates an object's size
 	stat(repoID string, objID string) (res int64, err error)
 }
@@ -31,13 +41,44 @@ type storageBackend interface {
 func New(seafileConfPath string, seafileDataDir string, objType string) *ObjectStore {
 	obj := new(ObjectStore)
 	obj.ObjType = objType
-	obj.backend, _ = newFSBackend(seafileDataDir, objType)
+	if backendName(seafileConfPath, objType) == "pack" {
+		obj.backend, _ = newPackBackend(seafileDataDir, objType)
+		if loose, err := newFSBackend(seafileDataDir, objType); err == nil {
+			obj.loose = loose
+		}
+	} else {
+		obj.backend, _ = newFSBackend(seafileDataDir, objType)
+	}
 	return obj
 }
 
+// backendName reads the backend of commit and fs objects from seafile.conf,
+// e.g. "name = pack" in the [fs_object_backend] section.
+func backendName(seafileConfPath string, objType string) string {
+	var section string
+	switch objType {
+	case "commits":
+		section = "commit_object_backend"
+	case "fs":
+		section = "fs_object_backend"
+	default:
+		return "fs"
+	}
+
+	config, err := ini.Load(filepath.Join(seafileConfPath, "seafile.conf"))
+	if err != nil {
+		return "fs"
+	}
+	return config.Section(section).Key("name").MustString("fs")
+}
+
 // Read data from storage backends.
 func (s *ObjectStore) Read(repoID string, objID string, w io.Writer) (err error) {
-	return s.backend.read(repoID, objID, w)
+	err = s.backend.read(repoID, objID, w)
+	if err != nil && os.IsNotExist(err) && s.loose != nil {
+		return s.loose.read(repoID, objID, w)
+	}
+	return err
 }
 
 // Write data to storage backends.
@@ -47,10 +88,42 @@ func (s *ObjectStore) Write(repoID string, objID string, r io.Reader, sync bool)
 
 // Check whether object exists.
 func (s *ObjectStore) Exists(repoID string, objID string) (res bool, err error) {
-	return s.backend.exists(repoID, objID)
+	res, err = s.backend.exists(repoID, objID)
+	if !res && s.loose != nil {
+		return s.loose.exists(repoID, objID)
+	}
+	return res, err
+}
+
+// ExistsMany checks whether each of the objects exists.
+func (s *ObjectStore) ExistsMany(repoID string, objIDs []string) []bool {
+	res := s.backend.existsMany(repoID, objIDs)
+	if s.loose == nil {
+		return res
+	}
+
+	var missing []string
+	var index []int
+	for i, exists := range res {
+		if !exists {
+			missing = append(missing, objIDs[i])
+			index = append(index, i)
+		}
+	}
+	if len(missing) == 0 {
+		return res
+	}
+	for i, exists := range s.loose.existsMany(repoID, missing) {
+		res[index[i]] = exists
+	}
+	return res
 }
 
 // Stat calculates object size.
 func (s *ObjectStore) Stat(repoID string, objID string) (res int64, err error) {
-	return s.backend.stat(repoID, objID)
+	res, err = s.backend.stat(repoID, objID)
+	if err != nil && os.IsNotExist(err) && s.loose != nil {
+		return s.loose.stat(repoID, objID)
+	}
+	return res, err
 }
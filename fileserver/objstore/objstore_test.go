@@ -1,6 +1,7 @@
 package objstore
 
 import (
+	"bytes"
 	"fmt"
 	"os"
 	"path"
@@ -98,8 +99,154 @@ func testExists(t *testing.T) {
 	}
 }
 
+func testExistsMany(t *testing.T) {
+	bend := New(seafileConfPath, seafileDataDir, "commit")
+
+	// Large enough to be checked by several workers.
+	objIDs := make([]string, 1000)
+	for i := range objIDs {
+		objIDs[i] = fmt.Sprintf("%040x", i)
+	}
+	objIDs[777] = objID
+
+	ret := bend.ExistsMany(repoID, objIDs)
+	if len(ret) != len(objIDs) {
+		t.Fatalf("Got %d results for %d objects\n", len(ret), len(objIDs))
+	}
+	for i, exists := range ret {
+		if exists != (i == 777) {
+			t.Errorf("Wrong existence %v for object %s\n", exists, objIDs[i])
+		}
+	}
+}
+
+func testPackBackend(t *testing.T) {
+	dataDir, err := os.MkdirTemp("", "packbackend")
+	if err != nil {
+		t.Fatalf("Failed to create temp dir: %v\n", err)
+	}
+	defer os.RemoveAll(dataDir)
+
+	bend, err := newPackBackend(dataDir, "fs")
+	if err != nil {
+		t.Fatalf("Failed to create pack backend: %v\n", err)
+	}
+
+	// Enough objects to fold the recent records into the index.
+	n := maxUnindexedObjs + 100
+	objIDs := make([]string, n)
+	for i := 0; i < n; i++ {
+		objIDs[i] = fmt.Sprintf("%040x", i+1)
+		content := fmt.Sprintf("object %d", i)
+		if err := bend.write(repoID, objIDs[i], bytes.NewBufferString(content), false); err != nil {
+			t.Fatalf("Failed to write object %s: %v\n", objIDs[i], err)
+		}
+	}
+
+	// A second backend sees the same packs, like another process would.
+	other, _ := newPackBackend(dataDir, "fs")
+	for _, b := range []*packBackend{bend, other} {
+		for _, i := range []int{0, maxUnindexedObjs, n - 1} {
+			buf := new(bytes.Buffer)
+			if err := b.read(repoID, objIDs[i], buf); err != nil {
+				t.Fatalf("Failed to read object %s: %v\n", objIDs[i], err)
+			}
+			if buf.String() != fmt.Sprintf("object %d", i) {
+				t.Errorf("Wrong content %q for object %s\n", buf.String(), objIDs[i])
+			}
+		}
+	}
+
+	missing := fmt.Sprintf("%040x", n+1)
+	if exists, _ := other.exists(repoID, missing); exists {
+		t.Errorf("Object %s should not exist\n", missing)
+	}
+
+	// Objects written after the other backend has opened the repo.
+	if err := bend.write(repoID, missing, bytes.NewBufferString("late"), true); err != nil {
+		t.Fatalf("Failed to write object %s: %v\n", missing, err)
+	}
+	ret := other.existsMany(repoID, []string{objIDs[1], missing, objID})
+	if !ret[0] || !ret[1] || ret[2] {
+		t.Errorf("Wrong existence %v\n", ret)
+	}
+	if size, err := other.stat(repoID, missing); err != nil || size != 4 {
+		t.Errorf("Wrong size %d of object %s: %v\n", size, missing, err)
+	}
+
+	// A pack removed by compaction in another process is closed when the
+	// index is reloaded.
+	r, err := other.getRepo(repoID, false)
+	if err != nil {
+		t.Fatalf("Failed to open repo: %v\n", err)
+	}
+	os.Remove(r.packPath(1))
+	r.lock.Lock()
+	r.loadIndex()
+	_, open := r.packs[1]
+	r.lock.Unlock()
+	other.putRepo(r)
+	if open {
+		t.Errorf("Removed pack is still open\n")
+	}
+}
+
+func testPackFallback(t *testing.T) {
+	confDir, err := os.MkdirTemp("", "packfallback")
+	if err != nil {
+		t.Fatalf("Failed to create temp dir: %v\n", err)
+	}
+	defer os.RemoveAll(confDir)
+	dataDir := path.Join(confDir, "seafile-data")
+
+	conf := "[fs_object_backend]\nname = pack\n"
+	if err := os.WriteFile(path.Join(confDir, "seafile.conf"), []byte(conf), 0644); err != nil {
+		t.Fatalf("Failed to write seafile.conf: %v\n", err)
+	}
+
+	// An object written before the pack backend was enabled.
+	loose, _ := newFSBackend(dataDir, "fs")
+	if err := loose.write(repoID, objID, bytes.NewBufferString("loose"), false); err != nil {
+		t.Fatalf("Failed to write loose object: %v\n", err)
+	}
+
+	store := New(confDir, dataDir, "fs")
+	packed := fmt.Sprintf("%040x", 1)
+	if err := store.Write(repoID, packed, bytes.NewBufferString("packed"), false); err != nil {
+		t.Fatalf("Failed to write object %s: %v\n", packed, err)
+	}
+	if exists, _ := loose.exists(repoID, packed); exists {
+		t.Errorf("Object %s should be written to the packs\n", packed)
+	}
+
+	for id, content := range map[string]string{objID: "loose", packed: "packed"} {
+		buf := new(bytes.Buffer)
+		if err := store.Read(repoID, id, buf); err != nil || buf.String() != content {
+			t.Errorf("Read %q for object %s: %v\n", buf.String(), id, err)
+		}
+		if exists, _ := store.Exists(repoID, id); !exists {
+			t.Errorf("Object %s should exist\n", id)
+		}
+		if size, err := store.Stat(repoID, id); err != nil || size != int64(len(content)) {
+			t.Errorf("Wrong size %d of object %s: %v\n", size, id, err)
+		}
+	}
+
+	missing := fmt.Sprintf("%040x", 2)
+	ret := store.ExistsMany(repoID, []string{objID, missing, packed})
+	if !ret[0] || ret[1] || !ret[2] {
+		t.Errorf("Wrong existence %v\n", ret)
+	}
+	if err := store.Read(repoID, missing, new(bytes.Buffer)); err == nil {
+		t.Errorf("Object %s should not exist\n", missing)
+	}
+}
+
 func TestObjStore(t *testing.T) {
 	testWrite(t)
 	testRead(t)
 	testExists(t)
+	testExistsMany(t)
+	testPackBackend(t)
+	testPackFallback(t)
 }
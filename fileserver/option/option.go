@@ -15,6 +15,10 @@ import (
 // InfiniteQuota indicates that the quota is unlimited.
 const InfiniteQuota = -2
 
+// Largest cdc_max_block_size accepted. The chunker buffers twice the maximum
+// block size for every file being indexed.
+const maxCDCBlockSize = 1 << 25
+
 // Storage unit.
 const (
 	KB = 1000
@@ -31,6 +35,12 @@ var (
 	FsIdListRequestTimeout int64
 	// Block size for indexing uploaded files
 	FixedBlockSize uint64
+	// Split uploaded files at content-defined boundaries instead of
+	// fixed offsets, with block sizes in bytes.
+	ContentDefinedChunking bool
+	CDCMinBlockSize        uint64
+	CDCAvgBlockSize        uint64
+	CDCMaxBlockSize        uint64
 	// Maximum number of goroutines to index uploaded files
 	MaxIndexingThreads uint32
 	WebTokenExpireTime uint32
@@ -40,6 +50,10 @@ var (
 	SkipBlockHash             bool
 	FsCacheLimit              int64
 	VerifyClientBlocks        bool
+	// Number of blocks to read ahead in file downloads, and the total
+	// size of read-ahead blocks in bytes
+	ReadAheadBlocks uint32
+	ReadAheadMemory int64
 
 	// general options
 	CloudMode bool
@@ -53,6 +67,8 @@ var (
 
 	// quota options
 	DefaultQuota int64
+	// How long the usage of a user is cached, 0 disables the cache.
+	QuotaUsageCacheTTL time.Duration
 
 	// redis options
 	HasRedisOptions bool
@@ -82,12 +98,18 @@ func initDefaultOptions() {
 	Host = "0.0.0.0"
 	Port = 8082
 	FixedBlockSize = 1 << 23
+	CDCMinBlockSize = 1 << 18
+	CDCAvgBlockSize = 1 << 20
+	CDCMaxBlockSize = 1 << 22
 	MaxIndexingThreads = 1
 	WebTokenExpireTime = 7200
 	ClusterSharedTempFileMode = 0600
 	DefaultQuota = InfiniteQuota
+	QuotaUsageCacheTTL = 60 * time.Second
 	FsCacheLimit = 4 << 30
 	VerifyClientBlocks = true
+	ReadAheadBlocks = 2
+	ReadAheadMemory = 256 << 20
 	FsIdListRequestTimeout = -1
 	DBOpTimeout = 60 * time.Second
 	RedisHost = "127.0.0.1"
@@ -133,6 +155,12 @@ func LoadFileServerOptions(centralDir string) {
 			quotaStr := key.String()
 			DefaultQuota = parseQuota(quotaStr)
 		}
+		if key, err := section.GetKey("usage_cache_ttl"); err == nil {
+			ttl, err := key.Int()
+			if err == nil && ttl >= 0 {
+				QuotaUsageCacheTTL = time.Duration(ttl) * time.Second
+			}
+		}
 	}
 
 	loadCacheOptionFromEnv()
@@ -171,6 +199,34 @@ func parseFileServerSection(section *ini.Section) {
 			FixedBlockSize = blkSize * (1 << 20)
 		}
 	}
+	if key, err := section.GetKey("content_defined_chunking"); err == nil {
+		ContentDefinedChunking, _ = key.Bool()
+	}
+	if key, err := section.GetKey("cdc_min_block_size"); err == nil {
+		blkSize, err := key.Uint64()
+		if err == nil {
+			CDCMinBlockSize = blkSize * (1 << 10)
+		}
+	}
+	if key, err := section.GetKey("cdc_avg_block_size"); err == nil {
+		blkSize, err := key.Uint64()
+		if err == nil {
+			CDCAvgBlockSize = blkSize * (1 << 10)
+		}
+	}
+	if key, err := section.GetKey("cdc_max_block_size"); err == nil {
+		blkSize, err := key.Uint64()
+		if err == nil {
+			CDCMaxBlockSize = blkSize * (1 << 10)
+		}
+	}
+	if CDCMinBlockSize == 0 || CDCMinBlockSize >= CDCAvgBlockSize || CDCAvgBlockSize >= CDCMaxBlockSize ||
+		CDCMaxBlockSize > maxCDCBlockSize {
+		log.Printf("invalid cdc block sizes %d/%d/%d KB, use defaults", CDCMinBlockSize>>10, CDCAvgBlockSize>>10, CDCMaxBlockSize>>10)
+		CDCMinBlockSize = 1 << 18
+		CDCAvgBlockSize = 1 << 20
+		CDCMaxBlockSize = 1 << 22
+	}
 	if key, err := section.GetKey("web_token_expire_time"); err == nil {
 		expire, err := key.Uint()
 		if err == nil {
@@ -215,6 +271,18 @@ func parseFileServerSection(section *ini.Section) {
 	if key, err := section.GetKey("verify_client_blocks_after_sync"); err == nil {
 		VerifyClientBlocks, _ = key.Bool()
 	}
+	if key, err := section.GetKey("download_read_ahead_blocks"); err == nil {
+		blocks, err := key.Uint()
+		if err == nil {
+			ReadAheadBlocks = uint32(blocks)
+		}
+	}
+	if key, err := section.GetKey("download_read_ahead_memory"); err == nil {
+		size, err := key.Int64()
+		if err == nil {
+			ReadAheadMemory = size * (1 << 20)
+		}
+	}
 }
 
 func parseQuota(quotaStr string) int64 {
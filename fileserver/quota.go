@@ -4,9 +4,12 @@ import (
 	"context"
 	"database/sql"
 	"fmt"
+	"sync"
+	"time"
 
 	"github.com/haiwen/seafile-server/fileserver/option"
 	"github.com/haiwen/seafile-server/fileserver/repomgr"
+	log "github.com/sirupsen/logrus"
 )
 
 // InfiniteQuota indicates that the quota is unlimited.
@@ -48,7 +51,7 @@ func checkQuota(repoID string, delta int64) (int, error) {
 	if quota == InfiniteQuota {
 		return 0, nil
 	}
-	usage, err := getUserUsage(user)
+	usage, err := usageCache.get(user, getUserUsage)
 	if err != nil || usage < 0 {
 		err := fmt.Errorf("failed to get user usage: %v", err)
 		return -1, err
@@ -103,3 +106,134 @@ func getUserUsage(user string) (int64, error) {
 
 	return 0, nil
 }
+
+// Summing up the sizes of all repos of a user is expensive for users with
+// many repos. The usage is cached for option.QuotaUsageCacheTTL, and dropped
+// when the size scheduler stores a new size of one of the user's repos.
+type userUsageEntry struct {
+	usage  int64
+	valid  bool
+	expire time.Time
+	// Number of invalidations, so that a usage summed up while repo sizes
+	// were changing isn't cached.
+	changes uint64
+}
+
+// Entries are pruned when the cache grows beyond this size.
+const maxUserUsageEntries = 100000
+
+type userUsageCache struct {
+	sync.Mutex
+	entries map[string]*userUsageEntry
+}
+
+var usageCache = newUserUsageCache()
+
+func newUserUsageCache() *userUsageCache {
+	return &userUsageCache{entries: make(map[string]*userUsageEntry)}
+}
+
+// prune drops expired and invalid entries. Called with the lock held.
+func (c *userUsageCache) prune() {
+	now := time.Now()
+	for user, e := range c.entries {
+		if !e.valid || !now.Before(e.expire) {
+			delete(c.entries, user)
+		}
+	}
+	if len(c.entries) >= maxUserUsageEntries {
+		c.entries = make(map[string]*userUsageEntry)
+	}
+}
+
+func (c *userUsageCache) get(user string, load func(string) (int64, error)) (int64, error) {
+	ttl := option.QuotaUsageCacheTTL
+	if ttl <= 0 {
+		return load(user)
+	}
+
+	c.Lock()
+	e, ok := c.entries[user]
+	if ok && e.valid && time.Now().Before(e.expire) {
+		usage := e.usage
+		c.Unlock()
+		return usage, nil
+	}
+	if !ok {
+		if len(c.entries) >= maxUserUsageEntries {
+			c.prune()
+		}
+		e = new(userUsageEntry)
+		c.entries[user] = e
+	}
+	changes := e.changes
+	c.Unlock()
+
+	usage, err := load(user)
+	if err != nil {
+		return usage, err
+	}
+
+	c.Lock()
+	if c.entries[user] == e && e.changes == changes {
+		e.usage = usage
+		e.valid = true
+		e.expire = time.Now().Add(ttl)
+	}
+	c.Unlock()
+
+	return usage, nil
+}
+
+func (c *userUsageCache) invalidate(user string) {
+	c.Lock()
+	defer c.Unlock()
+	if e, ok := c.entries[user]; ok {
+		e.valid = false
+		e.changes++
+	}
+}
+
+func (c *userUsageCache) clear() {
+	c.Lock()
+	defer c.Unlock()
+	c.entries = make(map[string]*userUsageEntry)
+}
+
+func (c *userUsageCache) empty() bool {
+	c.Lock()
+	defer c.Unlock()
+	return len(c.entries) == 0
+}
+
+// invalidateRepoUsage drops the cached usage of the owner of a repo after
+// its size has been stored. Adding the size change to the cached usage
+// instead could count it twice, if the usage was summed up after the new
+// size was stored but cached before the change was added.
+// Virtual repos aren't counted in the usage.
+func invalidateRepoUsage(repoID string) {
+	if usageCache.empty() {
+		return
+	}
+
+	vInfo, err := repomgr.GetVirtualRepoInfo(repoID)
+	if err != nil {
+		log.Warnf("Failed to get virtual repo info of %s: %v", repoID, err)
+		usageCache.clear()
+		return
+	}
+	if vInfo != nil {
+		return
+	}
+
+	user, err := repomgr.GetRepoOwner(repoID)
+	if err != nil {
+		log.Warnf("Failed to get owner of repo %s: %v", repoID, err)
+		usageCache.clear()
+		return
+	}
+	if user == "" {
+		return
+	}
+	usageCache.invalidate(user)
+}
@@ -0,0 +1,99 @@
+package main
+
+import (
+	"fmt"
+	"testing"
+	"time"
+
+	"github.com/haiwen/seafile-server/fileserver/option"
+)
+
+func TestUserUsageCache(t *testing.T) {
+	oldTTL := option.QuotaUsageCacheTTL
+	option.QuotaUsageCacheTTL = time.Minute
+	defer func() {
+		option.QuotaUsageCacheTTL = oldTTL
+	}()
+
+	loads := 0
+	load := func(user string) (int64, error) {
+		loads++
+		return 100, nil
+	}
+
+	c := newUserUsageCache()
+	for i := 0; i < 3; i++ {
+		usage, err := c.get("a@example.com", load)
+		if err != nil || usage != 100 {
+			t.Fatalf("got usage %d, %v, want 100", usage, err)
+		}
+	}
+	if loads != 1 {
+		t.Fatalf("usage loaded %d times, want 1", loads)
+	}
+
+	c.invalidate("a@example.com")
+	c.invalidate("b@example.com")
+	usage, _ := c.get("a@example.com", load)
+	if usage != 100 || loads != 2 {
+		t.Fatalf("got usage %d after %d loads, want 100 after 2", usage, loads)
+	}
+
+	c.entries["a@example.com"].expire = time.Now()
+	usage, _ = c.get("a@example.com", load)
+	if usage != 100 || loads != 3 {
+		t.Fatalf("got usage %d after %d loads, want 100 after 3", usage, loads)
+	}
+}
+
+func TestUserUsageCacheChangedWhileLoading(t *testing.T) {
+	oldTTL := option.QuotaUsageCacheTTL
+	option.QuotaUsageCacheTTL = time.Minute
+	defer func() {
+		option.QuotaUsageCacheTTL = oldTTL
+	}()
+
+	c := newUserUsageCache()
+	loads := 0
+	load := func(user string) (int64, error) {
+		loads++
+		if loads == 1 {
+			// The size changes after it was summed up.
+			c.invalidate(user)
+		}
+		return 100, nil
+	}
+
+	c.get("a@example.com", load)
+	usage, _ := c.get("a@example.com", load)
+	if loads != 2 || usage != 100 {
+		t.Fatalf("got usage %d after %d loads, want 100 after 2", usage, loads)
+	}
+	c.get("a@example.com", load)
+	if loads != 2 {
+		t.Fatalf("usage loaded %d times, want 2", loads)
+	}
+}
+
+func TestUserUsageCachePrune(t *testing.T) {
+	oldTTL := option.QuotaUsageCacheTTL
+	option.QuotaUsageCacheTTL = time.Minute
+	defer func() {
+		option.QuotaUsageCacheTTL = oldTTL
+	}()
+
+	c := newUserUsageCache()
+	load := func(user string) (int64, error) {
+		return 100, nil
+	}
+	for i := 0; i < maxUserUsageEntries; i++ {
+		c.entries[fmt.Sprintf("%d@example.com", i)] = &userUsageEntry{
+			usage: 100, valid: i%2 == 0, expire: time.Now().Add(time.Minute),
+		}
+	}
+
+	c.get("a@example.com", load)
+	if len(c.entries) != maxUserUsageEntries/2+1 {
+		t.Fatalf("got %d entries after pruning, want %d", len(c.entries), maxUserUsageEntries/2+1)
+	}
+}
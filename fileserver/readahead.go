@@ -0,0 +1,189 @@
+package main
+
+import (
+	"bytes"
+	"io"
+	"sync"
+	"sync/atomic"
+
+	"github.com/haiwen/seafile-server/fileserver/metrics"
+	"github.com/haiwen/seafile-server/fileserver/option"
+)
+
+// Downloads send the blocks of a file one after another. Without read-ahead
+// the transfer stalls at every block boundary while the next block is read
+// from the backend. A blockReader reads up to option.ReadAheadBlocks blocks
+// after the current one in the background, so that they're usually ready
+// when the client gets to them.
+
+// readAheadMem is the size of the blocks being read ahead or read ahead but
+// not taken yet, over all downloads. A block is only read ahead if its size
+// fits in option.ReadAheadMemory.
+var readAheadMem atomic.Int64
+
+func reserveReadAheadMem(size, limit int64) bool {
+	for {
+		used := readAheadMem.Load()
+		if used+size > limit {
+			return false
+		}
+		if readAheadMem.CompareAndSwap(used, used+size) {
+			return true
+		}
+	}
+}
+
+var readAheadBufPool = sync.Pool{
+	New: func() interface{} {
+		return new(bytes.Buffer)
+	},
+}
+
+type blockReadFunc func(storeID string, blockID string, w io.Writer) error
+type blockStatFunc func(storeID string, blockID string) (int64, error)
+
+type blockFuture struct {
+	done chan struct{}
+	buf  *bytes.Buffer
+	err  error
+	// Size reserved in readAheadMem for the block, 0 if it wasn't read
+	// ahead. The download reads it then.
+	reserved int64
+}
+
+type blockReader struct {
+	storeID string
+	blkIDs  []string
+	read    blockReadFunc
+	stat    blockStatFunc
+
+	futures []*blockFuture
+	next    int
+	// Buffer of the block returned by the last call of nextBlock.
+	cur *bytes.Buffer
+}
+
+func newBlockReader(storeID string, blkIDs []string, read blockReadFunc, stat blockStatFunc) *blockReader {
+	r := new(blockReader)
+	r.storeID = storeID
+	r.blkIDs = blkIDs
+	r.read = read
+	r.stat = stat
+	r.futures = make([]*blockFuture, len(blkIDs))
+	return r
+}
+
+func (r *blockReader) start(i int) {
+	f := &blockFuture{done: make(chan struct{})}
+	r.futures[i] = f
+	limit := option.ReadAheadMemory
+
+	go func() {
+		defer close(f.done)
+		// Leave the block to the download if there's no room for it.
+		size, err := r.stat(r.storeID, r.blkIDs[i])
+		if err != nil || size <= 0 || !reserveReadAheadMem(size, limit) {
+			return
+		}
+		buf := readAheadBufPool.Get().(*bytes.Buffer)
+		buf.Reset()
+		if err := r.read(r.storeID, r.blkIDs[i], buf); err != nil {
+			readAheadMem.Add(-size)
+			readAheadBufPool.Put(buf)
+			f.err = err
+			return
+		}
+		f.buf = buf
+		f.reserved = size
+	}()
+}
+
+// release returns the memory reserved for the block and its buffer.
+func (f *blockFuture) release() {
+	if f.reserved > 0 {
+		readAheadMem.Add(-f.reserved)
+		f.reserved = 0
+	}
+	if f.buf != nil {
+		readAheadBufPool.Put(f.buf)
+		f.buf = nil
+	}
+}
+
+// nextBlock returns the content of the next block. It's only valid until the
+// next call of nextBlock or close. Returns io.EOF after the last block.
+func (r *blockReader) nextBlock() ([]byte, error) {
+	if r.cur != nil {
+		readAheadBufPool.Put(r.cur)
+		r.cur = nil
+	}
+	if r.next >= len(r.blkIDs) {
+		return nil, io.EOF
+	}
+
+	i := r.next
+	r.next++
+
+	f := r.futures[i]
+	r.futures[i] = nil
+	if f != nil {
+		select {
+		case <-f.done:
+			if f.buf != nil {
+				metrics.Download.PrefetchHits.Add(1)
+			}
+		default:
+			metrics.Download.PrefetchStalls.Add(1)
+		}
+	}
+
+	for j := i + 1; j <= i+int(option.ReadAheadBlocks) && j < len(r.blkIDs); j++ {
+		if r.futures[j] != nil {
+			continue
+		}
+		if readAheadMem.Load() >= option.ReadAheadMemory {
+			break
+		}
+		r.start(j)
+	}
+
+	if f != nil {
+		<-f.done
+		if f.err != nil {
+			return nil, f.err
+		}
+		if f.buf != nil {
+			r.cur = f.buf
+			f.buf = nil
+			f.release()
+			return r.cur.Bytes(), nil
+		}
+	}
+
+	// Not read ahead.
+	r.cur = readAheadBufPool.Get().(*bytes.Buffer)
+	r.cur.Reset()
+	if err := r.read(r.storeID, r.blkIDs[i], r.cur); err != nil {
+		return nil, err
+	}
+	return r.cur.Bytes(), nil
+}
+
+// close releases the blocks read ahead. Reads still running are left to
+// finish in the background.
+func (r *blockReader) close() {
+	if r.cur != nil {
+		readAheadBufPool.Put(r.cur)
+		r.cur = nil
+	}
+	for i, f := range r.futures {
+		if f == nil {
+			continue
+		}
+		r.futures[i] = nil
+		go func(f *blockFuture) {
+			<-f.done
+			f.release()
+		}(f)
+	}
+}
@@ -0,0 +1,167 @@
+package main
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/haiwen/seafile-server/fileserver/metrics"
+	"github.com/haiwen/seafile-server/fileserver/option"
+)
+
+func readAheadTestRead(reads *atomic.Int64) blockReadFunc {
+	return func(storeID string, blockID string, w io.Writer) error {
+		reads.Add(1)
+		if blockID == "bad" {
+			return fmt.Errorf("failed to read block %s", blockID)
+		}
+		_, err := w.Write(bytes.Repeat([]byte(blockID), 1000))
+		return err
+	}
+}
+
+func readAheadTestStat(storeID string, blockID string) (int64, error) {
+	return int64(len(blockID) * 1000), nil
+}
+
+// readAheadTestWaitReleased waits for the reads left running by closed
+// readers to release their memory.
+func readAheadTestWaitReleased(t *testing.T) {
+	deadline := time.Now().Add(time.Second)
+	for readAheadMem.Load() != 0 {
+		if time.Now().After(deadline) {
+			t.Fatalf("%d bytes of read-ahead blocks not released", readAheadMem.Load())
+		}
+		time.Sleep(time.Millisecond)
+	}
+}
+
+func readAheadTestRun(t *testing.T, blocks uint32) {
+	oldBlocks, oldMemory := option.ReadAheadBlocks, option.ReadAheadMemory
+	option.ReadAheadBlocks, option.ReadAheadMemory = blocks, 1<<20
+	defer func() {
+		option.ReadAheadBlocks, option.ReadAheadMemory = oldBlocks, oldMemory
+	}()
+
+	var reads atomic.Int64
+	blkIDs := []string{"a", "b", "c", "d", "e"}
+	hits := metrics.Download.PrefetchHits.Load()
+	reader := newBlockReader("store", blkIDs, readAheadTestRead(&reads), readAheadTestStat)
+
+	for _, id := range blkIDs {
+		data, err := reader.nextBlock()
+		if err != nil {
+			t.Fatalf("failed to read block %s: %v", id, err)
+		}
+		if !bytes.Equal(data, bytes.Repeat([]byte(id), 1000)) {
+			t.Fatalf("wrong content of block %s", id)
+		}
+		// Let the blocks after it be read ahead.
+		time.Sleep(10 * time.Millisecond)
+	}
+	if _, err := reader.nextBlock(); err != io.EOF {
+		t.Fatalf("expected EOF after the last block, got %v", err)
+	}
+	reader.close()
+
+	if reads.Load() != int64(len(blkIDs)) {
+		t.Fatalf("read %d blocks, want %d", reads.Load(), len(blkIDs))
+	}
+	gotHits := metrics.Download.PrefetchHits.Load() - hits
+	if blocks == 0 && gotHits != 0 {
+		t.Fatalf("got %d prefetch hits without read-ahead", gotHits)
+	}
+	if blocks > 0 && gotHits != int64(len(blkIDs)-1) {
+		t.Fatalf("got %d prefetch hits, want %d", gotHits, len(blkIDs)-1)
+	}
+}
+
+func TestBlockReader(t *testing.T) {
+	readAheadTestRun(t, 0)
+	readAheadTestRun(t, 1)
+	readAheadTestRun(t, 3)
+}
+
+func TestBlockReaderError(t *testing.T) {
+	var reads atomic.Int64
+	reader := newBlockReader("store", []string{"a", "bad", "c"}, readAheadTestRead(&reads), readAheadTestStat)
+	defer reader.close()
+
+	if _, err := reader.nextBlock(); err != nil {
+		t.Fatalf("failed to read block: %v", err)
+	}
+	if _, err := reader.nextBlock(); err == nil {
+		t.Fatalf("expected an error for a bad block")
+	}
+}
+
+func TestBlockReaderClose(t *testing.T) {
+	oldBlocks, oldMemory := option.ReadAheadBlocks, option.ReadAheadMemory
+	option.ReadAheadBlocks, option.ReadAheadMemory = 2, 1<<20
+	defer func() {
+		option.ReadAheadBlocks, option.ReadAheadMemory = oldBlocks, oldMemory
+	}()
+
+	var reads atomic.Int64
+	reader := newBlockReader("store", []string{"a", "b", "c", "d"}, readAheadTestRead(&reads), readAheadTestStat)
+	if _, err := reader.nextBlock(); err != nil {
+		t.Fatalf("failed to read block: %v", err)
+	}
+	reader.close()
+
+	readAheadTestWaitReleased(t)
+}
+
+func TestBlockReaderMemoryLimit(t *testing.T) {
+	oldBlocks, oldMemory := option.ReadAheadBlocks, option.ReadAheadMemory
+	option.ReadAheadBlocks, option.ReadAheadMemory = 2, 1500
+	defer func() {
+		option.ReadAheadBlocks, option.ReadAheadMemory = oldBlocks, oldMemory
+	}()
+
+	release := make(chan struct{})
+	started := make(chan string, 4)
+	read := func(storeID string, blockID string, w io.Writer) error {
+		started <- blockID
+		if blockID != "a" {
+			<-release
+		}
+		_, err := w.Write(bytes.Repeat([]byte(blockID), 1000))
+		return err
+	}
+
+	readAheadTestWaitReleased(t)
+	reader := newBlockReader("store", []string{"a", "b", "c", "d"}, read, readAheadTestStat)
+	if _, err := reader.nextBlock(); err != nil {
+		t.Fatalf("failed to read block: %v", err)
+	}
+	// Only one of the two blocks after "a" fits, and its size is reserved
+	// before it's read.
+	for i := 0; i < 2; i++ {
+		select {
+		case <-started:
+		case <-time.After(time.Second):
+			t.Fatalf("block not read ahead")
+		}
+	}
+	if used := readAheadMem.Load(); used != 1000 {
+		t.Fatalf("%d bytes reserved while reading ahead, want 1000", used)
+	}
+	close(release)
+
+	for _, id := range []string{"b", "c", "d"} {
+		data, err := reader.nextBlock()
+		if err != nil {
+			t.Fatalf("failed to read block %s: %v", id, err)
+		}
+		if !bytes.Equal(data, bytes.Repeat([]byte(id), 1000)) {
+			t.Fatalf("wrong content of block %s", id)
+		}
+	}
+	reader.close()
+
+	readAheadTestWaitReleased(t)
+}
@@ -138,6 +138,10 @@ func computeRepoSize(args ...interface{}) error {
 		return err
 	}
 
+	if info == nil || size != info.Size {
+		invalidateRepoUsage(repoID)
+	}
+
 	err = notifyRepoSizeChange(repo.StoreID)
 	if err != nil {
 		log.Warnf("Failed to notify repo size change for repo %s: %v", repoID, err)
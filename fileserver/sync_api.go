@@ -110,8 +110,8 @@ func getFsId(args ...interface{}) error {
 	}
 
 	resChan := args[0].(chan *calResult)
-	rsp := args[1].(http.ResponseWriter)
-	r := args[2].(*http.Request)
+	r := args[1].(*http.Request)
+	writer := args[2].(*fsIDListWriter)
 
 	queries := r.URL.Query()
 
@@ -156,8 +156,21 @@ func getFsId(args ...interface{}) error {
 		resChan <- &calResult{user, appErr}
 		return nil
 	}
-	ret, err := calculateSendObjectList(r.Context(), repo, serverHead, clientHead, dirOnly)
+	err := calculateSendObjectList(r.Context(), repo, serverHead, clientHead, dirOnly, writer)
+	if err == nil {
+		err = writer.finish()
+	}
 	if err != nil {
+		writer.abort()
+		if writer.streaming() {
+			// Part of the list has been sent, so the status can't be changed.
+			// The list is left unterminated instead.
+			if !errors.Is(err, context.Canceled) {
+				log.Warnf("Failed to send fs id list of repo %.8s: %v", repoID, err)
+			}
+			resChan <- &calResult{user, nil}
+			return nil
+		}
 		if !errors.Is(err, context.Canceled) {
 			err := fmt.Errorf("Failed to get fs id list: %w", err)
 			appErr := &appError{err, "", http.StatusInternalServerError}
@@ -169,23 +182,6 @@ func getFsId(args ...interface{}) error {
 		return nil
 	}
 
-	var objList []byte
-	if ret != nil {
-		objList, err = json.Marshal(ret)
-		if err != nil {
-			appErr := &appError{err, "", http.StatusInternalServerError}
-			resChan <- &calResult{user, appErr}
-			return nil
-		}
-	} else {
-		// when get obj list is nil, return []
-		objList = []byte{'[', ']'}
-	}
-
-	rsp.Header().Set("Content-Length", strconv.Itoa(len(objList)))
-	rsp.WriteHeader(http.StatusOK)
-	rsp.Write(objList)
-
 	resChan <- &calResult{user, nil}
 
 	return nil
@@ -540,19 +536,24 @@ func postCheckExistCB(rsp http.ResponseWriter, r *http.Request, existType checkE
 		return &appError{nil, err.Error(), http.StatusBadRequest}
 	}
 
-	var neededObjs []string
-	var ret bool
-	for i := 0; i < len(objIDList); i++ {
-		if !utils.IsObjectIDValid(objIDList[i]) {
-			continue
+	validIDs := make([]string, 0, len(objIDList))
+	for _, objID := range objIDList {
+		if utils.IsObjectIDValid(objID) {
+			validIDs = append(validIDs, objID)
 		}
-		if existType == checkFSExist {
-			ret, _ = fsmgr.Exists(storeID, objIDList[i])
-		} else if existType == checkBlockExist {
-			ret = blockmgr.Exists(storeID, objIDList[i])
-		}
-		if !ret {
-			neededObjs = append(neededObjs, objIDList[i])
+	}
+
+	var exists []bool
+	if existType == checkFSExist {
+		exists = fsmgr.ExistsMany(storeID, validIDs)
+	} else if existType == checkBlockExist {
+		exists = blockmgr.ExistsMany(storeID, validIDs)
+	}
+
+	var neededObjs []string
+	for i, objID := range validIDs {
+		if !exists[i] {
+			neededObjs = append(neededObjs, objID)
 		}
 	}
 
@@ -753,9 +754,12 @@ func getJWTTokenCB(rsp http.ResponseWriter, r *http.Request) *appError {
 
 func getFsObjIDCB(rsp http.ResponseWriter, r *http.Request) *appError {
 	recvChan := make(chan *calResult)
+	writer := newFsIDListWriter(rsp, fsIDListTmpDir())
 
-	calFsIdPool.AddTask(recvChan, rsp, r)
+	calFsIdPool.AddTask(recvChan, r, writer)
 	result := <-recvChan
+	// Long lists are still being sent after the worker returns.
+	writer.wait()
 	return result.err
 }
 
@@ -1104,10 +1108,11 @@ func checkBlocks(ctx context.Context, repo *repomgr.Repo, base, remote *commitmg
 	aux.storeID = repo.StoreID
 	aux.version = repo.Version
 	opt := &diff.DiffOptions{
-		FileCB: checkFileBlocks,
-		DirCB:  checkDirCB,
-		Ctx:    ctx,
-		RepoID: repo.StoreID}
+		FileCB:      checkFileBlocks,
+		DirCB:       checkDirCB,
+		Ctx:         ctx,
+		RepoID:      repo.StoreID,
+		Concurrency: diff.DefaultConcurrency}
 	opt.Data = aux
 
 	trees := []string{base.RootID, remote.RootID}
@@ -1420,6 +1425,13 @@ func publishUpdateEvent(repoID string, commitID string) {
 	}
 }
 
+// The file history index is maintained by seaf-server, let it index the new commits.
+func scheduleFileHistoryUpdate(repoID string) {
+	if _, err := rpcclient.Call("schedule_file_history_update", repoID); err != nil {
+		log.Warnf("Failed to schedule file history update for repo %s: %v", repoID, err)
+	}
+}
+
 func removeSyncAPIExpireCache() {
 	deleteTokens := func(key interface{}, value interface{}) bool {
 		if info, ok := value.(*tokenInfo); ok {
@@ -1456,16 +1468,18 @@ func removeSyncAPIExpireCache() {
 type collectFsInfo struct {
 	startTime int64
 	isTimeout bool
-	results   []interface{}
+	writer    *fsIDListWriter
 }
 
 var ErrTimeout = fmt.Errorf("get fs id list timeout")
 
-func calculateSendObjectList(ctx context.Context, repo *repomgr.Repo, serverHead string, clientHead string, dirOnly bool) ([]interface{}, error) {
+// calculateSendObjectList writes the ids of fs objects in serverHead but not
+// in clientHead to writer, while the trees are being diffed.
+func calculateSendObjectList(ctx context.Context, repo *repomgr.Repo, serverHead string, clientHead string, dirOnly bool, writer *fsIDListWriter) error {
 	masterHead, err := commitmgr.Load(repo.ID, serverHead)
 	if err != nil {
 		err := fmt.Errorf("Failed to load server head commit %s:%s: %v", repo.ID, serverHead, err)
-		return nil, err
+		return err
 	}
 	var remoteHead *commitmgr.Commit
 	remoteHeadRoot := emptySHA1
@@ -1473,42 +1487,47 @@ func calculateSendObjectList(ctx context.Context, repo *repomgr.Repo, serverHead
 		remoteHead, err = commitmgr.Load(repo.ID, clientHead)
 		if err != nil {
 			err := fmt.Errorf("Failed to load remote head commit %s:%s: %v", repo.ID, clientHead, err)
-			return nil, err
+			return err
 		}
 		remoteHeadRoot = remoteHead.RootID
 	}
 
 	info := new(collectFsInfo)
 	info.startTime = time.Now().Unix()
+	info.writer = writer
 	if remoteHeadRoot != masterHead.RootID && masterHead.RootID != emptySHA1 {
-		info.results = append(info.results, masterHead.RootID)
+		if err := writer.add(masterHead.RootID); err != nil {
+			return err
+		}
 	}
 
 	var opt *diff.DiffOptions
 	if !dirOnly {
 		opt = &diff.DiffOptions{
-			FileCB: collectFileIDs,
-			DirCB:  collectDirIDs,
-			Ctx:    ctx,
-			RepoID: repo.StoreID}
+			FileCB:      collectFileIDs,
+			DirCB:       collectDirIDs,
+			Ctx:         ctx,
+			RepoID:      repo.StoreID,
+			Concurrency: diff.DefaultConcurrency}
 		opt.Data = info
 	} else {
 		opt = &diff.DiffOptions{
-			FileCB: collectFileIDsNOp,
-			DirCB:  collectDirIDs,
-			Ctx:    ctx,
-			RepoID: repo.StoreID}
+			FileCB:      collectFileIDsNOp,
+			DirCB:       collectDirIDs,
+			Ctx:         ctx,
+			RepoID:      repo.StoreID,
+			Concurrency: diff.DefaultConcurrency}
 		opt.Data = info
 	}
 	trees := []string{masterHead.RootID, remoteHeadRoot}
 
 	if err := diff.DiffTrees(trees, opt); err != nil {
 		if info.isTimeout {
-			return nil, ErrTimeout
+			return ErrTimeout
 		}
-		return nil, err
+		return err
 	}
-	return info.results, nil
+	return nil
 }
 
 func collectFileIDs(ctx context.Context, baseDir string, files []*fsmgr.SeafDirent, data interface{}) error {
@@ -1529,7 +1548,9 @@ func collectFileIDs(ctx context.Context, baseDir string, files []*fsmgr.SeafDire
 	if file1 != nil &&
 		(file2 == nil || file1.ID != file2.ID) &&
 		file1.ID != emptySHA1 {
-		info.results = append(info.results, file1.ID)
+		if err := info.writer.add(file1.ID); err != nil {
+			return err
+		}
 	}
 
 	return nil
@@ -1557,7 +1578,9 @@ func collectDirIDs(ctx context.Context, baseDir string, dirs []*fsmgr.SeafDirent
 	if dir1 != nil &&
 		(dir2 == nil || dir1.ID != dir2.ID) &&
 		dir1.ID != emptySHA1 {
-		info.results = append(info.results, dir1.ID)
+		if err := info.writer.add(dir1.ID); err != nil {
+			return err
+		}
 	}
 
 	if option.FsIdListRequestTimeout > 0 {
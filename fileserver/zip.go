@@ -0,0 +1,386 @@
+package main
+
+import (
+	"archive/zip"
+	"bytes"
+	"compress/flate"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"path/filepath"
+	"runtime"
+	"strings"
+	"sync"
+	"time"
+	"unicode/utf8"
+)
+
+// Files are packed in segments of one block. A pool of workers reads,
+// decrypts and deflates the segments in parallel, each into an independent
+// deflate stream. All but the last segment of a file end with a sync flush,
+// so the segments of a file concatenate into one valid deflate stream.
+// A single goroutine writes the finished segments to the archive in order.
+const (
+	zipMaxWorkers = 4
+	// Segments being packed or waiting to be written, per worker.
+	zipSegmentsPerWorker = 2
+)
+
+// Already compressed files are packed with stored deflate blocks. Unlike
+// the zip "store" method, this keeps the entries readable by streaming
+// unzippers, which can't find the end of stored entries with a data
+// descriptor.
+var zipCompressedExts = map[string]bool{
+	".7z": true, ".apk": true, ".bz2": true, ".docx": true, ".epub": true,
+	".flac": true, ".gif": true, ".gz": true, ".heic": true, ".jar": true,
+	".jpeg": true, ".jpg": true, ".m4a": true, ".m4v": true, ".mkv": true,
+	".mov": true, ".mp3": true, ".mp4": true, ".odp": true, ".ods": true,
+	".odt": true, ".ogg": true, ".png": true, ".pptx": true, ".rar": true,
+	".tgz": true, ".webm": true, ".webp": true, ".xlsx": true, ".xz": true,
+	".zip": true, ".zst": true,
+}
+
+var errZipStopped = errors.New("zip packing stopped")
+
+type zipBlockReader func(storeID, blkID string, w io.Writer) error
+
+type zipSegment struct {
+	header *zip.FileHeader
+	isDir  bool
+	blkID  string
+	level  int
+	first  bool
+	last   bool
+
+	done    chan struct{}
+	data    *bytes.Buffer
+	crc     uint32
+	rawSize int64
+	err     error
+}
+
+type zipPacker struct {
+	ar        *zip.Writer
+	storeID   string
+	cryptKey  *seafileCrypt
+	readBlock zipBlockReader
+
+	jobs       chan *zipSegment
+	pending    chan *zipSegment
+	workers    sync.WaitGroup
+	writerDone chan struct{}
+
+	stop     chan struct{}
+	stopOnce sync.Once
+	err      error
+	// The error has been returned by addDir or addFile.
+	reported bool
+}
+
+var zipBufPool = sync.Pool{
+	New: func() interface{} {
+		return new(bytes.Buffer)
+	},
+}
+
+func newZipPacker(ar *zip.Writer, storeID string, cryptKey *seafileCrypt, readBlock zipBlockReader) *zipPacker {
+	nworkers := runtime.GOMAXPROCS(0)
+	if nworkers > zipMaxWorkers {
+		nworkers = zipMaxWorkers
+	}
+
+	p := new(zipPacker)
+	p.ar = ar
+	p.storeID = storeID
+	p.cryptKey = cryptKey
+	p.readBlock = readBlock
+	p.jobs = make(chan *zipSegment, nworkers)
+	p.pending = make(chan *zipSegment, nworkers*zipSegmentsPerWorker)
+	p.writerDone = make(chan struct{})
+	p.stop = make(chan struct{})
+
+	for i := 0; i < nworkers; i++ {
+		p.workers.Add(1)
+		go p.packSegments()
+	}
+	go p.writeSegments()
+
+	return p
+}
+
+// addDir adds an empty directory to the archive.
+func (p *zipPacker) addDir(name string) error {
+	seg := &zipSegment{header: &zip.FileHeader{Name: name + "/"}, isDir: true}
+	seg.done = make(chan struct{})
+	close(seg.done)
+	return p.queue(seg, false)
+}
+
+// addFile adds a file made of the blocks to the archive.
+func (p *zipPacker) addFile(name string, mtime int64, blkIDs []string) error {
+	header := newZipFileHeader(name, time.Unix(mtime, 0))
+	level := flate.DefaultCompression
+	if zipCompressedExts[strings.ToLower(filepath.Ext(name))] {
+		level = flate.NoCompression
+	}
+
+	// An empty file still needs a final deflate block.
+	n := len(blkIDs)
+	if n == 0 {
+		n = 1
+	}
+	for i := 0; i < n; i++ {
+		seg := &zipSegment{header: header, level: level}
+		if i < len(blkIDs) {
+			seg.blkID = blkIDs[i]
+		}
+		seg.first = i == 0
+		seg.last = i == n-1
+		seg.done = make(chan struct{})
+		if err := p.queue(seg, true); err != nil {
+			return err
+		}
+	}
+
+	return nil
+}
+
+func (p *zipPacker) queue(seg *zipSegment, pack bool) error {
+	// Segments enter the writer queue first to keep their order. The
+	// bounded queue also limits the memory used by packed segments.
+	select {
+	case p.pending <- seg:
+	case <-p.stop:
+		p.reported = true
+		return p.err
+	}
+	if pack {
+		p.jobs <- seg
+	}
+	return nil
+}
+
+// close waits for all queued entries to be written and returns the error
+// that addDir or addFile haven't returned yet. It doesn't close the zip
+// writer.
+func (p *zipPacker) close() error {
+	close(p.jobs)
+	close(p.pending)
+	p.workers.Wait()
+	<-p.writerDone
+	if p.reported {
+		return nil
+	}
+	return p.err
+}
+
+func (p *zipPacker) fail(err error) {
+	p.stopOnce.Do(func() {
+		p.err = err
+		close(p.stop)
+	})
+}
+
+func (p *zipPacker) stopped() bool {
+	select {
+	case <-p.stop:
+		return true
+	default:
+		return false
+	}
+}
+
+func (p *zipPacker) packSegments() {
+	defer p.workers.Done()
+
+	var raw bytes.Buffer
+	writers := make(map[int]*flate.Writer)
+
+	for seg := range p.jobs {
+		if p.stopped() {
+			seg.err = errZipStopped
+		} else {
+			fw := writers[seg.level]
+			if fw == nil {
+				fw, _ = flate.NewWriter(nil, seg.level)
+				writers[seg.level] = fw
+			}
+			seg.err = p.packSegment(seg, &raw, fw)
+		}
+		close(seg.done)
+	}
+}
+
+func (p *zipPacker) packSegment(seg *zipSegment, raw *bytes.Buffer, fw *flate.Writer) error {
+	seg.data = zipBufPool.Get().(*bytes.Buffer)
+	seg.data.Reset()
+	fw.Reset(seg.data)
+
+	if seg.blkID != "" {
+		raw.Reset()
+		if err := p.readBlock(p.storeID, seg.blkID, raw); err != nil {
+			return fmt.Errorf("failed to read block %s: %v", seg.blkID, err)
+		}
+		data := raw.Bytes()
+		if p.cryptKey != nil {
+			decoded, err := p.cryptKey.decryptInPlace(data)
+			if err != nil {
+				return fmt.Errorf("failed to decrypt block %s: %v", seg.blkID, err)
+			}
+			data = decoded
+		}
+		seg.crc = crc32.ChecksumIEEE(data)
+		seg.rawSize = int64(len(data))
+		if _, err := fw.Write(data); err != nil {
+			return err
+		}
+	}
+
+	if seg.last {
+		return fw.Close()
+	}
+	return fw.Flush()
+}
+
+func (p *zipPacker) writeSegments() {
+	defer close(p.writerDone)
+
+	var w io.Writer
+	var crc uint32
+	var compSize, rawSize uint64
+
+	for seg := range p.pending {
+		<-seg.done
+		if !p.stopped() {
+			var err error
+			if seg.isDir {
+				_, err = p.ar.Create(seg.header.Name)
+			} else {
+				if seg.first {
+					w, err = p.ar.CreateRaw(seg.header)
+					crc, compSize, rawSize = 0, 0, 0
+				}
+				if err == nil {
+					err = seg.err
+				}
+				if err == nil {
+					_, err = w.Write(seg.data.Bytes())
+				}
+				if err == nil {
+					crc = crc32Combine(crc, seg.crc, seg.rawSize)
+					compSize += uint64(seg.data.Len())
+					rawSize += uint64(seg.rawSize)
+					if seg.last {
+						setZipFileSizes(seg.header, crc, compSize, rawSize)
+					}
+				}
+			}
+			if err != nil {
+				p.fail(err)
+			}
+		}
+		if seg.data != nil {
+			zipBufPool.Put(seg.data)
+			seg.data = nil
+		}
+	}
+}
+
+// newZipFileHeader fills in what zip.Writer.CreateHeader would for a
+// deflated file, since CreateRaw takes the header as it is.
+func newZipFileHeader(name string, modified time.Time) *zip.FileHeader {
+	fh := &zip.FileHeader{Name: name, Method: zip.Deflate, Modified: modified}
+	// CRC and sizes follow the data in a data descriptor.
+	fh.Flags |= 0x8
+	if utf8.ValidString(name) {
+		for _, r := range name {
+			if r >= 0x80 {
+				fh.Flags |= 0x800
+				break
+			}
+		}
+	}
+	fh.CreatorVersion = 20
+	fh.ReaderVersion = 20
+
+	fh.ModifiedDate = uint16(modified.Day() + int(modified.Month())<<5 + (modified.Year()-1980)<<9)
+	fh.ModifiedTime = uint16(modified.Second()/2 + modified.Minute()<<5 + modified.Hour()<<11)
+	// Extended timestamp, as written by CreateHeader.
+	mt := uint32(modified.Unix())
+	fh.Extra = []byte{0x55, 0x54, 5, 0, 1, byte(mt), byte(mt >> 8), byte(mt >> 16), byte(mt >> 24)}
+
+	return fh
+}
+
+// setZipFileSizes sets the CRC and sizes of a file written with CreateRaw.
+// The zip writer writes them into the data descriptor and the central
+// directory when the next entry is created or the archive is closed.
+func setZipFileSizes(fh *zip.FileHeader, crc uint32, compSize, rawSize uint64) {
+	fh.CRC32 = crc
+	fh.CompressedSize64 = compSize
+	fh.UncompressedSize64 = rawSize
+	if compSize >= 1<<32-1 || rawSize >= 1<<32-1 {
+		fh.CompressedSize = 1<<32 - 1
+		fh.UncompressedSize = 1<<32 - 1
+		fh.ReaderVersion = 45
+	} else {
+		fh.CompressedSize = uint32(compSize)
+		fh.UncompressedSize = uint32(rawSize)
+	}
+}
+
+// crc32Combine returns the CRC-32 of two concatenated buffers from their
+// CRCs and the length of the second one, as crc32_combine in zlib.
+func crc32Combine(crc1, crc2 uint32, len2 int64) uint32 {
+	if len2 <= 0 {
+		return crc1
+	}
+
+	var even, odd [32]uint32
+	odd[0] = crc32.IEEE
+	row := uint32(1)
+	for n := 1; n < 32; n++ {
+		odd[n] = row
+		row <<= 1
+	}
+	gf2MatrixSquare(even[:], odd[:])
+	gf2MatrixSquare(odd[:], even[:])
+
+	for {
+		gf2MatrixSquare(even[:], odd[:])
+		if len2&1 != 0 {
+			crc1 = gf2MatrixTimes(even[:], crc1)
+		}
+		len2 >>= 1
+		if len2 == 0 {
+			break
+		}
+		gf2MatrixSquare(odd[:], even[:])
+		if len2&1 != 0 {
+			crc1 = gf2MatrixTimes(odd[:], crc1)
+		}
+		len2 >>= 1
+		if len2 == 0 {
+			break
+		}
+	}
+
+	return crc1 ^ crc2
+}
+
+func gf2MatrixTimes(mat []uint32, vec uint32) uint32 {
+	var sum uint32
+	for i := 0; vec != 0; i, vec = i+1, vec>>1 {
+		if vec&1 != 0 {
+			sum ^= mat[i]
+		}
+	}
+	return sum
+}
+
+func gf2MatrixSquare(square, mat []uint32) {
+	for n := 0; n < 32; n++ {
+		square[n] = gf2MatrixTimes(mat, mat[n])
+	}
+}
@@ -0,0 +1,206 @@
+package main
+
+import (
+	"archive/zip"
+	"bytes"
+	"crypto/sha1"
+	"encoding/hex"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"math/rand"
+	"testing"
+)
+
+const zipTestStoreID = "b1f2ad61-9164-418a-a47f-ab805dbd5694"
+
+type zipTestFile struct {
+	name    string
+	content []byte
+	blkIDs  []string
+}
+
+type zipTestStore struct {
+	blocks map[string][]byte
+}
+
+func (s *zipTestStore) readBlock(storeID, blkID string, w io.Writer) error {
+	data, ok := s.blocks[blkID]
+	if !ok {
+		return fmt.Errorf("block %s not found", blkID)
+	}
+	_, err := w.Write(data)
+	return err
+}
+
+// addFile splits the content into blocks of blkSize and stores them,
+// encrypted if cryptKey is not nil.
+func (s *zipTestStore) addFile(name string, content []byte, blkSize int, cryptKey *seafileCrypt) (*zipTestFile, error) {
+	file := &zipTestFile{name: name, content: content}
+	for off := 0; off < len(content); off += blkSize {
+		end := off + blkSize
+		if end > len(content) {
+			end = len(content)
+		}
+		data := content[off:end]
+		if cryptKey != nil {
+			encoded, err := cryptKey.encrypt(append([]byte(nil), data...))
+			if err != nil {
+				return nil, err
+			}
+			data = encoded
+		}
+		sum := sha1.Sum(data)
+		blkID := hex.EncodeToString(sum[:])
+		s.blocks[blkID] = data
+		file.blkIDs = append(file.blkIDs, blkID)
+	}
+	return file, nil
+}
+
+func zipTestText(size int) []byte {
+	var buf bytes.Buffer
+	for i := 0; buf.Len() < size; i++ {
+		fmt.Fprintf(&buf, "line %d of a compressible text file\n", i)
+	}
+	return buf.Bytes()[:size]
+}
+
+func zipTestRandom(size int) []byte {
+	data := make([]byte, size)
+	rand.New(rand.NewSource(int64(size))).Read(data)
+	return data
+}
+
+func zipTestPack(store *zipTestStore, files []*zipTestFile, dirs []string, cryptKey *seafileCrypt, w io.Writer) error {
+	ar := zip.NewWriter(w)
+	packer := newZipPacker(ar, zipTestStoreID, cryptKey, store.readBlock)
+	for _, dir := range dirs {
+		if err := packer.addDir(dir); err != nil {
+			packer.close()
+			return err
+		}
+	}
+	for _, file := range files {
+		if err := packer.addFile(file.name, 1700000000, file.blkIDs); err != nil {
+			packer.close()
+			return err
+		}
+	}
+	if err := packer.close(); err != nil {
+		return err
+	}
+	return ar.Close()
+}
+
+func testPackZip(t *testing.T, cryptKey *seafileCrypt) {
+	store := &zipTestStore{blocks: make(map[string][]byte)}
+	contents := []struct {
+		name    string
+		content []byte
+		blkSize int
+	}{
+		{"docs/a.txt", zipTestText(300000), 100000},
+		{"img/b.jpg", zipTestRandom(250000), 100000},
+		{"empty.txt", nil, 100000},
+		{"文档/c.txt", zipTestText(1000), 100000},
+	}
+
+	var files []*zipTestFile
+	for _, c := range contents {
+		file, err := store.addFile(c.name, c.content, c.blkSize, cryptKey)
+		if err != nil {
+			t.Fatalf("failed to add file %s: %v", c.name, err)
+		}
+		files = append(files, file)
+	}
+
+	var buf bytes.Buffer
+	if err := zipTestPack(store, files, []string{"emptydir"}, cryptKey, &buf); err != nil {
+		t.Fatalf("failed to pack zip: %v", err)
+	}
+
+	r, err := zip.NewReader(bytes.NewReader(buf.Bytes()), int64(buf.Len()))
+	if err != nil {
+		t.Fatalf("failed to read zip: %v", err)
+	}
+	if len(r.File) != len(files)+1 {
+		t.Fatalf("zip has %d entries, expected %d", len(r.File), len(files)+1)
+	}
+	if r.File[0].Name != "emptydir/" {
+		t.Errorf("first entry is %s, expected emptydir/", r.File[0].Name)
+	}
+	for i, file := range files {
+		f := r.File[i+1]
+		if f.Name != file.name {
+			t.Errorf("entry %d is %s, expected %s", i+1, f.Name, file.name)
+		}
+		if f.Modified.Unix() != 1700000000 {
+			t.Errorf("wrong mtime %v of %s", f.Modified, f.Name)
+		}
+		rc, err := f.Open()
+		if err != nil {
+			t.Fatalf("failed to open %s: %v", f.Name, err)
+		}
+		data, err := io.ReadAll(rc)
+		rc.Close()
+		if err != nil {
+			t.Fatalf("failed to read %s: %v", f.Name, err)
+		}
+		if !bytes.Equal(data, file.content) {
+			t.Errorf("wrong content of %s", f.Name)
+		}
+	}
+}
+
+func TestPackZip(t *testing.T) {
+	testPackZip(t, nil)
+
+	key := zipTestRandom(32)
+	iv := zipTestRandom(16)
+	testPackZip(t, &seafileCrypt{key: key, iv: iv, version: 2})
+}
+
+func TestPackZipMissingBlock(t *testing.T) {
+	store := &zipTestStore{blocks: make(map[string][]byte)}
+	file, _ := store.addFile("a.txt", zipTestText(1000), 100, nil)
+	delete(store.blocks, file.blkIDs[3])
+
+	if err := zipTestPack(store, []*zipTestFile{file}, nil, nil, io.Discard); err == nil {
+		t.Errorf("packing a file with a missing block should fail")
+	}
+}
+
+func TestCrc32Combine(t *testing.T) {
+	data := zipTestRandom(100000)
+	for _, split := range []int{0, 1, 4096, 99999, 100000} {
+		crc1 := crc32.ChecksumIEEE(data[:split])
+		crc2 := crc32.ChecksumIEEE(data[split:])
+		got := crc32Combine(crc1, crc2, int64(len(data)-split))
+		if got != crc32.ChecksumIEEE(data) {
+			t.Errorf("wrong combined crc when split at %d", split)
+		}
+	}
+}
+
+// BenchmarkPackZip packs a folder of half text and half already
+// compressed files.
+func BenchmarkPackZip(b *testing.B) {
+	store := &zipTestStore{blocks: make(map[string][]byte)}
+	var files []*zipTestFile
+	var total int64
+	for i := 0; i < 8; i++ {
+		text, _ := store.addFile(fmt.Sprintf("docs/%d.txt", i), zipTestText(4<<20+i), 1<<20, nil)
+		video, _ := store.addFile(fmt.Sprintf("videos/%d.mp4", i), zipTestRandom(4<<20+i), 1<<20, nil)
+		files = append(files, text, video)
+		total += int64(len(text.content) + len(video.content))
+	}
+
+	b.SetBytes(total)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := zipTestPack(store, files, nil, nil, io.Discard); err != nil {
+			b.Fatalf("failed to pack zip: %v", err)
+		}
+	}
+}
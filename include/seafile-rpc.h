@@ -956,6 +956,13 @@ char *
 seafile_check_permission_by_path (const char *repo_id, const char *path,
                                   const char *user, GError **error);
 
+/*
+ * Check the permissions of @user on the comma separated @repo_ids at once.
+ * Returns a json object mapping the accessible repos to their permissions.
+ */
+json_t *
+seafile_check_permissions (const char *repo_ids, const char *user, GError **error);
+
 GList *
 seafile_list_dir_with_perm (const char *repo_id,
                             const char *path,
@@ -1152,6 +1159,12 @@ seafile_set_repo_status(const char *repo_id, int status, GError **error);
 int
 seafile_get_repo_status(const char *repo_id, GError **error);
 
+/* Index the file history of new commits in the background. Called by the
+ * Go fileserver after it updates a branch.
+ */
+int
+seafile_schedule_file_history_update (const char *repo_id, GError **error);
+
 GList*
 seafile_get_repos_by_id_prefix  (const char *id_prefix, int start,
                                  int limit, GError **error);
@@ -0,0 +1,185 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Measure the bloom filters used by GC and check their false-positive rate.
+ *
+ * For each number of keys, the filters are sized the way seafserv-gc sizes
+ * them. Random 40 character hex ids are added, and as many other ids are
+ * tested to measure the false-positive rate. The program exits with 1 if
+ * an added id isn't found, or if the split block filter misses its target
+ * rate when its size isn't capped.
+ *
+ * Usage: bloom-bench [n_keys ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "bloom-filter.h"
+
+/* Same as in server/gc/gc-core.c. */
+#define GC_INDEX_FALSE_POSITIVE_RATE 0.01
+#define MAX_BF_SIZE (((size_t)1) << 26)   /* 64 MB */
+
+/* The old GC index used 4 bits per block and k = 3. */
+#define OLD_BITS_PER_KEY 4
+#define OLD_K 3
+
+/* Allow for the variance of the measurement. */
+#define FPR_TOLERANCE 1.1
+
+/* Different seeds for the ids that are added and the ids that are not. */
+#define ADDED_SEED 1
+#define ABSENT_SEED 2
+
+static void
+make_id (guint64 seed, guint64 i, char *id)
+{
+    static const char hex[] = "0123456789abcdef";
+    guint64 x = (seed << 48) ^ i;
+    int j, k;
+
+    /* splitmix64, one round per 16 hex digits. */
+    for (j = 0; j < 40; j += 16) {
+        guint64 z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        for (k = j; k < j + 16 && k < 40; k++, z >>= 4)
+            id[k] = hex[z & 0xf];
+    }
+    id[40] = '\0';
+}
+
+static double
+mops (size_t n, gint64 usec)
+{
+    return usec > 0 ? (double)n / usec : 0;
+}
+
+static gboolean
+run_blocked (size_t n)
+{
+    BlockedBloom *bloom;
+    char id[48];
+    size_t i, false_negatives = 0, false_positives = 0;
+    gint64 start, add_usec, test_usec;
+    double fpr;
+    gboolean capped, ok = TRUE;
+
+    bloom = blocked_bloom_create (n, GC_INDEX_FALSE_POSITIVE_RATE, MAX_BF_SIZE);
+    if (!bloom) {
+        fprintf (stderr, "Failed to create bloom filter for %zu keys.\n", n);
+        return FALSE;
+    }
+    capped = (blocked_bloom_size (bloom) ==
+              (MAX_BF_SIZE / sizeof(BloomBlock)) * sizeof(BloomBlock));
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; i++) {
+        make_id (ADDED_SEED, i, id);
+        blocked_bloom_add (bloom, id);
+    }
+    add_usec = g_get_monotonic_time () - start;
+
+    for (i = 0; i < n; i++) {
+        make_id (ADDED_SEED, i, id);
+        if (!blocked_bloom_test (bloom, id))
+            ++false_negatives;
+    }
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; i++) {
+        make_id (ABSENT_SEED, i, id);
+        if (blocked_bloom_test (bloom, id))
+            ++false_positives;
+    }
+    test_usec = g_get_monotonic_time () - start;
+
+    fpr = (double)false_positives / n;
+    printf ("blocked %zu keys, %zu bytes%s, add %.1f Mops/s, test %.1f Mops/s, "
+            "fpr %.4f%% (target %.4f%%)\n",
+            n, blocked_bloom_size (bloom), capped ? " (capped)" : "",
+            mops (n, add_usec), mops (n, test_usec),
+            fpr * 100, GC_INDEX_FALSE_POSITIVE_RATE * 100);
+
+    if (false_negatives > 0) {
+        fprintf (stderr, "FAILED: %zu added keys not found.\n", false_negatives);
+        ok = FALSE;
+    }
+    if (!capped && fpr > GC_INDEX_FALSE_POSITIVE_RATE * FPR_TOLERANCE) {
+        fprintf (stderr, "FAILED: false-positive rate %.4f%% is above the target.\n",
+                 fpr * 100);
+        ok = FALSE;
+    }
+
+    blocked_bloom_destroy (bloom);
+    return ok;
+}
+
+static void
+run_old (size_t n)
+{
+    Bloom *bloom;
+    char id[48];
+    size_t i, false_positives = 0;
+    gint64 start, add_usec, test_usec;
+
+    bloom = bloom_create (n * OLD_BITS_PER_KEY, OLD_K, 0);
+    if (!bloom) {
+        fprintf (stderr, "Failed to create bloom filter for %zu keys.\n", n);
+        return;
+    }
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; i++) {
+        make_id (ADDED_SEED, i, id);
+        bloom_add (bloom, id);
+    }
+    add_usec = g_get_monotonic_time () - start;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; i++) {
+        make_id (ABSENT_SEED, i, id);
+        if (bloom_test (bloom, id))
+            ++false_positives;
+    }
+    test_usec = g_get_monotonic_time () - start;
+
+    printf ("old     %zu keys, %zu bytes, add %.1f Mops/s, test %.1f Mops/s, fpr %.4f%%\n",
+            n, (n * OLD_BITS_PER_KEY + 7) / 8,
+            mops (n, add_usec), mops (n, test_usec),
+            (double)false_positives / n * 100);
+
+    bloom_destroy (bloom);
+}
+
+int
+main (int argc, char **argv)
+{
+    /* 1M and 8M blocks, and enough blocks to reach the size cap. */
+    size_t defaults[] = { 1000000, 8000000, 60000000 };
+    gboolean ok = TRUE;
+    int i;
+
+    if (argc < 2) {
+        for (i = 0; i < G_N_ELEMENTS(defaults); i++) {
+            run_old (defaults[i]);
+            ok = run_blocked (defaults[i]) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        size_t n = strtoull (argv[i], NULL, 10);
+        if (n == 0) {
+            fprintf (stderr, "Usage: %s [n_keys ...]\n", argv[0]);
+            return 1;
+        }
+        run_old (n);
+        ok = run_blocked (n) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -5,6 +5,11 @@
 #include <string.h>
 #include <openssl/sha.h>
 #include <assert.h>
+#include <math.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "bloom-filter.h"
 
@@ -174,3 +179,177 @@ int bloom_test(Bloom *bloom, const char *s)
 
     return 1;
 }
+
+/* Split block bloom filter. */
+
+/* Odd constants to derive the bit of each word from a single hash,
+ * same as in the parquet split block bloom filter.
+ */
+static const uint32_t bloom_salt[BLOCKED_BLOOM_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+/* Keys are usually hex object ids, which are already well distributed.
+ * A cheap string hash with a final mix is enough, there is no need
+ * for a cryptographic hash.
+ */
+static uint64_t
+hash_string (const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/*
+ * Expected false-positive rate when @load keys fall into each block on
+ * average. The number of keys in a block is Poisson distributed, and a
+ * block with i keys gives a false positive with probability
+ * (1 - (31/32)^i)^8.
+ */
+static double
+block_fpp (double load)
+{
+    double p_i = exp (-load);
+    double fpp = 0;
+    int i, max_i;
+
+    max_i = (int)(load + 10 * sqrt (load) + 20);
+    for (i = 0; i <= max_i; ++i) {
+        fpp += p_i * pow (1 - pow (31.0 / 32, i), BLOCKED_BLOOM_WORDS);
+        p_i *= load / (i + 1);
+    }
+
+    return fpp;
+}
+
+BlockedBloom *blocked_bloom_create (size_t n_items, double fpp, size_t max_bytes)
+{
+    BlockedBloom *bloom;
+    double lo = 0, hi = 256, load;
+    size_t nblocks;
+    int i;
+
+    if (fpp <= 0 || fpp >= 1)
+        return NULL;
+    if (n_items == 0)
+        n_items = 1;
+
+    /* Find the highest load per block that still meets @fpp. */
+    for (i = 0; i < 50; ++i) {
+        load = (lo + hi) / 2;
+        if (block_fpp (load) > fpp)
+            hi = load;
+        else
+            lo = load;
+    }
+    if (lo <= 0)
+        lo = 1.0 / 256;
+
+    nblocks = (size_t)(n_items / lo) + 1;
+    if (max_bytes > 0 && nblocks * sizeof(BloomBlock) > max_bytes)
+        nblocks = max_bytes / sizeof(BloomBlock);
+    if (nblocks == 0)
+        nblocks = 1;
+
+    if ( !(bloom = malloc(sizeof(BlockedBloom))) ) return NULL;
+    if ( !(bloom->blocks = calloc(nblocks, sizeof(BloomBlock))) )
+    {
+        free (bloom);
+        return NULL;
+    }
+    bloom->nblocks = nblocks;
+
+    return bloom;
+}
+
+void blocked_bloom_destroy (BlockedBloom *bloom)
+{
+    free (bloom->blocks);
+    free (bloom);
+}
+
+size_t blocked_bloom_size (BlockedBloom *bloom)
+{
+    return bloom->nblocks * sizeof(BloomBlock);
+}
+
+static inline BloomBlock *
+select_block (BlockedBloom *bloom, uint64_t h)
+{
+    /* Map the high 32 bits to [0, nblocks) without a division. */
+    return &bloom->blocks[((h >> 32) * bloom->nblocks) >> 32];
+}
+
+#ifdef __AVX2__
+
+static inline __m256i
+make_mask (uint32_t key)
+{
+    const __m256i salt = _mm256_loadu_si256 ((const __m256i *)bloom_salt);
+    __m256i m = _mm256_mullo_epi32 (_mm256_set1_epi32 (key), salt);
+    m = _mm256_srli_epi32 (m, 27);
+    return _mm256_sllv_epi32 (_mm256_set1_epi32 (1), m);
+}
+
+void blocked_bloom_add (BlockedBloom *bloom, const char *s)
+{
+    uint64_t h = hash_string (s);
+    __m256i *b = (__m256i *)select_block (bloom, h);
+
+    _mm256_storeu_si256 (b, _mm256_or_si256 (_mm256_loadu_si256 (b),
+                                             make_mask ((uint32_t)h)));
+}
+
+int blocked_bloom_test (BlockedBloom *bloom, const char *s)
+{
+    uint64_t h = hash_string (s);
+    __m256i *b = (__m256i *)select_block (bloom, h);
+
+    /* All mask bits must be set in the block. */
+    return _mm256_testc_si256 (_mm256_loadu_si256 (b), make_mask ((uint32_t)h));
+}
+
+#else
+
+/* Written as independent operations on the 8 words, so that compilers
+ * can vectorize them.
+ */
+void blocked_bloom_add (BlockedBloom *bloom, const char *s)
+{
+    uint64_t h = hash_string (s);
+    BloomBlock *b = select_block (bloom, h);
+    uint32_t key = (uint32_t)h;
+    int i;
+
+    for (i = 0; i < BLOCKED_BLOOM_WORDS; ++i)
+        b->w[i] |= 1U << ((key * bloom_salt[i]) >> 27);
+}
+
+int blocked_bloom_test (BlockedBloom *bloom, const char *s)
+{
+    uint64_t h = hash_string (s);
+    BloomBlock *b = select_block (bloom, h);
+    uint32_t key = (uint32_t)h;
+    uint32_t missing = 0;
+    int i;
+
+    for (i = 0; i < BLOCKED_BLOOM_WORDS; ++i)
+        missing |= ~b->w[i] & (1U << ((key * bloom_salt[i]) >> 27));
+
+    return missing == 0;
+}
+
+#endif
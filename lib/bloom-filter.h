@@ -4,6 +4,7 @@
 #define __BLOOM_H__
 
 #include <stdlib.h>
+#include <stdint.h>
 
 typedef struct {
     size_t          asize;
@@ -20,4 +21,33 @@ int bloom_add (Bloom *bloom, const char *s);
 int bloom_remove (Bloom *bloom, const char *s);
 int bloom_test (Bloom *bloom, const char *s);
 
+/*
+ * Split block bloom filter.
+ *
+ * The bit array is divided into 256-bit blocks. Each key selects one
+ * block and sets one bit in each of the eight 32-bit words of that
+ * block, so every add or test touches only one cache line.
+ */
+
+#define BLOCKED_BLOOM_WORDS 8
+
+typedef struct {
+    uint32_t w[BLOCKED_BLOOM_WORDS];
+} BloomBlock;
+
+typedef struct {
+    size_t          nblocks;
+    BloomBlock     *blocks;
+} BlockedBloom;
+
+/*
+ * Create a filter for @n_items keys with false-positive rate @fpp.
+ * The size is capped at @max_bytes if it's not 0.
+ */
+BlockedBloom *blocked_bloom_create (size_t n_items, double fpp, size_t max_bytes);
+void blocked_bloom_destroy (BlockedBloom *bloom);
+size_t blocked_bloom_size (BlockedBloom *bloom);
+void blocked_bloom_add (BlockedBloom *bloom, const char *s);
+int blocked_bloom_test (BlockedBloom *bloom, const char *s);
+
 #endif
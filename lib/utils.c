@@ -654,6 +654,80 @@ seaf_util_exists (const char *path)
 #endif
 }
 
+#define EXISTS_BATCH_SIZE 256
+#define EXISTS_MAX_THREADS 16
+
+typedef struct ExistsBatch {
+    char **paths;
+    gboolean *exists;
+    int start;
+    int end;
+    GAsyncQueue *done;
+} ExistsBatch;
+
+static void
+exists_worker (gpointer data, gpointer user_data)
+{
+    ExistsBatch *batch = data;
+    int i;
+
+    for (i = batch->start; i < batch->end; ++i)
+        batch->exists[i] = seaf_util_exists (batch->paths[i]);
+
+    g_async_queue_push (batch->done, batch);
+}
+
+static GThreadPool *
+get_exists_pool ()
+{
+    static gsize inited = 0;
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter (&inited)) {
+        pool = g_thread_pool_new (exists_worker, NULL,
+                                  EXISTS_MAX_THREADS, FALSE, NULL);
+        g_once_init_leave (&inited, 1);
+    }
+
+    return pool;
+}
+
+void
+seaf_util_exists_many (char **paths, int n_paths, gboolean *exists)
+{
+    GThreadPool *pool = NULL;
+    GAsyncQueue *done;
+    ExistsBatch *batch;
+    int i, n_batches = 0;
+
+    if (n_paths > EXISTS_BATCH_SIZE)
+        pool = get_exists_pool ();
+
+    if (!pool) {
+        for (i = 0; i < n_paths; ++i)
+            exists[i] = seaf_util_exists (paths[i]);
+        return;
+    }
+
+    done = g_async_queue_new ();
+
+    for (i = 0; i < n_paths; i += EXISTS_BATCH_SIZE) {
+        batch = g_new0 (ExistsBatch, 1);
+        batch->paths = paths;
+        batch->exists = exists;
+        batch->start = i;
+        batch->end = MIN (i + EXISTS_BATCH_SIZE, n_paths);
+        batch->done = done;
+        g_thread_pool_push (pool, batch, NULL);
+        ++n_batches;
+    }
+
+    while (n_batches-- > 0)
+        g_free (g_async_queue_pop (done));
+
+    g_async_queue_unref (done);
+}
+
 gint64
 seaf_util_lseek (int fd, gint64 offset, int whence)
 {
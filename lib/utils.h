@@ -113,6 +113,10 @@ seaf_util_rename (const char *oldpath, const char *newpath);
 gboolean
 seaf_util_exists (const char *path);
 
+/* Check many paths at once. Large batches are checked in parallel. */
+void
+seaf_util_exists_many (char **paths, int n_paths, gboolean *exists);
+
 gint64
 seaf_util_lseek (int fd, gint64 offset, int whence);
 
@@ -180,17 +180,7 @@ func (client *Client) subscribe(repoID, user string, exp int64) {
 	client.Repos[repoID] = exp
 	client.ReposMutex.Unlock()
 
-	subMutex.Lock()
-	subscribers, ok := subscriptions[repoID]
-	if !ok {
-		subscribers = newSubscribers(client)
-		subscriptions[repoID] = subscribers
-	}
-	subMutex.Unlock()
-
-	subscribers.Mutex.Lock()
-	subscribers.Clients[client.ID] = client
-	subscribers.Mutex.Unlock()
+	addSubscriber(repoID, client)
 }
 
 func (client *Client) unsubscribe(repoID string) {
@@ -198,18 +188,7 @@ func (client *Client) unsubscribe(repoID string) {
 	delete(client.Repos, repoID)
 	client.ReposMutex.Unlock()
 
-	subMutex.Lock()
-	subscribers, ok := subscriptions[repoID]
-	if !ok {
-		subMutex.Unlock()
-		return
-	}
-	subMutex.Unlock()
-
-	subscribers.Mutex.Lock()
-	delete(subscribers.Clients, client.ID)
-	subscribers.Mutex.Unlock()
-
+	removeSubscriber(repoID, client)
 }
 
 func (client *Client) writeMessages() {
@@ -220,16 +199,24 @@ func (client *Client) writeMessages() {
 	for {
 		select {
 		case msg := <-client.WCh:
+			var m *Message
+			var err error
 			client.conn.SetWriteDeadline(time.Now().Add(writeWait))
 			client.connMutex.Lock()
-			err := client.conn.WriteJSON(msg)
+			switch v := msg.(type) {
+			case *broadcastMessage:
+				m = v.msg
+				err = client.conn.WritePreparedMessage(v.prepared)
+			default:
+				m, _ = msg.(*Message)
+				err = client.conn.WriteJSON(msg)
+			}
 			client.connMutex.Unlock()
 			if err != nil {
 				client.ConnCloser.Signal()
 				log.Debugf("failed to send notification to client: %v", err)
 				return
 			}
-			m, _ := msg.(*Message)
 			log.Debugf("send %s event to client %s(%d): %s", m.Type, client.User, client.ID, string(m.Content))
 		case <-client.ConnCloser.HasBeenClosed():
 			return
@@ -3,10 +3,11 @@ package main
 import (
 	"context"
 	"encoding/json"
-	"reflect"
 	"runtime/debug"
+	"sync"
 	"time"
 
+	"github.com/gorilla/websocket"
 	log "github.com/sirupsen/logrus"
 )
 
@@ -73,21 +74,38 @@ func Notify(msg *Message) {
 		return
 	}
 
-	clients := make(map[uint64]*Client)
+	if msg.Type == "repo-update" {
+		coalesceRepoUpdate(repoID, msg)
+		return
+	}
+
+	broadcast(repoID, userList, msg)
+}
 
-	subMutex.RLock()
-	subscribers := subscriptions[repoID]
-	if subscribers == nil {
-		subMutex.RUnlock()
+// broadcastMessage is a message sent to many clients. It's encoded once into
+// a prepared websocket message, which is shared by all recipients.
+type broadcastMessage struct {
+	msg      *Message
+	prepared *websocket.PreparedMessage
+}
+
+func broadcast(repoID string, userList map[string]struct{}, msg *Message) {
+	clients := getSubscribers(repoID)
+	if len(clients) == 0 {
 		return
 	}
-	subMutex.RUnlock()
 
-	subscribers.Mutex.RLock()
-	for clientID, client := range subscribers.Clients {
-		clients[clientID] = client
+	data, err := json.Marshal(msg)
+	if err != nil {
+		log.Warnf("failed to encode %s event: %v", msg.Type, err)
+		return
+	}
+	prepared, err := websocket.NewPreparedMessage(websocket.TextMessage, data)
+	if err != nil {
+		log.Warnf("failed to prepare %s event: %v", msg.Type, err)
+		return
 	}
-	subscribers.Mutex.RUnlock()
+	bmsg := &broadcastMessage{msg, prepared}
 
 	go func() {
 		defer func() {
@@ -95,25 +113,77 @@ func Notify(msg *Message) {
 				log.Printf("panic: %v\n%s", err, debug.Stack())
 			}
 		}()
-		// In order to avoid being blocked on a Client for a long time, it is necessary to write WCh in a non-blocking way,
-		// and the waiting WCh needs to be blocked and processed after other Clients have finished writing.
-		value := reflect.ValueOf(msg)
-		var branches []reflect.SelectCase
+		// In order to avoid being blocked on a Client for a long time, WCh is first written in a non-blocking way.
+		// Clients whose WCh is full are waited for after all other Clients have been written.
+		var blocked []*Client
 		for _, client := range clients {
 			if !needToNotif(userList, client.User) {
 				continue
 			}
-			branch := reflect.SelectCase{Dir: reflect.SelectSend, Chan: reflect.ValueOf(client.WCh), Send: value}
-			branches = append(branches, branch)
+			select {
+			case client.WCh <- bmsg:
+			default:
+				blocked = append(blocked, client)
+			}
 		}
 
-		for len(branches) != 0 {
-			index, _, _ := reflect.Select(branches)
-			branches = append(branches[:index], branches[index+1:]...)
+		for _, client := range blocked {
+			select {
+			case client.WCh <- bmsg:
+			case <-client.ConnCloser.HasBeenClosed():
+			}
 		}
 	}()
 }
 
+// Repo updates only tell clients the latest commit, so updates of a repo
+// within a short window are coalesced. The first update is sent at once and
+// the latest of the following ones at the end of the window.
+const repoUpdateWindow = 200 * time.Millisecond
+
+type repoUpdateState struct {
+	pending *Message
+}
+
+var repoUpdates = make(map[string]*repoUpdateState)
+var repoUpdatesMutex sync.Mutex
+
+func coalesceRepoUpdate(repoID string, msg *Message) {
+	repoUpdatesMutex.Lock()
+	if state, ok := repoUpdates[repoID]; ok {
+		state.pending = msg
+		repoUpdatesMutex.Unlock()
+		return
+	}
+	state := new(repoUpdateState)
+	repoUpdates[repoID] = state
+	repoUpdatesMutex.Unlock()
+
+	broadcast(repoID, nil, msg)
+	time.AfterFunc(repoUpdateWindow, func() {
+		flushRepoUpdate(repoID, state)
+	})
+}
+
+func flushRepoUpdate(repoID string, state *repoUpdateState) {
+	repoUpdatesMutex.Lock()
+	msg := state.pending
+	state.pending = nil
+	if msg == nil {
+		delete(repoUpdates, repoID)
+		repoUpdatesMutex.Unlock()
+		return
+	}
+	repoUpdatesMutex.Unlock()
+
+	// Keep the window open, so that a steady stream of updates is sent
+	// once per window.
+	broadcast(repoID, nil, msg)
+	time.AfterFunc(repoUpdateWindow, func() {
+		flushRepoUpdate(repoID, state)
+	})
+}
+
 func getGroupMembers(group int) map[string]struct{} {
 	query := `SELECT user_name FROM GroupUser WHERE group_id = ?`
 	ctx, cancel := context.WithTimeout(context.Background(), 60*time.Second)
@@ -0,0 +1,235 @@
+// Command loadtest simulates many websocket clients against a running
+// notification server and measures how fast repo updates reach them.
+//
+// Start a local notification server with JWT_PRIVATE_KEY set, then run e.g.
+//
+//	JWT_PRIVATE_KEY=... go run ./loadtest -clients 100000 -repos 1000 -rate 200
+//
+// Each client subscribes to random repos. Events are posted to /events at the
+// given rate, and the commit id of each event carries its send time, so the
+// clients can record the delivery latency. Large client counts need a higher
+// open files limit on both sides.
+package main
+
+import (
+	"bytes"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"math/rand"
+	"net/http"
+	"os"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	jwt "github.com/golang-jwt/jwt/v5"
+	"github.com/gorilla/websocket"
+)
+
+var (
+	addr        = flag.String("addr", "127.0.0.1:8083", "address of the notification server")
+	numClients  = flag.Int("clients", 1000, "number of websocket clients")
+	numRepos    = flag.Int("repos", 100, "number of repos")
+	subsPerConn = flag.Int("subs", 1, "number of repos each client subscribes to")
+	numEvents   = flag.Int("events", 1000, "number of repo-update events to send")
+	rate        = flag.Int("rate", 100, "events sent per second")
+	dialers     = flag.Int("dialers", 64, "number of concurrent connection attempts")
+	wait        = flag.Duration("wait", 2*time.Second, "time to wait for deliveries after the last event")
+)
+
+// Delivery latencies in milliseconds, the last bucket holds all longer ones.
+const maxLatencyMs = 10000
+
+var (
+	latencies [maxLatencyMs + 1]int64
+	delivered int64
+	connected int64
+	failed    int64
+)
+
+type claims struct {
+	Exp      int64  `json:"exp"`
+	RepoID   string `json:"repo_id"`
+	UserName string `json:"username"`
+	jwt.RegisteredClaims
+}
+
+func signToken(key, repoID, user string) (string, error) {
+	c := claims{Exp: time.Now().Add(24 * time.Hour).Unix(), RepoID: repoID, UserName: user}
+	return jwt.NewWithClaims(jwt.SigningMethodHS256, &c).SignedString([]byte(key))
+}
+
+func repoID(i int) string {
+	return fmt.Sprintf("00000000-0000-0000-0000-%012d", i)
+}
+
+type repoUpdate struct {
+	Type    string `json:"type"`
+	Content struct {
+		RepoID   string `json:"repo_id"`
+		CommitID string `json:"commit_id"`
+	} `json:"content"`
+}
+
+func runClient(id int, key string, rnd *rand.Rand) (*websocket.Conn, error) {
+	conn, _, err := websocket.DefaultDialer.Dial("ws://"+*addr+"/", nil)
+	if err != nil {
+		return nil, err
+	}
+
+	type repo struct {
+		ID    string `json:"id"`
+		Token string `json:"jwt_token"`
+	}
+	var repos []repo
+	user := fmt.Sprintf("user%d@example.com", id)
+	for i := 0; i < *subsPerConn; i++ {
+		rid := repoID(rnd.Intn(*numRepos))
+		token, err := signToken(key, rid, user)
+		if err != nil {
+			conn.Close()
+			return nil, err
+		}
+		repos = append(repos, repo{rid, token})
+	}
+	sub := map[string]interface{}{"type": "subscribe", "content": map[string]interface{}{"repos": repos}}
+	if err := conn.WriteJSON(sub); err != nil {
+		conn.Close()
+		return nil, err
+	}
+
+	// Reading also answers the server's pings.
+	go func() {
+		for {
+			_, data, err := conn.ReadMessage()
+			if err != nil {
+				return
+			}
+			var msg repoUpdate
+			if json.Unmarshal(data, &msg) != nil || msg.Type != "repo-update" {
+				continue
+			}
+			sent, err := strconv.ParseInt(msg.Content.CommitID, 10, 64)
+			if err != nil {
+				continue
+			}
+			ms := time.Since(time.Unix(0, sent)).Milliseconds()
+			if ms > maxLatencyMs {
+				ms = maxLatencyMs
+			}
+			atomic.AddInt64(&latencies[ms], 1)
+			atomic.AddInt64(&delivered, 1)
+		}
+	}()
+
+	return conn, nil
+}
+
+func connectClients(key string) []*websocket.Conn {
+	conns := make([]*websocket.Conn, *numClients)
+	ids := make(chan int)
+	var wg sync.WaitGroup
+	for i := 0; i < *dialers; i++ {
+		wg.Add(1)
+		go func(seed int64) {
+			defer wg.Done()
+			rnd := rand.New(rand.NewSource(seed))
+			for id := range ids {
+				conn, err := runClient(id, key, rnd)
+				if err != nil {
+					atomic.AddInt64(&failed, 1)
+					continue
+				}
+				conns[id] = conn
+				atomic.AddInt64(&connected, 1)
+			}
+		}(int64(i))
+	}
+	for i := 0; i < *numClients; i++ {
+		ids <- i
+	}
+	close(ids)
+	wg.Wait()
+	return conns
+}
+
+func sendEvents(key string) (int, error) {
+	token, err := signToken(key, "", "")
+	if err != nil {
+		return 0, err
+	}
+	interval := time.Second / time.Duration(*rate)
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	sent := 0
+	for i := 0; i < *numEvents; i++ {
+		<-ticker.C
+		var event repoUpdate
+		event.Type = "repo-update"
+		event.Content.RepoID = repoID(rand.Intn(*numRepos))
+		event.Content.CommitID = strconv.FormatInt(time.Now().UnixNano(), 10)
+		body, _ := json.Marshal(event)
+
+		req, _ := http.NewRequest("POST", "http://"+*addr+"/events", bytes.NewReader(body))
+		req.Header.Set("Authorization", "Token "+token)
+		rsp, err := http.DefaultClient.Do(req)
+		if err != nil {
+			return sent, err
+		}
+		rsp.Body.Close()
+		if rsp.StatusCode != http.StatusOK {
+			return sent, fmt.Errorf("server returned %s", rsp.Status)
+		}
+		sent++
+	}
+	return sent, nil
+}
+
+func percentile(total int64, p float64) int {
+	target := int64(float64(total) * p)
+	var n int64
+	for ms := range latencies {
+		n += atomic.LoadInt64(&latencies[ms])
+		if n > target {
+			return ms
+		}
+	}
+	return maxLatencyMs
+}
+
+func main() {
+	flag.Parse()
+	key := os.Getenv("JWT_PRIVATE_KEY")
+	if key == "" {
+		fmt.Fprintln(os.Stderr, "JWT_PRIVATE_KEY is not set")
+		os.Exit(1)
+	}
+
+	start := time.Now()
+	conns := connectClients(key)
+	fmt.Printf("connected %d clients in %v, %d failed\n", connected, time.Since(start), failed)
+
+	start = time.Now()
+	sent, err := sendEvents(key)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "failed to send events: %v\n", err)
+	}
+	elapsed := time.Since(start)
+	time.Sleep(*wait)
+
+	total := atomic.LoadInt64(&delivered)
+	fmt.Printf("sent %d events in %v, %d deliveries\n", sent, elapsed, total)
+	if total > 0 {
+		fmt.Printf("latency p50 %dms, p90 %dms, p99 %dms\n",
+			percentile(total, 0.5), percentile(total, 0.9), percentile(total, 0.99))
+	}
+
+	for _, conn := range conns {
+		if conn != nil {
+			conn.Close()
+		}
+	}
+}
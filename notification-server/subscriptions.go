@@ -1,6 +1,7 @@
 package main
 
 import (
+	"hash/fnv"
 	"sync"
 	"sync/atomic"
 	"time"
@@ -11,20 +12,31 @@ import (
 
 const (
 	chanBufSize = 10
+	// Number of shards of the client and subscription registries.
+	numShards = 64
 )
 
-// clients is a map from client id to Client structs.
-// It contains all current connected clients. Each client is identified by 64-bit ID.
-var clients map[uint64]*Client
-var clientsMutex sync.RWMutex
+// clientShard is a shard of the map from client id to Client structs.
+// The registry contains all current connected clients. Each client is identified by 64-bit ID.
+type clientShard struct {
+	clients map[uint64]*Client
+	mutex   sync.RWMutex
+}
+
+var clientShards [numShards]clientShard
 
 // Use atomic operation to increase this value.
 var nextClientID uint64 = 1
 
-// subscriptions is a map from repo_id to Subscribers struct.
-// It's protected by rw mutex.
-var subscriptions map[string]*Subscribers
-var subMutex sync.RWMutex
+// subShard is a shard of the map from repo_id to Subscribers struct.
+// Repos are assigned to shards by hash, so that subscribing to and notifying
+// different repos don't contend on one lock.
+type subShard struct {
+	subscriptions map[string]*Subscribers
+	mutex         sync.RWMutex
+}
+
+var subShards [numShards]subShard
 
 // Client contains information about a client.
 // Two go routines are associated with each client to handle message reading and writting.
@@ -58,12 +70,30 @@ type Subscribers struct {
 	// Clients is a map from client id to Client struct, protected by rw mutex.
 	Clients map[uint64]*Client
 	Mutex   sync.RWMutex
+	// list is a snapshot of Clients for notifications. It's rebuilt by the
+	// first notification after the subscribers change.
+	list  []*Client
+	dirty bool
 }
 
 // Init inits clients and subscriptions.
 func Init() {
-	clients = make(map[uint64]*Client)
-	subscriptions = make(map[string]*Subscribers)
+	for i := range clientShards {
+		clientShards[i].clients = make(map[uint64]*Client)
+	}
+	for i := range subShards {
+		subShards[i].subscriptions = make(map[string]*Subscribers)
+	}
+}
+
+func getClientShard(clientID uint64) *clientShard {
+	return &clientShards[clientID%numShards]
+}
+
+func getSubShard(repoID string) *subShard {
+	h := fnv.New32a()
+	h.Write([]byte(repoID))
+	return &subShards[h.Sum32()%numShards]
 }
 
 // NewClient creates a new client.
@@ -82,22 +112,93 @@ func NewClient(conn *websocket.Conn, addr string) *Client {
 
 // Register adds the client to the list of clients.
 func RegisterClient(client *Client) {
-	clientsMutex.Lock()
-	clients[client.ID] = client
-	clientsMutex.Unlock()
+	shard := getClientShard(client.ID)
+	shard.mutex.Lock()
+	shard.clients[client.ID] = client
+	shard.mutex.Unlock()
 }
 
 // Unregister deletes the client from the list of clients.
 func UnregisterClient(client *Client) {
-	clientsMutex.Lock()
-	delete(clients, client.ID)
-	clientsMutex.Unlock()
+	shard := getClientShard(client.ID)
+	shard.mutex.Lock()
+	delete(shard.clients, client.ID)
+	shard.mutex.Unlock()
 }
 
-func newSubscribers(client *Client) *Subscribers {
+// addSubscriber adds the client to the subscribers of the repo.
+func addSubscriber(repoID string, client *Client) {
+	shard := getSubShard(repoID)
+	shard.mutex.Lock()
+	subscribers, ok := shard.subscriptions[repoID]
+	if !ok {
+		subscribers = newSubscribers()
+		shard.subscriptions[repoID] = subscribers
+	}
+	subscribers.Mutex.Lock()
+	subscribers.Clients[client.ID] = client
+	subscribers.dirty = true
+	subscribers.Mutex.Unlock()
+	shard.mutex.Unlock()
+}
+
+// removeSubscriber removes the client from the subscribers of the repo, and
+// removes the repo once it has no subscribers.
+func removeSubscriber(repoID string, client *Client) {
+	shard := getSubShard(repoID)
+	shard.mutex.Lock()
+	subscribers, ok := shard.subscriptions[repoID]
+	if !ok {
+		shard.mutex.Unlock()
+		return
+	}
+	subscribers.Mutex.Lock()
+	delete(subscribers.Clients, client.ID)
+	subscribers.dirty = true
+	if len(subscribers.Clients) == 0 {
+		delete(shard.subscriptions, repoID)
+	}
+	subscribers.Mutex.Unlock()
+	shard.mutex.Unlock()
+}
+
+// getSubscribers returns the clients who subscribe to the repo. The
+// returned slice is shared and must not be modified.
+func getSubscribers(repoID string) []*Client {
+	shard := getSubShard(repoID)
+	shard.mutex.RLock()
+	subscribers := shard.subscriptions[repoID]
+	shard.mutex.RUnlock()
+	if subscribers == nil {
+		return nil
+	}
+
+	subscribers.Mutex.RLock()
+	if !subscribers.dirty {
+		list := subscribers.list
+		subscribers.Mutex.RUnlock()
+		return list
+	}
+	subscribers.Mutex.RUnlock()
+
+	subscribers.Mutex.Lock()
+	defer subscribers.Mutex.Unlock()
+	if subscribers.dirty {
+		// Build a new slice, since notifications in flight may still use
+		// the old one.
+		list := make([]*Client, 0, len(subscribers.Clients))
+		for _, client := range subscribers.Clients {
+			list = append(list, client)
+		}
+		subscribers.list = list
+		subscribers.dirty = false
+	}
+	return subscribers.list
+}
+
+func newSubscribers() *Subscribers {
 	subscribers := new(Subscribers)
 	subscribers.Clients = make(map[uint64]*Client)
-	subscribers.Clients[client.ID] = client
 
 	return subscribers
 }
@@ -499,6 +499,11 @@ class SeafServerThreadedRpcClient(NamedPipeClient):
     def check_permission(repo_id, user):
         pass
 
+    # repo_ids is comma separated
+    @searpc_func("json", ["string", "string"])
+    def check_permissions(repo_ids, user):
+        pass
+
     # folder permission check
     @searpc_func("string", ["string", "string", "string"])
     def check_permission_by_path(repo_id, path, user):
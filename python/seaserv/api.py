@@ -675,6 +675,13 @@ class SeafileAPI(object):
         """
         return seafserv_threaded_rpc.check_permission(repo_id, user)
 
+    def check_permissions(self, repo_ids, user):
+        """
+        Check the permissions of a user on many repos at once.
+        Return: a dict mapping the ids of accessible repos to 'r' or 'rw'
+        """
+        return seafserv_threaded_rpc.check_permissions(','.join(repo_ids), user)
+
     def check_permission_by_path(self, repo_id, path, user):
         """
         Check both repo share permission and sub-folder access permissions.
@@ -327,3 +327,25 @@ CREATE TABLE IF NOT EXISTS WebUploadTempFiles (
   tmp_file_path TEXT NOT NULL,
   INDEX(repo_id)
 ) ENGINE=INNODB;
+
+CREATE TABLE IF NOT EXISTS FileHistory (
+  id BIGINT NOT NULL PRIMARY KEY AUTO_INCREMENT,
+  repo_id CHAR(37),
+  path_hash CHAR(40),
+  dir_hash CHAR(40),
+  path TEXT,
+  is_dir INTEGER,
+  commit_id CHAR(41),
+  obj_id CHAR(41),
+  size BIGINT,
+  ctime BIGINT,
+  INDEX(repo_id, path_hash, ctime),
+  INDEX(repo_id, dir_hash)
+) ENGINE=INNODB;
+
+CREATE TABLE IF NOT EXISTS FileHistoryCommit (
+  id BIGINT NOT NULL PRIMARY KEY AUTO_INCREMENT,
+  repo_id CHAR(37),
+  commit_id CHAR(41),
+  UNIQUE INDEX(repo_id, commit_id)
+) ENGINE=INNODB;
@@ -64,3 +64,7 @@ CREATE INDEX IF NOT EXISTS OrgFromEmailIndex on OrgSharedRepo (from_email);
 CREATE INDEX IF NOT EXISTS OrgToEmailIndex on OrgSharedRepo (to_email);
 CREATE INDEX IF NOT EXISTS OrgLibIdIndex on OrgSharedRepo (repo_id);
 CREATE TABLE IF NOT EXISTS SystemInfo (info_key VARCHAR(256), info_value VARCHAR(1024));
+CREATE TABLE IF NOT EXISTS FileHistory (id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, repo_id CHAR(37), path_hash CHAR(40), dir_hash CHAR(40), path TEXT, is_dir INTEGER, commit_id CHAR(41), obj_id CHAR(41), size BIGINT, ctime BIGINT);
+CREATE INDEX IF NOT EXISTS FileHistoryPathIndex ON FileHistory (repo_id, path_hash, ctime);
+CREATE INDEX IF NOT EXISTS FileHistoryDirIndex ON FileHistory (repo_id, dir_hash);
+CREATE TABLE IF NOT EXISTS FileHistoryCommit (repo_id CHAR(37), commit_id CHAR(41), PRIMARY KEY (repo_id, commit_id));
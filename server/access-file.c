@@ -28,6 +28,7 @@
 #include "zip-download-mgr.h"
 #include "http-server.h"
 #include "seaf-utils.h"
+#include "block-prefetch.h"
 
 #define FILE_TYPE_MAP_DEFAULT_LEN 1
 #define BUFFER_SIZE 1024 * 64
@@ -37,6 +38,15 @@ struct file_type_map {
     char *type;
 };
 
+/* Content of the block being sent, when it was taken from the read-ahead
+ * buffer instead of being opened with the block manager.
+ */
+typedef struct BlockBuf {
+    char *data;
+    int len;
+    int off;
+} BlockBuf;
+
 typedef struct SendBlockData {
     evhtp_request_t *req;
     char *block_id;
@@ -49,6 +59,9 @@ typedef struct SendBlockData {
 
     char *user;
 
+    /* Block file has been queued with evbuffer_add_file(). */
+    gboolean zero_copy_queued;
+
     bufferevent_data_cb saved_read_cb;
     bufferevent_data_cb saved_write_cb;
     bufferevent_event_cb saved_event_cb;
@@ -59,8 +72,7 @@ typedef struct SendfileData {
     evhtp_request_t *req;
     Seafile *file;
     SeafileCrypt *crypt;
-    gboolean enc_init;
-    EVP_CIPHER_CTX *ctx;
+    SeafileDecryptStream *dec;
     BlockHandle *handle;
     size_t remain;
     int idx;
@@ -71,6 +83,12 @@ typedef struct SendfileData {
     char *user;
     char *token_type;
 
+    /* All blocks have been queued with evbuffer_add_file(). */
+    gboolean zero_copy_queued;
+
+    BlockPrefetcher *prefetcher;
+    BlockBuf blk_buf;
+
     bufferevent_data_cb saved_read_cb;
     bufferevent_data_cb saved_write_cb;
     bufferevent_event_cb saved_event_cb;
@@ -91,6 +109,9 @@ typedef struct SendFileRangeData {
     char *user;
     char *token_type;
 
+    BlockPrefetcher *prefetcher;
+    BlockBuf blk_buf;
+
     bufferevent_data_cb saved_read_cb;
     bufferevent_data_cb saved_write_cb;
     bufferevent_event_cb saved_event_cb;
@@ -177,8 +198,10 @@ free_sendfile_data (SendfileData *data)
         seaf_block_manager_block_handle_free(seaf->block_mgr, data->handle);
     }
 
-    if (data->enc_init)
-        EVP_CIPHER_CTX_free (data->ctx);
+    seafile_decrypt_stream_free (data->dec);
+
+    g_free (data->blk_buf.data);
+    block_prefetcher_free (data->prefetcher);
 
     seafile_unref (data->file);
     g_free (data->user);
@@ -195,6 +218,9 @@ free_send_file_range_data (SendFileRangeData *data)
         seaf_block_manager_block_handle_free(seaf->block_mgr, data->handle);
     }
 
+    g_free (data->blk_buf.data);
+    block_prefetcher_free (data->prefetcher);
+
     seafile_unref (data->file);
     g_free (data->user);
     g_free (data->token_type);
@@ -214,6 +240,101 @@ free_senddir_data (SendDirData *data)
     g_free (data);
 }
 
+/* Hand the content of an opened block to libevent as a file segment,
+ * so that the kernel sends it with sendfile() and it's never copied
+ * into user space. The block handle can be closed after this call.
+ *
+ * Returns 0 on success, -1 if the backend can't expose the block as a
+ * file. In that case the caller should fall back to read and copy.
+ */
+static int
+queue_block_file (struct bufferevent *bev, BlockHandle *handle, guint64 size)
+{
+    int fd;
+
+    fd = seaf_block_manager_dup_block_fd (seaf->block_mgr, handle);
+    if (fd < 0)
+        return -1;
+
+    /* On success, libevent owns fd and closes it after the data is sent. */
+    if (evbuffer_add_file (bufferevent_get_output (bev), fd, 0, size) < 0) {
+        seaf_warning ("Failed to add block file to output buffer.\n");
+        close (fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Take block @idx from the read-ahead buffer into @blk_buf, and start
+ * reading up to @n blocks after it.
+ * Returns FALSE if the block should be read with the block manager.
+ */
+static gboolean
+take_prefetched_block (BlockPrefetcher *prefetcher, int idx, int n,
+                       BlockBuf *blk_buf)
+{
+    if (!prefetcher)
+        return FALSE;
+
+    block_prefetcher_advance (prefetcher, idx, n);
+
+    blk_buf->data = block_prefetcher_take (prefetcher, idx, &blk_buf->len);
+    blk_buf->off = 0;
+
+    return (blk_buf->data != NULL);
+}
+
+/* Read from the current block, either the read-ahead buffer or the
+ * opened handle.
+ */
+static int
+read_current_block (BlockHandle *handle, BlockBuf *blk_buf, char *buf, int size)
+{
+    int n;
+
+    if (!blk_buf->data)
+        return seaf_block_manager_read_block (seaf->block_mgr, handle, buf, size);
+
+    n = MIN (size, blk_buf->len - blk_buf->off);
+    memcpy (buf, blk_buf->data + blk_buf->off, n);
+    blk_buf->off += n;
+
+    return n;
+}
+
+static void
+close_current_block (BlockHandle **handle, BlockBuf *blk_buf)
+{
+    if (*handle) {
+        seaf_block_manager_close_block (seaf->block_mgr, *handle);
+        seaf_block_manager_block_handle_free (seaf->block_mgr, *handle);
+        *handle = NULL;
+    }
+
+    g_free (blk_buf->data);
+    memset (blk_buf, 0, sizeof(BlockBuf));
+}
+
+static void
+finish_send_block (struct bufferevent *bev, SendBlockData *data)
+{
+    /* Recover evhtp's callbacks */
+    bev->readcb = data->saved_read_cb;
+    bev->writecb = data->saved_write_cb;
+    bev->errorcb = data->saved_event_cb;
+    bev->cbarg = data->saved_cb_arg;
+
+    /* Resume reading incomming requests. */
+    evhtp_request_resume (data->req);
+
+    evhtp_send_reply_end (data->req);
+
+    send_statistic_msg (data->store_id, data->user, "web-file-download", (guint64)data->bsize);
+
+    free_sendblock_data (data);
+}
+
 static void
 write_block_data_cb (struct bufferevent *bev, void *ctx)
 {
@@ -225,6 +346,12 @@ write_block_data_cb (struct bufferevent *bev, void *ctx)
 
     blk_id = data->block_id;
 
+    if (data->zero_copy_queued) {
+        /* The block file has been flushed to the socket. */
+        finish_send_block (bev, data);
+        return;
+    }
+
     if (!data->handle) {
         data->handle = seaf_block_manager_open_block(seaf->block_mgr,
                                                      data->store_id,
@@ -236,6 +363,16 @@ write_block_data_cb (struct bufferevent *bev, void *ctx)
         }
 
         data->remain = data->bsize;
+
+        if (seaf->http_server->zero_copy_download &&
+            queue_block_file (bev, data->handle, data->bsize) == 0) {
+            seaf_block_manager_close_block (seaf->block_mgr, data->handle);
+            seaf_block_manager_block_handle_free (seaf->block_mgr, data->handle);
+            data->handle = NULL;
+            data->remain = 0;
+            data->zero_copy_queued = TRUE;
+            return;
+        }
     }
     handle = data->handle;
 
@@ -251,20 +388,7 @@ write_block_data_cb (struct bufferevent *bev, void *ctx)
         seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
         data->handle = NULL;
 
-        /* Recover evhtp's callbacks */
-        bev->readcb = data->saved_read_cb;
-        bev->writecb = data->saved_write_cb;
-        bev->errorcb = data->saved_event_cb;
-        bev->cbarg = data->saved_cb_arg;
-
-        /* Resume reading incomming requests. */
-        evhtp_request_resume (data->req);
-
-        evhtp_send_reply_end (data->req);
-
-        send_statistic_msg (data->store_id, data->user, "web-file-download", (guint64)data->bsize);
-
-        free_sendblock_data (data);
+        finish_send_block (bev, data);
         return;
     }
 
@@ -279,84 +403,115 @@ err:
     return;
 }
 
+static void
+finish_sendfile (struct bufferevent *bev, SendfileData *data)
+{
+    /* Recover evhtp's callbacks */
+    bev->readcb = data->saved_read_cb;
+    bev->writecb = data->saved_write_cb;
+    bev->errorcb = data->saved_event_cb;
+    bev->cbarg = data->saved_cb_arg;
+
+    /* Resume reading incomming requests. */
+    evhtp_request_resume (data->req);
+
+    evhtp_send_reply_end (data->req);
+
+    char *oper = "web-file-download";
+    if (g_strcmp0(data->token_type, "download-link") == 0)
+        oper = "link-file-download";
+
+    send_statistic_msg(data->store_id, data->user, oper,
+                       (guint64)data->file->file_size);
+
+    free_sendfile_data (data);
+}
+
 static void
 write_data_cb (struct bufferevent *bev, void *ctx)
 {
     SendfileData *data = ctx;
     char *blk_id;
-    BlockHandle *handle;
     char buf[1024 * 64];
     int n;
 
+    if (data->zero_copy_queued) {
+        /* All block files have been flushed to the socket. */
+        finish_sendfile (bev, data);
+        return;
+    }
+
 next:
     blk_id = data->file->blk_sha1s[data->idx];
 
-    if (!data->handle) {
-        data->handle = seaf_block_manager_open_block(seaf->block_mgr,
-                                                     data->store_id,
-                                                     data->repo_version,
-                                                     blk_id, BLOCK_READ);
-        if (!data->handle) {
-            seaf_warning ("Failed to open block %s:%s\n", data->store_id, blk_id);
-            goto err;
-        }
+    if (!data->handle && !data->blk_buf.data) {
+        if (take_prefetched_block (data->prefetcher, data->idx,
+                                   seaf->http_server->read_ahead_blocks,
+                                   &data->blk_buf)) {
+            data->remain = data->blk_buf.len;
+        } else {
+            data->handle = seaf_block_manager_open_block(seaf->block_mgr,
+                                                         data->store_id,
+                                                         data->repo_version,
+                                                         blk_id, BLOCK_READ);
+            if (!data->handle) {
+                seaf_warning ("Failed to open block %s:%s\n", data->store_id, blk_id);
+                goto err;
+            }
 
-        BlockMetadata *bmd;
-        bmd = seaf_block_manager_stat_block_by_handle (seaf->block_mgr,
-                                                       data->handle);
-        if (!bmd)
-            goto err;
-        data->remain = bmd->size;
-        g_free (bmd);
+            BlockMetadata *bmd;
+            bmd = seaf_block_manager_stat_block_by_handle (seaf->block_mgr,
+                                                           data->handle);
+            if (!bmd)
+                goto err;
+            data->remain = bmd->size;
+            g_free (bmd);
 
+            /* Only plain blocks can be sent without passing through user space.
+             * Queue one block per callback, so that we don't keep too many
+             * block files open for a single download.
+             */
+            if (!data->crypt && seaf->http_server->zero_copy_download &&
+                queue_block_file (bev, data->handle, data->remain) == 0) {
+                seaf_block_manager_close_block (seaf->block_mgr, data->handle);
+                seaf_block_manager_block_handle_free (seaf->block_mgr, data->handle);
+                data->handle = NULL;
+                data->remain = 0;
+
+                if (data->idx == data->file->n_blocks - 1)
+                    data->zero_copy_queued = TRUE;
+                else
+                    ++(data->idx);
+                return;
+            }
+        }
+
+        /* The decryption context is set up once per file and reset
+         * for every block.
+         */
         if (data->crypt) {
-            if (seafile_decrypt_init (&data->ctx,
-                                      data->crypt->version,
-                                      (unsigned char *)data->crypt->key,
-                                      (unsigned char *)data->crypt->iv) < 0) {
+            if (!data->dec) {
+                data->dec = seafile_decrypt_stream_new (data->crypt);
+                if (!data->dec)
+                    goto err;
+            } else if (seafile_decrypt_stream_reset (data->dec) < 0) {
                 seaf_warning ("Failed to init decrypt.\n");
                 goto err;
             }
-            data->enc_init = TRUE;
         }
     }
-    handle = data->handle;
 
-    n = seaf_block_manager_read_block(seaf->block_mgr, handle, buf, sizeof(buf));
+    n = read_current_block (data->handle, &data->blk_buf, buf, sizeof(buf));
     data->remain -= n;
     if (n < 0) {
         seaf_warning ("Error when reading from block %s.\n", blk_id);
         goto err;
     } else if (n == 0) {
         /* We've read up the data of this block, finish or try next block. */
-        seaf_block_manager_close_block (seaf->block_mgr, handle);
-        seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
-        data->handle = NULL;
-        if (data->crypt != NULL) {
-            EVP_CIPHER_CTX_free (data->ctx);
-            data->enc_init = FALSE;
-        }
+        close_current_block (&data->handle, &data->blk_buf);
 
         if (data->idx == data->file->n_blocks - 1) {
-            /* Recover evhtp's callbacks */
-            bev->readcb = data->saved_read_cb;
-            bev->writecb = data->saved_write_cb;
-            bev->errorcb = data->saved_event_cb;
-            bev->cbarg = data->saved_cb_arg;
-
-            /* Resume reading incomming requests. */
-            evhtp_request_resume (data->req);
-
-            evhtp_send_reply_end (data->req);
-
-            char *oper = "web-file-download";
-            if (g_strcmp0(data->token_type, "download-link") == 0)
-                oper = "link-file-download";
-
-            send_statistic_msg(data->store_id, data->user, oper,
-                               (guint64)data->file->file_size);
-
-            free_sendfile_data (data);
+            finish_sendfile (bev, data);
             return;
         }
 
@@ -370,20 +525,9 @@ next:
         int dec_out_len = -1;
         struct evbuffer *tmp_buf;
 
-        dec_out = g_new (char, n + 16);
-        if (!dec_out) {
-            seaf_warning ("Failed to alloc memory.\n");
-            goto err;
-        }
-
-        int ret = EVP_DecryptUpdate (data->ctx,
-                                     (unsigned char *)dec_out,
-                                     &dec_out_len,
-                                     (unsigned char *)buf,
-                                     n);
-        if (ret == 0) {
+        if (seafile_decrypt_stream_update (data->dec, buf, n,
+                                           &dec_out, &dec_out_len) < 0) {
             seaf_warning ("Decrypt block %s:%s failed.\n", data->store_id, blk_id);
-            g_free (dec_out);
             goto err;
         }
 
@@ -394,13 +538,10 @@ next:
         /* If it's the last piece of a block, call decrypt_final()
          * to decrypt the possible partial block. */
         if (data->remain == 0) {
-            ret = EVP_DecryptFinal_ex (data->ctx,
-                                       (unsigned char *)dec_out,
-                                       &dec_out_len);
-            if (ret == 0) {
+            if (seafile_decrypt_stream_final (data->dec,
+                                              &dec_out, &dec_out_len) < 0) {
                 seaf_warning ("Decrypt block %s:%s failed.\n", data->store_id, blk_id);
                 evbuffer_free (tmp_buf);
-                g_free (dec_out);
                 goto err;
             }
             evbuffer_add (tmp_buf, dec_out, dec_out_len);
@@ -412,7 +553,6 @@ next:
         bufferevent_write_buffer (bev, tmp_buf);
 
         evbuffer_free (tmp_buf);
-        g_free (dec_out);
     } else {
         bufferevent_write (bev, buf, n);
     }
@@ -662,6 +802,14 @@ do_file(evhtp_request_t *req, SeafRepo *repo, const char *file_id,
     memcpy (data->store_id, repo->store_id, 36);
     data->repo_version = repo->version;
 
+    /* Plain blocks sent with zero copy don't pass through user space,
+     * there's nothing to read ahead for them.
+     */
+    if (seaf->http_server->read_ahead_blocks > 0 &&
+        (crypt || !seaf->http_server->zero_copy_download))
+        data->prefetcher = block_prefetcher_new (repo->store_id, repo->version,
+                                                 file->blk_sha1s, file->n_blocks);
+
     /* We need to overwrite evhtp's callback functions to
      * write file data piece by piece.
      */
@@ -767,6 +915,26 @@ finish_file_range_request (struct bufferevent *bev, SendFileRangeData *data)
     free_send_file_range_data (data);
 }
 
+/* Number of blocks to read ahead for the rest of a range. Sizes of the
+ * blocks aren't known without stat'ing them, so estimate with the average.
+ */
+static int
+range_read_ahead_blocks (SendFileRangeData *data)
+{
+    guint64 avg_size;
+    guint64 n = 1;
+
+    /* An empty file has no blocks to read ahead. */
+    if (data->file->n_blocks == 0)
+        return 0;
+
+    avg_size = data->file->file_size / data->file->n_blocks;
+    if (avg_size > 0)
+        n = data->range_remain / avg_size + 1;
+
+    return MIN (n, seaf->http_server->read_ahead_blocks);
+}
+
 static void
 write_file_range_cb (struct bufferevent *bev, void *ctx)
 {
@@ -783,12 +951,19 @@ write_file_range_cb (struct bufferevent *bev, void *ctx)
                                                &data->blk_idx);
         if (!data->handle)
             goto err;
+
+        if (data->prefetcher)
+            block_prefetcher_advance (data->prefetcher, data->blk_idx,
+                                      range_read_ahead_blocks (data));
     }
 
 next:
     blk_id = data->file->blk_sha1s[data->blk_idx];
 
-    if (!data->handle) {
+    if (!data->handle && !data->blk_buf.data &&
+        !take_prefetched_block (data->prefetcher, data->blk_idx,
+                                range_read_ahead_blocks (data),
+                                &data->blk_buf)) {
         data->handle = seaf_block_manager_open_block(seaf->block_mgr,
                                                      data->store_id,
                                                      data->repo_version,
@@ -800,16 +975,14 @@ next:
     }
 
     bsize = data->range_remain < BUFFER_SIZE ? data->range_remain : BUFFER_SIZE;
-    n = seaf_block_manager_read_block(seaf->block_mgr, data->handle, buf, bsize);
+    n = read_current_block (data->handle, &data->blk_buf, buf, bsize);
     data->range_remain -= n;
     if (n < 0) {
         seaf_warning ("Error when reading from block %s:%s.\n",
                       data->store_id, blk_id);
         goto err;
     } else if (n == 0) {
-        seaf_block_manager_close_block (seaf->block_mgr, data->handle);
-        seaf_block_manager_block_handle_free (seaf->block_mgr, data->handle);
-        data->handle = NULL;
+        close_current_block (&data->handle, &data->blk_buf);
         ++data->blk_idx;
         goto next;
     }
@@ -1018,6 +1191,10 @@ do_file_range (evhtp_request_t *req, SeafRepo *repo, const char *file_id,
     memcpy (data->store_id, repo->store_id, 36);
     data->repo_version = repo->version;
 
+    if (seaf->http_server->read_ahead_blocks > 0)
+        data->prefetcher = block_prefetcher_new (repo->store_id, repo->version,
+                                                 file->blk_sha1s, file->n_blocks);
+
     /* We need to overwrite evhtp's callback functions to
      * write file data piece by piece.
      */
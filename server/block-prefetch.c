@@ -0,0 +1,345 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "seafile-session.h"
+#include "block-prefetch.h"
+#include "log.h"
+
+enum {
+    BLOCK_NONE = 0,
+    BLOCK_QUEUED,
+    BLOCK_READING,
+    BLOCK_READY,
+    BLOCK_FAILED,
+    BLOCK_TAKEN,
+};
+
+typedef struct PrefetchedBlock {
+    int state;
+    char *data;
+    int len;
+} PrefetchedBlock;
+
+struct BlockPrefetcher {
+    char store_id[37];
+    int version;
+    char **blk_ids;
+    int n_blocks;
+
+    /* Held by the owner and by every queued read. */
+    gint ref;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    gboolean closed;
+    PrefetchedBlock *blocks;
+};
+
+typedef struct PrefetchTask {
+    BlockPrefetcher *prefetcher;
+    int idx;
+} PrefetchTask;
+
+static GThreadPool *prefetch_pool;
+
+/* Size of the blocks read ahead and not taken yet, over all downloads. */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static gint64 mem_used;
+static gint64 mem_limit;
+
+static void
+prefetch_block (gpointer data, gpointer user_data);
+
+int
+block_prefetch_init (int threads, gint64 limit)
+{
+    GError *error = NULL;
+
+    if (threads <= 0 || limit <= 0)
+        return 0;
+
+    mem_limit = limit;
+
+    prefetch_pool = g_thread_pool_new (prefetch_block, NULL,
+                                       threads, FALSE, &error);
+    if (!prefetch_pool) {
+        seaf_warning ("Failed to create block prefetch thread pool: %s.\n",
+                      error ? error->message : "");
+        g_clear_error (&error);
+        return -1;
+    }
+
+    return 0;
+}
+
+static gboolean
+reserve_mem (gint64 size)
+{
+    gboolean ret = FALSE;
+
+    pthread_mutex_lock (&mem_lock);
+    if (mem_used + size <= mem_limit) {
+        mem_used += size;
+        ret = TRUE;
+    }
+    pthread_mutex_unlock (&mem_lock);
+
+    return ret;
+}
+
+static void
+release_mem (gint64 size)
+{
+    pthread_mutex_lock (&mem_lock);
+    mem_used -= size;
+    pthread_mutex_unlock (&mem_lock);
+}
+
+static gboolean
+mem_available ()
+{
+    gboolean ret;
+
+    pthread_mutex_lock (&mem_lock);
+    ret = (mem_used < mem_limit);
+    pthread_mutex_unlock (&mem_lock);
+
+    return ret;
+}
+
+BlockPrefetcher *
+block_prefetcher_new (const char *store_id, int version,
+                      char **blk_ids, int n_blocks)
+{
+    BlockPrefetcher *prefetcher;
+    int i;
+
+    if (!prefetch_pool)
+        return NULL;
+
+    prefetcher = g_new0 (BlockPrefetcher, 1);
+    memcpy (prefetcher->store_id, store_id, 36);
+    prefetcher->version = version;
+    prefetcher->n_blocks = n_blocks;
+    prefetcher->blk_ids = g_new0 (char *, n_blocks + 1);
+    for (i = 0; i < n_blocks; ++i)
+        prefetcher->blk_ids[i] = g_strdup (blk_ids[i]);
+    prefetcher->blocks = g_new0 (PrefetchedBlock, n_blocks);
+    prefetcher->ref = 1;
+    pthread_mutex_init (&prefetcher->lock, NULL);
+    pthread_cond_init (&prefetcher->cond, NULL);
+
+    return prefetcher;
+}
+
+static void
+block_prefetcher_unref (BlockPrefetcher *prefetcher)
+{
+    if (!g_atomic_int_dec_and_test (&prefetcher->ref))
+        return;
+
+    g_strfreev (prefetcher->blk_ids);
+    g_free (prefetcher->blocks);
+    pthread_mutex_destroy (&prefetcher->lock);
+    pthread_cond_destroy (&prefetcher->cond);
+    g_free (prefetcher);
+}
+
+void
+block_prefetcher_free (BlockPrefetcher *prefetcher)
+{
+    PrefetchedBlock *block;
+    int i;
+
+    if (!prefetcher)
+        return;
+
+    /* Reads still running will drop their data when they finish. */
+    pthread_mutex_lock (&prefetcher->lock);
+    prefetcher->closed = TRUE;
+    for (i = 0; i < prefetcher->n_blocks; ++i) {
+        block = &prefetcher->blocks[i];
+        if (block->state == BLOCK_READY) {
+            release_mem (block->len);
+            g_free (block->data);
+            block->data = NULL;
+            block->state = BLOCK_TAKEN;
+        }
+    }
+    pthread_mutex_unlock (&prefetcher->lock);
+
+    block_prefetcher_unref (prefetcher);
+}
+
+void
+block_prefetcher_advance (BlockPrefetcher *prefetcher, int idx, int n)
+{
+    PrefetchTask *task;
+    int i;
+
+    pthread_mutex_lock (&prefetcher->lock);
+    for (i = idx + 1; i <= idx + n && i < prefetcher->n_blocks; ++i) {
+        if (prefetcher->blocks[i].state != BLOCK_NONE)
+            continue;
+        if (!mem_available ())
+            break;
+
+        prefetcher->blocks[i].state = BLOCK_QUEUED;
+
+        task = g_new0 (PrefetchTask, 1);
+        task->prefetcher = prefetcher;
+        task->idx = i;
+        g_atomic_int_inc (&prefetcher->ref);
+        g_thread_pool_push (prefetch_pool, task, NULL);
+    }
+    pthread_mutex_unlock (&prefetcher->lock);
+}
+
+static char *
+read_whole_block (BlockPrefetcher *prefetcher, const char *blk_id,
+                  int *len, gboolean *reserved)
+{
+    BlockHandle *handle = NULL;
+    BlockMetadata *bmd = NULL;
+    char *buf = NULL;
+    int size, off = 0, n;
+
+    *reserved = FALSE;
+
+    handle = seaf_block_manager_open_block (seaf->block_mgr,
+                                            prefetcher->store_id,
+                                            prefetcher->version,
+                                            blk_id, BLOCK_READ);
+    if (!handle) {
+        seaf_warning ("Failed to open block %s:%s.\n",
+                      prefetcher->store_id, blk_id);
+        goto out;
+    }
+
+    bmd = seaf_block_manager_stat_block_by_handle (seaf->block_mgr, handle);
+    if (!bmd)
+        goto out;
+    size = bmd->size;
+
+    /* Leave the block to the download if there's no room for it. */
+    if (size <= 0 || !reserve_mem (size))
+        goto out;
+    *reserved = TRUE;
+
+    buf = g_malloc (size);
+    while (off < size) {
+        n = seaf_block_manager_read_block (seaf->block_mgr, handle,
+                                           buf + off, size - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    if (off != size) {
+        seaf_warning ("Failed to read block %s:%s.\n",
+                      prefetcher->store_id, blk_id);
+        g_free (buf);
+        buf = NULL;
+        goto out;
+    }
+    *len = size;
+
+out:
+    g_free (bmd);
+    if (handle) {
+        seaf_block_manager_close_block (seaf->block_mgr, handle);
+        seaf_block_manager_block_handle_free (seaf->block_mgr, handle);
+    }
+    return buf;
+}
+
+static void
+prefetch_block (gpointer data, gpointer user_data)
+{
+    PrefetchTask *task = data;
+    BlockPrefetcher *prefetcher = task->prefetcher;
+    PrefetchedBlock *block = &prefetcher->blocks[task->idx];
+    char *buf = NULL;
+    int len = 0;
+    gboolean reserved = FALSE;
+
+    pthread_mutex_lock (&prefetcher->lock);
+    /* The download may have got to the block or finished already. */
+    if (prefetcher->closed || block->state != BLOCK_QUEUED) {
+        pthread_mutex_unlock (&prefetcher->lock);
+        goto out;
+    }
+    block->state = BLOCK_READING;
+    pthread_mutex_unlock (&prefetcher->lock);
+
+    buf = read_whole_block (prefetcher, prefetcher->blk_ids[task->idx],
+                            &len, &reserved);
+
+    pthread_mutex_lock (&prefetcher->lock);
+    if (buf && !prefetcher->closed) {
+        block->data = buf;
+        block->len = len;
+        block->state = BLOCK_READY;
+        buf = NULL;
+        reserved = FALSE;
+    } else {
+        block->state = BLOCK_FAILED;
+    }
+    pthread_cond_broadcast (&prefetcher->cond);
+    pthread_mutex_unlock (&prefetcher->lock);
+
+    if (reserved)
+        release_mem (len);
+    g_free (buf);
+
+out:
+    block_prefetcher_unref (prefetcher);
+    g_free (task);
+}
+
+char *
+block_prefetcher_take (BlockPrefetcher *prefetcher, int idx, int *len)
+{
+    PrefetchedBlock *block = &prefetcher->blocks[idx];
+    char *data = NULL;
+    gboolean hit = FALSE, stall = FALSE;
+    int state;
+
+    pthread_mutex_lock (&prefetcher->lock);
+
+    state = block->state;
+    if (state == BLOCK_NONE || state == BLOCK_TAKEN) {
+        /* Not read ahead. */
+        pthread_mutex_unlock (&prefetcher->lock);
+        return NULL;
+    }
+
+    if (state == BLOCK_QUEUED) {
+        /* No thread has picked it up, it's faster to read it here. */
+        block->state = BLOCK_FAILED;
+    } else {
+        hit = (state == BLOCK_READY);
+        stall = (state == BLOCK_READING);
+        while (block->state == BLOCK_READING)
+            pthread_cond_wait (&prefetcher->cond, &prefetcher->lock);
+    }
+
+    if (block->state == BLOCK_READY) {
+        data = block->data;
+        *len = block->len;
+        block->data = NULL;
+        release_mem (block->len);
+    }
+    block->state = BLOCK_TAKEN;
+
+    pthread_mutex_unlock (&prefetcher->lock);
+
+    if (hit)
+        seaf_metric_manager_download_prefetch_hit (seaf->metric_mgr);
+    else if (stall)
+        seaf_metric_manager_download_prefetch_stall (seaf->metric_mgr);
+
+    return data;
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef BLOCK_PREFETCH_H
+#define BLOCK_PREFETCH_H
+
+#include <glib.h>
+
+/*
+ * Read-ahead for file downloads.
+ *
+ * Downloads read blocks one by one in the event loop thread, so the transfer
+ * stalls at every block boundary while the next block is opened and read.
+ * A BlockPrefetcher reads the next few blocks of a file into memory in a
+ * shared thread pool, while the current block is being sent. The total size
+ * of the blocks read ahead and not taken yet is bounded.
+ */
+
+typedef struct BlockPrefetcher BlockPrefetcher;
+
+int
+block_prefetch_init (int threads, gint64 mem_limit);
+
+BlockPrefetcher *
+block_prefetcher_new (const char *store_id, int version,
+                      char **blk_ids, int n_blocks);
+
+void
+block_prefetcher_free (BlockPrefetcher *prefetcher);
+
+/* Start reading up to @n blocks after block @idx. */
+void
+block_prefetcher_advance (BlockPrefetcher *prefetcher, int idx, int n);
+
+/*
+ * Take the content of block @idx if it has been read ahead. If the block is
+ * being read, wait for it. The returned buffer belongs to the caller.
+ * Returns NULL if the block wasn't read ahead, or failed to be read. The
+ * caller should read it from the block manager then.
+ */
+char *
+block_prefetcher_take (BlockPrefetcher *prefetcher, int idx, int *len);
+
+#endif
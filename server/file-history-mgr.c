@@ -0,0 +1,978 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "utils.h"
+#include "log.h"
+
+#include "seafile-session.h"
+#include "file-history-mgr.h"
+#include "diff-simple.h"
+
+/* The most commits indexed while a history query waits. Longer backlogs
+ * are indexed in the background and the query walks the commits instead.
+ */
+#define SYNC_INDEX_LIMIT 64
+/* The most dir entries compared while a history query waits. A single
+ * commit can add a whole tree, e.g. when a library is uploaded.
+ */
+#define SYNC_INDEX_MAX_DIRENTS 20000
+
+/* Rows are written while the trees are compared, this many at a time. */
+#define INDEX_BATCH_SIZE 256
+
+struct _SeafFileHistoryManagerPriv {
+    gboolean enabled;
+
+    GThreadPool *update_pool;
+
+    pthread_mutex_t lock;
+    /* Repos waiting in update_pool. */
+    GHashTable *pending_repos;
+    /* Repos being indexed. Only one thread indexes a repo at a time. */
+    GHashTable *busy_repos;
+};
+
+typedef struct UpdateJob {
+    SeafFileHistoryManager *mgr;
+    char repo_id[37];
+} UpdateJob;
+
+typedef struct FileHistoryRow {
+    char *path;
+    char obj_id[41];
+    gboolean deleted;
+    gboolean is_dir;
+    gint64 size;
+} FileHistoryRow;
+
+static void
+update_task (void *data, void *user_data);
+
+void
+file_change_free (FileChange *change)
+{
+    if (!change)
+        return;
+    g_free (change->obj_id);
+    g_free (change);
+}
+
+static void
+file_history_row_free (FileHistoryRow *row)
+{
+    g_free (row->path);
+    g_free (row);
+}
+
+SeafFileHistoryManager *
+seaf_file_history_manager_new (struct _SeafileSession *seaf)
+{
+    SeafFileHistoryManager *mgr = g_new0 (SeafFileHistoryManager, 1);
+    GError *error = NULL;
+
+    mgr->seaf = seaf;
+    mgr->priv = g_new0 (SeafFileHistoryManagerPriv, 1);
+
+    mgr->priv->enabled = g_key_file_get_boolean (seaf->config,
+                                                 "history", "file_history_index",
+                                                 &error);
+    if (error) {
+        /* Enabled by default. */
+        mgr->priv->enabled = TRUE;
+        g_clear_error (&error);
+    }
+
+    pthread_mutex_init (&mgr->priv->lock, NULL);
+    mgr->priv->pending_repos = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free, NULL);
+    mgr->priv->busy_repos = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+
+    return mgr;
+}
+
+static int
+create_tables (SeafFileHistoryManager *mgr)
+{
+    SeafDB *db = mgr->seaf->db;
+    char *sql;
+
+    switch (seaf_db_type (db)) {
+    case SEAF_DB_TYPE_MYSQL:
+        sql = "CREATE TABLE IF NOT EXISTS FileHistory ("
+            "id BIGINT NOT NULL PRIMARY KEY AUTO_INCREMENT, "
+            "repo_id CHAR(37), path_hash CHAR(40), dir_hash CHAR(40), "
+            "path TEXT, is_dir INTEGER, commit_id CHAR(41), obj_id CHAR(41), "
+            "size BIGINT, ctime BIGINT, "
+            "INDEX (repo_id, path_hash, ctime), INDEX (repo_id, dir_hash))"
+            "ENGINE=INNODB";
+        if (seaf_db_query (db, sql) < 0)
+            return -1;
+
+        sql = "CREATE TABLE IF NOT EXISTS FileHistoryCommit ("
+            "id BIGINT NOT NULL PRIMARY KEY AUTO_INCREMENT, "
+            "repo_id CHAR(37), commit_id CHAR(41), "
+            "UNIQUE INDEX (repo_id, commit_id))"
+            "ENGINE=INNODB";
+        if (seaf_db_query (db, sql) < 0)
+            return -1;
+        break;
+    case SEAF_DB_TYPE_SQLITE:
+        sql = "CREATE TABLE IF NOT EXISTS FileHistory ("
+            "id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+            "repo_id CHAR(37), path_hash CHAR(40), dir_hash CHAR(40), "
+            "path TEXT, is_dir INTEGER, commit_id CHAR(41), obj_id CHAR(41), "
+            "size BIGINT, ctime BIGINT)";
+        if (seaf_db_query (db, sql) < 0)
+            return -1;
+
+        sql = "CREATE INDEX IF NOT EXISTS FileHistoryPathIndex ON "
+            "FileHistory (repo_id, path_hash, ctime)";
+        if (seaf_db_query (db, sql) < 0)
+            return -1;
+
+        sql = "CREATE INDEX IF NOT EXISTS FileHistoryDirIndex ON "
+            "FileHistory (repo_id, dir_hash)";
+        if (seaf_db_query (db, sql) < 0)
+            return -1;
+
+        sql = "CREATE TABLE IF NOT EXISTS FileHistoryCommit ("
+            "repo_id CHAR(37), commit_id CHAR(41), "
+            "PRIMARY KEY (repo_id, commit_id))";
+        if (seaf_db_query (db, sql) < 0)
+            return -1;
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+int
+seaf_file_history_manager_init (SeafFileHistoryManager *mgr)
+{
+    gboolean db_err = FALSE;
+
+    if (!mgr->priv->enabled)
+        return 0;
+
+    if (mgr->seaf->create_tables && create_tables (mgr) < 0) {
+        seaf_warning ("Failed to create file history tables.\n");
+        return -1;
+    }
+
+    /* The tables may not be created yet if the server doesn't create tables
+     * itself. Keep using the commit history in that case.
+     */
+    seaf_db_check_for_existence (mgr->seaf->db,
+                                 "SELECT 1 FROM FileHistoryCommit LIMIT 1",
+                                 &db_err);
+    if (db_err) {
+        seaf_message ("File history tables don't exist, "
+                      "file history index is disabled.\n");
+        mgr->priv->enabled = FALSE;
+    }
+
+    return 0;
+}
+
+int
+seaf_file_history_manager_start (SeafFileHistoryManager *mgr)
+{
+    GError *error = NULL;
+
+    if (!mgr->priv->enabled)
+        return 0;
+
+    mgr->priv->update_pool = g_thread_pool_new (update_task, NULL,
+                                                1, FALSE, &error);
+    if (!mgr->priv->update_pool) {
+        seaf_warning ("Failed to create file history thread pool: %s.\n",
+                      error ? error->message : "");
+        g_clear_error (&error);
+        return -1;
+    }
+
+    return 0;
+}
+
+static gboolean
+lock_repo (SeafFileHistoryManager *mgr, const char *repo_id)
+{
+    gboolean ret = FALSE;
+
+    pthread_mutex_lock (&mgr->priv->lock);
+    if (!g_hash_table_contains (mgr->priv->busy_repos, repo_id)) {
+        g_hash_table_add (mgr->priv->busy_repos, g_strdup(repo_id));
+        ret = TRUE;
+    }
+    pthread_mutex_unlock (&mgr->priv->lock);
+
+    return ret;
+}
+
+static void
+unlock_repo (SeafFileHistoryManager *mgr, const char *repo_id)
+{
+    pthread_mutex_lock (&mgr->priv->lock);
+    g_hash_table_remove (mgr->priv->busy_repos, repo_id);
+    pthread_mutex_unlock (&mgr->priv->lock);
+}
+
+void
+seaf_file_history_manager_schedule_update (SeafFileHistoryManager *mgr,
+                                           const char *repo_id)
+{
+    UpdateJob *job;
+    gboolean queued;
+
+    if (!mgr->priv->enabled || !mgr->priv->update_pool)
+        return;
+
+    pthread_mutex_lock (&mgr->priv->lock);
+    queued = g_hash_table_contains (mgr->priv->pending_repos, repo_id);
+    if (!queued)
+        g_hash_table_add (mgr->priv->pending_repos, g_strdup(repo_id));
+    pthread_mutex_unlock (&mgr->priv->lock);
+
+    if (queued)
+        return;
+
+    job = g_new0 (UpdateJob, 1);
+    job->mgr = mgr;
+    memcpy (job->repo_id, repo_id, 36);
+
+    g_thread_pool_push (mgr->priv->update_pool, job, NULL);
+}
+
+/* Helpers for computing row keys. */
+
+static void
+hash_path (const char *path, int len, char *hex)
+{
+    unsigned char sha1[20];
+
+    calculate_sha1 (sha1, path, len);
+    rawdata_to_hex (sha1, hex, 20);
+}
+
+/* Paths in the index look like "/a/b". Callers may pass "a/b", "/a//b" or
+ * "/a/", which the commit walk accepts too.
+ */
+static char *
+normalize_path (const char *path)
+{
+    GString *buf = g_string_sized_new (strlen(path) + 1);
+    const char *p;
+
+    for (p = path; *p; ++p) {
+        if (buf->len == 0 && *p != '/')
+            g_string_append_c (buf, '/');
+        else if (*p == '/' && buf->len > 0 && buf->str[buf->len - 1] == '/')
+            continue;
+        g_string_append_c (buf, *p);
+    }
+
+    if (buf->len == 0)
+        g_string_append_c (buf, '/');
+    else if (buf->len > 1 && buf->str[buf->len - 1] == '/')
+        g_string_truncate (buf, buf->len - 1);
+
+    return g_string_free (buf, FALSE);
+}
+
+/* @path must start with '/'. The parent of "/a" is "/". */
+static void
+hash_parent_dir (const char *path, char *hex)
+{
+    const char *slash = strrchr (path, '/');
+    int len = slash - path;
+
+    if (len == 0)
+        len = 1;
+    hash_path (path, len, hex);
+}
+
+/* Indexing */
+
+static gboolean
+is_commit_indexed (SeafDB *db, const char *repo_id, const char *commit_id,
+                   gboolean *db_err)
+{
+    return seaf_db_statement_exists (db,
+                                     "SELECT 1 FROM FileHistoryCommit "
+                                     "WHERE repo_id=? AND commit_id=?",
+                                     db_err, 2,
+                                     "string", repo_id, "string", commit_id);
+}
+
+typedef struct CollectFrame {
+    char commit_id[41];
+    SeafCommit *commit;
+} CollectFrame;
+
+static void
+push_frame (GQueue *stack, const char *commit_id, SeafCommit *commit)
+{
+    CollectFrame *frame = g_new0 (CollectFrame, 1);
+
+    memcpy (frame->commit_id, commit_id, 40);
+    frame->commit = commit;
+    g_queue_push_head (stack, frame);
+}
+
+/*
+ * Collect the commits reachable from @head_id that are not indexed yet,
+ * parents before children. Returns 1 if there are more than @limit of them
+ * (if @limit > 0).
+ */
+static int
+collect_unindexed_commits (SeafFileHistoryManager *mgr, SeafRepo *repo,
+                           const char *head_id, int limit, GList **commits)
+{
+    GQueue *stack = g_queue_new ();
+    GHashTable *visited = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, NULL);
+    CollectFrame *frame;
+    SeafCommit *commit;
+    gboolean db_err = FALSE;
+    int n = 0;
+    int ret = 0;
+
+    push_frame (stack, head_id, NULL);
+
+    while ((frame = g_queue_pop_head (stack)) != NULL) {
+        if (frame->commit) {
+            /* All parents have been collected. */
+            *commits = g_list_prepend (*commits, frame->commit);
+            g_free (frame);
+            continue;
+        }
+
+        if (g_hash_table_contains (visited, frame->commit_id)) {
+            g_free (frame);
+            continue;
+        }
+        g_hash_table_add (visited, g_strdup(frame->commit_id));
+
+        if (is_commit_indexed (mgr->seaf->db, repo->id, frame->commit_id,
+                               &db_err)) {
+            g_free (frame);
+            continue;
+        }
+        if (db_err) {
+            g_free (frame);
+            ret = -1;
+            break;
+        }
+
+        commit = seaf_commit_manager_get_graph_commit (mgr->seaf->commit_mgr,
+                                                       repo->id, repo->version,
+                                                       frame->commit_id);
+        if (!commit) {
+            /* History before a missing commit can't be reached anyway. */
+            seaf_warning ("Failed to get commit %s:%s.\n",
+                          repo->id, frame->commit_id);
+            g_free (frame);
+            continue;
+        }
+
+        if (limit > 0 && ++n > limit) {
+            seaf_commit_unref (commit);
+            g_free (frame);
+            ret = 1;
+            break;
+        }
+
+        push_frame (stack, commit->commit_id, commit);
+        if (commit->second_parent_id &&
+            !g_hash_table_contains (visited, commit->second_parent_id))
+            push_frame (stack, commit->second_parent_id, NULL);
+        if (commit->parent_id &&
+            !g_hash_table_contains (visited, commit->parent_id))
+            push_frame (stack, commit->parent_id, NULL);
+        g_free (frame);
+    }
+
+    while ((frame = g_queue_pop_head (stack)) != NULL) {
+        seaf_commit_unref (frame->commit);
+        g_free (frame);
+    }
+    g_queue_free (stack);
+    g_hash_table_destroy (visited);
+
+    *commits = g_list_reverse (*commits);
+    if (ret != 0) {
+        g_list_free_full (*commits, (GDestroyNotify)seaf_commit_unref);
+        *commits = NULL;
+    }
+
+    return ret;
+}
+
+typedef struct IndexData {
+    SeafDBTrans *trans;
+    SeafRepo *repo;
+    SeafCommit *commit;
+    /* Rows not written yet. */
+    GPtrArray *rows;
+    /* Dir entries left to compare, NULL if there's no limit. */
+    gint64 *budget;
+    gboolean over_budget;
+    gboolean db_err;
+} IndexData;
+
+static void
+add_row (IndexData *data, const char *basedir, SeafDirent *dent,
+         gboolean deleted, gboolean is_dir)
+{
+    FileHistoryRow *row = g_new0 (FileHistoryRow, 1);
+
+    row->path = g_strconcat ("/", basedir, dent->name, NULL);
+    if (!deleted)
+        memcpy (row->obj_id, dent->id, 40);
+    row->deleted = deleted;
+    row->is_dir = is_dir;
+    if (!deleted && !is_dir) {
+        /* Dirents of version 0 repos don't have the size. */
+        if (data->repo->version > 0)
+            row->size = dent->size;
+        else
+            row->size = seaf_fs_manager_get_file_size (seaf->fs_mgr,
+                                                       data->repo->store_id,
+                                                       data->repo->version,
+                                                       dent->id);
+    }
+
+    g_ptr_array_add (data->rows, row);
+}
+
+static int
+write_rows (IndexData *data)
+{
+    FileHistoryRow *row;
+    char path_hash[41], dir_hash[41];
+    guint i;
+
+    for (i = 0; i < data->rows->len; ++i) {
+        row = g_ptr_array_index (data->rows, i);
+        hash_path (row->path, strlen(row->path), path_hash);
+        hash_parent_dir (row->path, dir_hash);
+
+        if (seaf_db_trans_query (data->trans,
+                                 "INSERT INTO FileHistory (repo_id, path_hash, "
+                                 "dir_hash, path, is_dir, commit_id, obj_id, "
+                                 "size, ctime) VALUES (?,?,?,?,?,?,?,?,?)",
+                                 9, "string", data->repo->id,
+                                 "string", path_hash,
+                                 "string", dir_hash, "string", row->path,
+                                 "int", row->is_dir ? 1 : 0,
+                                 "string", data->commit->commit_id,
+                                 "string", row->deleted ? NULL : row->obj_id,
+                                 "int64", row->size,
+                                 "int64", (gint64)data->commit->ctime) < 0) {
+            data->db_err = TRUE;
+            return -1;
+        }
+    }
+
+    g_ptr_array_set_size (data->rows, 0);
+    return 0;
+}
+
+static gboolean
+same_id (SeafDirent *a, SeafDirent *b)
+{
+    return (a && b && strcmp (a->id, b->id) == 0);
+}
+
+/*
+ * entries[0] is the entry in the commit, the others are in its parents.
+ * Like a file revision, a change is only recorded if the entry differs
+ * from all parents. Returns whether a row is added.
+ */
+static gboolean
+index_entries (IndexData *data, int n, const char *basedir,
+               SeafDirent *entries[], gboolean is_dir)
+{
+    SeafDirent *m = entries[0];
+    SeafDirent *p1 = entries[1];
+    SeafDirent *p2 = (n == 3) ? entries[2] : NULL;
+
+    if (m) {
+        if (same_id (m, p1) || same_id (m, p2))
+            return FALSE;
+        add_row (data, basedir, m, FALSE, is_dir);
+        return TRUE;
+    }
+
+    if (p1 && (n == 2 || p2)) {
+        add_row (data, basedir, p1, TRUE, is_dir);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Returns -1 to stop the diff if the budget is used up. */
+static int
+charge_entry (IndexData *data)
+{
+    if (data->budget && --(*data->budget) < 0) {
+        data->over_budget = TRUE;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+index_files_cb (int n, const char *basedir, SeafDirent *files[], void *vdata)
+{
+    IndexData *data = vdata;
+
+    if (charge_entry (data) < 0)
+        return -1;
+
+    index_entries (data, n, basedir, files, FALSE);
+    if (data->rows->len >= INDEX_BATCH_SIZE)
+        return write_rows (data);
+    return 0;
+}
+
+static int
+index_dirs_cb (int n, const char *basedir, SeafDirent *dirs[], void *vdata,
+               gboolean *recurse)
+{
+    IndexData *data = vdata;
+
+    if (charge_entry (data) < 0)
+        return -1;
+
+    /* Entries under a dir can only differ from all parents if the dir
+     * itself does.
+     */
+    *recurse = index_entries (data, n, basedir, dirs, TRUE);
+    if (data->rows->len >= INDEX_BATCH_SIZE)
+        return write_rows (data);
+    return 0;
+}
+
+/*
+ * Start the transaction that saves the changes of @commit. Returns NULL
+ * if the commit is already indexed, or on error (@db_err is set).
+ */
+static SeafDBTrans *
+begin_index_commit (SeafDB *db, SeafRepo *repo, SeafCommit *commit,
+                    gboolean *db_err)
+{
+    SeafDBTrans *trans;
+
+    trans = seaf_db_begin_transaction (db);
+    if (!trans) {
+        *db_err = TRUE;
+        return NULL;
+    }
+
+    if (seaf_db_trans_check_for_existence (trans,
+                                           "SELECT 1 FROM FileHistoryCommit "
+                                           "WHERE repo_id=? AND commit_id=?",
+                                           db_err, 2, "string", repo->id,
+                                           "string", commit->commit_id) ||
+        *db_err) {
+        /* Indexed by another process. */
+        seaf_db_rollback (trans);
+        seaf_db_trans_close (trans);
+        return NULL;
+    }
+
+    return trans;
+}
+
+static void
+abort_index_commit (IndexData *data)
+{
+    seaf_db_rollback (data->trans);
+    seaf_db_trans_close (data->trans);
+    data->trans = NULL;
+}
+
+/*
+ * The rows are written in batches while the trees are compared, in the
+ * same transaction as the commit record, so a large commit isn't held in
+ * memory and is either indexed completely or not at all.
+ * Returns 1 if @budget is used up before the commit is indexed.
+ */
+static int
+index_commit (SeafFileHistoryManager *mgr, SeafRepo *repo, SeafCommit *commit,
+              gint64 *budget)
+{
+    SeafDB *db = mgr->seaf->db;
+    SeafCommit *p1 = NULL, *p2 = NULL;
+    const char *roots[3];
+    DiffOptions opt;
+    IndexData data = {0};
+    gboolean db_err = FALSE;
+    int n = 2;
+    int ret = 0;
+
+    data.repo = repo;
+    data.commit = commit;
+    data.budget = budget;
+    data.rows = g_ptr_array_new_with_free_func ((GDestroyNotify)file_history_row_free);
+
+    data.trans = begin_index_commit (db, repo, commit, &db_err);
+    if (!data.trans) {
+        if (db_err)
+            goto save_error;
+        goto out;
+    }
+
+    if (commit->parent_id)
+        p1 = seaf_commit_manager_get_graph_commit (mgr->seaf->commit_mgr,
+                                                   repo->id, repo->version,
+                                                   commit->parent_id);
+    if (commit->second_parent_id)
+        p2 = seaf_commit_manager_get_graph_commit (mgr->seaf->commit_mgr,
+                                                   repo->id, repo->version,
+                                                   commit->second_parent_id);
+
+    /* Missing parents are treated as empty, so the files of the commit are
+     * recorded as added in it, like the history walk does.
+     */
+    roots[0] = commit->root_id;
+    if (p1 && p2) {
+        roots[1] = p1->root_id;
+        roots[2] = p2->root_id;
+        n = 3;
+    } else if (p1 || p2) {
+        roots[1] = p1 ? p1->root_id : p2->root_id;
+    } else {
+        roots[1] = EMPTY_SHA1;
+    }
+
+    memset (&opt, 0, sizeof(opt));
+    memcpy (opt.store_id, repo->store_id, 36);
+    opt.version = repo->version;
+    opt.file_cb = index_files_cb;
+    opt.dir_cb = index_dirs_cb;
+    opt.data = &data;
+
+    if (diff_trees (n, roots, &opt) < 0) {
+        abort_index_commit (&data);
+
+        if (data.over_budget) {
+            ret = 1;
+            goto out;
+        }
+        if (data.db_err)
+            goto save_error;
+
+        /* Usually the fs objects are missing. Don't retry the commit forever;
+         * its changes are just left out of the index.
+         */
+        seaf_warning ("Failed to diff commit %s:%s, "
+                      "its changes are not indexed.\n",
+                      repo->id, commit->commit_id);
+        g_ptr_array_set_size (data.rows, 0);
+
+        data.trans = begin_index_commit (db, repo, commit, &db_err);
+        if (!data.trans) {
+            if (db_err)
+                goto save_error;
+            goto out;
+        }
+    }
+
+    if (write_rows (&data) < 0 ||
+        seaf_db_trans_query (data.trans,
+                             "INSERT INTO FileHistoryCommit (repo_id, commit_id) "
+                             "VALUES (?,?)",
+                             2, "string", repo->id,
+                             "string", commit->commit_id) < 0 ||
+        seaf_db_commit (data.trans) < 0) {
+        abort_index_commit (&data);
+        goto save_error;
+    }
+
+    seaf_db_trans_close (data.trans);
+    goto out;
+
+save_error:
+    seaf_warning ("Failed to save file history of commit %s:%s.\n",
+                  repo->id, commit->commit_id);
+    ret = -1;
+
+out:
+    g_ptr_array_free (data.rows, TRUE);
+    seaf_commit_unref (p1);
+    seaf_commit_unref (p2);
+    return ret;
+}
+
+/*
+ * Index the commits reachable from @head_id. Returns 1 without indexing
+ * anything if there are more than @limit commits to index, or with only
+ * the older commits indexed if comparing their trees goes over
+ * @max_dirents dir entries. Both are unlimited if 0.
+ * The caller must hold the repo lock.
+ */
+static int
+index_repo (SeafFileHistoryManager *mgr, SeafRepo *repo, const char *head_id,
+            int limit, gint64 max_dirents)
+{
+    GList *commits = NULL, *ptr;
+    gint64 budget = max_dirents;
+    int n_commits;
+    gint64 start = g_get_monotonic_time ();
+    int ret;
+
+    ret = collect_unindexed_commits (mgr, repo, head_id, limit, &commits);
+    if (ret != 0)
+        return ret;
+
+    for (ptr = commits; ptr; ptr = ptr->next) {
+        ret = index_commit (mgr, repo, ptr->data,
+                            max_dirents > 0 ? &budget : NULL);
+        if (ret != 0)
+            break;
+    }
+
+    n_commits = g_list_length (commits);
+    if (ret == 0 && n_commits > SYNC_INDEX_LIMIT)
+        seaf_message ("Indexed file history of %d commits of repo %s in %" G_GINT64_FORMAT " ms.\n",
+                      n_commits, repo->id,
+                      (g_get_monotonic_time () - start) / 1000);
+
+    g_list_free_full (commits, (GDestroyNotify)seaf_commit_unref);
+    return ret;
+}
+
+static void
+update_task (void *data, void *user_data)
+{
+    UpdateJob *job = data;
+    SeafFileHistoryManager *mgr = job->mgr;
+    SeafRepo *repo = NULL;
+
+    pthread_mutex_lock (&mgr->priv->lock);
+    g_hash_table_remove (mgr->priv->pending_repos, job->repo_id);
+    pthread_mutex_unlock (&mgr->priv->lock);
+
+    repo = seaf_repo_manager_get_repo (mgr->seaf->repo_mgr, job->repo_id);
+    if (!repo)
+        goto out;
+
+    /* The repo is indexed by a query. It will schedule another update if
+     * that's not enough.
+     */
+    if (!lock_repo (mgr, repo->id))
+        goto out;
+
+    if (index_repo (mgr, repo, repo->head->commit_id, 0, 0) < 0)
+        seaf_warning ("Failed to index file history of repo %s.\n", repo->id);
+
+    unlock_repo (mgr, repo->id);
+
+out:
+    seaf_repo_unref (repo);
+    g_free (job);
+}
+
+/*
+ * Make sure the index covers @head_id. Small backlogs are indexed right
+ * away, larger ones are left to the update thread.
+ */
+static int
+ensure_indexed (SeafFileHistoryManager *mgr, SeafRepo *repo,
+                const char *head_id)
+{
+    gboolean db_err = FALSE;
+    int ret;
+
+    if (!mgr->priv->enabled)
+        return -1;
+
+    if (is_commit_indexed (mgr->seaf->db, repo->id, head_id, &db_err))
+        return 0;
+    if (db_err)
+        return -1;
+
+    if (!lock_repo (mgr, repo->id))
+        return -1;
+    ret = index_repo (mgr, repo, head_id,
+                      SYNC_INDEX_LIMIT, SYNC_INDEX_MAX_DIRENTS);
+    unlock_repo (mgr, repo->id);
+
+    if (ret == 1) {
+        seaf_file_history_manager_schedule_update (mgr, repo->id);
+        return -1;
+    }
+
+    return ret;
+}
+
+static gboolean
+collect_file_change (SeafDBRow *row, void *data)
+{
+    GList **changes = data;
+    FileChange *change;
+    const char *commit_id = seaf_db_row_get_column_text (row, 0);
+    const char *obj_id = seaf_db_row_get_column_text (row, 1);
+
+    if (!commit_id)
+        return TRUE;
+
+    change = g_new0 (FileChange, 1);
+    memcpy (change->commit_id, commit_id, 40);
+    if (obj_id && *obj_id)
+        change->obj_id = g_strdup (obj_id);
+    change->size = seaf_db_row_get_column_int64 (row, 2);
+    change->ctime = seaf_db_row_get_column_int64 (row, 3);
+
+    *changes = g_list_prepend (*changes, change);
+
+    return TRUE;
+}
+
+int
+seaf_file_history_manager_get_file_changes (SeafFileHistoryManager *mgr,
+                                            SeafRepo *repo,
+                                            const char *head_id,
+                                            const char *path,
+                                            GList **changes)
+{
+    char path_hash[41];
+    char *norm_path;
+
+    if (ensure_indexed (mgr, repo, head_id) < 0)
+        return -1;
+
+    norm_path = normalize_path (path);
+    hash_path (norm_path, strlen(norm_path), path_hash);
+    g_free (norm_path);
+
+    /* Rows are inserted parents first, so id breaks ctime ties. */
+    if (seaf_db_statement_foreach_row (mgr->seaf->db,
+                                       "SELECT commit_id, obj_id, size, ctime "
+                                       "FROM FileHistory WHERE repo_id=? AND "
+                                       "path_hash=? AND is_dir=0 "
+                                       "ORDER BY ctime DESC, id DESC",
+                                       collect_file_change, changes,
+                                       2, "string", repo->id,
+                                       "string", path_hash) < 0) {
+        g_list_free_full (*changes, (GDestroyNotify)file_change_free);
+        *changes = NULL;
+        return -1;
+    }
+
+    *changes = g_list_reverse (*changes);
+
+    return 0;
+}
+
+typedef struct LastModifiedData {
+    GHashTable *entry_ids;
+    GHashTable *found;
+} LastModifiedData;
+
+static gboolean
+collect_last_modified (SeafDBRow *row, void *vdata)
+{
+    LastModifiedData *data = vdata;
+    const char *path = seaf_db_row_get_column_text (row, 0);
+    const char *obj_id = seaf_db_row_get_column_text (row, 1);
+    gint64 ctime = seaf_db_row_get_column_int64 (row, 2);
+    const char *name, *cur_id;
+    gint64 *found;
+
+    if (!path || !obj_id)
+        return TRUE;
+
+    name = strrchr (path, '/');
+    name = name ? name + 1 : path;
+
+    cur_id = g_hash_table_lookup (data->entry_ids, name);
+    if (!cur_id || strcmp (cur_id, obj_id) != 0)
+        return TRUE;
+
+    found = g_hash_table_lookup (data->found, name);
+    if (!found) {
+        found = g_new (gint64, 1);
+        *found = ctime;
+        g_hash_table_insert (data->found, g_strdup(name), found);
+    } else if (ctime > *found) {
+        *found = ctime;
+    }
+
+    return TRUE;
+}
+
+int
+seaf_file_history_manager_get_last_modified (SeafFileHistoryManager *mgr,
+                                             SeafRepo *repo,
+                                             const char *head_id,
+                                             const char *dir,
+                                             GHashTable *entry_ids,
+                                             GHashTable *last_modified)
+{
+    LastModifiedData data;
+    char dir_hash[41];
+    GHashTableIter iter;
+    gpointer key, value;
+    char *norm_dir;
+
+    if (ensure_indexed (mgr, repo, head_id) < 0)
+        return -1;
+
+    norm_dir = normalize_path (dir);
+    hash_path (norm_dir, strlen(norm_dir), dir_hash);
+    g_free (norm_dir);
+
+    data.entry_ids = entry_ids;
+    data.found = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    if (seaf_db_statement_foreach_row (mgr->seaf->db,
+                                       "SELECT path, obj_id, MAX(ctime) "
+                                       "FROM FileHistory WHERE repo_id=? AND "
+                                       "dir_hash=? AND obj_id IS NOT NULL "
+                                       "GROUP BY path, obj_id",
+                                       collect_last_modified, &data,
+                                       2, "string", repo->id,
+                                       "string", dir_hash) < 0) {
+        g_hash_table_destroy (data.found);
+        return -1;
+    }
+
+    g_hash_table_iter_init (&iter, data.found);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        g_hash_table_iter_steal (&iter);
+        g_hash_table_replace (last_modified, key, value);
+    }
+    g_hash_table_destroy (data.found);
+
+    return 0;
+}
+
+int
+seaf_file_history_manager_remove_repo (SeafFileHistoryManager *mgr,
+                                       const char *repo_id)
+{
+    if (!mgr->priv->enabled)
+        return 0;
+
+    if (seaf_db_statement_query (mgr->seaf->db,
+                                 "DELETE FROM FileHistory WHERE repo_id=?",
+                                 1, "string", repo_id) < 0)
+        return -1;
+
+    if (seaf_db_statement_query (mgr->seaf->db,
+                                 "DELETE FROM FileHistoryCommit WHERE repo_id=?",
+                                 1, "string", repo_id) < 0)
+        return -1;
+
+    return 0;
+}
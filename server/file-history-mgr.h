@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef SEAF_FILE_HISTORY_MGR_H
+#define SEAF_FILE_HISTORY_MGR_H
+
+#include "repo-mgr.h"
+
+/*
+ * File history index.
+ *
+ * For every commit, the paths whose object id changed against its parents are
+ * recorded in the FileHistory table, keyed by the path and its parent dir.
+ * Commits are indexed parents first, and a commit is marked in the
+ * FileHistoryCommit table once its changes are stored. So if a commit is
+ * marked, the changes of all its ancestors are in the index too.
+ *
+ * New commits are indexed in the background. Repos created before the index
+ * existed are backfilled the first time their history is queried.
+ */
+
+struct _SeafileSession;
+
+typedef struct _SeafFileHistoryManager SeafFileHistoryManager;
+typedef struct _SeafFileHistoryManagerPriv SeafFileHistoryManagerPriv;
+
+struct _SeafFileHistoryManager {
+    struct _SeafileSession *seaf;
+
+    SeafFileHistoryManagerPriv *priv;
+};
+
+typedef struct FileChange {
+    char commit_id[41];
+    /* NULL if the path was deleted in this commit. */
+    char *obj_id;
+    gint64 size;
+    gint64 ctime;
+} FileChange;
+
+void
+file_change_free (FileChange *change);
+
+SeafFileHistoryManager *
+seaf_file_history_manager_new (struct _SeafileSession *seaf);
+
+int
+seaf_file_history_manager_init (SeafFileHistoryManager *mgr);
+
+int
+seaf_file_history_manager_start (SeafFileHistoryManager *mgr);
+
+/* Index the new commits of @repo_id in the background. */
+void
+seaf_file_history_manager_schedule_update (SeafFileHistoryManager *mgr,
+                                           const char *repo_id);
+
+/*
+ * Get the changes of the file at @path made in @head_id and its ancestors,
+ * newest first. Returns -1 if the index doesn't cover @head_id yet, in which
+ * case the caller should walk the history itself.
+ */
+int
+seaf_file_history_manager_get_file_changes (SeafFileHistoryManager *mgr,
+                                            SeafRepo *repo,
+                                            const char *head_id,
+                                            const char *path,
+                                            GList **changes);
+
+/*
+ * @entry_ids maps the names of the entries under @dir in @head_id to their
+ * object ids. For every entry whose current object id is found in the index,
+ * set the ctime of the latest commit that changed the entry to that id in
+ * @last_modified (name -> heap allocated gint64).
+ * Returns -1 if the index doesn't cover @head_id yet.
+ */
+int
+seaf_file_history_manager_get_last_modified (SeafFileHistoryManager *mgr,
+                                             SeafRepo *repo,
+                                             const char *head_id,
+                                             const char *dir,
+                                             GHashTable *entry_ids,
+                                             GHashTable *last_modified);
+
+int
+seaf_file_history_manager_remove_repo (SeafFileHistoryManager *mgr,
+                                       const char *repo_id);
+
+#endif
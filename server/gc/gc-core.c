@@ -5,35 +5,35 @@
 #include "seafile-session.h"
 #include "bloom-filter.h"
 #include "gc-core.h"
+#include "gc-live-index.h"
 #include "utils.h"
 
 #define DEBUG_FLAG SEAFILE_DEBUG_OTHER
 #include "log.h"
 
 #include <time.h>
-#define MAX_BF_SIZE (((size_t)1) << 29)   /* 64 MB */
+#include <pthread.h>
+#define MAX_BF_SIZE (((size_t)1) << 26)   /* 64 MB */
 
 #define KEEP_ALIVE_PER_OBJS 100
 #define KEEP_ALIVE_PER_SECOND 1
 
 /*
- * The number of bits in the bloom filter is 4 times the number of all blocks.
- * Let m be the bits in the bf, n be the number of blocks to be added to the bf
- * (the number of live blocks), and k = 3 (closed to optimal for m/n = 4),
- * the probability of false-positive is
+ * The index of live blocks is a split block bloom filter. Each block id
+ * sets 8 bits within a single 256-bit block, so adding and testing an id
+ * touches only one cache line instead of k random ones.
  *
- *     p = (1 - e^(-kn/m))^k = 0.15
+ * The filter is sized so that the false-positive rate is at most
+ * GC_INDEX_FALSE_POSITIVE_RATE when all blocks in the store are alive.
+ * Since the number of live blocks is <= total_blocks, the real rate is
+ * lower. Put it another way, we'll clean up at least 99% dead blocks in
+ * each gc operation.
  *
- * Because m = 4 * total_blocks >= 4 * (live blocks) = 4n, we should have p <= 0.15.
- * Put it another way, we'll clean up at least 85% dead blocks in each gc operation.
- * See http://en.wikipedia.org/wiki/Bloom_filter.
- *
- * Supose we have 8TB space, and the avg block size is 1MB, we'll have 8M blocks, then
- * the size of bf is (8M * 4)/8 = 4MB.
- *
- * If total_blocks is a small number (e.g. < 100), we should try to clean all dead blocks.
- * So we set the minimal size of the bf to 1KB.
+ * This takes about 10.5 bits per block. Supose we have 8TB space, and the
+ * avg block size is 1MB, we'll have 8M blocks, then the size of bf is
+ * about 10.5MB.
  */
+#define GC_INDEX_FALSE_POSITIVE_RATE 0.01
 
 /*
  * Online GC algorithm
@@ -58,27 +58,39 @@
  * table has to be deleted.
  */
 
-static Bloom *
+static BlockedBloom *
 alloc_gc_index (const char *repo_id, guint64 total_blocks)
 {
-    size_t size;
+    BlockedBloom *index;
 
-    size = (size_t) MAX(total_blocks << 2, 1 << 13);
-    size = MIN (size, MAX_BF_SIZE);
+    index = blocked_bloom_create ((size_t)total_blocks,
+                                  GC_INDEX_FALSE_POSITIVE_RATE,
+                                  MAX_BF_SIZE);
+    if (!index)
+        return NULL;
 
-    seaf_message ("GC index size is %u Byte for repo %.8s.\n",
-                  (int)size >> 3, repo_id);
+    seaf_message ("GC index size is %"G_GSIZE_FORMAT" Byte for repo %.8s.\n",
+                  blocked_bloom_size (index), repo_id);
 
-    return bloom_create (size, 3, 0);
+    return index;
 }
 
 typedef struct {
     SeafRepo *repo;
-    Bloom *blocks_index;
-    Bloom *fs_index;
+    BlockedBloom *blocks_index;
+    BlockedBloom *fs_index;
     GHashTable *visited;
     GHashTable *visited_commits;
 
+    /* Persistent index for incremental GC, NULL for full GC. */
+    GCLiveIndex *live_index;
+    /* With a live index, fs objects only visited from base commits are
+     * tracked separately. Otherwise a later traversal would stop at them
+     * without indexing their blocks, and the persisted index would claim
+     * that their blocks are indexed.
+     */
+    GHashTable *visited_base;
+
     /* > 0: keep a period of history;
      * == 0: only keep data in head commit;
      * < 0: keep all history data.
@@ -103,7 +115,7 @@ static int
 add_blocks_to_index (SeafFSManager *mgr, GCData *data, const char *file_id)
 {
     SeafRepo *repo = data->repo;
-    Bloom *blocks_index = data->blocks_index;
+    BlockedBloom *blocks_index = data->blocks_index;
     Seafile *seafile;
     int i;
 
@@ -114,7 +126,9 @@ add_blocks_to_index (SeafFSManager *mgr, GCData *data, const char *file_id)
     }
 
     for (i = 0; i < seafile->n_blocks; ++i) {
-        bloom_add (blocks_index, seafile->blk_sha1s[i]);
+        blocked_bloom_add (blocks_index, seafile->blk_sha1s[i]);
+        if (data->live_index)
+            gc_live_index_add_block (data->live_index, seafile->blk_sha1s[i]);
         ++data->traversed_blocks;
     }
 
@@ -126,9 +140,9 @@ add_blocks_to_index (SeafFSManager *mgr, GCData *data, const char *file_id)
 static void
 add_fs_to_index(GCData *data, const char *file_id)
 {
-    Bloom *fs_index = data->fs_index;
+    BlockedBloom *fs_index = data->fs_index;
     if (fs_index) {
-        bloom_add (fs_index, file_id);
+        blocked_bloom_add (fs_index, file_id);
     }
     ++(data->traversed_fs_objs);
 }
@@ -143,15 +157,30 @@ fs_callback (SeafFSManager *mgr,
              gboolean *stop)
 {
     GCData *data = user_data;
+    GHashTable *visited = data->visited;
 
-    if (data->visited != NULL) {
+    if (data->live_index && data->traverse_base_commit) {
         if (g_hash_table_lookup (data->visited, obj_id) != NULL) {
             *stop = TRUE;
             return TRUE;
         }
+        visited = data->visited_base;
+    }
+
+    if (visited != NULL) {
+        if (g_hash_table_lookup (visited, obj_id) != NULL) {
+            *stop = TRUE;
+            return TRUE;
+        }
 
         char *key = g_strdup(obj_id);
-        g_hash_table_replace (data->visited, key, key);
+        g_hash_table_replace (visited, key, key);
+    }
+
+    /* Indexed in a previous run, together with all objects under it. */
+    if (data->live_index && gc_live_index_has_fs (data->live_index, obj_id)) {
+        *stop = TRUE;
+        return TRUE;
     }
 
     if (data->trans) {
@@ -174,6 +203,9 @@ fs_callback (SeafFSManager *mgr,
         return TRUE;
     }
 
+    if (data->live_index)
+        gc_live_index_add_fs (data->live_index, obj_id);
+
     if (type == SEAF_METADATA_TYPE_FILE &&
         add_blocks_to_index (mgr, data, obj_id) < 0)
         return FALSE;
@@ -193,6 +225,13 @@ traverse_commit (SeafCommit *commit, void *vdata, gboolean *stop)
         return TRUE;
     }
 
+    if (data->live_index &&
+        gc_live_index_has_commit (data->live_index, commit->commit_id)) {
+        // Has traversed in a previous GC run
+        *stop = TRUE;
+        return TRUE;
+    }
+
     if (data->truncate_time == 0)
     {
         *stop = TRUE;
@@ -233,6 +272,9 @@ traverse_commit (SeafCommit *commit, void *vdata, gboolean *stop)
     g_hash_table_replace (data->visited_commits,
                           g_strdup (commit->commit_id), &dummy);
 
+    if (data->live_index && !data->traverse_base_commit)
+        gc_live_index_add_commit (data->live_index, commit->commit_id);
+
     if (data->verbose)
         seaf_message ("Traversed %"G_GINT64_FORMAT" fs objects for repo %.8s.\n",
                       data->traversed_fs_objs, data->repo->id);
@@ -292,7 +334,8 @@ update_valid_since_time (SeafRepo *repo, gint64 new_time)
 }
 
 static GCData *
-gc_data_new (SeafRepo *repo, Bloom *blocks_index, Bloom *fs_index, int verbose)
+gc_data_new (SeafRepo *repo, BlockedBloom *blocks_index, BlockedBloom *fs_index,
+             GCLiveIndex *live_index, int verbose)
 {
     GCData *data;
     data = g_new0(GCData, 1);
@@ -303,6 +346,10 @@ gc_data_new (SeafRepo *repo, Bloom *blocks_index, Bloom *fs_index, int verbose)
     data->visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
     data->visited_commits = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                    g_free, NULL);
+    data->live_index = live_index;
+    if (live_index)
+        data->visited_base = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, NULL);
     data->verbose = verbose;
 
     gint64 truncate_time;
@@ -326,6 +373,8 @@ gc_data_free (GCData *data)
     seaf_repo_unref(data->repo);
     g_hash_table_destroy (data->visited);
     g_hash_table_destroy (data->visited_commits);
+    if (data->visited_base)
+        g_hash_table_destroy (data->visited_base);
     g_free (data);
 
     return;
@@ -363,12 +412,12 @@ populate_gc_index_for_repo_for_new_commits (GCData *data, SeafDBTrans *trans)
     }
 
     if (g_strcmp0 (repo->head->commit_id, new_branch->commit_id) != 0) {
-        res = seaf_commit_manager_traverse_commit_tree (seaf->commit_mgr,
-                                                        repo->id, repo->version,
-                                                        new_branch->commit_id,
-                                                        traverse_commit,
-                                                        data,
-                                                        FALSE);
+        res = seaf_commit_manager_traverse_commit_graph (seaf->commit_mgr,
+                                                         repo->id, repo->version,
+                                                         new_branch->commit_id,
+                                                         traverse_commit,
+                                                         data,
+                                                         FALSE);
         if (!res) {
             ret = -1;
             seaf_warning ("Failed to populate index for repo %.8s.\n", repo->id);
@@ -404,12 +453,12 @@ populate_gc_index_for_repo (GCData *data, SeafDBTrans *trans)
     else
         seaf_message ("Populating index for sub-repo %.8s.\n", repo->id);
 
-    res = seaf_commit_manager_traverse_commit_tree (seaf->commit_mgr,
-                                                    repo->id, repo->version,
-                                                    repo->head->commit_id,
-                                                    traverse_commit,
-                                                    data,
-                                                    FALSE);
+    res = seaf_commit_manager_traverse_commit_graph (seaf->commit_mgr,
+                                                     repo->id, repo->version,
+                                                     repo->head->commit_id,
+                                                     traverse_commit,
+                                                     data,
+                                                     FALSE);
     if (!res) {
         ret = -1;
         seaf_warning ("Failed to populate index for repo %.8s.\n", repo->id);
@@ -431,12 +480,12 @@ populate_gc_index_for_repo (GCData *data, SeafDBTrans *trans)
                 continue;
             }
             data->traverse_base_commit = TRUE;
-            res = seaf_commit_manager_traverse_commit_tree (seaf->commit_mgr,
-                                                            repo->store_id, repo->version,
-                                                            vinfo->base_commit,
-                                                            traverse_commit,
-                                                            data,
-                                                            FALSE);
+            res = seaf_commit_manager_traverse_commit_graph (seaf->commit_mgr,
+                                                             repo->store_id, repo->version,
+                                                             vinfo->base_commit,
+                                                             traverse_commit,
+                                                             data,
+                                                             FALSE);
             data->traverse_base_commit = FALSE;
             seaf_virtual_repo_info_free (vinfo);
             if (!res) {
@@ -458,7 +507,8 @@ populate_gc_index_for_repo (GCData *data, SeafDBTrans *trans)
 typedef struct CheckBlockParam {
     char *store_id;
     int repo_version;
-    Bloom *index;
+    BlockedBloom *index;
+    GCLiveIndex *live_index;
     int dry_run;
     GAsyncQueue *async_queue;
     pthread_mutex_t counter_lock;
@@ -468,7 +518,8 @@ typedef struct CheckBlockParam {
 typedef struct CheckFSParam {
     char *store_id;
     int repo_version;
-    Bloom *index;
+    BlockedBloom *index;
+    GCLiveIndex *live_index;
     int dry_run;
     GAsyncQueue *async_queue;
     pthread_mutex_t counter_lock;
@@ -481,7 +532,9 @@ check_block_liveness (gpointer data, gpointer user_data)
     char *block_id = data;
     CheckBlockParam *param = user_data;
 
-    if (!bloom_test (param->index, block_id)) {
+    if (!blocked_bloom_test (param->index, block_id) &&
+        !(param->live_index &&
+          gc_live_index_has_block (param->live_index, block_id))) {
         pthread_mutex_lock (&param->counter_lock);
         param->removed_blocks ++;
         pthread_mutex_unlock (&param->counter_lock);
@@ -496,7 +549,8 @@ check_block_liveness (gpointer data, gpointer user_data)
 
 static gint64
 check_existing_blocks (char *store_id, int repo_version, GHashTable *exist_blocks,
-                       Bloom *blocks_index, int dry_run)
+                       BlockedBloom *blocks_index, GCLiveIndex *live_index,
+                       int dry_run)
 {
     char *block_id;
     GThreadPool *tpool = NULL;
@@ -511,6 +565,7 @@ check_existing_blocks (char *store_id, int repo_version, GHashTable *exist_block
     param->store_id = store_id;
     param->repo_version = repo_version;
     param->index = blocks_index;
+    param->live_index = live_index;
     param->dry_run = dry_run;
     param->async_queue = async_queue;
     pthread_mutex_init (&param->counter_lock, NULL);
@@ -564,7 +619,9 @@ check_fs_liveness (gpointer data, gpointer user_data)
     char *fs_id = data;
     CheckFSParam *param = user_data;
 
-    if (!bloom_test (param->index, fs_id)) {
+    if (!blocked_bloom_test (param->index, fs_id) &&
+        !(param->live_index &&
+          gc_live_index_has_fs (param->live_index, fs_id))) {
         pthread_mutex_lock (&param->counter_lock);
         param->removed_fs ++;
         pthread_mutex_unlock (&param->counter_lock);
@@ -579,7 +636,8 @@ check_fs_liveness (gpointer data, gpointer user_data)
 
 static gint64
 check_existing_fs (char *store_id, int repo_version, GHashTable *exist_fs,
-                   Bloom *fs_index, int dry_run)
+                   BlockedBloom *fs_index, GCLiveIndex *live_index,
+                   int dry_run)
 {
     char *fs_id;
     GThreadPool *tpool = NULL;
@@ -594,6 +652,7 @@ check_existing_fs (char *store_id, int repo_version, GHashTable *exist_fs,
     param->store_id = store_id;
     param->repo_version = repo_version;
     param->index = fs_index;
+    param->live_index = live_index;
     param->dry_run = dry_run;
     param->async_queue = async_queue;
     pthread_mutex_init (&param->counter_lock, NULL);
@@ -676,8 +735,9 @@ out:
 static gint64
 populate_gc_index_for_virtual_repos (SeafRepo *repo,
                                      GList **virtual_repos,
-                                     Bloom *blocks_index,
-                                     Bloom *fs_index,
+                                     BlockedBloom *blocks_index,
+                                     BlockedBloom *fs_index,
+                                     GCLiveIndex *live_index,
                                      SeafDBTrans *trans,
                                      int verbose)
 {
@@ -699,7 +759,7 @@ populate_gc_index_for_virtual_repos (SeafRepo *repo,
             goto out;
         }
 
-        data = gc_data_new (vrepo, blocks_index, fs_index, verbose);
+        data = gc_data_new (vrepo, blocks_index, fs_index, live_index, verbose);
         *virtual_repos = g_list_prepend (*virtual_repos, data);
 
         scan_ret = populate_gc_index_for_repo (data, trans);
@@ -720,27 +780,38 @@ out:
  * @keep_days: explicitly sepecify how many days of history to keep after GC.
  *             This has higher priority than the history limit set in database.
  * @online: is running online GC. Online GC is not supported for SQLite DB.
+ * @incremental: only traverse commits and fs objects that are not in the
+ *               persistent live index, and update the index afterwards.
+ * @exist_blocks: blocks collected by a shared scan, taken over by this
+ *                function. If NULL, they're collected from the repo's store.
  */
 gint64
-gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
+gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs,
+            int incremental, GHashTable *exist_blocks)
 {
-    Bloom *blocks_index = NULL;
-    Bloom *fs_index = NULL;
-    GHashTable *exist_blocks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    BlockedBloom *blocks_index = NULL;
+    BlockedBloom *fs_index = NULL;
+    GCLiveIndex *live_index = NULL;
     GHashTable *exist_fs = NULL;
     GList *virtual_repos = NULL;
     guint64 total_blocks = 0;
     guint64 total_fs = 0;
     guint64 reachable_blocks = 0;
     gint64 removed_fs = 0;
+    gint64 truncate_time = 0;
     gint64 ret;
-    GCData *data;
+    GCData *data = NULL;
     SeafDBTrans *trans = NULL;
 
-    ret = seaf_block_manager_foreach_block (seaf->block_mgr,
-                                            repo->store_id, repo->version,
-                                            collect_exist_blocks,
-                                            exist_blocks);
+    if (exist_blocks)
+        ret = 0;
+    else {
+        exist_blocks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        ret = seaf_block_manager_foreach_block (seaf->block_mgr,
+                                                repo->store_id, repo->version,
+                                                collect_exist_blocks,
+                                                exist_blocks);
+    }
     if (ret < 0) {
         seaf_warning ("Failed to collect existing blocks for repo %.8s, stop GC.\n\n",
                       repo->id);
@@ -801,7 +872,27 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
         }
     }
 
-    data = gc_data_new (repo, blocks_index, fs_index, verbose);
+    /* The index only grows, so it has to be rebuilt by a full GC
+     * to drop objects that have become unreachable. If no history is kept,
+     * every commit but the head becomes unreachable, so don't use it.
+     */
+    if (incremental) {
+        truncate_time = seaf_repo_manager_get_repo_truncate_time (repo->manager,
+                                                                  repo->id);
+        if (truncate_time == 0) {
+            seaf_message ("Repo %.8s keeps no history, run full GC for it.\n",
+                          repo->id);
+            incremental = 0;
+        }
+    }
+    if (incremental)
+        live_index = gc_live_index_open (repo->store_id, truncate_time);
+    else if (gc_live_index_remove (repo->store_id) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    data = gc_data_new (repo, blocks_index, fs_index, live_index, verbose);
     ret = populate_gc_index_for_repo (data, trans);
     if (ret < 0) {
         goto out;
@@ -813,7 +904,8 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
      * it's necessary to do GC for them together.
      */
     ret = populate_gc_index_for_virtual_repos (repo, &virtual_repos,
-                                               blocks_index, fs_index, trans, verbose);
+                                               blocks_index, fs_index, live_index,
+                                               trans, verbose);
     if (ret < 0) {
         goto out;
     }
@@ -857,7 +949,7 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
         seaf_message ("Scanning unused blocks for repo %.8s.\n", repo->id);
 
     ret = check_existing_blocks (repo->store_id, repo->version, exist_blocks,
-                                 blocks_index, dry_run);
+                                 blocks_index, live_index, dry_run);
     if (ret < 0) {
         if (online) {
             seaf_db_rollback (trans);
@@ -868,7 +960,7 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
 
     if (rm_fs && total_fs > 0) {
         removed_fs = check_existing_fs(repo->store_id, repo->version, exist_fs,
-                                       fs_index, dry_run);
+                                       fs_index, live_index, dry_run);
         if (removed_fs < 0) {
             if (online) {
                 seaf_db_rollback (trans);
@@ -876,6 +968,11 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
             }
             goto out;
         }
+
+        if (!dry_run && removed_fs > 0 &&
+            seaf_fs_manager_compact_store (seaf->fs_mgr, repo->store_id) < 0)
+            seaf_warning ("Failed to compact fs objects of repo %.8s.\n",
+                          repo->id);
     }
 
     if (!dry_run) {
@@ -911,18 +1008,22 @@ gc_v1_repo (SeafRepo *repo, int dry_run, int online, int verbose, int rm_fs)
         seaf_db_trans_close (trans);
     }
 
+    if (live_index && gc_live_index_save (live_index) < 0)
+        seaf_warning ("Failed to save GC index for repo %.8s.\n", repo->id);
+
 out:
     printf ("\n");
 
     if (blocks_index)
-        bloom_destroy (blocks_index);
+        blocked_bloom_destroy (blocks_index);
     if (fs_index)
-        bloom_destroy(fs_index);
+        blocked_bloom_destroy (fs_index);
     g_hash_table_destroy (exist_blocks);
     if (exist_fs)
         g_hash_table_destroy (exist_fs);
     gc_data_free (data);
     g_list_free_full(virtual_repos, (GDestroyNotify)gc_data_free);
+    gc_live_index_free (live_index);
     return ret;
 }
 
@@ -964,6 +1065,7 @@ remove_store (gpointer data, gpointer user_data)
             seaf_message ("Deleting blocks for repo %s.\n", task->repo_id);
             ret = seaf_block_manager_remove_store (seaf->block_mgr, task->repo_id);
             if (ret == 0) {
+                gc_live_index_remove (task->repo_id);
                 task->success = TRUE;
             }
             break;
@@ -1078,15 +1180,43 @@ typedef struct GCRepoParam {
     int dry_run;
     int verbose;
     int rm_fs;
+    int incremental;
     gboolean online;
     GAsyncQueue *async_queue;
+
+    /* For shared scan. Repos whose blocks have been collected but are
+     * not finished yet, bounded to limit the memory of block lists.
+     */
+    gboolean shared_scan;
+    GThreadPool *tpool;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running_repos;
+    int max_running_repos;
+    gint64 scanned_blocks;
 } GCRepoParam;
 
 typedef struct GCRepo {
     SeafRepo *repo;
     gint64 gc_ret;
+
+    /* Blocks collected by the shared scan. */
+    pthread_mutex_t lock;
+    GHashTable *exist_blocks;
+    gboolean scanned;
 } GCRepo;
 
+static GCRepo *
+gc_repo_new (SeafRepo *repo)
+{
+    GCRepo *gc_repo = g_new0 (GCRepo, 1);
+
+    gc_repo->repo = repo;
+    pthread_mutex_init (&gc_repo->lock, NULL);
+
+    return gc_repo;
+}
+
 static void
 free_gc_repo (GCRepo *gc_repo)
 {
@@ -1094,6 +1224,9 @@ free_gc_repo (GCRepo *gc_repo)
         return;
 
     seaf_repo_unref (gc_repo->repo);
+    if (gc_repo->exist_blocks)
+        g_hash_table_destroy (gc_repo->exist_blocks);
+    pthread_mutex_destroy (&gc_repo->lock);
     g_free (gc_repo);
 }
 
@@ -1108,14 +1241,130 @@ gc_repo_cb (gpointer data, gpointer user_data)
                   repo->version, repo->name, repo->id);
 
     gc_repo->gc_ret = gc_v1_repo (repo, param->dry_run,
-                                  param->online, param->verbose, param->rm_fs);
+                                  param->online, param->verbose, param->rm_fs,
+                                  param->incremental, gc_repo->exist_blocks);
+    gc_repo->exist_blocks = NULL;
+
+    if (param->shared_scan) {
+        pthread_mutex_lock (&param->lock);
+        param->running_repos--;
+        pthread_cond_signal (&param->cond);
+        pthread_mutex_unlock (&param->lock);
+    }
 
     g_async_queue_push (param->async_queue, gc_repo);
 }
 
+typedef struct SharedScanData {
+    GCRepoParam *param;
+    /* store_id -> GCRepo, read-only during the scan. */
+    GHashTable *gc_repos;
+} SharedScanData;
+
+static gboolean
+collect_scanned_block (const char *store_id, int version,
+                       const char *block_id, void *vdata)
+{
+    SharedScanData *data = vdata;
+    GCRepo *gc_repo;
+    int dummy;
+
+    /* Stores of deleted repos are left to delete_garbaged_repos(). */
+    gc_repo = g_hash_table_lookup (data->gc_repos, store_id);
+    if (!gc_repo)
+        return TRUE;
+
+    pthread_mutex_lock (&gc_repo->lock);
+    if (!gc_repo->exist_blocks)
+        gc_repo->exist_blocks = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       g_free, NULL);
+    g_hash_table_replace (gc_repo->exist_blocks, g_strdup (block_id), &dummy);
+    pthread_mutex_unlock (&gc_repo->lock);
+
+    return TRUE;
+}
+
+static void
+start_scanned_repo (const char *store_id, int version, void *vdata)
+{
+    SharedScanData *data = vdata;
+    GCRepoParam *param = data->param;
+    GCRepo *gc_repo;
+    guint n_blocks;
+
+    gc_repo = g_hash_table_lookup (data->gc_repos, store_id);
+    if (!gc_repo)
+        return;
+
+    pthread_mutex_lock (&gc_repo->lock);
+    if (!gc_repo->exist_blocks)
+        gc_repo->exist_blocks = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                       g_free, NULL);
+    n_blocks = g_hash_table_size (gc_repo->exist_blocks);
+    gc_repo->scanned = TRUE;
+    pthread_mutex_unlock (&gc_repo->lock);
+
+    /* Blocks the scanner until GC catches up. */
+    pthread_mutex_lock (&param->lock);
+    while (param->running_repos >= param->max_running_repos)
+        pthread_cond_wait (&param->cond, &param->lock);
+    param->running_repos++;
+    param->scanned_blocks += n_blocks;
+    pthread_mutex_unlock (&param->lock);
+
+    g_thread_pool_push (param->tpool, gc_repo, NULL);
+}
+
+/*
+ * Walk the block store once for all repos instead of one store per repo.
+ * Repos are handed to the GC threads as soon as their stores are scanned.
+ * Repos that the scan didn't reach, e.g. because they have no blocks or
+ * the scan failed, collect their blocks by themselves.
+ */
+static void
+run_shared_scan (GCRepoParam *param, GHashTable *gc_repos, int thread_num)
+{
+    SharedScanData data;
+    GHashTableIter iter;
+    gpointer key, value;
+    GCRepo *gc_repo;
+    gint64 start, elapsed;
+
+    data.param = param;
+    data.gc_repos = gc_repos;
+
+    seaf_message ("Scanning blocks of %u repos with %d threads.\n",
+                  g_hash_table_size (gc_repos), thread_num);
+
+    start = g_get_monotonic_time ();
+    if (seaf_block_manager_scan_all_stores (seaf->block_mgr, thread_num,
+                                            collect_scanned_block,
+                                            start_scanned_repo,
+                                            &data) < 0)
+        seaf_warning ("Failed to scan block store, "
+                      "fall back to scanning repos one by one.\n");
+    elapsed = (g_get_monotonic_time () - start) / 1000000;
+
+    seaf_message ("Scanned %"G_GINT64_FORMAT" blocks in %"G_GINT64_FORMAT" seconds.\n",
+                  param->scanned_blocks, elapsed);
+
+    g_hash_table_iter_init (&iter, gc_repos);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        gc_repo = value;
+        if (gc_repo->scanned)
+            continue;
+        if (gc_repo->exist_blocks) {
+            g_hash_table_destroy (gc_repo->exist_blocks);
+            gc_repo->exist_blocks = NULL;
+        }
+        g_thread_pool_push (param->tpool, gc_repo, NULL);
+    }
+}
+
 int
 gc_core_run (GList *repo_id_list, const char *id_prefix,
-             int dry_run, int verbose, int thread_num, int rm_fs)
+             int dry_run, int verbose, int thread_num, int rm_fs,
+             int incremental, int shared_scan)
 {
     GList *ptr;
     SeafRepo *repo;
@@ -1130,6 +1379,7 @@ gc_core_run (GList *repo_id_list, const char *id_prefix,
     GCRepo *gc_repo = NULL;
     char *repo_id;
     gboolean online;
+    GHashTable *gc_repos = NULL;
 
     if (seaf_db_type (seaf->db) == SEAF_DB_TYPE_SQLITE) {
         online = FALSE;
@@ -1149,17 +1399,28 @@ gc_core_run (GList *repo_id_list, const char *id_prefix,
     param->dry_run = dry_run;
     param->verbose = verbose;
     param->rm_fs = rm_fs;
+    param->incremental = incremental;
     param->online = online;
     param->async_queue = async_queue;
+    param->shared_scan = shared_scan;
+    pthread_mutex_init (&param->lock, NULL);
+    pthread_cond_init (&param->cond, NULL);
 
     tnum = thread_num <= 0 ? MAX_THREADS : thread_num;
+    param->max_running_repos = tnum * 2;
     tpool = g_thread_pool_new (gc_repo_cb, param, tnum, FALSE, NULL);
     if (!tpool) {
         seaf_warning ("Failed to create thread pool, stop gc.\n");
         g_async_queue_unref (async_queue);
+        pthread_mutex_destroy (&param->lock);
+        pthread_cond_destroy (&param->cond);
         g_free (param);
         return -1;
     }
+    param->tpool = tpool;
+
+    if (shared_scan)
+        gc_repos = g_hash_table_new (g_str_hash, g_str_equal);
 
     seaf_message ("Using up to %d threads to run GC.\n", tnum);
 
@@ -1189,9 +1450,11 @@ gc_core_run (GList *repo_id_list, const char *id_prefix,
         }
 
         if (!repo->is_virtual) {
-            gc_repo = g_new0 (GCRepo, 1);
-            gc_repo->repo = repo;
-            g_thread_pool_push (tpool, gc_repo, NULL);
+            gc_repo = gc_repo_new (repo);
+            if (gc_repos)
+                g_hash_table_replace (gc_repos, repo->store_id, gc_repo);
+            else
+                g_thread_pool_push (tpool, gc_repo, NULL);
             gc_repo_num++;
         } else {
             seaf_repo_unref (repo);
@@ -1199,6 +1462,11 @@ gc_core_run (GList *repo_id_list, const char *id_prefix,
     }
     g_list_free (repo_id_list);
 
+    if (gc_repos) {
+        run_shared_scan (param, gc_repos, tnum);
+        g_hash_table_destroy (gc_repos);
+    }
+
     while (gc_repo_num > 0 && (gc_repo = g_async_queue_pop (async_queue))) {
         if (gc_repo->gc_ret < 0) {
             corrupt_repos = g_list_prepend (corrupt_repos, g_strdup(gc_repo->repo->id));
@@ -1239,6 +1507,8 @@ gc_core_run (GList *repo_id_list, const char *id_prefix,
 
     g_thread_pool_free (tpool, TRUE, TRUE);
     g_async_queue_unref (async_queue);
+    pthread_mutex_destroy (&param->lock);
+    pthread_cond_destroy (&param->cond);
     g_free (param);
 
     return 0;
@@ -2,7 +2,8 @@
 #define GC_CORE_H
 
 int gc_core_run (GList *repo_id_list, const char *id_prefix,
-                 int dry_run, int verbose, int thread_num, int rm_fs);
+                 int dry_run, int verbose, int thread_num, int rm_fs,
+                 int incremental, int shared_scan);
 
 void
 delete_garbaged_repos (int dry_run, int thread_num);
@@ -0,0 +1,364 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+
+#include "seafile-session.h"
+#include "gc-live-index.h"
+#include "utils.h"
+
+#define DEBUG_FLAG SEAFILE_DEBUG_OTHER
+#include "log.h"
+
+/*
+ * On-disk format:
+ *
+ * | header | commit ids | fs ids | block ids |
+ *
+ * Each section is a sorted array of 20-byte raw ids without duplicates,
+ * so lookups are binary searches on the mapped file.
+ *
+ * The header also records when the index was built from a full traversal,
+ * and the history truncate time at that point. Objects only reachable from
+ * commits older than a later truncate time stay in the index, so it's
+ * rebuilt once it is GC_LIVE_INDEX_MAX_AGE old and history has been
+ * truncated since it was built.
+ */
+
+#define GC_LIVE_INDEX_MAGIC "SEAFGCLI"
+#define GC_LIVE_INDEX_VERSION 2
+
+#define ID_LEN 20
+
+enum {
+    SECTION_COMMIT = 0,
+    SECTION_FS,
+    SECTION_BLOCK,
+    N_SECTIONS,
+};
+
+typedef struct IndexHeader {
+    char magic[8];
+    guint32 version;
+    guint32 reserved;
+    gint64 built_time;
+    gint64 truncate_time;
+    guint64 n_ids[N_SECTIONS];
+} IndexHeader;
+
+struct _GCLiveIndex {
+    char *path;
+    gint64 built_time;
+    gint64 truncate_time;
+    GMappedFile *mapped;
+    const guint8 *sections[N_SECTIONS];
+    guint64 n_ids[N_SECTIONS];
+
+    /* Ids added in this run, not sorted. */
+    GArray *added[N_SECTIONS];
+};
+
+static char *
+get_index_path (const char *store_id)
+{
+    return g_build_filename (seaf->seaf_dir, "storage", "gc-index", store_id, NULL);
+}
+
+static void
+unmap_index_file (GCLiveIndex *index)
+{
+    g_mapped_file_unref (index->mapped);
+    index->mapped = NULL;
+    memset (index->sections, 0, sizeof(index->sections));
+    memset (index->n_ids, 0, sizeof(index->n_ids));
+}
+
+static gboolean
+map_index_file (GCLiveIndex *index)
+{
+    GError *error = NULL;
+    const IndexHeader *hdr;
+    const guint8 *p;
+    gsize size, expected;
+    int i;
+
+    if (!g_file_test (index->path, G_FILE_TEST_EXISTS))
+        return FALSE;
+
+    index->mapped = g_mapped_file_new (index->path, FALSE, &error);
+    if (!index->mapped) {
+        seaf_warning ("Failed to map GC index %s: %s.\n", index->path, error->message);
+        g_clear_error (&error);
+        return FALSE;
+    }
+
+    size = g_mapped_file_get_length (index->mapped);
+    hdr = (const IndexHeader *)g_mapped_file_get_contents (index->mapped);
+    if (size < sizeof(IndexHeader) ||
+        memcmp (hdr->magic, GC_LIVE_INDEX_MAGIC, 8) != 0 ||
+        hdr->version != GC_LIVE_INDEX_VERSION) {
+        seaf_warning ("Invalid GC index %s, ignore it.\n", index->path);
+        goto error;
+    }
+
+    expected = sizeof(IndexHeader);
+    for (i = 0; i < N_SECTIONS; ++i)
+        expected += hdr->n_ids[i] * ID_LEN;
+    if (expected != size) {
+        seaf_warning ("GC index %s is truncated, ignore it.\n", index->path);
+        goto error;
+    }
+
+    index->built_time = hdr->built_time;
+    index->truncate_time = hdr->truncate_time;
+
+    p = (const guint8 *)(hdr + 1);
+    for (i = 0; i < N_SECTIONS; ++i) {
+        index->sections[i] = p;
+        index->n_ids[i] = hdr->n_ids[i];
+        p += hdr->n_ids[i] * ID_LEN;
+    }
+
+    return TRUE;
+
+error:
+    unmap_index_file (index);
+    return FALSE;
+}
+
+GCLiveIndex *
+gc_live_index_open (const char *store_id, gint64 truncate_time)
+{
+    GCLiveIndex *index = g_new0 (GCLiveIndex, 1);
+    gint64 now = (gint64)time(NULL);
+    int i;
+
+    index->path = get_index_path (store_id);
+    for (i = 0; i < N_SECTIONS; ++i)
+        index->added[i] = g_array_new (FALSE, FALSE, ID_LEN);
+
+    if (map_index_file (index) &&
+        truncate_time > index->truncate_time &&
+        now - index->built_time > GC_LIVE_INDEX_MAX_AGE) {
+        seaf_message ("History of repo %.8s has been truncated since the GC index "
+                      "was built, rebuild it.\n", store_id);
+        unmap_index_file (index);
+    }
+
+    if (!index->mapped) {
+        /* Built by the full traversal in this run. */
+        index->built_time = now;
+        index->truncate_time = truncate_time;
+    } else
+        seaf_message ("Loaded GC index for repo %.8s: %"G_GUINT64_FORMAT" commits, "
+                      "%"G_GUINT64_FORMAT" fs objects, %"G_GUINT64_FORMAT" blocks.\n",
+                      store_id, index->n_ids[SECTION_COMMIT],
+                      index->n_ids[SECTION_FS], index->n_ids[SECTION_BLOCK]);
+
+    return index;
+}
+
+void
+gc_live_index_free (GCLiveIndex *index)
+{
+    int i;
+
+    if (!index)
+        return;
+
+    if (index->mapped)
+        g_mapped_file_unref (index->mapped);
+    for (i = 0; i < N_SECTIONS; ++i)
+        g_array_free (index->added[i], TRUE);
+    g_free (index->path);
+    g_free (index);
+}
+
+static gboolean
+section_has_id (GCLiveIndex *index, int section, const char *hex_id)
+{
+    guint8 id[ID_LEN];
+    const guint8 *base = index->sections[section];
+    guint64 lo = 0, hi = index->n_ids[section], mid;
+    int cmp;
+
+    if (hi == 0 || hex_to_rawdata (hex_id, id, ID_LEN) < 0)
+        return FALSE;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = memcmp (base + mid * ID_LEN, id, ID_LEN);
+        if (cmp == 0)
+            return TRUE;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return FALSE;
+}
+
+static void
+section_add_id (GCLiveIndex *index, int section, const char *hex_id)
+{
+    guint8 id[ID_LEN];
+
+    if (hex_to_rawdata (hex_id, id, ID_LEN) < 0)
+        return;
+    g_array_append_val (index->added[section], id);
+}
+
+gboolean
+gc_live_index_has_commit (GCLiveIndex *index, const char *commit_id)
+{
+    return section_has_id (index, SECTION_COMMIT, commit_id);
+}
+
+gboolean
+gc_live_index_has_fs (GCLiveIndex *index, const char *fs_id)
+{
+    return section_has_id (index, SECTION_FS, fs_id);
+}
+
+gboolean
+gc_live_index_has_block (GCLiveIndex *index, const char *block_id)
+{
+    return section_has_id (index, SECTION_BLOCK, block_id);
+}
+
+void
+gc_live_index_add_commit (GCLiveIndex *index, const char *commit_id)
+{
+    section_add_id (index, SECTION_COMMIT, commit_id);
+}
+
+void
+gc_live_index_add_fs (GCLiveIndex *index, const char *fs_id)
+{
+    section_add_id (index, SECTION_FS, fs_id);
+}
+
+void
+gc_live_index_add_block (GCLiveIndex *index, const char *block_id)
+{
+    section_add_id (index, SECTION_BLOCK, block_id);
+}
+
+static gint
+compare_id (gconstpointer a, gconstpointer b)
+{
+    return memcmp (a, b, ID_LEN);
+}
+
+/* Merge the sorted mapped section with the added ids, dropping duplicates. */
+static int
+write_section (GCLiveIndex *index, int section, FILE *fp, guint64 *n_written)
+{
+    GArray *added = index->added[section];
+    const guint8 *old = index->sections[section];
+    guint64 n_old = index->n_ids[section], i = 0, j = 0;
+    const guint8 *next, *last = NULL;
+
+    g_array_sort (added, compare_id);
+
+    *n_written = 0;
+    while (i < n_old || j < added->len) {
+        if (j >= added->len ||
+            (i < n_old && memcmp (old + i * ID_LEN,
+                                  added->data + j * ID_LEN, ID_LEN) <= 0))
+            next = old + (i++) * ID_LEN;
+        else
+            next = (const guint8 *)added->data + (j++) * ID_LEN;
+
+        if (last && memcmp (last, next, ID_LEN) == 0)
+            continue;
+
+        if (fwrite (next, ID_LEN, 1, fp) != 1)
+            return -1;
+        last = next;
+        ++(*n_written);
+    }
+
+    return 0;
+}
+
+int
+gc_live_index_save (GCLiveIndex *index)
+{
+    IndexHeader hdr;
+    char *tmp_path = NULL, *dir = NULL;
+    FILE *fp = NULL;
+    int i, ret = 0;
+
+    dir = g_path_get_dirname (index->path);
+    if (g_mkdir_with_parents (dir, 0777) < 0) {
+        seaf_warning ("Failed to create dir %s: %s.\n", dir, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    tmp_path = g_strconcat (index->path, ".tmp", NULL);
+    fp = g_fopen (tmp_path, "wb");
+    if (!fp) {
+        seaf_warning ("Failed to open %s: %s.\n", tmp_path, strerror(errno));
+        ret = -1;
+        goto out;
+    }
+
+    /* Write a placeholder header, the counts are known after merging. */
+    memset (&hdr, 0, sizeof(hdr));
+    memcpy (hdr.magic, GC_LIVE_INDEX_MAGIC, 8);
+    hdr.version = GC_LIVE_INDEX_VERSION;
+    hdr.built_time = index->built_time;
+    hdr.truncate_time = index->truncate_time;
+    if (fwrite (&hdr, sizeof(hdr), 1, fp) != 1)
+        goto write_error;
+
+    for (i = 0; i < N_SECTIONS; ++i) {
+        if (write_section (index, i, fp, &hdr.n_ids[i]) < 0)
+            goto write_error;
+    }
+
+    if (fseek (fp, 0, SEEK_SET) < 0 ||
+        fwrite (&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fflush (fp) != 0 ||
+        fsync (fileno (fp)) < 0)
+        goto write_error;
+
+    fclose (fp);
+    fp = NULL;
+
+    if (g_rename (tmp_path, index->path) < 0) {
+        seaf_warning ("Failed to rename %s: %s.\n", tmp_path, strerror(errno));
+        g_unlink (tmp_path);
+        ret = -1;
+    }
+    goto out;
+
+write_error:
+    seaf_warning ("Failed to write GC index %s: %s.\n", tmp_path, strerror(errno));
+    fclose (fp);
+    fp = NULL;
+    g_unlink (tmp_path);
+    ret = -1;
+
+out:
+    g_free (dir);
+    g_free (tmp_path);
+    return ret;
+}
+
+int
+gc_live_index_remove (const char *store_id)
+{
+    char *path = get_index_path (store_id);
+    int ret = 0;
+
+    if (g_file_test (path, G_FILE_TEST_EXISTS) && g_unlink (path) < 0) {
+        seaf_warning ("Failed to remove GC index %s: %s.\n", path, strerror(errno));
+        ret = -1;
+    }
+
+    g_free (path);
+    return ret;
+}
@@ -0,0 +1,64 @@
+#ifndef GC_LIVE_INDEX_H
+#define GC_LIVE_INDEX_H
+
+#include <glib.h>
+
+/*
+ * Persistent index of live objects for incremental GC.
+ *
+ * For each block store, the index records the commits that have been
+ * traversed, and the fs objects and blocks reachable from them. The
+ * next incremental GC run only traverses commits that are not in the
+ * index, and stops descending into fs objects that are already in it.
+ *
+ * The index only grows. Objects that become unreachable after history
+ * is truncated stay in it, so they are not removed by incremental GC
+ * until the index is rebuilt. That happens when the index is older than
+ * GC_LIVE_INDEX_MAX_AGE and history has been truncated since it was
+ * built. A full GC run drops the index too.
+ *
+ * Only the traversal is incremental. The block store is still listed in
+ * full to find the blocks to remove.
+ */
+
+#define GC_LIVE_INDEX_MAX_AGE (7 * 24 * 3600) /* 7 days */
+
+typedef struct _GCLiveIndex GCLiveIndex;
+
+/* Map the index of @store_id, or create an empty one if it doesn't exist,
+ * is invalid, or has to be rebuilt. @truncate_time is the current history
+ * truncate time of the repo.
+ */
+GCLiveIndex *
+gc_live_index_open (const char *store_id, gint64 truncate_time);
+
+void
+gc_live_index_free (GCLiveIndex *index);
+
+/* Lookups only check the mapped index, not the ids added in this run. */
+gboolean
+gc_live_index_has_commit (GCLiveIndex *index, const char *commit_id);
+
+gboolean
+gc_live_index_has_fs (GCLiveIndex *index, const char *fs_id);
+
+gboolean
+gc_live_index_has_block (GCLiveIndex *index, const char *block_id);
+
+void
+gc_live_index_add_commit (GCLiveIndex *index, const char *commit_id);
+
+void
+gc_live_index_add_fs (GCLiveIndex *index, const char *fs_id);
+
+void
+gc_live_index_add_block (GCLiveIndex *index, const char *block_id);
+
+/* Merge the added ids into the mapped index and write it to disk. */
+int
+gc_live_index_save (GCLiveIndex *index);
+
+int
+gc_live_index_remove (const char *store_id);
+
+#endif
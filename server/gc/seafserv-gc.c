@@ -16,7 +16,7 @@ static char *central_config_dir = NULL;
 
 SeafileSession *seaf;
 
-static const char *short_opts = "hvc:d:VDrRF:Ct:i:";
+static const char *short_opts = "hvc:d:VDrRF:Ct:i:IS";
 static const struct option long_opts[] = {
     { "help", no_argument, NULL, 'h', },
     { "version", no_argument, NULL, 'v', },
@@ -30,6 +30,8 @@ static const struct option long_opts[] = {
     { "check", no_argument, NULL, 'C' },
     { "thread-num", required_argument, NULL, 't', },
     { "id-prefix", required_argument, NULL, 'i', },
+    { "incremental", no_argument, NULL, 'I' },
+    { "shared-scan", no_argument, NULL, 'S' },
     { 0, 0, 0, 0 },
 };
 
@@ -44,7 +46,12 @@ static void usage ()
              "-D, --dry-run: report blocks that can be remove, but not remove them\n"
              "-V, --verbose: verbose output messages\n"
              "-C, --check: check data integrity\n"
-             "-t, --thread-num: thread number for gc repos\n");
+             "-t, --thread-num: thread number for gc repos\n"
+             "-I, --incremental: only scan history added since the last incremental gc.\n"
+             "    The block store is still listed in full. The index of scanned history\n"
+             "    is rebuilt when it's older than 7 days and history has been truncated\n"
+             "    since. Repos that keep no history always get a full gc.\n"
+             "-S, --shared-scan: walk the block store once for all repos\n");
 }
 
 #ifdef WIN32
@@ -85,6 +92,8 @@ main(int argc, char *argv[])
     int rm_fs = 0;
     int check_integrity = 0;
     int thread_num = 1;
+    int incremental = 0;
+    int shared_scan = 0;
     const char *debug_str = NULL;
     char *id_prefix = NULL;
 
@@ -133,6 +142,12 @@ main(int argc, char *argv[])
         case 'i':
             id_prefix = g_strdup(optarg);
             break;
+        case 'I':
+            incremental = 1;
+            break;
+        case 'S':
+            shared_scan = 1;
+            break;
         default:
             usage();
             exit(-1);
@@ -175,7 +190,8 @@ main(int argc, char *argv[])
         return verify_repos (repo_id_list);
     }
 
-    gc_core_run (repo_id_list, id_prefix, dry_run, verbose, thread_num, rm_fs);
+    gc_core_run (repo_id_list, id_prefix, dry_run, verbose, thread_num, rm_fs,
+                 incremental, shared_scan);
 
     g_free (id_prefix);
 
@@ -0,0 +1,195 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Measure the rate of cache lookups done by the http server for sync
+ * requests, with many threads. Every request looks up a token and a
+ * permission, as validate_token() and check_permission() do. The sharded
+ * caches are compared with a single locked hash table, which the http
+ * server used before.
+ *
+ * Usage: http-cache-bench [threads] [requests_per_thread] [users]
+ */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "http-cache.h"
+
+#define DEFAULT_REQUESTS 1000000
+#define DEFAULT_USERS 10000
+#define REPOS_PER_USER 10
+#define CACHE_TTL 7200
+
+typedef struct BenchData {
+    int n_requests;
+    int n_users;
+    int seed;
+} BenchData;
+
+/* The locked hash tables used before. */
+static GHashTable *locked_tokens;
+static GHashTable *locked_perms;
+static pthread_mutex_t token_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t perm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static HttpCache *token_cache;
+static HttpCache *perm_cache;
+
+static void
+format_request (int user, int repo, char *token, char *repo_id, char *email)
+{
+    snprintf (token, 41, "%08x%08x000000000000000000000000", user, repo);
+    snprintf (repo_id, 37, "%08x-0000-0000-0000-%012x", repo, user);
+    snprintf (email, 64, "%08x0000000000000000000000000000000@auth.local", user);
+}
+
+static void
+fill_caches (int n_users)
+{
+    char token[41], repo_id[37], email[64], value[128];
+    int user, repo;
+
+    locked_tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    locked_perms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    token_cache = http_cache_new (CACHE_TTL);
+    perm_cache = http_cache_new (CACHE_TTL);
+
+    for (user = 0; user < n_users; user++) {
+        for (repo = 0; repo < REPOS_PER_USER; repo++) {
+            format_request (user, repo, token, repo_id, email);
+            snprintf (value, sizeof(value), "%s:%s", repo_id, email);
+
+            g_hash_table_insert (locked_tokens, g_strdup (token), g_strdup (value));
+            g_hash_table_insert (locked_perms,
+                                 g_strdup_printf ("%s:%s:%s", repo_id, email, "download"),
+                                 g_new0 (gint64, 1));
+
+            http_cache_insert (token_cache, token, value, 0);
+            snprintf (value, sizeof(value), "%s:%s:%s", repo_id, email, "download");
+            http_cache_insert (perm_cache, value, NULL, 0);
+        }
+    }
+}
+
+static void *
+run_locked (void *arg)
+{
+    BenchData *data = arg;
+    char token[41], repo_id[37], email[64];
+    unsigned int seed = data->seed;
+    char *value, *key, *username;
+    gint64 *perm;
+    int i, hits = 0;
+
+    for (i = 0; i < data->n_requests; i++) {
+        format_request (rand_r (&seed) % data->n_users, rand_r (&seed) % REPOS_PER_USER,
+                        token, repo_id, email);
+
+        pthread_mutex_lock (&token_lock);
+        value = g_hash_table_lookup (locked_tokens, token);
+        username = value ? g_strdup (strchr (value, ':') + 1) : NULL;
+        pthread_mutex_unlock (&token_lock);
+
+        key = g_strdup_printf ("%s:%s:%s", repo_id, email, "download");
+        pthread_mutex_lock (&perm_lock);
+        perm = g_hash_table_lookup (locked_perms, key);
+        if (perm) {
+            /* The old cache copied the cached entry. */
+            gint64 *copy = g_new0 (gint64, 1);
+            *copy = *perm;
+            g_free (copy);
+            ++hits;
+        }
+        pthread_mutex_unlock (&perm_lock);
+        g_free (key);
+        g_free (username);
+    }
+
+    return GINT_TO_POINTER (hits);
+}
+
+static void *
+run_sharded (void *arg)
+{
+    BenchData *data = arg;
+    char token[41], repo_id[37], email[64], value[512];
+    char key[256];
+    unsigned int seed = data->seed;
+    char *username;
+    gint64 version;
+    int i, hits = 0;
+
+    for (i = 0; i < data->n_requests; i++) {
+        format_request (rand_r (&seed) % data->n_users, rand_r (&seed) % REPOS_PER_USER,
+                        token, repo_id, email);
+
+        username = NULL;
+        if (http_cache_lookup (token_cache, token, value, sizeof(value), NULL))
+            username = g_strdup (strchr (value, ':') + 1);
+
+        snprintf (key, sizeof(key), "%s:%s:%s", repo_id, email, "download");
+        if (http_cache_lookup (perm_cache, key, NULL, 0, &version))
+            ++hits;
+        g_free (username);
+    }
+
+    return GINT_TO_POINTER (hits);
+}
+
+static void
+run_bench (const char *label, void *(*func) (void *), int n_threads,
+           int n_requests, int n_users)
+{
+    pthread_t *threads = g_new0 (pthread_t, n_threads);
+    BenchData *data = g_new0 (BenchData, n_threads);
+    gint64 start, usec;
+    int i, hits = 0;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n_threads; i++) {
+        data[i].n_requests = n_requests;
+        data[i].n_users = n_users;
+        data[i].seed = i + 1;
+        pthread_create (&threads[i], NULL, func, &data[i]);
+    }
+    for (i = 0; i < n_threads; i++) {
+        void *ret;
+        pthread_join (threads[i], &ret);
+        hits += GPOINTER_TO_INT (ret);
+    }
+    usec = g_get_monotonic_time () - start;
+
+    printf ("%-8s %d threads, %d requests, %d hits, %.0f requests/s\n",
+            label, n_threads, n_threads * n_requests, hits,
+            usec > 0 ? (double)n_threads * n_requests * 1000000 / usec : 0);
+
+    g_free (threads);
+    g_free (data);
+}
+
+int
+main (int argc, char **argv)
+{
+    int n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    int n_requests = DEFAULT_REQUESTS;
+    int n_users = DEFAULT_USERS;
+
+    if (argc > 1)
+        n_threads = atoi (argv[1]);
+    if (argc > 2)
+        n_requests = atoi (argv[2]);
+    if (argc > 3)
+        n_users = atoi (argv[3]);
+    if (n_threads <= 0 || n_requests <= 0 || n_users <= 0) {
+        fprintf (stderr, "Usage: %s [threads] [requests_per_thread] [users]\n", argv[0]);
+        return 1;
+    }
+
+    fill_caches (n_users);
+
+    run_bench ("locked", run_locked, n_threads, n_requests, n_users);
+    run_bench ("sharded", run_sharded, n_threads, n_requests, n_users);
+
+    return 0;
+}
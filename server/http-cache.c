@@ -0,0 +1,224 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "http-cache.h"
+
+#define N_SHARDS_BITS 6
+#define N_SHARDS (1 << N_SHARDS_BITS)
+#define WHEEL_SLOTS 256
+
+typedef struct CacheEntry {
+    /* Links in the bucket of the timer wheel. */
+    struct CacheEntry *prev;
+    struct CacheEntry *next;
+
+    gint64 expire;
+    gint64 aux;
+    char *key;                  /* points after the value */
+    char value[];
+} CacheEntry;
+
+typedef struct CacheShard {
+    pthread_rwlock_t lock;
+    GHashTable *entries;        /* key -> CacheEntry, the key belongs to the entry */
+    /* Entries by expire time, a slot covers one tick. */
+    CacheEntry *wheel[WHEEL_SLOTS];
+    gint64 last_tick;           /* the last tick expired */
+} CacheShard;
+
+struct HttpCache {
+    int ttl;
+    int tick;                   /* seconds */
+    CacheShard shards[N_SHARDS];
+};
+
+HttpCache *
+http_cache_new (int ttl)
+{
+    HttpCache *cache = g_new0 (HttpCache, 1);
+    gint64 now = (gint64)time(NULL);
+    int i;
+
+    cache->ttl = ttl;
+    /* The wheel spans more than the ttl, so that a slot only holds entries
+     * expiring in the same tick.
+     */
+    cache->tick = ttl / WHEEL_SLOTS + 1;
+
+    for (i = 0; i < N_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        pthread_rwlock_init (&shard->lock, NULL);
+        shard->entries = g_hash_table_new (g_str_hash, g_str_equal);
+        shard->last_tick = now / cache->tick;
+    }
+
+    return cache;
+}
+
+static CacheShard *
+get_shard (HttpCache *cache, const char *key)
+{
+    /* Take the high bits of the mixed hash, as the hash tables of the
+     * shards use the low bits.
+     */
+    guint32 hash = g_str_hash (key) * 2654435761U;
+
+    return &cache->shards[hash >> (32 - N_SHARDS_BITS)];
+}
+
+static CacheEntry **
+wheel_slot (CacheShard *shard, gint64 tick)
+{
+    return &shard->wheel[tick % WHEEL_SLOTS];
+}
+
+static void
+wheel_add (HttpCache *cache, CacheShard *shard, CacheEntry *entry)
+{
+    CacheEntry **slot = wheel_slot (shard, entry->expire / cache->tick);
+
+    entry->prev = NULL;
+    entry->next = *slot;
+    if (*slot)
+        (*slot)->prev = entry;
+    *slot = entry;
+}
+
+static void
+remove_entry (HttpCache *cache, CacheShard *shard, CacheEntry *entry)
+{
+    g_hash_table_remove (shard->entries, entry->key);
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        *wheel_slot (shard, entry->expire / cache->tick) = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+
+    g_free (entry);
+}
+
+gboolean
+http_cache_lookup (HttpCache *cache, const char *key,
+                   char *value, int size, gint64 *aux)
+{
+    CacheShard *shard;
+    CacheEntry *entry;
+    gboolean found = FALSE;
+
+    shard = get_shard (cache, key);
+
+    pthread_rwlock_rdlock (&shard->lock);
+    entry = g_hash_table_lookup (shard->entries, key);
+    if (entry && entry->expire > (gint64)time(NULL) &&
+        (!value || g_strlcpy (value, entry->value, size) < (gsize)size)) {
+        if (aux)
+            *aux = entry->aux;
+        found = TRUE;
+    }
+    pthread_rwlock_unlock (&shard->lock);
+
+    return found;
+}
+
+void
+http_cache_insert (HttpCache *cache, const char *key,
+                   const char *value, gint64 aux)
+{
+    CacheShard *shard;
+    CacheEntry *entry, *old;
+    size_t key_len = strlen (key);
+    size_t value_len;
+
+    if (!value)
+        value = "";
+    value_len = strlen (value);
+
+    /* The value and the key are stored after the entry. */
+    entry = g_malloc (sizeof(CacheEntry) + value_len + 1 + key_len + 1);
+    memcpy (entry->value, value, value_len + 1);
+    entry->key = entry->value + value_len + 1;
+    memcpy (entry->key, key, key_len + 1);
+    entry->aux = aux;
+    entry->expire = (gint64)time(NULL) + cache->ttl;
+
+    shard = get_shard (cache, key);
+
+    pthread_rwlock_wrlock (&shard->lock);
+    old = g_hash_table_lookup (shard->entries, key);
+    if (old)
+        remove_entry (cache, shard, old);
+    g_hash_table_insert (shard->entries, entry->key, entry);
+    wheel_add (cache, shard, entry);
+    pthread_rwlock_unlock (&shard->lock);
+}
+
+void
+http_cache_remove (HttpCache *cache, const char *key)
+{
+    CacheShard *shard;
+    CacheEntry *entry;
+
+    shard = get_shard (cache, key);
+
+    pthread_rwlock_wrlock (&shard->lock);
+    entry = g_hash_table_lookup (shard->entries, key);
+    if (entry)
+        remove_entry (cache, shard, entry);
+    pthread_rwlock_unlock (&shard->lock);
+}
+
+void
+http_cache_expire (HttpCache *cache)
+{
+    gint64 now = (gint64)time(NULL);
+    gint64 now_tick = now / cache->tick;
+    gint64 tick;
+    CacheEntry *entry, *next;
+    int i;
+
+    for (i = 0; i < N_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        pthread_rwlock_wrlock (&shard->lock);
+
+        /* Visit every slot at most once. The slot of the current tick is
+         * visited again next time, as some of its entries haven't expired.
+         */
+        tick = shard->last_tick;
+        if (now_tick - tick >= WHEEL_SLOTS)
+            tick = now_tick - WHEEL_SLOTS + 1;
+        for (; tick <= now_tick; tick++) {
+            for (entry = *wheel_slot (shard, tick); entry; entry = next) {
+                next = entry->next;
+                if (entry->expire <= now)
+                    remove_entry (cache, shard, entry);
+            }
+        }
+        shard->last_tick = now_tick;
+
+        pthread_rwlock_unlock (&shard->lock);
+    }
+}
+
+guint
+http_cache_size (HttpCache *cache)
+{
+    guint size = 0;
+    int i;
+
+    for (i = 0; i < N_SHARDS; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        pthread_rwlock_rdlock (&shard->lock);
+        size += g_hash_table_size (shard->entries);
+        pthread_rwlock_unlock (&shard->lock);
+    }
+
+    return size;
+}
@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <glib.h>
+
+/*
+ * Caches of the http server, such as the token and permission caches.
+ *
+ * Every sync request looks up these caches, so they are split into shards
+ * with their own read-write locks, and lookups don't allocate memory. Entries
+ * expire after the ttl given at creation. Expired entries are put in the
+ * buckets of a timer wheel, so that removing them only visits the buckets
+ * that became due.
+ */
+
+typedef struct HttpCache HttpCache;
+
+HttpCache *
+http_cache_new (int ttl);
+
+/*
+ * Look up @key. On a hit, the value is copied to @value, which has room for
+ * @size bytes, and @aux is set if not NULL. Returns FALSE if @key isn't
+ * cached, has expired, or its value doesn't fit in @value.
+ */
+gboolean
+http_cache_lookup (HttpCache *cache, const char *key,
+                   char *value, int size, gint64 *aux);
+
+/* Add or replace @key. */
+void
+http_cache_insert (HttpCache *cache, const char *key,
+                   const char *value, gint64 aux);
+
+void
+http_cache_remove (HttpCache *cache, const char *key);
+
+/* Remove entries that expired since the last call. */
+void
+http_cache_expire (HttpCache *cache);
+
+guint
+http_cache_size (HttpCache *cache);
+
+#endif
@@ -9,6 +9,8 @@
 
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #include <event2/event.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_struct.h>
 #else
 #include <event.h>
 #endif
@@ -28,6 +30,8 @@
 #include "seaf-utils.h"
 
 #include "access-file.h"
+#include "block-prefetch.h"
+#include "http-cache.h"
 #include "upload-file.h"
 #include "fileserver-config.h"
 
@@ -41,6 +45,9 @@
 #define DEFAULT_MAX_INDEX_PROCESSING_THREADS 3
 #define DEFAULT_FIXED_BLOCK_SIZE ((gint64)1 << 23) /* 8MB */
 #define DEFAULT_CLUSTER_SHARED_TEMP_FILE_MODE 0600
+#define DEFAULT_READ_AHEAD_BLOCKS 2
+#define DEFAULT_READ_AHEAD_THREADS 4
+#define DEFAULT_READ_AHEAD_MEMORY (256 * ((gint64)1 << 20)) /* 256MB */
 
 #define HOST "host"
 #define PORT "port"
@@ -67,11 +74,9 @@ struct _HttpServer {
     event_t *reap_timer;
     pthread_t thread_id;
 
-    GHashTable *token_cache;
-    pthread_mutex_t token_cache_lock; /* token -> username */
+    HttpCache *token_cache; /* token -> repo_id:username */
 
-    GHashTable *perm_cache;
-    pthread_mutex_t perm_cache_lock; /* repo_id:username -> permission */
+    HttpCache *perm_cache; /* repo_id:username:op -> permission version */
 
     GHashTable *vir_repo_info_cache;
     pthread_mutex_t vir_repo_info_cache_lock;
@@ -92,19 +97,14 @@ struct _StatsEventData {
 };
 typedef struct _StatsEventData StatsEventData;
 
-typedef struct TokenInfo {
-    char *repo_id;
-    char *email;
-    gint64 expire_time;
-} TokenInfo;
+/* Big enough for a repo id and an email. */
+#define TOKEN_CACHE_VALUE_LEN 512
 
-// PermInfo caches the results from the last permission check for accessing a repo.
-// They're cached in a hash table having "repo_Id:username:op" as key.
+// The perm cache caches the results from the last permission check for accessing a repo.
+// They're cached with "repo_id:username:op" as key.
 // The cached result is updated on the next call to get_check_permission_cb function, or when the cache expires.
 // The result is only cached if the permission check passed.
-typedef struct PermInfo {
-    gint64 expire_time;
-} PermInfo;
+// It's ignored when the permission version of the repo manager changes.
 
 typedef struct VirRepoInfo {
     char *store_id;
@@ -153,6 +153,10 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
     char *encoding;
     char *cluster_shared_temp_file_mode = NULL;
     gboolean verify_client_blocks;
+    gboolean zero_copy_download;
+    int read_ahead_blocks;
+    int read_ahead_threads;
+    int read_ahead_memory;
 
     host = fileserver_config_get_string (session->config, HOST, &error);
     if (!error) {
@@ -207,6 +211,59 @@ load_http_config (HttpServerStruct *htp_server, SeafileSession *session)
     seaf_message ("fileserver: verify_client_blocks = %d\n",
                   htp_server->verify_client_blocks);
 
+    zero_copy_download = fileserver_config_get_boolean (session->config,
+                                                        "zero_copy_download",
+                                                        &error);
+    if (error) {
+        htp_server->zero_copy_download = FALSE;
+        g_clear_error(&error);
+    } else {
+        htp_server->zero_copy_download = zero_copy_download;
+    }
+    seaf_message ("fileserver: zero_copy_download = %d\n",
+                  htp_server->zero_copy_download);
+
+    read_ahead_blocks = fileserver_config_get_integer (session->config,
+                                                       "download_read_ahead_blocks",
+                                                       &error);
+    if (error) {
+        htp_server->read_ahead_blocks = DEFAULT_READ_AHEAD_BLOCKS;
+        g_clear_error (&error);
+    } else {
+        if (read_ahead_blocks < 0)
+            htp_server->read_ahead_blocks = DEFAULT_READ_AHEAD_BLOCKS;
+        else
+            htp_server->read_ahead_blocks = read_ahead_blocks;
+    }
+    seaf_message ("fileserver: download_read_ahead_blocks = %d\n",
+                  htp_server->read_ahead_blocks);
+
+    read_ahead_threads = fileserver_config_get_integer (session->config,
+                                                        "download_read_ahead_threads",
+                                                        &error);
+    if (error) {
+        htp_server->read_ahead_threads = DEFAULT_READ_AHEAD_THREADS;
+        g_clear_error (&error);
+    } else {
+        if (read_ahead_threads <= 0)
+            htp_server->read_ahead_threads = DEFAULT_READ_AHEAD_THREADS;
+        else
+            htp_server->read_ahead_threads = read_ahead_threads;
+    }
+
+    read_ahead_memory = fileserver_config_get_integer (session->config,
+                                                       "download_read_ahead_memory",
+                                                       &error);
+    if (error) {
+        htp_server->read_ahead_memory = DEFAULT_READ_AHEAD_MEMORY;
+        g_clear_error (&error);
+    } else {
+        if (read_ahead_memory <= 0)
+            htp_server->read_ahead_memory = DEFAULT_READ_AHEAD_MEMORY;
+        else
+            htp_server->read_ahead_memory = read_ahead_memory * ((gint64)1 << 20);
+    }
+
     cluster_shared_temp_file_mode = fileserver_config_get_string (session->config,
                                                                   "cluster_shared_temp_file_mode",
                                                                   &error);
@@ -247,7 +304,8 @@ validate_token (HttpServer *htp_server, evhtp_request_t *req,
                 gboolean skip_cache)
 {
     char *email = NULL;
-    TokenInfo *token_info;
+    char cached[TOKEN_CACHE_VALUE_LEN];
+    char *sep, *value;
     char *tmp_token = NULL;
 
     const char *token = evhtp_kv_find (req->headers_in, "Seafile-Repo-Token");
@@ -261,69 +319,86 @@ validate_token (HttpServer *htp_server, evhtp_request_t *req,
         token = tmp_token;
     }
 
-    if (!skip_cache) {
-        pthread_mutex_lock (&htp_server->token_cache_lock);
-
-        token_info = g_hash_table_lookup (htp_server->token_cache, token);
-        if (token_info) {
-            if (strcmp (token_info->repo_id, repo_id) != 0) {
-                pthread_mutex_unlock (&htp_server->token_cache_lock);
-                g_free (tmp_token);
-                return EVHTP_RES_FORBIDDEN;
-            }
-
-            if (username)
-                *username = g_strdup(token_info->email);
-            pthread_mutex_unlock (&htp_server->token_cache_lock);
+    /* The cached value is "repo_id:email". Repo ids don't contain ':'.
+     * A value without ':' is treated as a miss.
+     */
+    if (!skip_cache &&
+        http_cache_lookup (htp_server->token_cache, token,
+                           cached, sizeof(cached), NULL) &&
+        (sep = strchr (cached, ':')) != NULL) {
+        *sep = '\0';
+        if (strcmp (cached, repo_id) != 0) {
             g_free (tmp_token);
-            return EVHTP_RES_OK;
+            return EVHTP_RES_FORBIDDEN;
         }
 
-        pthread_mutex_unlock (&htp_server->token_cache_lock);
+        if (username)
+            *username = g_strdup(sep + 1);
+        g_free (tmp_token);
+        return EVHTP_RES_OK;
     }
 
     email = seaf_repo_manager_get_email_by_token (seaf->repo_mgr,
                                                   repo_id, token);
     if (email == NULL) {
-        pthread_mutex_lock (&htp_server->token_cache_lock);
-        g_hash_table_remove (htp_server->token_cache, token);
-        pthread_mutex_unlock (&htp_server->token_cache_lock);
+        http_cache_remove (htp_server->token_cache, token);
         g_free (tmp_token);
         return EVHTP_RES_FORBIDDEN;
     }
 
-    token_info = g_new0 (TokenInfo, 1);
-    token_info->repo_id = g_strdup (repo_id);
-    token_info->expire_time = (gint64)time(NULL) + TOKEN_EXPIRE_TIME;
-    token_info->email = email;
-
-    pthread_mutex_lock (&htp_server->token_cache_lock);
-    g_hash_table_insert (htp_server->token_cache, g_strdup (token), token_info);
-    pthread_mutex_unlock (&htp_server->token_cache_lock);
+    value = g_strconcat (repo_id, ":", email, NULL);
+    http_cache_insert (htp_server->token_cache, token, value, 0);
+    g_free (value);
 
     if (username)
-        *username = g_strdup(email);
+        *username = email;
+    else
+        g_free (email);
     g_free (tmp_token);
     return EVHTP_RES_OK;
 }
 
-static PermInfo *
-lookup_perm_cache (HttpServer *htp_server, const char *repo_id, const char *username, const char *op)
+#define PERM_CACHE_KEY_BUF_LEN 256
+
+/*
+ * Formats the key in @buf if it fits, so that most lookups don't allocate
+ * memory. Otherwise returns a newly allocated key, which should be freed
+ * with free_perm_cache_key().
+ */
+static char *
+format_perm_cache_key (char *buf, const char *repo_id, const char *username,
+                       const char *op)
 {
-    PermInfo *ret = NULL;
-    PermInfo *perm = NULL;
-    char *key = g_strdup_printf ("%s:%s:%s", repo_id, username, op);
+    int n = snprintf (buf, PERM_CACHE_KEY_BUF_LEN, "%s:%s:%s",
+                      repo_id, username, op);
 
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    ret = g_hash_table_lookup (htp_server->perm_cache, key);
-    if (ret) {
-        perm = g_new0 (PermInfo, 1);
-        perm->expire_time = ret->expire_time;
-    }
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
-    g_free (key);
+    if (n >= 0 && n < PERM_CACHE_KEY_BUF_LEN)
+        return buf;
+    return g_strdup_printf ("%s:%s:%s", repo_id, username, op);
+}
+
+static void
+free_perm_cache_key (char *key, char *buf)
+{
+    if (key != buf)
+        g_free (key);
+}
 
-    return perm;
+static gboolean
+lookup_perm_cache (HttpServer *htp_server, const char *repo_id, const char *username,
+                   const char *op, gint64 version)
+{
+    char buf[PERM_CACHE_KEY_BUF_LEN];
+    char *key;
+    gint64 cached_version;
+    gboolean ret;
+
+    key = format_perm_cache_key (buf, repo_id, username, op);
+    ret = http_cache_lookup (htp_server->perm_cache, key, NULL, 0, &cached_version) &&
+        cached_version == version;
+    free_perm_cache_key (key, buf);
+
+    return ret;
 }
 
 static char *
@@ -345,13 +420,14 @@ static void
 insert_perm_cache (HttpServer *htp_server,
                    const char *repo_id, const char *username,
                    const char *op,
-                   PermInfo *perm)
+                   gint64 version)
 {
-    char *key = g_strdup_printf ("%s:%s:%s", repo_id, username, op);
+    char buf[PERM_CACHE_KEY_BUF_LEN];
+    char *key;
 
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    g_hash_table_insert (htp_server->perm_cache, key, perm);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
+    key = format_perm_cache_key (buf, repo_id, username, op);
+    http_cache_insert (htp_server->perm_cache, key, NULL, version);
+    free_perm_cache_key (key, buf);
 }
 
 static void
@@ -359,30 +435,22 @@ remove_perm_cache (HttpServer *htp_server,
                    const char *repo_id, const char *username,
                    const char *op)
 {
-    char *key = g_strdup_printf ("%s:%s:%s", repo_id, username, op);
+    char buf[PERM_CACHE_KEY_BUF_LEN];
+    char *key;
 
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    g_hash_table_remove (htp_server->perm_cache, key);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
-
-    g_free (key);
+    key = format_perm_cache_key (buf, repo_id, username, op);
+    http_cache_remove (htp_server->perm_cache, key);
+    free_perm_cache_key (key, buf);
 }
 
-static void perm_cache_value_free (gpointer data);
-
 static int
 check_permission (HttpServer *htp_server, const char *repo_id, const char *username,
                   const char *op, gboolean skip_cache)
 {
-    PermInfo *perm_info = NULL;
-
-    if (!skip_cache)
-        perm_info = lookup_perm_cache (htp_server, repo_id, username, op);
+    gint64 version = seaf_repo_manager_get_perm_version (seaf->repo_mgr);
 
-    if (perm_info) {
-        perm_cache_value_free (perm_info);
+    if (!skip_cache && lookup_perm_cache (htp_server, repo_id, username, op, version))
         return EVHTP_RES_OK;
-    }
 
     remove_perm_cache (htp_server, repo_id, username, op);
 
@@ -401,10 +469,7 @@ check_permission (HttpServer *htp_server, const char *repo_id, const char *usern
         }
 
         g_free (perm);
-        perm_info = g_new0 (PermInfo, 1);
-        /* Take the reference of perm. */
-        perm_info->expire_time = (gint64)time(NULL) + PERM_EXPIRE_TIME;
-        insert_perm_cache (htp_server, repo_id, username, op, perm_info);
+        insert_perm_cache (htp_server, repo_id, username, op, version);
         return EVHTP_RES_OK;
     }
 
@@ -1367,6 +1432,7 @@ put_update_branch_cb (evhtp_request_t *req, void *arg)
     seaf_repo_manager_merge_virtual_repo (seaf->repo_mgr, repo_id, NULL);
 
     schedule_repo_size_computation (seaf->size_sched, repo_id);
+    seaf_file_history_manager_schedule_update (seaf->file_history_mgr, repo_id);
 
     evhtp_send_reply (req, EVHTP_RES_OK);
 
@@ -1650,16 +1716,293 @@ commit_oper_cb (evhtp_request_t *req, void *arg)
     }
 }
 
+/* Fs id lists are encoded as a JSON array while the diff runs, instead of
+ * being collected in a list of strings and converted at the end. When the
+ * encoded list grows past FS_ID_LIST_MEM_LIMIT, it's moved to a temp file,
+ * and the reply is sent from the file chunk by chunk.
+ */
+#define FS_ID_LIST_MEM_LIMIT (1 << 22) /* 4MB */
+#define FS_ID_LIST_CHUNK_SIZE (1 << 16) /* 64KB */
+
+typedef struct FsIdList {
+    struct evbuffer *buf;
+    int count;
+
+    /* The temp file the list is spilled to, -1 if it's all in memory. */
+    int fd;
+    gint64 file_size;
+
+    /* Size of buf last reported to the metric manager. */
+    gint64 mem_size;
+} FsIdList;
+
+static FsIdList *
+fs_id_list_new ()
+{
+    FsIdList *list = g_new0 (FsIdList, 1);
+
+    list->buf = evbuffer_new ();
+    list->fd = -1;
+    evbuffer_add (list->buf, "[", 1);
+
+    seaf_metric_manager_fs_id_list_request_inc (seaf->metric_mgr);
+
+    return list;
+}
+
+static void
+fs_id_list_free (FsIdList *list)
+{
+    if (!list)
+        return;
+
+    seaf_metric_manager_fs_id_list_add_mem_bytes (seaf->metric_mgr,
+                                                  -list->mem_size);
+    evbuffer_free (list->buf);
+
+    if (list->fd >= 0) {
+        seaf_metric_manager_fs_id_list_add_spilled_bytes (seaf->metric_mgr,
+                                                          -list->file_size);
+        close (list->fd);
+    }
+
+    seaf_metric_manager_fs_id_list_request_dec (seaf->metric_mgr);
+    g_free (list);
+}
+
+static void
+fs_id_list_update_mem_size (FsIdList *list)
+{
+    gint64 size = evbuffer_get_length (list->buf);
+
+    seaf_metric_manager_fs_id_list_add_mem_bytes (seaf->metric_mgr,
+                                                  size - list->mem_size);
+    list->mem_size = size;
+}
+
+/* Move the encoded ids in memory to the end of the temp file. */
+static int
+fs_id_list_spill (FsIdList *list)
+{
+    char *tmp_path;
+    int n;
+
+    if (list->fd < 0) {
+        tmp_path = g_build_filename (seaf->http_server->http_temp_dir,
+                                     "fs-id-list-XXXXXX", NULL);
+        list->fd = g_mkstemp (tmp_path);
+        if (list->fd < 0) {
+            seaf_warning ("Failed to create temp file for fs id list: %s.\n",
+                          strerror (errno));
+            g_free (tmp_path);
+            return -1;
+        }
+        /* Only this list uses the file. */
+        g_unlink (tmp_path);
+        g_free (tmp_path);
+    }
+
+    while (evbuffer_get_length (list->buf) > 0) {
+        n = evbuffer_write (list->buf, list->fd);
+        if (n < 0) {
+            seaf_warning ("Failed to write fs id list to temp file: %s.\n",
+                          strerror (errno));
+            return -1;
+        }
+        list->file_size += n;
+        seaf_metric_manager_fs_id_list_add_spilled_bytes (seaf->metric_mgr, n);
+    }
+
+    fs_id_list_update_mem_size (list);
+
+    return 0;
+}
+
+static int
+fs_id_list_add (FsIdList *list, const char *id)
+{
+    if (list->count > 0)
+        evbuffer_add (list->buf, ",", 1);
+    evbuffer_add (list->buf, "\"", 1);
+    evbuffer_add (list->buf, id, 40);
+    evbuffer_add (list->buf, "\"", 1);
+    ++(list->count);
+
+    size_t size = evbuffer_get_length (list->buf);
+    if (size >= FS_ID_LIST_MEM_LIMIT)
+        return fs_id_list_spill (list);
+
+    /* Don't report every id to the metric manager. */
+    if (size - list->mem_size >= FS_ID_LIST_CHUNK_SIZE)
+        fs_id_list_update_mem_size (list);
+
+    return 0;
+}
+
+static int
+fs_id_list_finish (FsIdList *list)
+{
+    evbuffer_add (list->buf, "]", 1);
+
+    if (list->fd >= 0)
+        return fs_id_list_spill (list);
+
+    fs_id_list_update_mem_size (list);
+    return 0;
+}
+
+typedef struct SendFsIdListData {
+    evhtp_request_t *req;
+    FsIdList *list;
+    gint64 offset;
+
+    bufferevent_data_cb saved_read_cb;
+    bufferevent_data_cb saved_write_cb;
+    bufferevent_event_cb saved_event_cb;
+    void *saved_cb_arg;
+} SendFsIdListData;
+
+static void
+free_send_fs_id_list_data (SendFsIdListData *data)
+{
+    fs_id_list_free (data->list);
+    g_free (data);
+}
+
+/* Read the next chunk of the spilled list into @buf. */
+static int
+read_fs_id_list_chunk (SendFsIdListData *data, struct evbuffer *buf)
+{
+    int n;
+
+    n = evbuffer_read (buf, data->list->fd, FS_ID_LIST_CHUNK_SIZE);
+    if (n <= 0) {
+        seaf_warning ("Failed to read fs id list from temp file: %s.\n",
+                      n < 0 ? strerror (errno) : "unexpected EOF");
+        return -1;
+    }
+    data->offset += n;
+
+    return 0;
+}
+
+static void
+write_fs_id_list_cb (struct bufferevent *bev, void *ctx)
+{
+    SendFsIdListData *data = ctx;
+    struct evbuffer *buf;
+
+    if (data->offset >= data->list->file_size) {
+        /* Recover evhtp's callbacks */
+        bev->readcb = data->saved_read_cb;
+        bev->writecb = data->saved_write_cb;
+        bev->errorcb = data->saved_event_cb;
+        bev->cbarg = data->saved_cb_arg;
+
+        /* Resume reading incomming requests. */
+        evhtp_request_resume (data->req);
+
+        evhtp_send_reply_chunk_end (data->req);
+
+        free_send_fs_id_list_data (data);
+        return;
+    }
+
+    buf = evbuffer_new ();
+    if (read_fs_id_list_chunk (data, buf) < 0) {
+        evbuffer_free (buf);
+        /* Headers are already sent, the only way to report the error
+         * is to close the connection.
+         */
+        evhtp_connection_free (evhtp_request_get_connection (data->req));
+        free_send_fs_id_list_data (data);
+        return;
+    }
+
+    evhtp_send_reply_chunk (data->req, buf);
+    evbuffer_free (buf);
+}
+
+static void
+fs_id_list_event_cb (struct bufferevent *bev, short events, void *ctx)
+{
+    SendFsIdListData *data = ctx;
+
+    data->saved_event_cb (bev, events, data->saved_cb_arg);
+
+    /* Free aux data. */
+    free_send_fs_id_list_data (data);
+}
+
+/* Send a finished fs id list as the reply to @req. Takes the ownership
+ * of @list.
+ */
+static void
+send_fs_id_list (evhtp_request_t *req, FsIdList *list)
+{
+    if (list->fd < 0) {
+        evbuffer_add_buffer (req->buffer_out, list->buf);
+        fs_id_list_free (list);
+        evhtp_send_reply (req, EVHTP_RES_OK);
+        return;
+    }
+
+    if (lseek (list->fd, 0, SEEK_SET) < 0) {
+        seaf_warning ("Failed to seek fs id list temp file: %s.\n",
+                      strerror (errno));
+        fs_id_list_free (list);
+        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        return;
+    }
+
+    SendFsIdListData *data = g_new0 (SendFsIdListData, 1);
+    data->req = req;
+    data->list = list;
+
+    /* Read the first chunk before replying, so that errors in reading
+     * the temp file can still be reported with a proper status code.
+     */
+    struct evbuffer *first_chunk = evbuffer_new ();
+    if (read_fs_id_list_chunk (data, first_chunk) < 0) {
+        evbuffer_free (first_chunk);
+        free_send_fs_id_list_data (data);
+        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        return;
+    }
+
+    /* We need to overwrite evhtp's callback functions to
+     * send the list piece by piece.
+     */
+    struct bufferevent *bev = evhtp_request_get_bev (req);
+    data->saved_read_cb = bev->readcb;
+    data->saved_write_cb = bev->writecb;
+    data->saved_event_cb = bev->errorcb;
+    data->saved_cb_arg = bev->cbarg;
+    bufferevent_setcb (bev,
+                       NULL,
+                       write_fs_id_list_cb,
+                       fs_id_list_event_cb,
+                       data);
+    /* Block any new request from this connection before finish
+     * handling this request.
+     */
+    evhtp_request_pause (req);
+
+    evhtp_send_reply_chunk_start (req, EVHTP_RES_OK);
+    evhtp_send_reply_chunk (req, first_chunk);
+    evbuffer_free (first_chunk);
+}
+
 static int
 collect_file_ids (int n, const char *basedir, SeafDirent *files[], void *data)
 {
     SeafDirent *file1 = files[0];
     SeafDirent *file2 = files[1];
-    GList **pret = data;
+    FsIdList *list = data;
 
     if (file1 && (!file2 || strcmp(file1->id, file2->id) != 0) &&
         strcmp (file1->id, EMPTY_SHA1) != 0)
-        *pret = g_list_prepend (*pret, g_strdup(file1->id));
+        return fs_id_list_add (list, file1->id);
 
     return 0;
 }
@@ -1676,11 +2019,11 @@ collect_dir_ids (int n, const char *basedir, SeafDirent *dirs[], void *data,
 {
     SeafDirent *dir1 = dirs[0];
     SeafDirent *dir2 = dirs[1];
-    GList **pret = data;
+    FsIdList *list = data;
 
     if (dir1 && (!dir2 || strcmp(dir1->id, dir2->id) != 0) &&
         strcmp (dir1->id, EMPTY_SHA1) != 0)
-        *pret = g_list_prepend (*pret, g_strdup(dir1->id));
+        return fs_id_list_add (list, dir1->id);
 
     return 0;
 }
@@ -1690,14 +2033,12 @@ calculate_send_object_list (SeafRepo *repo,
                             const char *server_head,
                             const char *client_head,
                             gboolean dir_only,
-                            GList **results)
+                            FsIdList *results)
 {
     SeafCommit *remote_head = NULL, *master_head = NULL;
     char *remote_head_root;
     int ret = 0;
 
-    *results = NULL;
-
     master_head = seaf_commit_manager_get_commit (seaf->commit_mgr,
                                                   repo->id, repo->version,
                                                   server_head);
@@ -1720,8 +2061,12 @@ calculate_send_object_list (SeafRepo *repo,
 
     /* Diff won't traverse the root object itself. */
     if (strcmp (remote_head_root, master_head->root_id) != 0 &&
-        strcmp (master_head->root_id, EMPTY_SHA1) != 0)
-        *results = g_list_prepend (*results, g_strdup(master_head->root_id));
+        strcmp (master_head->root_id, EMPTY_SHA1) != 0) {
+        if (fs_id_list_add (results, master_head->root_id) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
 
     DiffOptions opts;
     memset (&opts, 0, sizeof(opts));
@@ -1740,10 +2085,13 @@ calculate_send_object_list (SeafRepo *repo,
     if (diff_trees (2, trees, &opts) < 0) {
         seaf_warning ("Failed to diff remote and master head for repo %.8s.\n",
                       repo->id);
-        string_list_free (*results);
         ret = -1;
+        goto out;
     }
 
+    if (fs_id_list_finish (results) < 0)
+        ret = -1;
+
 out:
     seaf_commit_unref (remote_head);
     seaf_commit_unref (master_head);
@@ -1798,7 +2146,7 @@ get_fs_obj_id_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    GList *list = NULL, *ptr;
+    FsIdList *list = NULL;
 
     repo = seaf_repo_manager_get_repo (seaf->repo_mgr, repo_id);
     if (!repo) {
@@ -1807,25 +2155,14 @@ get_fs_obj_id_cb (evhtp_request_t *req, void *arg)
         goto out;
     }
 
-    if (calculate_send_object_list (repo, server_head, client_head, dir_only, &list) < 0) {
+    list = fs_id_list_new ();
+    if (calculate_send_object_list (repo, server_head, client_head, dir_only, list) < 0) {
+        fs_id_list_free (list);
         evhtp_send_reply (req, EVHTP_RES_SERVERR);
         goto out;
     }
 
-    json_t *obj_array = json_array ();
-
-    for (ptr = list; ptr; ptr = ptr->next) {
-        json_array_append_new (obj_array, json_string (ptr->data));
-        g_free (ptr->data);
-    }
-    g_list_free (list);
-
-    char *obj_list = json_dumps (obj_array, JSON_COMPACT);
-    evbuffer_add (req->buffer_out, obj_list, strlen (obj_list));
-    evhtp_send_reply (req, EVHTP_RES_OK);
-
-    g_free (obj_list);
-    json_decref (obj_array);
+    send_fs_id_list (req, list);
 
 out:
     g_free (username);
@@ -1843,7 +2180,7 @@ typedef struct ComputeObjTask {
 } ComputeObjTask;
 
 typedef struct CalObjResult {
-    GList *list;
+    FsIdList *list;
     gboolean done;
 } CalObjResult;
 
@@ -1872,7 +2209,7 @@ free_obj_cal_result (gpointer data)
         return;
 
     if (result->list)
-        g_list_free (result->list);
+        fs_id_list_free (result->list);
 
     g_free(result);
 }
@@ -1888,6 +2225,7 @@ compute_fs_obj_id (gpointer ptask, gpointer ppara)
     gboolean dir_only = task->dir_only;
     HttpServer *htp_server = task->htp_server;
     CalObjResult *result = NULL;
+    FsIdList *list = NULL;
 
     pthread_mutex_lock (&htp_server->fs_obj_ids_lock);
     result = g_hash_table_lookup (htp_server->fs_obj_ids, task->token);
@@ -1902,14 +2240,19 @@ compute_fs_obj_id (gpointer ptask, gpointer ppara)
         goto out;
     }
 
-    if (calculate_send_object_list (repo, server_head, client_head, dir_only, &result->list) < 0) {
+    list = fs_id_list_new ();
+    if (calculate_send_object_list (repo, server_head, client_head, dir_only, list) < 0) {
+        fs_id_list_free (list);
         pthread_mutex_lock (&htp_server->fs_obj_ids_lock);
         g_hash_table_remove (htp_server->fs_obj_ids, task->token);
         pthread_mutex_unlock (&htp_server->fs_obj_ids_lock);
         goto out;
     }
 
+    pthread_mutex_lock (&htp_server->fs_obj_ids_lock);
+    result->list = list;
     result->done = TRUE;
+    pthread_mutex_unlock (&htp_server->fs_obj_ids_lock);
 out:
     seaf_repo_unref (repo);
     free_compute_obj_task(task);
@@ -2058,7 +2401,7 @@ retrieve_fs_obj_id_cb (evhtp_request_t *req, void *arg)
     char **parts;
     const char *token = NULL;
     char *repo_id = NULL;
-    GList *list = NULL;
+    FsIdList *list = NULL;
     CalObjResult *result = NULL;
     HttpServer *htp_server = seaf->http_server->priv;
 
@@ -2094,26 +2437,11 @@ retrieve_fs_obj_id_cb (evhtp_request_t *req, void *arg)
         return;
     }
     list = result->list;
-    pthread_mutex_unlock (&htp_server->fs_obj_ids_lock);
-
-    GList *ptr;
-    json_t *obj_array = json_array ();
-
-    for (ptr = list; ptr; ptr = ptr->next) {
-        json_array_append_new (obj_array, json_string (ptr->data));
-        g_free (ptr->data);
-    }
-
-    pthread_mutex_lock (&htp_server->fs_obj_ids_lock);
+    result->list = NULL;
     g_hash_table_remove (htp_server->fs_obj_ids, token);
     pthread_mutex_unlock (&htp_server->fs_obj_ids_lock);
 
-    char *obj_list = json_dumps (obj_array, JSON_COMPACT);
-    evbuffer_add (req->buffer_out, obj_list, strlen (obj_list));
-    evhtp_send_reply (req, EVHTP_RES_OK);
-
-    g_free (obj_list);
-    json_decref (obj_array);
+    send_fs_id_list (req, list);
 
 out:
     g_strfreev (parts);
@@ -2360,32 +2688,45 @@ post_check_exist_cb (evhtp_request_t *req, void *arg, CheckExistType type)
     }
 
     json_t *obj = NULL;
-    gboolean ret = TRUE;
     const char *obj_id = NULL;
     int index = 0;
+    int n_ids = 0;
 
     int array_size = json_array_size (obj_array);
     json_t *needed_objs = json_array();
+    json_t **objs = g_new (json_t *, array_size);
+    char **obj_ids = g_new (char *, array_size);
+    gboolean *exists = g_new0 (gboolean, array_size);
 
     for (; index < array_size; ++index) {
         obj = json_array_get (obj_array, index);
         obj_id = json_string_value (obj);
         if (!is_object_id_valid (obj_id))
             continue;
+        objs[n_ids] = obj;
+        obj_ids[n_ids] = (char *)obj_id;
+        ++n_ids;
+    }
 
-        if (type == CHECK_FS_EXIST) {
-            ret = seaf_fs_manager_object_exists (seaf->fs_mgr, store_id, 1,
-                                                 obj_id);
-        } else if (type == CHECK_BLOCK_EXIST) {
-            ret = seaf_block_manager_block_exists (seaf->block_mgr, store_id, 1,
-                                                   obj_id);
-        }
+    /* Check the whole list in one batch, which the backend can run in parallel. */
+    if (type == CHECK_FS_EXIST) {
+        seaf_fs_manager_objects_exist (seaf->fs_mgr, store_id, 1,
+                                       obj_ids, n_ids, exists);
+    } else if (type == CHECK_BLOCK_EXIST) {
+        seaf_block_manager_blocks_exist (seaf->block_mgr, store_id, 1,
+                                         obj_ids, n_ids, exists);
+    }
 
-        if (!ret) {
-            json_array_append (needed_objs, obj);
+    for (index = 0; index < n_ids; ++index) {
+        if (!exists[index]) {
+            json_array_append (needed_objs, objs[index]);
         }
     }
 
+    g_free (objs);
+    g_free (obj_ids);
+    g_free (exists);
+
     char *ret_array = json_dumps (needed_objs, JSON_COMPACT);
     evbuffer_add (req->buffer_out, ret_array, strlen (ret_array));
     evhtp_send_reply (req, EVHTP_RES_OK);
@@ -2508,6 +2849,123 @@ out:
 }
 
 #define MAX_OBJECT_PACK_SIZE (1 << 20) /* 1MB */
+/* Objects are read and sent in chunks of about this size, so that
+ * only a small part of the pack is held in memory at any time.
+ */
+#define PACK_FS_CHUNK_SIZE (1 << 16) /* 64KB */
+
+typedef struct SendFsObjData {
+    evhtp_request_t *req;
+    char *store_id;
+    json_t *fs_id_array;
+    int array_size;
+    int index;
+    int total_size;
+
+    bufferevent_data_cb saved_read_cb;
+    bufferevent_data_cb saved_write_cb;
+    bufferevent_event_cb saved_event_cb;
+    void *saved_cb_arg;
+} SendFsObjData;
+
+static void
+free_send_fs_obj_data (SendFsObjData *data)
+{
+    json_decref (data->fs_id_array);
+    g_free (data->store_id);
+    g_free (data);
+}
+
+static gboolean
+pack_fs_finished (SendFsObjData *data)
+{
+    return (data->index >= data->array_size ||
+            data->total_size >= MAX_OBJECT_PACK_SIZE);
+}
+
+/* Read the next batch of fs objects into @buf.
+ * Returns -1 if any object can't be read.
+ */
+static int
+pack_next_fs_objects (SendFsObjData *data, struct evbuffer *buf)
+{
+    const char *obj_id;
+    void *fs_data = NULL;
+    int data_len;
+    int data_len_net;
+    int chunk_size = 0;
+
+    while (!pack_fs_finished (data) && chunk_size < PACK_FS_CHUNK_SIZE) {
+        obj_id = json_string_value (json_array_get (data->fs_id_array, data->index));
+
+        if (seaf_obj_store_read_obj (seaf->fs_mgr->obj_store, data->store_id, 1,
+                                     obj_id, &fs_data, &data_len) < 0) {
+            seaf_warning ("Failed to read seafile object %s:%s.\n",
+                          data->store_id, obj_id);
+            return -1;
+        }
+
+        evbuffer_add (buf, obj_id, 40);
+        data_len_net = htonl (data_len);
+        evbuffer_add (buf, &data_len_net, 4);
+        evbuffer_add (buf, fs_data, data_len);
+
+        chunk_size += data_len + 44;
+        data->total_size += data_len;
+        ++(data->index);
+        g_free (fs_data);
+    }
+
+    return 0;
+}
+
+static void
+write_fs_obj_cb (struct bufferevent *bev, void *ctx)
+{
+    SendFsObjData *data = ctx;
+    struct evbuffer *buf;
+
+    if (pack_fs_finished (data)) {
+        /* Recover evhtp's callbacks */
+        bev->readcb = data->saved_read_cb;
+        bev->writecb = data->saved_write_cb;
+        bev->errorcb = data->saved_event_cb;
+        bev->cbarg = data->saved_cb_arg;
+
+        /* Resume reading incomming requests. */
+        evhtp_request_resume (data->req);
+
+        evhtp_send_reply_chunk_end (data->req);
+
+        free_send_fs_obj_data (data);
+        return;
+    }
+
+    buf = evbuffer_new ();
+    if (pack_next_fs_objects (data, buf) < 0) {
+        evbuffer_free (buf);
+        /* Headers are already sent, the only way to report the error
+         * is to close the connection.
+         */
+        evhtp_connection_free (evhtp_request_get_connection (data->req));
+        free_send_fs_obj_data (data);
+        return;
+    }
+
+    evhtp_send_reply_chunk (data->req, buf);
+    evbuffer_free (buf);
+}
+
+static void
+fs_obj_event_cb (struct bufferevent *bev, short events, void *ctx)
+{
+    SendFsObjData *data = ctx;
+
+    data->saved_event_cb (bev, events, data->saved_cb_arg);
+
+    /* Free aux data. */
+    free_send_fs_obj_data (data);
+}
 
 static void
 post_pack_fs_cb (evhtp_request_t *req, void *arg)
@@ -2564,13 +3022,10 @@ post_pack_fs_cb (evhtp_request_t *req, void *arg)
     json_t *obj = NULL;
     const char *obj_id = NULL;
     int index = 0;
-    void *fs_data = NULL;
-    int data_len;
-    int data_len_net;
-    int total_size = 0;
 
     int array_size = json_array_size (fs_id_array);
 
+    /* Validate all ids before sending out anything. */
     for (; index < array_size; ++index) {
         obj = json_array_get (fs_id_array, index);
         obj_id = json_string_value (obj);
@@ -2581,29 +3036,57 @@ post_pack_fs_cb (evhtp_request_t *req, void *arg)
             json_decref (fs_id_array);
             goto out;
         }
-        if (seaf_obj_store_read_obj (seaf->fs_mgr->obj_store, store_id, 1,
-                                     obj_id, &fs_data, &data_len) < 0) {
-            seaf_warning ("Failed to read seafile object %s:%s.\n", store_id, obj_id);
-            evhtp_send_reply (req, EVHTP_RES_SERVERR);
-            json_decref (fs_id_array);
-            goto out;
-        }
+    }
 
-        evbuffer_add (req->buffer_out, obj_id, 40);
-        data_len_net = htonl (data_len);
-        evbuffer_add (req->buffer_out, &data_len_net, 4);
-        evbuffer_add (req->buffer_out, fs_data, data_len);
+    SendFsObjData *data = g_new0 (SendFsObjData, 1);
+    data->req = req;
+    data->store_id = store_id;
+    store_id = NULL;
+    data->fs_id_array = fs_id_array;
+    data->array_size = array_size;
 
-        total_size += data_len;
-        g_free (fs_data);
+    /* Read the first chunk before replying, so that errors in reading
+     * objects can still be reported with a proper status code.
+     */
+    struct evbuffer *first_chunk = evbuffer_new ();
+    if (pack_next_fs_objects (data, first_chunk) < 0) {
+        evbuffer_free (first_chunk);
+        free_send_fs_obj_data (data);
+        evhtp_send_reply (req, EVHTP_RES_SERVERR);
+        goto out;
+    }
 
-        if (total_size >= MAX_OBJECT_PACK_SIZE)
-            break;
+    if (pack_fs_finished (data)) {
+        /* Small pack, no need to stream. */
+        evbuffer_add_buffer (req->buffer_out, first_chunk);
+        evbuffer_free (first_chunk);
+        free_send_fs_obj_data (data);
+        evhtp_send_reply (req, EVHTP_RES_OK);
+        goto out;
     }
 
-    evhtp_send_reply (req, EVHTP_RES_OK);
+    /* We need to overwrite evhtp's callback functions to
+     * send fs objects piece by piece.
+     */
+    struct bufferevent *bev = evhtp_request_get_bev (req);
+    data->saved_read_cb = bev->readcb;
+    data->saved_write_cb = bev->writecb;
+    data->saved_event_cb = bev->errorcb;
+    data->saved_cb_arg = bev->cbarg;
+    bufferevent_setcb (bev,
+                       NULL,
+                       write_fs_obj_cb,
+                       fs_obj_event_cb,
+                       data);
+    /* Block any new request from this connection before finish
+     * handling this request.
+     */
+    evhtp_request_pause (req);
+
+    evhtp_send_reply_chunk_start (req, EVHTP_RES_OK);
+    evhtp_send_reply_chunk (req, first_chunk);
+    evbuffer_free (first_chunk);
 
-    json_decref (fs_id_array);
 out:
     g_free (username);
     g_free (store_id);
@@ -3133,53 +3616,16 @@ http_request_init (HttpServerStruct *server)
     /* Web access file */
     access_file_init (priv->evhtp);
 
+    if (server->read_ahead_blocks > 0 &&
+        block_prefetch_init (server->read_ahead_threads,
+                             server->read_ahead_memory) < 0)
+        exit(-1);
+
     /* Web upload file */
     if (upload_file_init (priv->evhtp, server->http_temp_dir) < 0)
         exit(-1);
 }
 
-static void
-token_cache_value_free (gpointer data)
-{
-    TokenInfo *token_info = (TokenInfo *)data;
-    if (token_info != NULL) {
-        g_free (token_info->repo_id);
-        g_free (token_info->email);
-        g_free (token_info);
-    }
-}
-
-static gboolean
-is_token_expire (gpointer key, gpointer value, gpointer arg)
-{
-    TokenInfo *token_info = (TokenInfo *)value;
-
-    if(token_info && token_info->expire_time <= (gint64)time(NULL)) {
-        return TRUE;
-    }
-
-    return FALSE;
-}
-
-static void
-perm_cache_value_free (gpointer data)
-{
-    PermInfo *perm_info = data;
-    g_free (perm_info);
-}
-
-static gboolean
-is_perm_expire (gpointer key, gpointer value, gpointer arg)
-{
-    PermInfo *perm_info = (PermInfo *)value;
-
-    if(perm_info && perm_info->expire_time <= (gint64)time(NULL)) {
-        return TRUE;
-    }
-
-    return FALSE;
-}
-
 static gboolean
 is_vir_repo_info_expire (gpointer key, gpointer value, gpointer arg)
 {
@@ -3211,13 +3657,9 @@ remove_expire_cache_cb (evutil_socket_t sock, short type, void *data)
 {
     HttpServer *htp_server = data;
 
-    pthread_mutex_lock (&htp_server->token_cache_lock);
-    g_hash_table_foreach_remove (htp_server->token_cache, is_token_expire, NULL);
-    pthread_mutex_unlock (&htp_server->token_cache_lock);
+    http_cache_expire (htp_server->token_cache);
 
-    pthread_mutex_lock (&htp_server->perm_cache_lock);
-    g_hash_table_foreach_remove (htp_server->perm_cache, is_perm_expire, NULL);
-    pthread_mutex_unlock (&htp_server->perm_cache_lock);
+    http_cache_expire (htp_server->perm_cache);
 
     pthread_mutex_lock (&htp_server->vir_repo_info_cache_lock);
     g_hash_table_foreach_remove (htp_server->vir_repo_info_cache,
@@ -3271,13 +3713,9 @@ seaf_http_server_new (struct _SeafileSession *session)
 
     load_http_config (server, session);
 
-    priv->token_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                               g_free, token_cache_value_free);
-    pthread_mutex_init (&priv->token_cache_lock, NULL);
+    priv->token_cache = http_cache_new (TOKEN_EXPIRE_TIME);
 
-    priv->perm_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                              g_free, perm_cache_value_free);
-    pthread_mutex_init (&priv->perm_cache_lock, NULL);
+    priv->perm_cache = http_cache_new (PERM_EXPIRE_TIME);
 
     priv->vir_repo_info_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                        g_free, free_vir_repo_info);
@@ -3411,12 +3849,10 @@ seaf_http_server_invalidate_tokens (HttpServerStruct *htp_server,
 {
     const GList *p;
 
-    pthread_mutex_lock (&htp_server->priv->token_cache_lock);
     for (p = tokens; p; p = p->next) {
         const char *token = (char *)p->data;
-        g_hash_table_remove (htp_server->priv->token_cache, token);
+        http_cache_remove (htp_server->priv->token_cache, token);
     }
-    pthread_mutex_unlock (&htp_server->priv->token_cache_lock);
     return 0;
 }
 
@@ -23,6 +23,14 @@ struct _HttpServerStruct {
     int cluster_shared_temp_file_mode;
 
     gboolean verify_client_blocks;
+    gboolean zero_copy_download;
+
+    /* Blocks to read ahead in file downloads, threads to read them with,
+     * and the total size of read-ahead blocks in bytes.
+     */
+    int read_ahead_blocks;
+    int read_ahead_threads;
+    gint64 read_ahead_memory;
 };
 
 typedef struct RequestInfo {
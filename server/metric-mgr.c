@@ -19,6 +19,15 @@
 struct _SeafMetricManagerPriv {
     int in_flight_request_count;
 
+    int fs_id_list_request_count;
+    pthread_mutex_t fs_id_list_lock;
+    gint64 fs_id_list_mem_bytes;
+    gint64 fs_id_list_spilled_bytes;
+
+    pthread_mutex_t download_lock;
+    gint64 download_prefetch_hits;
+    gint64 download_prefetch_stalls;
+
     struct ObjCache *cache;
 };
 
@@ -30,6 +39,9 @@ seaf_metric_manager_new (struct _SeafileSession *seaf)
     mgr->priv = g_new0 (SeafMetricManagerPriv, 1);
     mgr->seaf = seaf;
 
+    pthread_mutex_init (&mgr->priv->fs_id_list_lock, NULL);
+    pthread_mutex_init (&mgr->priv->download_lock, NULL);
+
     // redis cache
     mgr->priv->cache = seaf->obj_cache;
 
@@ -70,6 +82,63 @@ seaf_metric_manager_in_flight_request_dec (SeafMetricManager *mgr)
     g_atomic_int_dec_and_test (&priv->in_flight_request_count);
 }
 
+void
+seaf_metric_manager_fs_id_list_request_inc (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+
+    g_atomic_int_inc (&priv->fs_id_list_request_count);
+}
+
+void
+seaf_metric_manager_fs_id_list_request_dec (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+    g_atomic_int_dec_and_test (&priv->fs_id_list_request_count);
+}
+
+void
+seaf_metric_manager_fs_id_list_add_mem_bytes (SeafMetricManager *mgr,
+                                              gint64 delta)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+
+    pthread_mutex_lock (&priv->fs_id_list_lock);
+    priv->fs_id_list_mem_bytes += delta;
+    pthread_mutex_unlock (&priv->fs_id_list_lock);
+}
+
+void
+seaf_metric_manager_fs_id_list_add_spilled_bytes (SeafMetricManager *mgr,
+                                                  gint64 delta)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+
+    pthread_mutex_lock (&priv->fs_id_list_lock);
+    priv->fs_id_list_spilled_bytes += delta;
+    pthread_mutex_unlock (&priv->fs_id_list_lock);
+}
+
+void
+seaf_metric_manager_download_prefetch_hit (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+
+    pthread_mutex_lock (&priv->download_lock);
+    ++(priv->download_prefetch_hits);
+    pthread_mutex_unlock (&priv->download_lock);
+}
+
+void
+seaf_metric_manager_download_prefetch_stall (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+
+    pthread_mutex_lock (&priv->download_lock);
+    ++(priv->download_prefetch_stalls);
+    pthread_mutex_unlock (&priv->download_lock);
+}
+
 static int
 publish_redis_msg (SeafMetricManager *mgr, const char *msg)
 {
@@ -85,20 +154,20 @@ publish_redis_msg (SeafMetricManager *mgr, const char *msg)
 }
 
 static int
-publish_in_flight_request (SeafMetricManager *mgr)
+publish_metric (SeafMetricManager *mgr, const char *name, const char *type,
+                gint64 value, const char *help)
 {
     int ret = 0;
     json_t *obj = NULL;
     char *msg = NULL;
-    SeafMetricManagerPriv *priv = mgr->priv;
 
     obj = json_object ();
 
-    json_object_set_new (obj, "metric_name", json_string("in_flight_request_total"));
-    json_object_set_new (obj, "metric_value", json_integer (priv->in_flight_request_count));
-    json_object_set_new (obj, "metric_type", json_string("gauge"));
+    json_object_set_new (obj, "metric_name", json_string(name));
+    json_object_set_new (obj, "metric_value", json_integer (value));
+    json_object_set_new (obj, "metric_type", json_string(type));
     json_object_set_new (obj, "component_name", json_string(COMPONENT_NAME));
-    json_object_set_new (obj, "metric_help", json_string("The number of currently running http requests."));
+    json_object_set_new (obj, "metric_help", json_string(help));
 
     msg = json_dumps (obj, JSON_COMPACT);
 
@@ -109,6 +178,119 @@ publish_in_flight_request (SeafMetricManager *mgr)
     return ret;
 }
 
+static int
+publish_gauge (SeafMetricManager *mgr, const char *name, gint64 value,
+               const char *help)
+{
+    return publish_metric (mgr, name, "gauge", value, help);
+}
+
+static int
+publish_in_flight_request (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+
+    return publish_gauge (mgr, "in_flight_request_total",
+                          g_atomic_int_get (&priv->in_flight_request_count),
+                          "The number of currently running http requests.");
+}
+
+static int
+publish_fs_id_list (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+    gint64 mem_bytes, spilled_bytes;
+
+    pthread_mutex_lock (&priv->fs_id_list_lock);
+    mem_bytes = priv->fs_id_list_mem_bytes;
+    spilled_bytes = priv->fs_id_list_spilled_bytes;
+    pthread_mutex_unlock (&priv->fs_id_list_lock);
+
+    if (publish_gauge (mgr, "fs_id_list_request_total",
+                       g_atomic_int_get (&priv->fs_id_list_request_count),
+                       "The number of fs id list requests being served.") < 0)
+        return -1;
+    if (publish_gauge (mgr, "fs_id_list_memory_bytes", mem_bytes,
+                       "The bytes of fs id lists buffered in memory.") < 0)
+        return -1;
+    if (publish_gauge (mgr, "fs_id_list_spilled_bytes", spilled_bytes,
+                       "The bytes of fs id lists spilled to temp files.") < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+publish_download_prefetch (SeafMetricManager *mgr)
+{
+    SeafMetricManagerPriv *priv = mgr->priv;
+    gint64 hits, stalls;
+
+    pthread_mutex_lock (&priv->download_lock);
+    hits = priv->download_prefetch_hits;
+    stalls = priv->download_prefetch_stalls;
+    pthread_mutex_unlock (&priv->download_lock);
+
+    if (publish_metric (mgr, "download_prefetch_hit_total", "counter", hits,
+                        "The number of read-ahead blocks that were ready when needed.") < 0)
+        return -1;
+    if (publish_metric (mgr, "download_prefetch_stall_total", "counter", stalls,
+                        "The number of read-ahead blocks that downloads had to wait for.") < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+publish_fs_cache (SeafMetricManager *mgr)
+{
+    gint64 hits, misses, mem_used;
+
+    seaf_fs_manager_get_cache_stats (mgr->seaf->fs_mgr, &hits, &misses, &mem_used);
+
+    if (publish_metric (mgr, "fs_cache_hit_total", "counter", hits,
+                        "The number of fs objects found in the cache.") < 0)
+        return -1;
+    if (publish_metric (mgr, "fs_cache_miss_total", "counter", misses,
+                        "The number of fs objects not found in the cache.") < 0)
+        return -1;
+    if (publish_gauge (mgr, "fs_cache_memory_bytes", mem_used,
+                       "The memory used by cached fs objects.") < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+publish_db_pool (SeafMetricManager *mgr)
+{
+    SeafDBPoolStats stats;
+
+    seaf_db_get_pool_stats (mgr->seaf->db, &stats);
+
+    if (publish_gauge (mgr, "db_pool_connections", stats.connections,
+                       "The number of open database connections.") < 0)
+        return -1;
+    if (publish_gauge (mgr, "db_pool_in_use_connections", stats.in_use,
+                       "The number of database connections in use.") < 0)
+        return -1;
+    if (publish_metric (mgr, "db_pool_checkout_total", "counter", stats.checkouts,
+                        "The number of database connections checked out.") < 0)
+        return -1;
+    if (publish_metric (mgr, "db_pool_wait_total", "counter", stats.waits,
+                        "The number of checkouts that waited for a free connection.") < 0)
+        return -1;
+    if (publish_metric (mgr, "db_pool_wait_milliseconds_total", "counter",
+                        stats.wait_usec / 1000,
+                        "The time spent waiting for a free connection.") < 0)
+        return -1;
+    if (publish_metric (mgr, "db_pool_wait_timeout_total", "counter", stats.wait_timeouts,
+                        "The number of checkouts that timed out waiting for a connection.") < 0)
+        return -1;
+
+    return 0;
+}
+
 static void
 do_publish_metrics (SeafMetricManager *mgr)
 {
@@ -124,6 +306,30 @@ do_publish_metrics (SeafMetricManager *mgr)
         seaf_warning ("Failed to publish in flight request\n");
         return;
     }
+
+    rc = publish_fs_id_list (mgr);
+    if (rc < 0) {
+        seaf_warning ("Failed to publish fs id list metrics\n");
+        return;
+    }
+
+    rc = publish_download_prefetch (mgr);
+    if (rc < 0) {
+        seaf_warning ("Failed to publish download prefetch metrics\n");
+        return;
+    }
+
+    rc = publish_fs_cache (mgr);
+    if (rc < 0) {
+        seaf_warning ("Failed to publish fs cache metrics\n");
+        return;
+    }
+
+    rc = publish_db_pool (mgr);
+    if (rc < 0) {
+        seaf_warning ("Failed to publish db pool metrics\n");
+        return;
+    }
 }
 
 static void *
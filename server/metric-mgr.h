@@ -27,4 +27,27 @@ seaf_metric_manager_in_flight_request_inc (SeafMetricManager *mgr);
 void
 seaf_metric_manager_in_flight_request_dec (SeafMetricManager *mgr);
 
+void
+seaf_metric_manager_fs_id_list_request_inc (SeafMetricManager *mgr);
+
+void
+seaf_metric_manager_fs_id_list_request_dec (SeafMetricManager *mgr);
+
+/* Bytes of fs id lists buffered in memory or spilled to temp files. */
+void
+seaf_metric_manager_fs_id_list_add_mem_bytes (SeafMetricManager *mgr,
+                                              gint64 delta);
+
+void
+seaf_metric_manager_fs_id_list_add_spilled_bytes (SeafMetricManager *mgr,
+                                                  gint64 delta);
+
+/* A block read ahead for a download was ready when needed. */
+void
+seaf_metric_manager_download_prefetch_hit (SeafMetricManager *mgr);
+
+/* A download had to wait for, or read itself, a block being read ahead. */
+void
+seaf_metric_manager_download_prefetch_stall (SeafMetricManager *mgr);
+
 #endif
@@ -87,8 +87,7 @@ add_file_to_archive (PackDirData *data,
     BlockMetadata *bmd = NULL;
     char *blk_id = NULL;
     uint32_t remain = 0;
-    EVP_CIPHER_CTX *ctx;
-    gboolean enc_init = FALSE;
+    SeafileDecryptStream *dec = NULL;
     char *dec_out = NULL;
     int dec_out_len = -1;
     int ret = 0;
@@ -158,14 +157,20 @@ add_file_to_archive (PackDirData *data,
         remain = bmd->size;
         g_free (bmd);
 
+        /* The decryption context is set up once per file and reset
+         * for every block. */
         if (crypt) {
-            if (seafile_decrypt_init (&ctx, crypt->version,
-                                      crypt->key, crypt->iv) < 0) {
+            if (!dec) {
+                dec = seafile_decrypt_stream_new (crypt);
+                if (!dec) {
+                    ret = -1;
+                    goto out;
+                }
+            } else if (seafile_decrypt_stream_reset (dec) < 0) {
                 seaf_warning ("Failed to init decrypt.\n");
                 ret = -1;
                 goto out;
             }
-            enc_init = TRUE;
         }
 
         while (remain != 0) {
@@ -190,21 +195,8 @@ add_file_to_archive (PackDirData *data,
 
             } else {
                 /* an encrypted block */
-                dec_out = g_new (char, n + 16);
-                if (!dec_out) {
-                    seaf_warning ("Failed to alloc memory.\n");
-                    ret = -1;
-                    goto out;
-                }
-
-                int r = EVP_DecryptUpdate (ctx,
-                                           (unsigned char *)dec_out,
-                                           &dec_out_len,
-                                           (unsigned char *)buf,
-                                           n);
-
-                /* EVP_DecryptUpdate returns 1 on success, 0 on failure */
-                if (r != 1) {
+                if (seafile_decrypt_stream_update (dec, buf, n,
+                                                   &dec_out, &dec_out_len) < 0) {
                     seaf_warning ("Decrypt block %s failed.\n", blk_id);
                     ret = -1;
                     goto out;
@@ -222,10 +214,8 @@ add_file_to_archive (PackDirData *data,
                 /* If it's the last piece of a block, call decrypt_final()
                  * to decrypt the possible partial block. */
                 if (remain == 0) {
-                    r = EVP_DecryptFinal_ex (ctx,
-                                             (unsigned char *)dec_out,
-                                             &dec_out_len);
-                    if (r != 1) {
+                    if (seafile_decrypt_stream_final (dec, &dec_out,
+                                                      &dec_out_len) < 0) {
                         seaf_warning ("Decrypt block %s failed.\n", blk_id);
                         ret = -1;
                         goto out;
@@ -240,9 +230,6 @@ add_file_to_archive (PackDirData *data,
                         }
                     }
                 }
-
-                g_free (dec_out);
-                dec_out = NULL;
             }
         }
 
@@ -264,9 +251,7 @@ out:
         seaf_block_manager_close_block (seaf->block_mgr, handle);
         seaf_block_manager_block_handle_free(seaf->block_mgr, handle);
     }
-    if (crypt != NULL && enc_init)
-        EVP_CIPHER_CTX_free (ctx);
-    g_free (dec_out);
+    seafile_decrypt_stream_free (dec);
 
     return ret;
 }
@@ -10,6 +10,8 @@
 #include "quota-mgr.h"
 #include "seaf-utils.h"
 
+#include <pthread.h>
+
 #define KB 1000L
 #define MB 1000000L
 #define GB 1000000000L
@@ -58,6 +60,44 @@ out:
     return quota;
 }
 
+/* Summing up the sizes of all repos of a user is expensive for users with
+ * many repos. The usage is cached for usage_cache_ttl seconds, and dropped
+ * when the size scheduler stores a new size of one of the user's repos.
+ */
+#define DEFAULT_USAGE_CACHE_TTL 60 /* seconds */
+#define USAGE_CACHE_MAX_ENTRIES 100000
+
+typedef struct UserUsageEntry {
+    gint64 usage;
+    gboolean valid;
+    gint64 expire;
+    /* Taken from the cache version when the entry is created or
+     * invalidated, so that a usage summed up while repo sizes were
+     * changing isn't cached.
+     */
+    guint64 changes;
+} UserUsageEntry;
+
+struct QuotaUsageCache {
+    int ttl;
+    pthread_mutex_t lock;
+    GHashTable *entries;
+    guint64 version;
+};
+
+static struct QuotaUsageCache *
+usage_cache_new (int ttl)
+{
+    struct QuotaUsageCache *cache = g_new0 (struct QuotaUsageCache, 1);
+
+    cache->ttl = ttl;
+    pthread_mutex_init (&cache->lock, NULL);
+    cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, g_free);
+
+    return cache;
+}
+
 SeafQuotaManager *
 seaf_quota_manager_new (struct _SeafileSession *session)
 {
@@ -70,6 +110,16 @@ seaf_quota_manager_new (struct _SeafileSession *session)
                                                     "quota", "calc_share_usage",
                                                     NULL);
 
+    GError *error = NULL;
+    int ttl = g_key_file_get_integer (session->config,
+                                      "quota", "usage_cache_ttl",
+                                      &error);
+    if (error || ttl < 0) {
+        g_clear_error (&error);
+        ttl = DEFAULT_USAGE_CACHE_TTL;
+    }
+    mgr->usage_cache = usage_cache_new (ttl);
+
     return mgr;
 }
 
@@ -398,6 +448,118 @@ out:
     return n_shared_to;
 }
 
+static gboolean
+is_usage_entry_stale (gpointer key, gpointer value, gpointer user_data)
+{
+    UserUsageEntry *entry = value;
+    gint64 *now = user_data;
+
+    return !entry->valid || entry->expire <= *now;
+}
+
+/* Called with the cache lock. */
+static void
+prune_usage_cache (struct QuotaUsageCache *cache)
+{
+    gint64 now = (gint64)time(NULL);
+
+    g_hash_table_foreach_remove (cache->entries, is_usage_entry_stale, &now);
+    if (g_hash_table_size (cache->entries) >= USAGE_CACHE_MAX_ENTRIES)
+        g_hash_table_remove_all (cache->entries);
+}
+
+static gint64
+get_cached_user_usage (SeafQuotaManager *mgr, const char *user)
+{
+    struct QuotaUsageCache *cache = mgr->usage_cache;
+    UserUsageEntry *entry;
+    guint64 changes;
+    gint64 usage;
+
+    if (cache->ttl == 0)
+        return seaf_quota_manager_get_user_usage (mgr, user);
+
+    pthread_mutex_lock (&cache->lock);
+    entry = g_hash_table_lookup (cache->entries, user);
+    if (entry && entry->valid && (gint64)time(NULL) < entry->expire) {
+        usage = entry->usage;
+        pthread_mutex_unlock (&cache->lock);
+        return usage;
+    }
+    if (!entry) {
+        if (g_hash_table_size (cache->entries) >= USAGE_CACHE_MAX_ENTRIES)
+            prune_usage_cache (cache);
+        entry = g_new0 (UserUsageEntry, 1);
+        entry->changes = ++(cache->version);
+        g_hash_table_insert (cache->entries, g_strdup(user), entry);
+    }
+    changes = entry->changes;
+    pthread_mutex_unlock (&cache->lock);
+
+    usage = seaf_quota_manager_get_user_usage (mgr, user);
+    if (usage < 0)
+        return usage;
+
+    /* The entry may have been pruned meanwhile, look it up again. */
+    pthread_mutex_lock (&cache->lock);
+    entry = g_hash_table_lookup (cache->entries, user);
+    if (entry && entry->changes == changes) {
+        entry->usage = usage;
+        entry->valid = TRUE;
+        entry->expire = (gint64)time(NULL) + cache->ttl;
+    }
+    pthread_mutex_unlock (&cache->lock);
+
+    return usage;
+}
+
+void
+seaf_quota_manager_invalidate_user_usage (SeafQuotaManager *mgr,
+                                          const char *user)
+{
+    struct QuotaUsageCache *cache = mgr->usage_cache;
+    UserUsageEntry *entry;
+
+    if (!user)
+        return;
+
+    pthread_mutex_lock (&cache->lock);
+    entry = g_hash_table_lookup (cache->entries, user);
+    if (entry) {
+        entry->valid = FALSE;
+        entry->changes = ++(cache->version);
+    }
+    pthread_mutex_unlock (&cache->lock);
+}
+
+/*
+ * Adding the size change to the cached usage instead could count it twice,
+ * if the usage was summed up after the new size was stored but cached
+ * before the change was added.
+ */
+void
+seaf_quota_manager_invalidate_repo_usage (SeafQuotaManager *mgr,
+                                          const char *repo_id)
+{
+    struct QuotaUsageCache *cache = mgr->usage_cache;
+    char *user = NULL;
+    guint size;
+
+    pthread_mutex_lock (&cache->lock);
+    size = g_hash_table_size (cache->entries);
+    pthread_mutex_unlock (&cache->lock);
+    if (size == 0)
+        return;
+
+    /* Virtual repos aren't counted in the usage. */
+    if (seaf_repo_manager_is_virtual_repo (seaf->repo_mgr, repo_id))
+        return;
+
+    user = seaf_repo_manager_get_repo_owner (seaf->repo_mgr, repo_id);
+    seaf_quota_manager_invalidate_user_usage (mgr, user);
+    g_free (user);
+}
+
 int
 seaf_quota_manager_check_quota_with_delta (SeafQuotaManager *mgr,
                                            const char *repo_id,
@@ -428,7 +590,7 @@ seaf_quota_manager_check_quota_with_delta (SeafQuotaManager *mgr,
     if (quota == INFINITE_QUOTA)
         goto out;
 
-    usage = seaf_quota_manager_get_user_usage (mgr, user);
+    usage = get_cached_user_usage (mgr, user);
     if (usage < 0) {
         ret = -1;
         goto out;
@@ -5,10 +5,14 @@
 
 #define INFINITE_QUOTA (gint64)-2
 
+struct QuotaUsageCache;
+
 struct _SeafQuotaManager {
     struct _SeafileSession *session;
 
     gboolean calc_share_usage;
+
+    struct QuotaUsageCache *usage_cache;
 };
 typedef struct _SeafQuotaManager SeafQuotaManager;
 
@@ -50,6 +54,18 @@ seaf_quota_manager_check_quota_with_delta (SeafQuotaManager *mgr,
 gint64
 seaf_quota_manager_get_user_usage (SeafQuotaManager *mgr, const char *user);
 
+/* Drop the cached usage of the owner of @repo_id, after its size has been
+ * stored.
+ */
+void
+seaf_quota_manager_invalidate_repo_usage (SeafQuotaManager *mgr,
+                                          const char *repo_id);
+
+/* Drop the cached usage of @user, e.g. after repos changed owner. */
+void
+seaf_quota_manager_invalidate_user_usage (SeafQuotaManager *mgr,
+                                          const char *user);
+
 GList *
 seaf_repo_quota_manager_list_user_quota_usage (SeafQuotaManager *mgr);
 
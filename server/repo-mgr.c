@@ -362,6 +362,8 @@ seaf_repo_manager_new (SeafileSession *seaf)
 
     init_scan_trash_timer (mgr->priv, seaf->config);
 
+    seaf_repo_manager_init_perm_cache (mgr, seaf->config);
+
     return mgr;
 }
 
@@ -506,6 +508,8 @@ remove_virtual_repo_ondisk (SeafRepoManager *mgr,
                                  1, "string", repo_id);
     }
 
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
     seaf_db_statement_query (mgr->seaf->db,
                              "DELETE FROM RepoUserToken WHERE repo_id = ?",
                              1, "string", repo_id);
@@ -518,6 +522,8 @@ remove_virtual_repo_ondisk (SeafRepoManager *mgr,
                              "DELETE FROM RepoSize WHERE repo_id = ?",
                              1, "string", repo_id);
 
+    seaf_file_history_manager_remove_repo (mgr->seaf->file_history_mgr, repo_id);
+
     seaf_db_statement_query (mgr->seaf->db,
                              "DELETE FROM RepoInfo WHERE repo_id = ?",
                              1, "string", repo_id);
@@ -610,6 +616,10 @@ del_repo:
     }
     seaf_branch_list_free (branch_list);
 
+    char *owner = seaf_repo_manager_get_repo_owner (mgr, repo_id);
+    seaf_quota_manager_invalidate_user_usage (seaf->quota_mgr, owner);
+    g_free (owner);
+
     seaf_db_statement_query (mgr->seaf->db, "DELETE FROM RepoOwner WHERE repo_id = ?",
                              1, "string", repo_id);
 
@@ -642,6 +652,8 @@ del_repo:
                              "DELETE FROM RepoSize WHERE repo_id = ?",
                              1, "string", repo_id);
 
+    seaf_file_history_manager_remove_repo (mgr->seaf->file_history_mgr, repo_id);
+
     /* Remove virtual repos when origin repo is deleted. */
     GList *vrepos, *ptr;
     vrepos = seaf_repo_manager_get_virtual_repo_ids_by_origin (mgr, repo_id);
@@ -657,6 +669,8 @@ del_repo:
                              "WHERE repo_id=? OR origin_repo=?",
                              2, "string", repo_id, "string", repo_id);
 
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
     if (!head_commit)
         add_deleted_repo_record(mgr, repo_id);
 
@@ -672,9 +686,12 @@ seaf_repo_manager_del_virtual_repo (SeafRepoManager *mgr,
     if (ret < 0)
         return ret;
 
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "DELETE FROM VirtualRepo WHERE repo_id = ?",
-                                    1, "string", repo_id);
+    ret = seaf_db_statement_query (mgr->seaf->db,
+                                   "DELETE FROM VirtualRepo WHERE repo_id = ?",
+                                   1, "string", repo_id);
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
+    return ret;
 }
 
 static gboolean
@@ -2167,6 +2184,9 @@ seaf_repo_manager_set_repo_owner (SeafRepoManager *mgr,
         }
     }
 
+    seaf_quota_manager_invalidate_user_usage (seaf->quota_mgr, orig_owner);
+    seaf_quota_manager_invalidate_user_usage (seaf->quota_mgr, email);
+
     /* If the repo was newly created, no need to remove share and virtual repos. */
     if (!orig_owner)
         goto out;
@@ -2194,6 +2214,9 @@ seaf_repo_manager_set_repo_owner (SeafRepoManager *mgr,
                              2, "string", repo_id, "string", repo_id);
 
 out:
+    /* Only granted access is cached, so a new repo has nothing to drop. */
+    if (ret == 0 && orig_owner && strcmp (orig_owner, email) != 0)
+        seaf_repo_manager_invalidate_perm_cache (mgr);
     g_free (orig_owner);
     return ret;
 }
@@ -3099,6 +3122,12 @@ seaf_repo_manager_restore_repo_from_trash (SeafRepoManager *mgr,
 
     seaf_db_trans_close (trans);
 
+    if (ret == 0) {
+        seaf_quota_manager_invalidate_user_usage (seaf->quota_mgr,
+                                                  seafile_trash_repo_get_owner_id (repo));
+        seaf_repo_manager_invalidate_perm_cache (mgr);
+    }
+
 out:
     seaf_commit_unref (commit);
     g_object_unref (repo);
@@ -3175,6 +3204,8 @@ seaf_repo_manager_add_group_repo (SeafRepoManager *mgr,
                                  "string", owner, "string", permission) < 0)
         return -1;
 
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
     return 0;
 }
 
@@ -3184,10 +3215,15 @@ seaf_repo_manager_del_group_repo (SeafRepoManager *mgr,
                                   int group_id,
                                   GError **error)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "DELETE FROM RepoGroup WHERE group_id=? "
-                                    "AND repo_id=?",
-                                    2, "int", group_id, "string", repo_id);
+    int ret;
+
+    ret = seaf_db_statement_query (mgr->seaf->db,
+                                   "DELETE FROM RepoGroup WHERE group_id=? "
+                                   "AND repo_id=?",
+                                   2, "int", group_id, "string", repo_id);
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
+    return ret;
 }
 
 static gboolean
@@ -3264,11 +3300,16 @@ seaf_repo_manager_set_group_repo_perm (SeafRepoManager *mgr,
                                        const char *permission,
                                        GError **error)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "UPDATE RepoGroup SET permission=? WHERE "
-                                    "repo_id=? AND group_id=?",
-                                    3, "string", permission, "string", repo_id,
-                                    "int", group_id);
+    int ret;
+
+    ret = seaf_db_statement_query (mgr->seaf->db,
+                                   "UPDATE RepoGroup SET permission=? WHERE "
+                                   "repo_id=? AND group_id=?",
+                                   3, "string", permission, "string", repo_id,
+                                   "int", group_id);
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
+    return ret;
 }
 
 int
@@ -3279,15 +3320,20 @@ seaf_repo_manager_set_subdir_group_perm_by_path (SeafRepoManager *mgr,
                                                  const char *permission,
                                                  const char *path)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "UPDATE RepoGroup SET permission=? WHERE repo_id IN "
-                                    "(SELECT repo_id FROM VirtualRepo WHERE origin_repo=? AND path=?) "
-                                    "AND group_id=? AND user_name=?",
-                                    5, "string", permission,
-                                    "string", repo_id,
-                                    "string", path,
-                                    "int", group_id,
-                                    "string", username);
+    int ret;
+
+    ret = seaf_db_statement_query (mgr->seaf->db,
+                                   "UPDATE RepoGroup SET permission=? WHERE repo_id IN "
+                                   "(SELECT repo_id FROM VirtualRepo WHERE origin_repo=? AND path=?) "
+                                   "AND group_id=? AND user_name=?",
+                                   5, "string", permission,
+                                   "string", repo_id,
+                                   "string", path,
+                                   "int", group_id,
+                                   "string", username);
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
+    return ret;
 }
 static gboolean
 get_group_repoids_cb (SeafDBRow *row, void *data)
@@ -3564,6 +3610,8 @@ seaf_repo_manager_remove_group_repos (SeafRepoManager *mgr,
                                       2, "int", group_id, "string", owner);
     }
 
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
     return rc;
 }
 
@@ -3576,6 +3624,7 @@ seaf_repo_manager_set_inner_pub_repo (SeafRepoManager *mgr,
 {
     SeafDB *db = mgr->seaf->db;
     char sql[256];
+    int ret;
 
     if (seaf_db_type(db) == SEAF_DB_TYPE_PGSQL) {
         gboolean err;
@@ -3592,23 +3641,30 @@ seaf_repo_manager_set_inner_pub_repo (SeafRepoManager *mgr,
                      "('%s', '%s')", repo_id, permission);
         if (err)
             return -1;
-        return seaf_db_query (db, sql);
+        ret = seaf_db_query (db, sql);
     } else {
-        return seaf_db_statement_query (db,
-                                        "REPLACE INTO InnerPubRepo (repo_id, permission) VALUES (?, ?)",
-                                        2, "string", repo_id, "string", permission);
+        ret = seaf_db_statement_query (db,
+                                       "REPLACE INTO InnerPubRepo (repo_id, permission) VALUES (?, ?)",
+                                       2, "string", repo_id, "string", permission);
     }
 
-    return -1;
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
+    return ret;
 }
 
 int
 seaf_repo_manager_unset_inner_pub_repo (SeafRepoManager *mgr,
                                         const char *repo_id)
 {
-    return seaf_db_statement_query (mgr->seaf->db,
-                                    "DELETE FROM InnerPubRepo WHERE repo_id = ?",
-                                    1, "string", repo_id);
+    int ret;
+
+    ret = seaf_db_statement_query (mgr->seaf->db,
+                                   "DELETE FROM InnerPubRepo WHERE repo_id = ?",
+                                   1, "string", repo_id);
+    seaf_repo_manager_invalidate_perm_cache (mgr);
+
+    return ret;
 }
 
 gboolean
@@ -4778,8 +4834,8 @@ seaf_get_group_repos_by_user (SeafRepoManager *mgr,
     int group_id = 0;
 
     /* Get the groups this user belongs to. */
-    groups = ccnet_group_manager_get_groups_by_user (seaf->group_mgr, user,
-                                                     1, NULL);
+    groups = ccnet_group_manager_get_groups_by_user_cached (seaf->group_mgr,
+                                                            user, NULL);
     if (!groups) {
         goto out;
     }
@@ -4984,8 +5040,8 @@ seaf_repo_manager_convert_repo_path (SeafRepoManager *mgr,
 
     /* Get the groups this user belongs to. */
 
-    groups = ccnet_group_manager_get_groups_by_user (seaf->group_mgr, user,
-                                                     1, NULL);
+    groups = ccnet_group_manager_get_groups_by_user_cached (seaf->group_mgr,
+                                                            user, NULL);
     if (!groups) {
         goto out;
     }
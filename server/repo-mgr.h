@@ -108,10 +108,15 @@ seaf_repo_diff (SeafRepo *repo, const char *arg1, const char *arg2, int fold_dir
 typedef struct _SeafRepoManager SeafRepoManager;
 typedef struct _SeafRepoManagerPriv SeafRepoManagerPriv;
 
+struct RepoPermCache;
+
 struct _SeafRepoManager {
     struct _SeafileSession *seaf;
 
     SeafRepoManagerPriv *priv;
+
+    /* Effective permissions of users on repos, see repo-perm.c. */
+    struct RepoPermCache *perm_cache;
 };
 
 SeafRepoManager* 
@@ -740,6 +745,31 @@ seaf_repo_manager_check_permission (SeafRepoManager *mgr,
                                     const char *user,
                                     GError **error);
 
+/*
+ * Check the permissions of @user on many repos at once.
+ * Returns a hash table mapping the id of every repo accessible to @user to
+ * its permission, or NULL on error.
+ */
+GHashTable *
+seaf_repo_manager_check_permissions (SeafRepoManager *mgr,
+                                     GList *repo_ids,
+                                     const char *user,
+                                     GError **error);
+
+void
+seaf_repo_manager_init_perm_cache (SeafRepoManager *mgr, GKeyFile *config);
+
+/*
+ * Changes whenever cached permissions become invalid, because shares or
+ * group membership changed.
+ */
+gint64
+seaf_repo_manager_get_perm_version (SeafRepoManager *mgr);
+
+/* Called after changing repo owners, shares, or sub-folder permissions. */
+void
+seaf_repo_manager_invalidate_perm_cache (SeafRepoManager *mgr);
+
 GList *
 seaf_repo_manager_list_dir_with_perm (SeafRepoManager *mgr,
                                       const char *repo_id,
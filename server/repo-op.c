@@ -631,6 +631,7 @@ static void
 update_repo_size(const char *repo_id)
 {
     schedule_repo_size_computation (seaf->size_sched, repo_id);
+    seaf_file_history_manager_schedule_update (seaf->file_history_mgr, repo_id);
 }
 
 int
@@ -2306,17 +2307,21 @@ copy_seafile (SeafRepo *src_repo, SeafRepo *dst_repo,
               SeafileCrypt *src_crypt, SeafileCrypt *dst_crypt,
               const char *file_id, CopyTask *task, guint64 *size)
 {
-    Seafile *file;
+    Seafile *cached, *file;
 
-    file = seaf_fs_manager_get_seafile (seaf->fs_mgr,
-                                        src_repo->store_id, src_repo->version,
-                                        file_id);
-    if (!file) {
+    cached = seaf_fs_manager_get_seafile (seaf->fs_mgr,
+                                          src_repo->store_id, src_repo->version,
+                                          file_id);
+    if (!cached) {
         seaf_warning ("Failed to get file object %s from repo %s.\n",
                       file_id, src_repo->id);
         return NULL;
     }
 
+    /* The file object may be shared with the fs cache, modify a private copy. */
+    file = seafile_dup (cached);
+    seafile_unref (cached);
+
     /* We may be copying from v0 repo to v1 repo or vise versa. */
     file->version = seafile_version_from_repo_version(dst_repo->version);
 
@@ -5533,17 +5538,32 @@ out:
     return file_info;
 }
 
-static void
+/* Commits are traversed through the commit graph, so the full commit object
+ * is only loaded for revisions that are returned.
+ */
+static int
 add_revision_info (CollectRevisionParam *data,
-                   SeafCommit *commit, const char *file_id, gint64 file_size)
+                   const char *commit_id, const char *file_id, gint64 file_size)
 {
-    seaf_commit_ref (commit);
-    data->wanted_commits = g_list_prepend (data->wanted_commits, commit);
+    SeafCommit *full;
+
+    full = seaf_commit_manager_get_commit (seaf->commit_mgr,
+                                           data->repo->id, data->repo->version,
+                                           commit_id);
+    if (!full) {
+        seaf_warning ("Failed to get commit %s:%s\n",
+                      data->repo->id, commit_id);
+        return -1;
+    }
+
+    data->wanted_commits = g_list_prepend (data->wanted_commits, full);
     data->file_id_list = g_list_prepend (data->file_id_list, g_strdup(file_id));
     gint64 *size = g_malloc(sizeof(gint64));
     *size = file_size;
     data->file_size_list = g_list_prepend (data->file_size_list, size);
     ++(data->n_commits);
+
+    return 0;
 }
 
 static gboolean
@@ -5602,13 +5622,15 @@ collect_file_revisions (SeafCommit *commit, void *vdata, gboolean *stop)
 
     if (!commit->parent_id) {
         /* Initial commit */
-        add_revision_info (data, commit, file_info->file_id, file_info->file_size);
+        if (add_revision_info (data, commit->commit_id, file_info->file_id,
+                               file_info->file_size) < 0)
+            ret = FALSE;
         goto out;
     }
 
-    parent_commit = seaf_commit_manager_get_commit (seaf->commit_mgr,
-                                                    repo->id, repo->version,
-                                                    commit->parent_id);
+    parent_commit = seaf_commit_manager_get_graph_commit (seaf->commit_mgr,
+                                                          repo->id, repo->version,
+                                                          commit->parent_id);
     if (!parent_commit) {
         seaf_warning ("Failed to get commit %s:%s\n", repo->id, commit->parent_id);
         ret = FALSE;
@@ -5632,9 +5654,9 @@ collect_file_revisions (SeafCommit *commit, void *vdata, gboolean *stop)
 
     /* In case of a merge, the second parent also need compare */
     if (commit->second_parent_id) {
-        parent_commit2 = seaf_commit_manager_get_commit (seaf->commit_mgr,
-                                                         repo->id, repo->version,
-                                                         commit->second_parent_id);
+        parent_commit2 = seaf_commit_manager_get_graph_commit (seaf->commit_mgr,
+                                                               repo->id, repo->version,
+                                                               commit->second_parent_id);
         if (!parent_commit2) {
             seaf_warning ("Failed to get commit %s:%s\n",
                           repo->id, commit->second_parent_id);
@@ -5664,7 +5686,9 @@ collect_file_revisions (SeafCommit *commit, void *vdata, gboolean *stop)
         if (!data->got_second)
             data->got_second = TRUE;
     }
-    add_revision_info (data, commit, file_info->file_id, file_info->file_size);
+    if (add_revision_info (data, commit->commit_id, file_info->file_id,
+                           file_info->file_size) < 0)
+        ret = FALSE;
 
 out:
     if (parent_commit) seaf_commit_unref (parent_commit);
@@ -5675,6 +5699,155 @@ out:
     return ret;
 }
 
+/*
+ * Walks the ancestors of a commit newest first, only as far back as the
+ * changes being checked, so that changes on branches merged after the
+ * commit are left out.
+ */
+typedef struct AncestorWalk {
+    SeafRepo *repo;
+    /* Ids of the commits reached, queued or not. */
+    GHashTable *reached;
+    /* Commits whose parents are not queued yet, newest first. */
+    GQueue *queue;
+} AncestorWalk;
+
+static gint
+compare_commit_ctime_desc (gconstpointer a, gconstpointer b, gpointer data)
+{
+    gint64 ta = ((const SeafCommit *)a)->ctime;
+    gint64 tb = ((const SeafCommit *)b)->ctime;
+
+    return (ta < tb) ? 1 : ((ta > tb) ? -1 : 0);
+}
+
+static void
+ancestor_walk_add (AncestorWalk *walk, const char *commit_id)
+{
+    SeafCommit *commit;
+
+    if (!commit_id || g_hash_table_contains (walk->reached, commit_id))
+        return;
+    g_hash_table_add (walk->reached, g_strdup (commit_id));
+
+    commit = seaf_commit_manager_get_graph_commit (seaf->commit_mgr,
+                                                   walk->repo->id,
+                                                   walk->repo->version,
+                                                   commit_id);
+    if (!commit)
+        return;
+    g_queue_insert_sorted (walk->queue, commit, compare_commit_ctime_desc, NULL);
+}
+
+/* Whether @commit_id, created at @ctime, is the start commit or one of its
+ * ancestors.
+ */
+static gboolean
+ancestor_walk_reaches (AncestorWalk *walk, const char *commit_id, gint64 ctime)
+{
+    SeafCommit *commit;
+
+    while ((commit = g_queue_peek_head (walk->queue)) != NULL &&
+           (gint64)commit->ctime >= ctime) {
+        g_queue_pop_head (walk->queue);
+        ancestor_walk_add (walk, commit->parent_id);
+        ancestor_walk_add (walk, commit->second_parent_id);
+        seaf_commit_unref (commit);
+    }
+
+    return g_hash_table_contains (walk->reached, commit_id);
+}
+
+/*
+ * Collect the revisions from the file history index instead of walking the
+ * commits, with the same rules as collect_file_revisions(). Unlike the walk,
+ * @limit is the number of revisions rather than commits.
+ * Returns -1 if the index doesn't cover @start_commit_id yet.
+ */
+static int
+collect_file_revisions_by_index (CollectRevisionParam *data,
+                                 const char *start_commit_id,
+                                 int limit,
+                                 char **next_start_commit)
+{
+    SeafRepo *repo = data->repo;
+    GList *changes = NULL, *ptr;
+    FileChange *change;
+    AncestorWalk walk;
+    int n = 0;
+    int ret = 0;
+
+    walk.repo = repo;
+    walk.reached = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    walk.queue = g_queue_new ();
+    ancestor_walk_add (&walk, start_commit_id);
+    if (g_queue_is_empty (walk.queue)) {
+        ret = -1;
+        goto out;
+    }
+
+    if (seaf_file_history_manager_get_file_changes (seaf->file_history_mgr,
+                                                    repo, start_commit_id,
+                                                    data->path, &changes) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    for (ptr = changes; ptr; ptr = ptr->next) {
+        change = ptr->data;
+
+        /* Skip the changes made after the start commit, or on branches
+         * that are not in its history.
+         */
+        if (!ancestor_walk_reaches (&walk, change->commit_id, change->ctime))
+            continue;
+
+        /* At least find the latest revision. */
+        if (data->got_latest && data->truncate_time == 0)
+            break;
+
+        if (data->got_latest &&
+            data->truncate_time > 0 &&
+            change->ctime < data->truncate_time &&
+            data->got_second) {
+            data->not_found_file = TRUE;
+            break;
+        }
+
+        /* Deleted files with the same path are not included in history. */
+        if (!change->obj_id) {
+            data->not_found_file = TRUE;
+            break;
+        }
+
+        if (limit > 0 && n >= limit) {
+            *next_start_commit = g_strdup (change->commit_id);
+            break;
+        }
+
+        if (!data->got_latest) {
+            data->got_latest = TRUE;
+        } else {
+            if (!data->got_second)
+                data->got_second = TRUE;
+        }
+        if (add_revision_info (data, change->commit_id, change->obj_id,
+                               change->size) < 0)
+            continue;
+        ++n;
+    }
+
+    /* Reached the initial version of the file. */
+    if (!ptr)
+        data->not_found_file = TRUE;
+
+out:
+    g_list_free_full (changes, (GDestroyNotify)file_change_free);
+    g_queue_free_full (walk.queue, (GDestroyNotify)seaf_commit_unref);
+    g_hash_table_destroy (walk.reached);
+    return ret;
+}
+
 static gboolean
 path_exists_in_commit (SeafRepo *repo, const char *commit_id, const char *path)
 {
@@ -5884,12 +6057,14 @@ seaf_repo_manager_list_file_revisions (SeafRepoManager *mgr,
     data.file_info_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                   g_free, free_file_info);
 
-    if (!seaf_commit_manager_traverse_commit_tree_with_limit (seaf->commit_mgr,
-                                                              repo->id,
-                                                              repo->version,
-                                                              head_id,
-                                                              (CommitTraverseFunc)collect_file_revisions,
-                                                              limit, &data, &next_start_commit, TRUE)) {
+    if (collect_file_revisions_by_index (&data, head_id, limit,
+                                         &next_start_commit) < 0 &&
+        !seaf_commit_manager_traverse_commit_graph_with_limit (seaf->commit_mgr,
+                                                               repo->id,
+                                                               repo->version,
+                                                               head_id,
+                                                               (CommitTraverseFunc)collect_file_revisions,
+                                                               limit, &data, &next_start_commit, TRUE)) {
         g_clear_error (error);
         g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_GENERAL,
                      "failed to traverse commit of repo %s", repo_id);
@@ -6063,6 +6238,9 @@ out:
  * tree. Give a commit, for each file, if the file id in that commit is
  * different than its current id, then this file is last modified in the
  * commit previous to that commit.
+ *
+ * If the file history index covers the head commit, the timestamps are
+ * looked up in the index instead.
  */
 GList *
 seaf_repo_manager_calc_files_last_modified (SeafRepoManager *mgr,
@@ -6134,11 +6312,17 @@ seaf_repo_manager_calc_files_last_modified (SeafRepoManager *mgr,
     data.parent_dir = parent_dir;
     data.error = error;
 
-    if (!seaf_commit_manager_traverse_commit_tree_with_limit (seaf->commit_mgr,
-                                                              repo->id, repo->version, 
-                                                        repo->head->commit_id,
+    if (seaf_file_history_manager_get_last_modified (seaf->file_history_mgr,
+                                                     repo,
+                                                     repo->head->commit_id,
+                                                     parent_dir,
+                                                     data.current_file_id_hash,
+                                                     data.last_modified_hash) < 0 &&
+        !seaf_commit_manager_traverse_commit_graph_with_limit (seaf->commit_mgr,
+                                                               repo->id, repo->version,
+                                                         repo->head->commit_id,
                                 (CommitTraverseFunc)collect_files_last_modified,
-                                                              limit, &data, NULL, FALSE)) {
+                                                               limit, &data, NULL, FALSE)) {
         if (*error)
             seaf_warning ("error when traversing commits: %s\n", (*error)->message);
         else
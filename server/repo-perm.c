@@ -2,6 +2,8 @@
 
 #include "common.h"
 
+#include <pthread.h>
+
 #include "utils.h"
 #include "log.h"
 
@@ -10,6 +12,177 @@
 
 #include "seafile-error.h"
 #include "seaf-utils.h"
+
+/*
+ * Effective permissions are cached per repo and user. Changes to shares
+ * and group membership made in this process invalidate the cache at once,
+ * the ttl only bounds how long changes made elsewhere go unnoticed.
+ */
+#define DEFAULT_PERM_CACHE_TTL 60 /* seconds */
+#define PERM_CACHE_MAX_ENTRIES 100000
+
+/* Max number of repos checked by one query in batch checks. */
+#define PERM_BATCH_SIZE 100
+
+typedef struct PermCacheEntry {
+    char *perm;                 /* "r" or "rw", only access is cached */
+    gint64 expire;
+    gint64 group_version;
+} PermCacheEntry;
+
+struct RepoPermCache {
+    int ttl;
+    pthread_mutex_t lock;
+    GHashTable *entries;        /* "repo_id:user" -> PermCacheEntry */
+    gint64 version;
+};
+
+/* Versions taken before permissions are read from the database, so that
+ * results read while they were being changed aren't cached.
+ */
+typedef struct PermVersion {
+    gint64 version;
+    gint64 group_version;
+} PermVersion;
+
+static void
+perm_cache_entry_free (gpointer data)
+{
+    PermCacheEntry *entry = data;
+
+    g_free (entry->perm);
+    g_free (entry);
+}
+
+void
+seaf_repo_manager_init_perm_cache (SeafRepoManager *mgr, GKeyFile *config)
+{
+    struct RepoPermCache *cache = g_new0 (struct RepoPermCache, 1);
+    GError *error = NULL;
+    int ttl;
+
+    ttl = g_key_file_get_integer (config, "permission", "cache_ttl", &error);
+    if (error || ttl < 0) {
+        g_clear_error (&error);
+        ttl = DEFAULT_PERM_CACHE_TTL;
+    }
+
+    cache->ttl = ttl;
+    pthread_mutex_init (&cache->lock, NULL);
+    cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, perm_cache_entry_free);
+    mgr->perm_cache = cache;
+}
+
+static void
+perm_cache_get_version (SeafRepoManager *mgr, PermVersion *v)
+{
+    struct RepoPermCache *cache = mgr->perm_cache;
+
+    v->group_version = ccnet_group_manager_get_membership_version (seaf->group_mgr);
+
+    pthread_mutex_lock (&cache->lock);
+    v->version = cache->version;
+    pthread_mutex_unlock (&cache->lock);
+}
+
+/* Returns TRUE if the permission is cached. @perm is set to NULL if the
+ * user has no access.
+ */
+static gboolean
+perm_cache_lookup (SeafRepoManager *mgr, const char *repo_id, const char *user,
+                   char **perm)
+{
+    struct RepoPermCache *cache = mgr->perm_cache;
+    PermCacheEntry *entry;
+    gint64 group_version;
+    gboolean found = FALSE;
+    char *key;
+
+    if (cache->ttl == 0)
+        return FALSE;
+
+    group_version = ccnet_group_manager_get_membership_version (seaf->group_mgr);
+    key = g_strconcat (repo_id, ":", user, NULL);
+
+    pthread_mutex_lock (&cache->lock);
+    entry = g_hash_table_lookup (cache->entries, key);
+    if (entry && (gint64)time(NULL) < entry->expire &&
+        entry->group_version == group_version) {
+        *perm = g_strdup (entry->perm);
+        found = TRUE;
+    }
+    pthread_mutex_unlock (&cache->lock);
+
+    g_free (key);
+    return found;
+}
+
+static gboolean
+is_perm_entry_expired (gpointer key, gpointer value, gpointer user_data)
+{
+    PermCacheEntry *entry = value;
+    gint64 *now = user_data;
+
+    return entry->expire <= *now;
+}
+
+static void
+perm_cache_insert (SeafRepoManager *mgr, const char *repo_id, const char *user,
+                   const char *perm, PermVersion *v)
+{
+    struct RepoPermCache *cache = mgr->perm_cache;
+    PermCacheEntry *entry;
+    gint64 now = (gint64)time(NULL);
+
+    if (cache->ttl == 0)
+        return;
+
+    pthread_mutex_lock (&cache->lock);
+
+    if (cache->version != v->version) {
+        pthread_mutex_unlock (&cache->lock);
+        return;
+    }
+
+    if (g_hash_table_size (cache->entries) >= PERM_CACHE_MAX_ENTRIES) {
+        g_hash_table_foreach_remove (cache->entries, is_perm_entry_expired, &now);
+        if (g_hash_table_size (cache->entries) >= PERM_CACHE_MAX_ENTRIES)
+            g_hash_table_remove_all (cache->entries);
+    }
+
+    entry = g_new0 (PermCacheEntry, 1);
+    entry->perm = g_strdup (perm);
+    entry->expire = now + cache->ttl;
+    entry->group_version = v->group_version;
+    g_hash_table_replace (cache->entries,
+                          g_strconcat (repo_id, ":", user, NULL), entry);
+
+    pthread_mutex_unlock (&cache->lock);
+}
+
+gint64
+seaf_repo_manager_get_perm_version (SeafRepoManager *mgr)
+{
+    PermVersion v;
+
+    perm_cache_get_version (mgr, &v);
+
+    /* Both versions only grow, so the sum changes when either changes. */
+    return v.version + v.group_version;
+}
+
+void
+seaf_repo_manager_invalidate_perm_cache (SeafRepoManager *mgr)
+{
+    struct RepoPermCache *cache = mgr->perm_cache;
+
+    pthread_mutex_lock (&cache->lock);
+    g_hash_table_remove_all (cache->entries);
+    ++(cache->version);
+    pthread_mutex_unlock (&cache->lock);
+}
+
 /*
  * Permission priority: owner --> personal share --> group share --> public.
  * Permission with higher priority overwrites those with lower priority.
@@ -46,8 +219,8 @@ check_group_permission_by_user (SeafRepoManager *mgr,
     GString *sql;
 
     /* Get the groups this user belongs to. */
-    groups = ccnet_group_manager_get_groups_by_user (seaf->group_mgr, user_name,
-                                                     1, NULL);
+    groups = ccnet_group_manager_get_groups_by_user_cached (seaf->group_mgr,
+                                                            user_name, NULL);
     if (!groups) {
         goto out;
     }
@@ -152,8 +325,8 @@ check_perm_on_parent_repo (const char *origin_repo_id,
     }
     g_hash_table_destroy (user_perms);
 
-    groups = ccnet_group_manager_get_groups_by_user (seaf->group_mgr, user,
-                                                     1, NULL);
+    groups = ccnet_group_manager_get_groups_by_user_cached (seaf->group_mgr,
+                                                            user, NULL);
     if (!groups) {
         return NULL;
     }
@@ -225,6 +398,12 @@ seaf_repo_manager_check_permission (SeafRepoManager *mgr,
     SeafVirtRepo *vinfo;
     char *owner = NULL;
     char *permission = NULL;
+    PermVersion v;
+
+    if (perm_cache_lookup (mgr, repo_id, user, &permission))
+        return permission;
+
+    perm_cache_get_version (mgr, &v);
 
     /* This is a virtual repo.*/
     vinfo = seaf_repo_manager_get_virtual_repo_info (mgr, repo_id);
@@ -244,11 +423,254 @@ seaf_repo_manager_check_permission (SeafRepoManager *mgr,
     }
 
 out:
+    /* Errors can't be told from no access here, so only cache granted access. */
+    if (permission)
+        perm_cache_insert (mgr, repo_id, user, permission, &v);
     seaf_virtual_repo_info_free (vinfo);
     g_free (owner);
     return permission;
 }
 
+static gboolean
+collect_repo_id_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *repo_ids = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+
+    g_hash_table_replace (repo_ids, g_strdup (repo_id), g_strdup (repo_id));
+
+    return TRUE;
+}
+
+/* Collect repo_id -> permission. "rw" takes precedence when a repo is
+ * shared more than once. Permissions other than "r" and "rw" are ignored,
+ * like in check_repo_share_perm_cb().
+ */
+static gboolean
+collect_repo_perm_cb (SeafDBRow *row, void *data)
+{
+    GHashTable *perms = data;
+    const char *repo_id = seaf_db_row_get_column_text (row, 0);
+    const char *perm = seaf_db_row_get_column_text (row, 1);
+    const char *orig_perm;
+
+    if (g_strcmp0 (perm, "r") != 0 && g_strcmp0 (perm, "rw") != 0)
+        return TRUE;
+
+    orig_perm = g_hash_table_lookup (perms, repo_id);
+    if (!orig_perm ||
+        (g_strcmp0 (orig_perm, "rw") != 0 && g_strcmp0 (perm, "rw") == 0))
+        g_hash_table_replace (perms, g_strdup (repo_id), g_strdup (perm));
+
+    return TRUE;
+}
+
+/*
+ * Check the permissions of up to PERM_BATCH_SIZE repos, with one query per
+ * source of permission instead of several queries per repo.
+ */
+static int
+check_permissions_batch (SeafRepoManager *mgr,
+                         GList *repo_ids,
+                         const char *user,
+                         const char *group_ids,
+                         PermVersion *v,
+                         GHashTable *result)
+{
+    SeafDB *db = mgr->seaf->db;
+    GString *ids = g_string_new ("");
+    GString *sql = g_string_new ("");
+    GHashTable *virtual_repos, *owners, *user_perms, *group_perms, *pub_perms;
+    GList *ptr;
+    const char *repo_id, *owner, *perm;
+    char *vperm;
+    int ret = 0;
+
+    virtual_repos = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    owners = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    user_perms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    group_perms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    pub_perms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    /* Repo ids are validated by the caller. */
+    for (ptr = repo_ids; ptr; ptr = ptr->next) {
+        if (ptr != repo_ids)
+            g_string_append (ids, ",");
+        g_string_append_printf (ids, "'%s'", (char *)ptr->data);
+    }
+
+    g_string_printf (sql, "SELECT repo_id FROM VirtualRepo WHERE repo_id IN (%s)",
+                     ids->str);
+    if (seaf_db_statement_foreach_row (db, sql->str, collect_repo_id_cb,
+                                       virtual_repos, 0) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    /* A repo has only one owner, so the callback just collects them. */
+    g_string_printf (sql, "SELECT repo_id, owner_id FROM RepoOwner WHERE repo_id IN (%s)",
+                     ids->str);
+    if (seaf_db_statement_foreach_row (db, sql->str, collect_repo_perm_cb,
+                                       owners, 0) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    g_string_printf (sql, "SELECT repo_id, permission FROM SharedRepo "
+                     "WHERE repo_id IN (%s) AND to_email=?", ids->str);
+    if (seaf_db_statement_foreach_row (db, sql->str, collect_repo_perm_cb,
+                                       user_perms, 1, "string", user) < 0) {
+        ret = -1;
+        goto out;
+    }
+
+    if (group_ids) {
+        g_string_printf (sql, "SELECT repo_id, permission FROM RepoGroup "
+                         "WHERE repo_id IN (%s) AND group_id IN (%s)",
+                         ids->str, group_ids);
+        if (seaf_db_statement_foreach_row (db, sql->str, collect_repo_perm_cb,
+                                           group_perms, 0) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    if (!mgr->seaf->cloud_mode) {
+        g_string_printf (sql, "SELECT repo_id, permission FROM InnerPubRepo "
+                         "WHERE repo_id IN (%s)", ids->str);
+        if (seaf_db_statement_foreach_row (db, sql->str, collect_repo_perm_cb,
+                                           pub_perms, 0) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+
+    for (ptr = repo_ids; ptr; ptr = ptr->next) {
+        repo_id = ptr->data;
+
+        /* Permissions of virtual repos depend on their paths in the
+         * origin repos, check them one by one.
+         */
+        if (g_hash_table_lookup (virtual_repos, repo_id)) {
+            vperm = seaf_repo_manager_check_permission (mgr, repo_id, user, NULL);
+            if (vperm)
+                g_hash_table_replace (result, g_strdup (repo_id), vperm);
+            continue;
+        }
+
+        owner = g_hash_table_lookup (owners, repo_id);
+        perm = NULL;
+        if (owner && strcmp (owner, user) == 0) {
+            perm = "rw";
+        } else if (owner) {
+            perm = g_hash_table_lookup (user_perms, repo_id);
+            if (!perm)
+                perm = g_hash_table_lookup (group_perms, repo_id);
+            if (!perm)
+                perm = g_hash_table_lookup (pub_perms, repo_id);
+        }
+
+        /* Like the single repo check, only cache granted access. */
+        if (perm) {
+            perm_cache_insert (mgr, repo_id, user, perm, v);
+            g_hash_table_replace (result, g_strdup (repo_id), g_strdup (perm));
+        }
+    }
+
+out:
+    g_hash_table_destroy (virtual_repos);
+    g_hash_table_destroy (owners);
+    g_hash_table_destroy (user_perms);
+    g_hash_table_destroy (group_perms);
+    g_hash_table_destroy (pub_perms);
+    g_string_free (ids, TRUE);
+    g_string_free (sql, TRUE);
+    return ret;
+}
+
+GHashTable *
+seaf_repo_manager_check_permissions (SeafRepoManager *mgr,
+                                     GList *repo_ids,
+                                     const char *user,
+                                     GError **error)
+{
+    GHashTable *result, *checked;
+    GList *missing = NULL, *batch = NULL, *groups = NULL, *ptr;
+    GString *group_ids = NULL;
+    GError *tmp_error = NULL;
+    const char *repo_id;
+    char *perm;
+    PermVersion v;
+    int n = 0, group_id;
+
+    result = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    checked = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (ptr = repo_ids; ptr; ptr = ptr->next) {
+        repo_id = ptr->data;
+        if (!is_uuid_valid (repo_id) || g_hash_table_lookup (checked, repo_id))
+            continue;
+        g_hash_table_insert (checked, (gpointer)repo_id, (gpointer)repo_id);
+
+        if (perm_cache_lookup (mgr, repo_id, user, &perm)) {
+            if (perm)
+                g_hash_table_replace (result, g_strdup (repo_id), perm);
+            continue;
+        }
+        missing = g_list_prepend (missing, (gpointer)repo_id);
+    }
+
+    if (!missing)
+        goto out;
+
+    perm_cache_get_version (mgr, &v);
+
+    groups = ccnet_group_manager_get_groups_by_user_cached (seaf->group_mgr,
+                                                            user, &tmp_error);
+    if (tmp_error) {
+        g_propagate_error (error, tmp_error);
+        g_hash_table_destroy (result);
+        result = NULL;
+        goto out;
+    }
+    for (ptr = groups; ptr; ptr = ptr->next) {
+        g_object_get (ptr->data, "id", &group_id, NULL);
+        if (!group_ids)
+            group_ids = g_string_new ("");
+        else
+            g_string_append (group_ids, ",");
+        g_string_append_printf (group_ids, "%d", group_id);
+    }
+
+    for (ptr = missing; ptr; ptr = ptr->next) {
+        batch = g_list_prepend (batch, ptr->data);
+        if (++n < PERM_BATCH_SIZE && ptr->next)
+            continue;
+
+        if (check_permissions_batch (mgr, batch, user,
+                                     group_ids ? group_ids->str : NULL,
+                                     &v, result) < 0) {
+            g_set_error (error, SEAFILE_DOMAIN, SEAF_ERR_GENERAL,
+                         "Failed to check permissions");
+            g_hash_table_destroy (result);
+            result = NULL;
+            goto out;
+        }
+        g_list_free (batch);
+        batch = NULL;
+        n = 0;
+    }
+
+out:
+    g_list_free (batch);
+    g_list_free (missing);
+    g_list_free_full (groups, g_object_unref);
+    if (group_ids)
+        g_string_free (group_ids, TRUE);
+    g_hash_table_destroy (checked);
+    return result;
+}
+
 /*
  * Directories are always before files. Otherwise compare the names.
  */
@@ -0,0 +1,117 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Measure the query rate of the statements run on every sync request by the
+ * http server, with and without the prepared statement cache.
+ *
+ * Usage: seaf-db-bench <host> <port> <user> <password> <seafile_db> [count]
+ * The repo to query is taken from the database, so it shouldn't be empty.
+ */
+
+#include "common.h"
+
+#include "seaf-db.h"
+
+#define DEFAULT_QUERY_COUNT 10000
+
+typedef struct BenchQuery {
+    const char *name;
+    const char *sql;
+    int n_args;
+} BenchQuery;
+
+static BenchQuery queries[] = {
+    { "check token", "SELECT email FROM RepoUserToken WHERE repo_id = ? AND token = ?", 2 },
+    { "repo owner", "SELECT owner_id FROM RepoOwner WHERE repo_id=?", 1 },
+    { "repo status", "SELECT status FROM RepoInfo WHERE repo_id=?", 1 },
+    { "virtual repo", "SELECT repo_id, origin_repo FROM VirtualRepo where repo_id = ?", 1 },
+    { "repo head", "SELECT repo_id FROM RepoHead WHERE repo_id=?", 1 },
+    { "repo size", "SELECT size FROM RepoSize WHERE repo_id=?", 1 },
+    { NULL, NULL, 0 },
+};
+
+static gboolean
+count_row (SeafDBRow *row, void *data)
+{
+    int *rows = data;
+
+    ++(*rows);
+    return TRUE;
+}
+
+static void
+run_bench (SeafDB *db, const char *label, const char *repo_id,
+           const char *token, int count)
+{
+    BenchQuery *q;
+    gint64 start, usec;
+    int i, rows;
+
+    for (q = queries; q->name; q++) {
+        rows = 0;
+        start = g_get_monotonic_time ();
+        for (i = 0; i < count; i++) {
+            int ret;
+            if (q->n_args == 2)
+                ret = seaf_db_statement_foreach_row (db, q->sql, count_row, &rows,
+                                                     2, "string", repo_id,
+                                                     "string", token);
+            else
+                ret = seaf_db_statement_foreach_row (db, q->sql, count_row, &rows,
+                                                     1, "string", repo_id);
+            if (ret < 0) {
+                fprintf (stderr, "Failed to run %s.\n", q->sql);
+                return;
+            }
+        }
+        usec = g_get_monotonic_time () - start;
+
+        printf ("%-8s %-13s %d queries, %d rows, %.0f queries/s\n",
+                label, q->name, count, rows,
+                usec > 0 ? (double)count * 1000000 / usec : 0);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    SeafDB *db;
+    char *repo_id, *token;
+    int count = DEFAULT_QUERY_COUNT;
+
+    if (argc < 6) {
+        fprintf (stderr, "Usage: %s <host> <port> <user> <password> <seafile_db> [count]\n",
+                 argv[0]);
+        return 1;
+    }
+    if (argc > 6)
+        count = atoi (argv[6]);
+
+    db = seaf_db_new_mysql (argv[1], atoi(argv[2]), argv[3], argv[4], argv[5],
+                            NULL, FALSE, FALSE, NULL, NULL, 1);
+    if (!db) {
+        fprintf (stderr, "Failed to open database %s.\n", argv[5]);
+        return 1;
+    }
+    seaf_db_set_stmt_cache_size (db, 0);
+
+    repo_id = seaf_db_get_string (db, "SELECT repo_id FROM RepoOwner LIMIT 1");
+    if (!repo_id) {
+        fprintf (stderr, "No repo found in %s.\n", argv[5]);
+        return 1;
+    }
+    token = seaf_db_statement_get_string (db,
+                                          "SELECT token FROM RepoUserToken WHERE repo_id=? LIMIT 1",
+                                          1, "string", repo_id);
+    if (!token)
+        token = g_strdup ("");
+
+    run_bench (db, "uncached", repo_id, token, count);
+
+    seaf_db_set_stmt_cache_size (db, DEFAULT_STMT_CACHE_SIZE);
+    run_bench (db, "cached", repo_id, token, count);
+
+    g_free (repo_id);
+    g_free (token);
+    return 0;
+}
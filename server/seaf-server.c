@@ -653,6 +653,10 @@ static void start_rpc_service (const char *seafile_dir,
                                      seafile_check_permission,
                                      "check_permission",
                                      searpc_signature_string__string_string());
+    searpc_server_register_function ("seafserv-threaded-rpcserver",
+                                     seafile_check_permissions,
+                                     "check_permissions",
+                                     searpc_signature_json__string_string());
 
     searpc_server_register_function ("seafserv-threaded-rpcserver",
                                      seafile_set_repo_status,
@@ -664,6 +668,11 @@ static void start_rpc_service (const char *seafile_dir,
                                      "get_repo_status",
                                      searpc_signature_int__string());
 
+    searpc_server_register_function ("seafserv-threaded-rpcserver",
+                                     seafile_schedule_file_history_update,
+                                     "schedule_file_history_update",
+                                     searpc_signature_int__string());
+
     /* folder permission */
     searpc_server_register_function ("seafserv-threaded-rpcserver",
                                      seafile_check_permission_by_path,
@@ -273,6 +273,8 @@ seafile_session_new(const char *central_config_dir,
 
     session->size_sched = size_scheduler_new (session);
 
+    session->file_history_mgr = seaf_file_history_manager_new (session);
+
     session->mq_mgr = seaf_mq_manager_new ();
     if (!session->mq_mgr)
         goto onerror;
@@ -404,6 +406,8 @@ seafile_repair_session_new(const char *central_config_dir,
 
     session->size_sched = size_scheduler_new (session);
 
+    session->file_history_mgr = seaf_file_history_manager_new (session);
+
     return session;
 
 onerror:
@@ -438,6 +442,11 @@ seafile_session_init (SeafileSession *session)
         return -1;
     }
 
+    if (seaf_file_history_manager_init (session->file_history_mgr) < 0) {
+        seaf_warning ("Failed to init file history manager.\n");
+        return -1;
+    }
+
     if (ccnet_user_manager_prepare (session->user_mgr) < 0) {
         seaf_warning ("Failed to init user manager.\n");
         return -1;
@@ -485,6 +494,11 @@ seafile_session_start (SeafileSession *session)
         return -1;
     }
 
+    if (seaf_file_history_manager_start (session->file_history_mgr) < 0) {
+        seaf_warning ("Failed to start file history manager.\n");
+        return -1;
+    }
+
     if (seaf_copy_manager_start (session->copy_mgr) < 0) {
         seaf_warning ("Failed to start copy manager.\n");
         return -1;
@@ -22,6 +22,7 @@
 #include "passwd-mgr.h"
 #include "quota-mgr.h"
 #include "size-sched.h"
+#include "file-history-mgr.h"
 #include "copy-mgr.h"
 #include "config-mgr.h"
 
@@ -73,6 +74,7 @@ struct _SeafileSession {
     CcnetJobManager     *job_mgr;
 
     SizeScheduler       *size_sched;
+    SeafFileHistoryManager *file_history_mgr;
 
     int                  cloud_mode;
 
@@ -112,6 +112,8 @@ seaf_share_manager_add_share (SeafShareManager *mgr, const char *repo_id,
         goto out;
     }
 
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
 out:
     g_free (from_email_l);
     g_free (to_email_l);
@@ -140,6 +142,9 @@ seaf_share_manager_set_subdir_perm_by_path (SeafShareManager *mgr, const char *r
                                    "string", to_email_l);
     g_free (from_email_l);
     g_free (to_email_l);
+
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
     return ret;
 }
 
@@ -162,6 +167,9 @@ seaf_share_manager_set_permission (SeafShareManager *mgr, const char *repo_id,
 
     g_free (from_email_l);
     g_free (to_email_l);
+
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
     return ret;
 }
 
@@ -652,6 +660,8 @@ seaf_share_manager_remove_share (SeafShareManager *mgr, const char *repo_id,
                        "string", to_email) < 0)
         return -1;
 
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
     return 0;
 }
 
@@ -674,6 +684,8 @@ seaf_share_manager_unshare_subdir (SeafShareManager* mgr,
                                  "string", path) < 0)
         return -1;
 
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
     return 0;
 }
 
@@ -685,6 +697,8 @@ seaf_share_manager_remove_repo (SeafShareManager *mgr, const char *repo_id)
                        1, "string", repo_id) < 0)
         return -1;
 
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
     return 0;
 }
 
@@ -882,6 +896,8 @@ seaf_share_manager_unshare_group_subdir (SeafShareManager* mgr,
                                  "string", path) < 0)
         return -1;
 
+    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
+
     return 0;
 }
 
@@ -408,6 +408,10 @@ compute_repo_size (void *vjob)
         goto out;
     }
 
+    if (!info || size != info->size)
+        seaf_quota_manager_invalidate_repo_usage (sched->seaf->quota_mgr,
+                                                  job->repo_id);
+
     notify_repo_size_change (sched, repo->store_id);
 
 out:
@@ -171,6 +171,7 @@ static void
 update_repo_size(const char *repo_id)
 {
     schedule_repo_size_computation (seaf->size_sched, repo_id);
+    seaf_file_history_manager_schedule_update (seaf->file_history_mgr, repo_id);
 }
 
 static char *
@@ -698,6 +699,8 @@ handle_missing_virtual_repo (SeafRepoManager *mgr,
                                 vinfo->repo_id, new_path);
                     set_virtual_repo_base_commit_path (vinfo->repo_id,
                                                        head->commit_id, new_path);
+                    /* Sub-folder permissions are looked up by path. */
+                    seaf_repo_manager_invalidate_perm_cache (seaf->repo_mgr);
                     if (return_new_path)
                         *return_new_path = g_strdup(new_path);
                     /* 'sub_path = NUll' means the virtual dir itself has been renamed,